@@ -0,0 +1,65 @@
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "CaptureFormat.h"
+
+namespace capture_format
+{
+	Reader::Reader(std::istream& stream)
+		: stream(stream)
+	{
+		if (!stream.read(reinterpret_cast<char*>(&header), sizeof(FileHeader)))
+		{
+			return;
+		}
+
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+			|| header.version == 0
+			|| header.version > VERSION
+			|| header.header_size < sizeof(FileHeader))
+		{
+			return;
+		}
+
+		// Skips anything a newer writer added to the header.
+		stream.ignore(header.header_size - sizeof(FileHeader));
+		is_valid = !!stream;
+	}
+
+	bool Reader::valid() const
+	{
+		return is_valid;
+	}
+
+	uint16_t Reader::version() const
+	{
+		return header.version;
+	}
+
+	bool Reader::next(EventType& type, std::vector<uint8_t>& payload)
+	{
+		if (!is_valid)
+		{
+			return false;
+		}
+
+		RecordHeader record {};
+
+		if (!stream.read(reinterpret_cast<char*>(&record), sizeof(RecordHeader)))
+		{
+			return false;
+		}
+
+		const uint32_t size = static_cast<uint32_t>(record.size_high) << 16 | record.size;
+		payload.resize(size);
+
+		if (size > 0 && !stream.read(reinterpret_cast<char*>(payload.data()), size))
+		{
+			return false;
+		}
+
+		type = record.type;
+		return true;
+	}
+}
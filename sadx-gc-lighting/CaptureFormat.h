@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+// Binary capture of the events the mod sees, written by capture.cpp.
+// Kept free of Windows and Direct3D dependencies so captures can be read anywhere.
+//
+// A capture is a FileHeader followed by records. Every record is a
+// RecordHeader followed by size bytes of payload. Readers skip record types
+// they don't know, so new types can be added without a version change.
+// VERSION changes when an existing payload changes.
+//
+// The first frame starts with the state set before the capture began: the
+// matrices, shader flags, vertex format, stream 0, indices and the value of
+// every shader parameter.
+//
+// Direct3D objects are identified by their address at the time of capture.
+//
+// Version 2 added the vertex and index data of UP draws, and the high byte
+// of the record size.
+
+namespace capture_format
+{
+	constexpr char     MAGIC[4] = { 'L', 'C', 'A', 'P' };
+	constexpr uint16_t VERSION  = 2;
+
+	constexpr uint32_t MAX_RECORD_SIZE = 0xFFFFFF;
+
+	enum class EventType : uint8_t
+	{
+		invalid,
+
+		frame,                     // Frame
+		world_matrix,              // Matrix
+		view_matrix,               // Matrix
+		projection_matrix,         // Matrix
+		material,                  // Material
+		fog_enable,                // FogEnable
+		fog_color,                 // FogColor
+		fog_table,                 // FogTable
+		lighting,                  // Lighting
+		shader_flags,              // ShaderFlags
+		parameter,                 // Parameter, followed by the value
+		fvf,                       // Fvf
+		stream_source,             // StreamSource
+		indices,                   // Indices
+		draw_primitive,            // DrawPrimitive
+		draw_indexed_primitive,    // DrawIndexedPrimitive
+		draw_primitive_up,         // DrawPrimitiveUP
+		draw_indexed_primitive_up, // DrawIndexedPrimitiveUP
+	};
+
+#pragma pack(push, 1)
+
+	struct FileHeader
+	{
+		char     magic[4];
+		uint16_t version;
+		uint16_t header_size; // sizeof(FileHeader) of the writer
+	};
+
+	struct RecordHeader
+	{
+		EventType type;
+		uint8_t   size_high; // Bits 16-23 of the size; always 0 in version 1.
+		uint16_t  size;
+	};
+
+	struct Frame
+	{
+		uint32_t frame;
+	};
+
+	struct Matrix
+	{
+		float m[16];
+	};
+
+	struct Material
+	{
+		uint32_t diffuse;
+		uint32_t specular;
+		float    exponent;
+		uint32_t texture_id;
+		uint32_t attrflags;
+		uint32_t effective_flags; // attrflags after the constant attribute overrides
+	};
+
+	struct FogEnable
+	{
+		uint8_t enabled;
+	};
+
+	struct FogColor
+	{
+		uint32_t color;
+	};
+
+	struct FogTable
+	{
+		uint32_t mode;
+		float    start;
+		float    end;
+		float    density;
+		float    table[128];
+	};
+
+	struct Lighting
+	{
+		int32_t type;
+	};
+
+	struct ShaderFlags
+	{
+		uint32_t flags;
+	};
+
+	enum ParameterKind : uint8_t
+	{
+		ParameterKind_Vertex  = 0b001,
+		ParameterKind_Pixel   = 0b010,
+		ParameterKind_Sampler = 0b100, // The value is a texture identity rather than constant data.
+	};
+
+	struct Parameter
+	{
+		uint16_t index;
+		uint8_t  kind;
+		uint8_t  reserved;
+		// The value follows, up to the end of the record.
+	};
+
+	struct Fvf
+	{
+		uint32_t fvf;
+	};
+
+	struct StreamSource
+	{
+		uint32_t stream;
+		uint32_t buffer;
+		uint32_t offset;
+		uint32_t stride;
+	};
+
+	struct Indices
+	{
+		uint32_t buffer;
+	};
+
+	struct DrawPrimitive
+	{
+		uint32_t primitive_type;
+		uint32_t start_vertex;
+		uint32_t primitive_count;
+	};
+
+	struct DrawIndexedPrimitive
+	{
+		uint32_t primitive_type;
+		int32_t  base_vertex_index;
+		uint32_t min_vertex_index;
+		uint32_t vertex_count;
+		uint32_t start_index;
+		uint32_t primitive_count;
+	};
+
+	// Followed by the vertices of the draw. UP data is left out of records
+	// that would be larger than MAX_RECORD_SIZE, and of version 1 captures.
+	struct DrawPrimitiveUP
+	{
+		uint32_t primitive_type;
+		uint32_t primitive_count;
+		uint32_t stride;
+	};
+
+	// Followed by the indices of the draw, then vertex_count vertices
+	// starting at min_vertex_index.
+	struct DrawIndexedPrimitiveUP
+	{
+		uint32_t primitive_type;
+		uint32_t min_vertex_index;
+		uint32_t vertex_count;
+		uint32_t primitive_count;
+		uint32_t index_format;
+		uint32_t stride;
+	};
+
+#pragma pack(pop)
+
+	// Reads a capture one record at a time.
+	class Reader
+	{
+	public:
+		explicit Reader(std::istream& stream);
+
+		// False if the stream isn't a capture or its version isn't supported.
+		// Captures of older versions are read as they are.
+		bool valid() const;
+		uint16_t version() const;
+
+		// Reads the next record into type and payload. Returns false at the
+		// end of the stream or if the last record was cut off.
+		bool next(EventType& type, std::vector<uint8_t>& payload);
+
+		// Interprets a payload as T. Returns nullptr if it's too small.
+		template <typename T>
+		static const T* as(const std::vector<uint8_t>& payload)
+		{
+			return payload.size() >= sizeof(T) ? reinterpret_cast<const T*>(payload.data()) : nullptr;
+		}
+
+	private:
+		std::istream& stream;
+		FileHeader header {};
+		bool is_valid = false;
+	};
+}
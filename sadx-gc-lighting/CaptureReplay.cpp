@@ -0,0 +1,327 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "CaptureFormat.h"
+#include "CaptureReplay.h"
+#include "CountingDevice.h"
+#include "lights.h"
+#include "materials.h"
+#include "ShaderParameter.h"
+#include "ShaderSelection.h"
+#include "ShaderState.h"
+
+using namespace capture_format;
+
+struct Event
+{
+	EventType type;
+	std::vector<uint8_t> payload;
+};
+
+// Placeholder shaders from the counting device, one per shader key like the real ones.
+class ReplayShaders : public ShaderState::IShaderSource
+{
+public:
+	ReplayShaders(IDirect3DDevice9* device, const bool& uber_shader)
+		: device(device),
+		  uber_shader(uber_shader)
+	{
+	}
+
+	VertexShader vertex_shader(Uint32 flags) override
+	{
+		auto& shader = vertex_shaders[selection::vs_key(selection::sanitize(flags), uber_shader)];
+
+		if (shader == nullptr)
+		{
+			device->CreateVertexShader(nullptr, &shader);
+		}
+
+		return shader;
+	}
+
+	PixelShader pixel_shader(Uint32 flags) override
+	{
+		auto& shader = pixel_shaders[selection::ps_key(selection::sanitize(flags), uber_shader)];
+
+		if (shader == nullptr)
+		{
+			device->CreatePixelShader(nullptr, &shader);
+		}
+
+		return shader;
+	}
+
+	void flush() override
+	{
+	}
+
+private:
+	IDirect3DDevice9* device;
+	const bool& uber_shader;
+	std::unordered_map<Uint32, VertexShader> vertex_shaders;
+	std::unordered_map<Uint32, PixelShader> pixel_shaders;
+};
+
+// A captured parameter, recreated as a ShaderParameter of the type its
+// size implies. Colors replay as vectors and ints as floats, which commit the same way.
+struct ReplayParameter
+{
+	std::unique_ptr<IShaderParameter> parameter;
+	// Null for textures.
+	void (*assign)(IShaderParameter* parameter, const uint8_t* data);
+};
+
+template <typename T>
+static void assign_value(IShaderParameter* parameter, const uint8_t* data)
+{
+	T value;
+	memcpy(&value, data, sizeof(T));
+	*static_cast<ShaderParameter<T>*>(parameter) = value;
+}
+
+template <typename T>
+static ReplayParameter make_parameter(int index, IShaderParameter::Type::T type)
+{
+	return { std::make_unique<ShaderParameter<T>>(index, T {}, type), &assign_value<T> };
+}
+
+static bool make_parameter(const Parameter& header, size_t size, ReplayParameter& out)
+{
+	const auto type = static_cast<IShaderParameter::Type::T>(header.kind & IShaderParameter::Type::both);
+
+	if (header.kind & ParameterKind_Sampler)
+	{
+		out = { std::make_unique<ShaderParameter<Texture>>(header.index, nullptr, type), nullptr };
+		return true;
+	}
+
+	switch (size)
+	{
+		case sizeof(bool):
+			out = make_parameter<bool>(header.index, type);
+			return true;
+		case sizeof(float):
+			out = make_parameter<float>(header.index, type);
+			return true;
+		case sizeof(D3DXVECTOR2):
+			out = make_parameter<D3DXVECTOR2>(header.index, type);
+			return true;
+		case sizeof(D3DXVECTOR3):
+			out = make_parameter<D3DXVECTOR3>(header.index, type);
+			return true;
+		case sizeof(D3DXVECTOR4):
+			out = make_parameter<D3DXVECTOR4>(header.index, type);
+			return true;
+		case sizeof(MaterialBlock):
+			out = make_parameter<MaterialBlock>(header.index, type);
+			return true;
+		case sizeof(D3DXMATRIX):
+			out = make_parameter<D3DXMATRIX>(header.index, type);
+			return true;
+		case sizeof(StageLights):
+			out = make_parameter<StageLights>(header.index, type);
+			return true;
+		default:
+			return false;
+	}
+}
+
+static double replay(const std::vector<Event>& events, const CaptureReplay::Options& options, CaptureReplay::Results& results)
+{
+	// Declared before everything holding its placeholders so it goes last.
+	CountingDevice device;
+	ReplayShaders shaders(&device, options.uber_shader);
+	ShaderState state(shaders, results.counters);
+
+	state.device = &device;
+	state.uber_shader = options.uber_shader;
+	state.state_blocks = options.state_blocks;
+
+	// Textures are captured by their address; each gets a placeholder.
+	std::unordered_map<uint64_t, Texture> textures;
+	std::unordered_map<uint32_t, ReplayParameter> parameters;
+
+	uint32_t shader_flags = 0;
+	uint32_t fvf = 0;
+	uint32_t last_flags = ~0u;
+
+	// The first frame is expected to allocate everything used later on.
+	const auto allocations = [&]() -> uint32_t
+	{
+		return options.allocations != nullptr && results.frames > 0 ? options.allocations() : 0;
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (auto& event : events)
+	{
+		switch (event.type)
+		{
+			default:
+				break;
+
+			case EventType::frame:
+				++results.frames;
+				break;
+
+			case EventType::shader_flags:
+				shader_flags = Reader::as<capture_format::ShaderFlags>(event.payload)->flags;
+				break;
+
+			case EventType::fvf:
+				fvf = Reader::as<Fvf>(event.payload)->fvf;
+				break;
+
+			case EventType::parameter:
+			{
+				const auto header = Reader::as<Parameter>(event.payload);
+				const auto data = event.payload.data() + sizeof(Parameter);
+				const auto size = event.payload.size() - sizeof(Parameter);
+				const auto key = static_cast<uint32_t>(header->index) << 8 | header->kind;
+
+				auto it = parameters.find(key);
+
+				if (it == parameters.end())
+				{
+					ReplayParameter parameter;
+
+					if (!make_parameter(*header, size, parameter))
+					{
+						break;
+					}
+
+					it = parameters.emplace(key, std::move(parameter)).first;
+				}
+
+				auto& parameter = it->second;
+
+				if (parameter.assign)
+				{
+					const auto before = allocations();
+					parameter.assign(parameter.parameter.get(), data);
+					results.draw_allocations += allocations() - before;
+					break;
+				}
+
+				uint64_t identity = 0;
+				memcpy(&identity, data, (std::min)(size, sizeof(identity)));
+
+				Texture texture;
+
+				if (identity != 0)
+				{
+					auto& placeholder = textures[identity];
+
+					if (placeholder == nullptr)
+					{
+						device.CreateTexture(1, 1, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &placeholder, nullptr);
+					}
+
+					texture = placeholder;
+				}
+
+				const auto before = allocations();
+				*static_cast<ShaderParameter<Texture>*>(parameter.parameter.get()) = texture;
+				results.draw_allocations += allocations() - before;
+				break;
+			}
+
+			case EventType::draw_primitive:
+			case EventType::draw_indexed_primitive:
+			case EventType::draw_primitive_up:
+			case EventType::draw_indexed_primitive_up:
+			{
+				++results.draws;
+
+				auto flags = shader_flags;
+
+				if (flags & ShaderFlags_VertexColor && !(fvf & D3DFVF_DIFFUSE))
+				{
+					flags &= ~ShaderFlags_VertexColor;
+				}
+
+				flags = selection::sanitize(flags);
+
+				if (flags != last_flags)
+				{
+					last_flags = flags;
+					++results.permutation_changes;
+				}
+
+				const auto before = allocations();
+				state.start(flags);
+				device.DrawPrimitive(D3DPT_TRIANGLELIST, 0, 0);
+				state.end();
+				results.draw_allocations += allocations() - before;
+				break;
+			}
+		}
+	}
+
+	const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	results.device = device.counts;
+
+	// Values assigned after the last draw would outlive their parameters.
+	IShaderParameter::values_assigned.clear();
+	return elapsed;
+}
+
+bool CaptureReplay::run(std::istream& stream, const Options& options, Results& out)
+{
+	Reader reader(stream);
+
+	if (!reader.valid())
+	{
+		return false;
+	}
+
+	std::vector<Event> events;
+	Event event;
+
+	while (reader.next(event.type, event.payload))
+	{
+		// Drops records too small for their type so the replay can trust the payloads.
+		if ((event.type == EventType::shader_flags && event.payload.size() < sizeof(capture_format::ShaderFlags))
+			|| (event.type == EventType::fvf && event.payload.size() < sizeof(Fvf))
+			|| (event.type == EventType::parameter && event.payload.size() < sizeof(Parameter)))
+		{
+			continue;
+		}
+
+		events.push_back(event);
+	}
+
+	// The replay has its own parameters; the mod's pending ones are put aside.
+	std::vector<IShaderParameter*> assigned;
+	assigned.reserve(IShaderParameter::MAX_ASSIGNED);
+	std::swap(assigned, IShaderParameter::values_assigned);
+
+	const auto on_assign = IShaderParameter::on_assign;
+	IShaderParameter::on_assign = nullptr;
+
+	const auto passes = options.passes > 0 ? options.passes : 1;
+	double elapsed = 0.0;
+
+	for (unsigned int i = 0; i < passes; i++)
+	{
+		out = {};
+		elapsed += replay(events, options, out);
+	}
+
+	IShaderParameter::on_assign = on_assign;
+	std::swap(assigned, IShaderParameter::values_assigned);
+
+	if (out.draws > 0)
+	{
+		out.ns_per_draw = elapsed / static_cast<double>(out.draws * passes);
+	}
+
+	return true;
+}
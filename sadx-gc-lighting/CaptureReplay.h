@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+
+#include "CountingDevice.h"
+#include "metrics.h"
+
+// Replays a capture (see CaptureFormat.h) through the mod's shader switching
+// (ShaderState) and its shader parameters against a CountingDevice. This
+// gives reproducible numbers for the CPU cost and device traffic of the draw
+// path, for comparing changes to ShaderSelection.cpp, ShaderState.cpp and
+// how parameters are assigned.
+//
+// Every captured draw is treated as shaded, since whether the game wanted the
+// mod's shaders for a draw isn't part of the capture. Shader LOD and UP
+// batching aren't applied.
+class CaptureReplay
+{
+public:
+	struct Options
+	{
+		bool uber_shader = false;
+		bool state_blocks = false;
+		// Times the capture is replayed; timings are taken over all passes.
+		unsigned int passes = 1;
+		// Returns the number of heap allocations made so far. If set, the
+		// allocations made while drawing after the first frame are counted.
+		uint32_t (*allocations)() = nullptr;
+	};
+
+	// Totals for a single pass.
+	struct Results
+	{
+		uint32_t frames = 0;
+		uint64_t draws = 0;
+		uint64_t permutation_changes = 0;
+		// The mod's own counters, as it would report them for the whole capture.
+		FrameCounters counters {};
+		// Calls that reached the device.
+		CountingDevice::Counts device {};
+		double ns_per_draw = 0.0;
+		// Heap allocations made by parameter assignment and draws once the
+		// first frame has created the shaders, parameters and state blocks.
+		uint64_t draw_allocations = 0;
+	};
+
+	// Returns false if the stream isn't a readable capture.
+	static bool run(std::istream& stream, const Options& options, Results& out);
+};
@@ -0,0 +1,884 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <vector>
+#include <d3d9.h>
+
+#include "CountingDevice.h"
+
+// A single recordable state.
+struct CountingDevice::Op
+{
+	enum class Kind : uint8_t
+	{
+		render_state,
+		sampler_state,
+		vertex_shader,
+		pixel_shader,
+		texture,
+		vertex_float,
+		pixel_float,
+		vertex_bool,
+		pixel_bool,
+	};
+
+	Kind kind;
+	DWORD index; // State, sampler, stage or register.
+	DWORD type;  // Sampler state type.
+	DWORD value; // State value or BOOL constant.
+	float vector[4];
+	IUnknown* object;
+};
+
+// Reference counting shared by the placeholder objects.
+template <typename T>
+class Counted : public T
+{
+public:
+	explicit Counted(CountingDevice* device) : device(device)
+	{
+	}
+
+	virtual ~Counted() = default;
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** ppvObj) override
+	{
+		if (ppvObj)
+		{
+			*ppvObj = nullptr;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++references;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		const ULONG count = --references;
+
+		if (count == 0)
+		{
+			delete this;
+		}
+
+		return count;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) override
+	{
+		if (ppDevice == nullptr)
+		{
+			return D3DERR_INVALIDCALL;
+		}
+
+		device->AddRef();
+		*ppDevice = device;
+		return D3D_OK;
+	}
+
+protected:
+	CountingDevice* device;
+
+private:
+	ULONG references = 1;
+};
+
+template <typename T>
+class PlaceholderShader : public Counted<T>
+{
+public:
+	using Counted<T>::Counted;
+
+	HRESULT STDMETHODCALLTYPE GetFunction(void*, UINT* pSizeOfData) override
+	{
+		if (pSizeOfData)
+		{
+			*pSizeOfData = 0;
+		}
+
+		return D3D_OK;
+	}
+};
+
+class PlaceholderTexture : public Counted<IDirect3DTexture9>
+{
+public:
+	using Counted::Counted;
+
+	HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, CONST void*, DWORD, DWORD) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, void*, DWORD*) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE FreePrivateData(REFGUID) override
+	{
+		return E_NOTIMPL;
+	}
+
+	DWORD STDMETHODCALLTYPE SetPriority(DWORD) override
+	{
+		return 0;
+	}
+
+	DWORD STDMETHODCALLTYPE GetPriority() override
+	{
+		return 0;
+	}
+
+	void STDMETHODCALLTYPE PreLoad() override
+	{
+	}
+
+	D3DRESOURCETYPE STDMETHODCALLTYPE GetType() override
+	{
+		return D3DRTYPE_TEXTURE;
+	}
+
+	DWORD STDMETHODCALLTYPE SetLOD(DWORD) override
+	{
+		return 0;
+	}
+
+	DWORD STDMETHODCALLTYPE GetLOD() override
+	{
+		return 0;
+	}
+
+	DWORD STDMETHODCALLTYPE GetLevelCount() override
+	{
+		return 1;
+	}
+
+	HRESULT STDMETHODCALLTYPE SetAutoGenFilterType(D3DTEXTUREFILTERTYPE) override
+	{
+		return E_NOTIMPL;
+	}
+
+	D3DTEXTUREFILTERTYPE STDMETHODCALLTYPE GetAutoGenFilterType() override
+	{
+		return D3DTEXF_NONE;
+	}
+
+	void STDMETHODCALLTYPE GenerateMipSubLevels() override
+	{
+	}
+
+	HRESULT STDMETHODCALLTYPE GetLevelDesc(UINT, D3DSURFACE_DESC*) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetSurfaceLevel(UINT, IDirect3DSurface9**) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE LockRect(UINT, D3DLOCKED_RECT*, CONST RECT*, DWORD) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE UnlockRect(UINT) override
+	{
+		return E_NOTIMPL;
+	}
+
+	HRESULT STDMETHODCALLTYPE AddDirtyRect(CONST RECT*) override
+	{
+		return E_NOTIMPL;
+	}
+};
+
+class CountingDevice::Block : public Counted<IDirect3DStateBlock9>
+{
+public:
+	using Counted::Counted;
+
+	~Block() override
+	{
+		for (auto& op : ops)
+		{
+			if (op.object)
+			{
+				op.object->Release();
+			}
+		}
+	}
+
+	// Keeps the last value of each state.
+	void record(const Op& op)
+	{
+		if (op.object)
+		{
+			op.object->AddRef();
+		}
+
+		for (auto& it : ops)
+		{
+			if (it.kind == op.kind && it.index == op.index && it.type == op.type)
+			{
+				if (it.object)
+				{
+					it.object->Release();
+				}
+
+				it = op;
+				return;
+			}
+		}
+
+		ops.push_back(op);
+	}
+
+	// Records every state the device keeps with its current value.
+	void record_all()
+	{
+		for (DWORD i = 0; i < RENDER_STATE_COUNT; i++)
+		{
+			add({ Op::Kind::render_state, i });
+		}
+
+		for (DWORD i = 0; i < SAMPLER_COUNT; i++)
+		{
+			for (DWORD type = 1; type < SAMPLER_STATE_COUNT; type++)
+			{
+				add({ Op::Kind::sampler_state, i, type });
+			}
+
+			add({ Op::Kind::texture, i });
+		}
+
+		add({ Op::Kind::vertex_shader });
+		add({ Op::Kind::pixel_shader });
+
+		for (DWORD i = 0; i < FLOAT_REGISTER_COUNT; i++)
+		{
+			add({ Op::Kind::vertex_float, i });
+			add({ Op::Kind::pixel_float, i });
+		}
+
+		for (DWORD i = 0; i < BOOL_REGISTER_COUNT; i++)
+		{
+			add({ Op::Kind::vertex_bool, i });
+			add({ Op::Kind::pixel_bool, i });
+		}
+
+		Capture();
+	}
+
+	HRESULT STDMETHODCALLTYPE Capture() override
+	{
+		++device->counts.calls;
+		++device->counts.state_block_captures;
+
+		for (auto& op : ops)
+		{
+			IUnknown* previous = op.object;
+			device->read(op);
+
+			if (op.object)
+			{
+				op.object->AddRef();
+			}
+
+			if (previous)
+			{
+				previous->Release();
+			}
+		}
+
+		return D3D_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE Apply() override
+	{
+		++device->counts.calls;
+		++device->counts.state_block_applies;
+		device->counts.applied_states += ops.size();
+
+		for (auto& op : ops)
+		{
+			device->put(op);
+		}
+
+		return D3D_OK;
+	}
+
+private:
+	void add(const Op& op)
+	{
+		ops.push_back(op);
+	}
+
+	std::vector<Op> ops;
+};
+
+CountingDevice::~CountingDevice()
+{
+	if (recorded)
+	{
+		recorded->Release();
+	}
+}
+
+bool CountingDevice::recording() const
+{
+	return recorded != nullptr;
+}
+
+HRESULT CountingDevice::call()
+{
+	++counts.calls;
+	return D3D_OK;
+}
+
+HRESULT CountingDevice::unsupported()
+{
+	++counts.calls;
+	return E_NOTIMPL;
+}
+
+HRESULT CountingDevice::set(const Op& op)
+{
+	if (recorded)
+	{
+		recorded->record(op);
+	}
+	else
+	{
+		put(op);
+	}
+
+	return D3D_OK;
+}
+
+void CountingDevice::put(const Op& op)
+{
+	switch (op.kind)
+	{
+		case Op::Kind::render_state:
+			state.render_states[op.index] = op.value;
+			break;
+
+		case Op::Kind::sampler_state:
+			state.sampler_states[op.index][op.type] = op.value;
+			break;
+
+		case Op::Kind::vertex_shader:
+			state.vertex_shader = static_cast<IDirect3DVertexShader9*>(op.object);
+			break;
+
+		case Op::Kind::pixel_shader:
+			state.pixel_shader = static_cast<IDirect3DPixelShader9*>(op.object);
+			break;
+
+		case Op::Kind::texture:
+			state.textures[op.index] = static_cast<IDirect3DBaseTexture9*>(op.object);
+			break;
+
+		case Op::Kind::vertex_float:
+			memcpy(state.vertex_constants[op.index], op.vector, sizeof(op.vector));
+			break;
+
+		case Op::Kind::pixel_float:
+			memcpy(state.pixel_constants[op.index], op.vector, sizeof(op.vector));
+			break;
+
+		case Op::Kind::vertex_bool:
+			state.vertex_bools[op.index] = op.value;
+			break;
+
+		case Op::Kind::pixel_bool:
+			state.pixel_bools[op.index] = op.value;
+			break;
+	}
+}
+
+void CountingDevice::read(Op& op) const
+{
+	switch (op.kind)
+	{
+		case Op::Kind::render_state:
+			op.value = state.render_states[op.index];
+			break;
+
+		case Op::Kind::sampler_state:
+			op.value = state.sampler_states[op.index][op.type];
+			break;
+
+		case Op::Kind::vertex_shader:
+			op.object = state.vertex_shader;
+			break;
+
+		case Op::Kind::pixel_shader:
+			op.object = state.pixel_shader;
+			break;
+
+		case Op::Kind::texture:
+			op.object = state.textures[op.index];
+			break;
+
+		case Op::Kind::vertex_float:
+			memcpy(op.vector, state.vertex_constants[op.index], sizeof(op.vector));
+			break;
+
+		case Op::Kind::pixel_float:
+			memcpy(op.vector, state.pixel_constants[op.index], sizeof(op.vector));
+			break;
+
+		case Op::Kind::vertex_bool:
+			op.value = state.vertex_bools[op.index];
+			break;
+
+		case Op::Kind::pixel_bool:
+			op.value = state.pixel_bools[op.index];
+			break;
+	}
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::QueryInterface(REFIID riid, void** ppvObj)
+{
+	++counts.calls;
+
+	if (ppvObj == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == __uuidof(IDirect3DDevice9) || riid == __uuidof(IUnknown))
+	{
+		AddRef();
+		*ppvObj = this;
+		return S_OK;
+	}
+
+	*ppvObj = nullptr;
+	return E_NOINTERFACE;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::CreateTexture(UINT, UINT, UINT, DWORD, D3DFORMAT, D3DPOOL,
+	IDirect3DTexture9** ppTexture, HANDLE*)
+{
+	++counts.calls;
+
+	if (ppTexture == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppTexture = new PlaceholderTexture(this);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetRenderState(D3DRENDERSTATETYPE State, DWORD Value)
+{
+	++counts.calls;
+	++counts.render_states;
+
+	if (static_cast<DWORD>(State) >= RENDER_STATE_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	return set({ Op::Kind::render_state, static_cast<DWORD>(State), 0, Value });
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetRenderState(D3DRENDERSTATETYPE State, DWORD* pValue)
+{
+	++counts.calls;
+	++counts.state_reads;
+
+	if (pValue == nullptr || static_cast<DWORD>(State) >= RENDER_STATE_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*pValue = state.render_states[State];
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::CreateStateBlock(D3DSTATEBLOCKTYPE, IDirect3DStateBlock9** ppSB)
+{
+	++counts.calls;
+
+	if (ppSB == nullptr || recorded)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	// Every type captures everything; the mod doesn't distinguish them.
+	auto block = new Block(this);
+	block->record_all();
+	*ppSB = block;
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::BeginStateBlock()
+{
+	++counts.calls;
+
+	if (recorded)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	recorded = new Block(this);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::EndStateBlock(IDirect3DStateBlock9** ppSB)
+{
+	++counts.calls;
+
+	if (ppSB == nullptr || !recorded)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppSB = recorded;
+	recorded = nullptr;
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture)
+{
+	++counts.calls;
+	++counts.textures;
+
+	// Vertex texture samplers aren't tracked.
+	if (Stage >= SAMPLER_COUNT)
+	{
+		return D3D_OK;
+	}
+
+	Op op {};
+	op.kind = Op::Kind::texture;
+	op.index = Stage;
+	op.object = pTexture;
+	return set(op);
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetTexture(DWORD Stage, IDirect3DBaseTexture9** ppTexture)
+{
+	++counts.calls;
+
+	if (ppTexture == nullptr || Stage >= SAMPLER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppTexture = state.textures[Stage];
+
+	if (*ppTexture)
+	{
+		(*ppTexture)->AddRef();
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD* pValue)
+{
+	++counts.calls;
+	++counts.state_reads;
+
+	if (pValue == nullptr || Sampler >= SAMPLER_COUNT || static_cast<DWORD>(Type) >= SAMPLER_STATE_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*pValue = state.sampler_states[Sampler][Type];
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value)
+{
+	++counts.calls;
+	++counts.sampler_states;
+
+	if (Sampler >= SAMPLER_COUNT || static_cast<DWORD>(Type) >= SAMPLER_STATE_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	return set({ Op::Kind::sampler_state, Sampler, static_cast<DWORD>(Type), Value });
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::DrawPrimitive(D3DPRIMITIVETYPE, UINT, UINT)
+{
+	++counts.draws;
+	return call();
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::DrawIndexedPrimitive(D3DPRIMITIVETYPE, INT, UINT, UINT, UINT, UINT)
+{
+	++counts.draws;
+	return call();
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::DrawPrimitiveUP(D3DPRIMITIVETYPE, UINT, CONST void*, UINT)
+{
+	++counts.draws;
+	return call();
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE, UINT, UINT, UINT, CONST void*, D3DFORMAT,
+	CONST void*, UINT)
+{
+	++counts.draws;
+	return call();
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetFVF(DWORD FVF)
+{
+	++counts.calls;
+
+	if (!recorded)
+	{
+		state.fvf = FVF;
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetFVF(DWORD* pFVF)
+{
+	++counts.calls;
+
+	if (pFVF == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*pFVF = state.fvf;
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::CreateVertexShader(CONST DWORD*, IDirect3DVertexShader9** ppShader)
+{
+	++counts.calls;
+
+	if (ppShader == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppShader = new PlaceholderShader<IDirect3DVertexShader9>(this);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetVertexShader(IDirect3DVertexShader9* pShader)
+{
+	++counts.calls;
+	++counts.vertex_shaders;
+
+	Op op {};
+	op.kind = Op::Kind::vertex_shader;
+	op.object = pShader;
+	return set(op);
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetVertexShader(IDirect3DVertexShader9** ppShader)
+{
+	++counts.calls;
+
+	if (ppShader == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppShader = state.vertex_shader;
+
+	if (*ppShader)
+	{
+		(*ppShader)->AddRef();
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetVertexShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount)
+{
+	++counts.calls;
+	++counts.float_constants;
+	counts.constant_bytes += Vector4fCount * sizeof(float) * 4;
+
+	if (pConstantData == nullptr || StartRegister + Vector4fCount > FLOAT_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	for (UINT i = 0; i < Vector4fCount; i++)
+	{
+		Op op {};
+		op.kind = Op::Kind::vertex_float;
+		op.index = StartRegister + i;
+		memcpy(op.vector, pConstantData + i * 4, sizeof(op.vector));
+		set(op);
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetVertexShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount)
+{
+	++counts.calls;
+
+	if (pConstantData == nullptr || StartRegister + Vector4fCount > FLOAT_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	memcpy(pConstantData, state.vertex_constants[StartRegister], Vector4fCount * sizeof(float) * 4);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetVertexShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount)
+{
+	++counts.calls;
+	++counts.bool_constants;
+
+	if (pConstantData == nullptr || StartRegister + BoolCount > BOOL_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	for (UINT i = 0; i < BoolCount; i++)
+	{
+		set({ Op::Kind::vertex_bool, StartRegister + i, 0, static_cast<DWORD>(pConstantData[i]) });
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetVertexShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount)
+{
+	++counts.calls;
+
+	if (pConstantData == nullptr || StartRegister + BoolCount > BOOL_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	memcpy(pConstantData, &state.vertex_bools[StartRegister], BoolCount * sizeof(BOOL));
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::CreatePixelShader(CONST DWORD*, IDirect3DPixelShader9** ppShader)
+{
+	++counts.calls;
+
+	if (ppShader == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppShader = new PlaceholderShader<IDirect3DPixelShader9>(this);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetPixelShader(IDirect3DPixelShader9* pShader)
+{
+	++counts.calls;
+	++counts.pixel_shaders;
+
+	Op op {};
+	op.kind = Op::Kind::pixel_shader;
+	op.object = pShader;
+	return set(op);
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetPixelShader(IDirect3DPixelShader9** ppShader)
+{
+	++counts.calls;
+
+	if (ppShader == nullptr)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	*ppShader = state.pixel_shader;
+
+	if (*ppShader)
+	{
+		(*ppShader)->AddRef();
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetPixelShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount)
+{
+	++counts.calls;
+	++counts.float_constants;
+	counts.constant_bytes += Vector4fCount * sizeof(float) * 4;
+
+	if (pConstantData == nullptr || StartRegister + Vector4fCount > FLOAT_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	for (UINT i = 0; i < Vector4fCount; i++)
+	{
+		Op op {};
+		op.kind = Op::Kind::pixel_float;
+		op.index = StartRegister + i;
+		memcpy(op.vector, pConstantData + i * 4, sizeof(op.vector));
+		set(op);
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetPixelShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount)
+{
+	++counts.calls;
+
+	if (pConstantData == nullptr || StartRegister + Vector4fCount > FLOAT_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	memcpy(pConstantData, state.pixel_constants[StartRegister], Vector4fCount * sizeof(float) * 4);
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::SetPixelShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount)
+{
+	++counts.calls;
+	++counts.bool_constants;
+
+	if (pConstantData == nullptr || StartRegister + BoolCount > BOOL_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	for (UINT i = 0; i < BoolCount; i++)
+	{
+		set({ Op::Kind::pixel_bool, StartRegister + i, 0, static_cast<DWORD>(pConstantData[i]) });
+	}
+
+	return D3D_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CountingDevice::GetPixelShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount)
+{
+	++counts.calls;
+
+	if (pConstantData == nullptr || StartRegister + BoolCount > BOOL_REGISTER_COUNT)
+	{
+		return D3DERR_INVALIDCALL;
+	}
+
+	memcpy(pConstantData, &state.pixel_bools[StartRegister], BoolCount * sizeof(BOOL));
+	return D3D_OK;
+}
@@ -0,0 +1,583 @@
+#pragma once
+
+#include <cstdint>
+#include <d3d9.h>
+
+// An IDirect3DDevice9 that draws nothing. It counts the calls made to it and
+// keeps the states the mod's shader switching depends on, so the device
+// traffic of the draw path can be measured and tested without a GPU
+// (see CaptureReplay.h and the tests).
+//
+// State blocks record the render and sampler states, shaders, textures and
+// constants set between BeginStateBlock and EndStateBlock and put them on the
+// device when applied; CreateStateBlock captures all of them. Shaders and
+// textures it creates are placeholders. Anything else is counted and ignored,
+// and methods that would return data fail with E_NOTIMPL.
+//
+// The device isn't deleted by Release; its owner destroys it.
+class CountingDevice : public IDirect3DDevice9
+{
+public:
+	static constexpr DWORD RENDER_STATE_COUNT   = D3DRS_BLENDOPALPHA + 1;
+	static constexpr DWORD SAMPLER_COUNT        = 16;
+	static constexpr DWORD SAMPLER_STATE_COUNT  = D3DSAMP_DMAPOFFSET + 1;
+	static constexpr UINT  FLOAT_REGISTER_COUNT = 256;
+	static constexpr UINT  BOOL_REGISTER_COUNT  = 16;
+
+	struct Counts
+	{
+		uint64_t calls;               // Every call except AddRef and Release, including Apply.
+		uint64_t draws;
+		uint64_t vertex_shaders;      // SetVertexShader
+		uint64_t pixel_shaders;       // SetPixelShader
+		uint64_t float_constants;     // Set*ShaderConstantF
+		uint64_t constant_bytes;      // Set*ShaderConstantF data
+		uint64_t bool_constants;      // Set*ShaderConstantB
+		uint64_t textures;            // SetTexture
+		uint64_t render_states;       // SetRenderState
+		uint64_t sampler_states;      // SetSamplerState
+		uint64_t state_reads;         // GetRenderState and GetSamplerState
+		uint64_t state_block_applies;
+		uint64_t applied_states;      // States set by Apply
+		uint64_t state_block_captures; // CreateStateBlock and Capture
+	};
+
+	// What's currently on the device.
+	struct State
+	{
+		DWORD render_states[RENDER_STATE_COUNT];
+		DWORD sampler_states[SAMPLER_COUNT][SAMPLER_STATE_COUNT];
+		IDirect3DVertexShader9* vertex_shader;
+		IDirect3DPixelShader9* pixel_shader;
+		IDirect3DBaseTexture9* textures[SAMPLER_COUNT];
+		float vertex_constants[FLOAT_REGISTER_COUNT][4];
+		float pixel_constants[FLOAT_REGISTER_COUNT][4];
+		BOOL vertex_bools[BOOL_REGISTER_COUNT];
+		BOOL pixel_bools[BOOL_REGISTER_COUNT];
+		DWORD fvf;
+	};
+
+	Counts counts {};
+	State state {};
+
+	CountingDevice() = default;
+	CountingDevice(const CountingDevice&) = delete;
+	CountingDevice& operator=(const CountingDevice&) = delete;
+	virtual ~CountingDevice();
+
+	bool recording() const;
+	// References held by others than the device itself.
+	ULONG reference_count() const
+	{
+		return references - 1;
+	}
+
+	// IUnknown
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObj) override;
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++references;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		return references > 1 ? --references : 1;
+	}
+
+	// Counted and tracked
+
+	HRESULT STDMETHODCALLTYPE CreateTexture(UINT Width, UINT Height, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool,
+		IDirect3DTexture9** ppTexture, HANDLE* pSharedHandle) override;
+	HRESULT STDMETHODCALLTYPE SetRenderState(D3DRENDERSTATETYPE State, DWORD Value) override;
+	HRESULT STDMETHODCALLTYPE GetRenderState(D3DRENDERSTATETYPE State, DWORD* pValue) override;
+	HRESULT STDMETHODCALLTYPE CreateStateBlock(D3DSTATEBLOCKTYPE Type, IDirect3DStateBlock9** ppSB) override;
+	HRESULT STDMETHODCALLTYPE BeginStateBlock() override;
+	HRESULT STDMETHODCALLTYPE EndStateBlock(IDirect3DStateBlock9** ppSB) override;
+	HRESULT STDMETHODCALLTYPE SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture) override;
+	HRESULT STDMETHODCALLTYPE GetTexture(DWORD Stage, IDirect3DBaseTexture9** ppTexture) override;
+	HRESULT STDMETHODCALLTYPE GetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD* pValue) override;
+	HRESULT STDMETHODCALLTYPE SetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value) override;
+	HRESULT STDMETHODCALLTYPE DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount) override;
+	HRESULT STDMETHODCALLTYPE DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex,
+		UINT NumVertices, UINT startIndex, UINT primCount) override;
+	HRESULT STDMETHODCALLTYPE DrawPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride) override;
+	HRESULT STDMETHODCALLTYPE DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices,
+		UINT PrimitiveCount, CONST void* pIndexData, D3DFORMAT IndexDataFormat, CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride) override;
+	HRESULT STDMETHODCALLTYPE SetFVF(DWORD FVF) override;
+	HRESULT STDMETHODCALLTYPE GetFVF(DWORD* pFVF) override;
+	HRESULT STDMETHODCALLTYPE CreateVertexShader(CONST DWORD* pFunction, IDirect3DVertexShader9** ppShader) override;
+	HRESULT STDMETHODCALLTYPE SetVertexShader(IDirect3DVertexShader9* pShader) override;
+	HRESULT STDMETHODCALLTYPE GetVertexShader(IDirect3DVertexShader9** ppShader) override;
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) override;
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) override;
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) override;
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) override;
+	HRESULT STDMETHODCALLTYPE CreatePixelShader(CONST DWORD* pFunction, IDirect3DPixelShader9** ppShader) override;
+	HRESULT STDMETHODCALLTYPE SetPixelShader(IDirect3DPixelShader9* pShader) override;
+	HRESULT STDMETHODCALLTYPE GetPixelShader(IDirect3DPixelShader9** ppShader) override;
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) override;
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) override;
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) override;
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) override;
+
+	// Counted only
+
+	HRESULT STDMETHODCALLTYPE TestCooperativeLevel() override
+	{
+		return call();
+	}
+
+	UINT STDMETHODCALLTYPE GetAvailableTextureMem() override
+	{
+		call();
+		return 0;
+	}
+
+	HRESULT STDMETHODCALLTYPE EvictManagedResources() override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDirect3D(IDirect3D9** ppD3D9) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDeviceCaps(D3DCAPS9* pCaps) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDisplayMode(UINT iSwapChain, D3DDISPLAYMODE* pMode) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetCreationParameters(D3DDEVICE_CREATION_PARAMETERS* pParameters) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetCursorProperties(UINT XHotSpot, UINT YHotSpot, IDirect3DSurface9* pCursorBitmap) override
+	{
+		return call();
+	}
+
+	void STDMETHODCALLTYPE SetCursorPosition(int X, int Y, DWORD Flags) override
+	{
+		call();
+	}
+
+	BOOL STDMETHODCALLTYPE ShowCursor(BOOL bShow) override
+	{
+		call();
+		return 0;
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateAdditionalSwapChain(D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DSwapChain9** pSwapChain) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetSwapChain(UINT iSwapChain, IDirect3DSwapChain9** pSwapChain) override
+	{
+		return unsupported();
+	}
+
+	UINT STDMETHODCALLTYPE GetNumberOfSwapChains() override
+	{
+		call();
+		return 0;
+	}
+
+	HRESULT STDMETHODCALLTYPE Reset(D3DPRESENT_PARAMETERS* pPresentationParameters) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE Present(CONST RECT* pSourceRect, CONST RECT* pDestRect, HWND hDestWindowOverride, CONST RGNDATA* pDirtyRegion) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetBackBuffer(UINT iSwapChain, UINT iBackBuffer, D3DBACKBUFFER_TYPE Type, IDirect3DSurface9** ppBackBuffer) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRasterStatus(UINT iSwapChain, D3DRASTER_STATUS* pRasterStatus) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetDialogBoxMode(BOOL bEnableDialogs) override
+	{
+		return call();
+	}
+
+	void STDMETHODCALLTYPE SetGammaRamp(UINT iSwapChain, DWORD Flags, CONST D3DGAMMARAMP* pRamp) override
+	{
+		call();
+	}
+
+	void STDMETHODCALLTYPE GetGammaRamp(UINT iSwapChain, D3DGAMMARAMP* pRamp) override
+	{
+		call();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVolumeTexture(UINT Width, UINT Height, UINT Depth, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DVolumeTexture9** ppVolumeTexture, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateCubeTexture(UINT EdgeLength, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DCubeTexture9** ppCubeTexture, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVertexBuffer(UINT Length, DWORD Usage, DWORD FVF, D3DPOOL Pool, IDirect3DVertexBuffer9** ppVertexBuffer, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateIndexBuffer(UINT Length, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DIndexBuffer9** ppIndexBuffer, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateRenderTarget(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample, DWORD MultisampleQuality, BOOL Lockable, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateDepthStencilSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample, DWORD MultisampleQuality, BOOL Discard, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE UpdateSurface(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect, IDirect3DSurface9* pDestinationSurface, CONST POINT* pDestPoint) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE UpdateTexture(IDirect3DBaseTexture9* pSourceTexture, IDirect3DBaseTexture9* pDestinationTexture) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRenderTargetData(IDirect3DSurface9* pRenderTarget, IDirect3DSurface9* pDestSurface) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetFrontBufferData(UINT iSwapChain, IDirect3DSurface9* pDestSurface) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE StretchRect(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect, IDirect3DSurface9* pDestSurface, CONST RECT* pDestRect, D3DTEXTUREFILTERTYPE Filter) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE ColorFill(IDirect3DSurface9* pSurface, CONST RECT* pRect, D3DCOLOR color) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateOffscreenPlainSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DPOOL Pool, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9** ppRenderTarget) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetDepthStencilSurface(IDirect3DSurface9* pNewZStencil) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDepthStencilSurface(IDirect3DSurface9** ppZStencilSurface) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE BeginScene() override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE EndScene() override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE Clear(DWORD Count, CONST D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetTransform(D3DTRANSFORMSTATETYPE State, D3DMATRIX* pMatrix) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE MultiplyTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetViewport(CONST D3DVIEWPORT9* pViewport) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetViewport(D3DVIEWPORT9* pViewport) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetMaterial(CONST D3DMATERIAL9* pMaterial) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetMaterial(D3DMATERIAL9* pMaterial) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetLight(DWORD Index, CONST D3DLIGHT9* pLight) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetLight(DWORD Index, D3DLIGHT9* pLight) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE LightEnable(DWORD Index, BOOL Enable) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetLightEnable(DWORD Index, BOOL* pEnable) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetClipPlane(DWORD Index, CONST float* pPlane) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetClipPlane(DWORD Index, float* pPlane) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetClipStatus(CONST D3DCLIPSTATUS9* pClipStatus) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetClipStatus(D3DCLIPSTATUS9* pClipStatus) override
+	{
+		return unsupported();
+	}
+
+
+	HRESULT STDMETHODCALLTYPE GetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD* pValue) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE ValidateDevice(DWORD* pNumPasses) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY* pEntries) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY* pEntries) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetCurrentTexturePalette(UINT PaletteNumber) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetCurrentTexturePalette(UINT* PaletteNumber) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetScissorRect(CONST RECT* pRect) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetScissorRect(RECT* pRect) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetSoftwareVertexProcessing(BOOL bSoftware) override
+	{
+		return call();
+	}
+
+	BOOL STDMETHODCALLTYPE GetSoftwareVertexProcessing() override
+	{
+		call();
+		return 0;
+	}
+
+	HRESULT STDMETHODCALLTYPE SetNPatchMode(float nSegments) override
+	{
+		return call();
+	}
+
+	float STDMETHODCALLTYPE GetNPatchMode() override
+	{
+		call();
+		return 0;
+	}
+
+	HRESULT STDMETHODCALLTYPE ProcessVertices(UINT SrcStartIndex, UINT DestIndex, UINT VertexCount, IDirect3DVertexBuffer9* pDestBuffer, IDirect3DVertexDeclaration9* pVertexDecl, DWORD Flags) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVertexDeclaration(CONST D3DVERTEXELEMENT9* pVertexElements, IDirect3DVertexDeclaration9** ppDecl) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexDeclaration(IDirect3DVertexDeclaration9* pDecl) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexDeclaration(IDirect3DVertexDeclaration9** ppDecl) override
+	{
+		return unsupported();
+	}
+
+
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) override
+	{
+		return unsupported();
+	}
+
+
+	HRESULT STDMETHODCALLTYPE SetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9** ppStreamData, UINT* pOffsetInBytes, UINT* pStride) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetStreamSourceFreq(UINT StreamNumber, UINT Setting) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting) override
+	{
+		return unsupported();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetIndices(IDirect3DIndexBuffer9* pIndexData) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetIndices(IDirect3DIndexBuffer9** ppIndexData) override
+	{
+		return unsupported();
+	}
+
+
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) override
+	{
+		return unsupported();
+	}
+
+
+	HRESULT STDMETHODCALLTYPE DrawRectPatch(UINT Handle, CONST float* pNumSegs, CONST D3DRECTPATCH_INFO* pRectPatchInfo) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawTriPatch(UINT Handle, CONST float* pNumSegs, CONST D3DTRIPATCH_INFO* pTriPatchInfo) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE DeletePatch(UINT Handle) override
+	{
+		return call();
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateQuery(D3DQUERYTYPE Type, IDirect3DQuery9** ppQuery) override
+	{
+		return unsupported();
+	}
+
+private:
+	struct Op;
+	class Block;
+	friend class Block;
+
+	HRESULT call();
+	HRESULT unsupported();
+	// Puts a state on the device, or into the block being recorded.
+	HRESULT set(const Op& op);
+	void put(const Op& op);
+	void read(Op& op) const;
+
+	ULONG references = 1;
+	Block* recorded = nullptr;
+};
@@ -0,0 +1,310 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <utility>
+
+#include "DeviceProxy.h"
+
+void DeviceProxy::invalidate_state()
+{
+	memset(render_states, 0, sizeof(render_states));
+	memset(sampler_states, 0, sizeof(sampler_states));
+}
+
+// Forwards to a state block of the device. Applying it updates the
+// proxy's shadow with the states the block sets.
+class DeviceProxy::StateBlock : public IDirect3DStateBlock9
+{
+public:
+	// A block from CreateStateBlock sets every state, so everything is set.
+	StateBlock(DeviceProxy* proxy, IDirect3DStateBlock9* target, std::vector<RecordedState>&& states, bool everything)
+		: proxy(proxy),
+		  block(target),
+		  states(std::move(states)),
+		  everything(everything)
+	{
+		proxy->AddRef();
+	}
+
+	StateBlock(const StateBlock&) = delete;
+	StateBlock& operator=(const StateBlock&) = delete;
+
+	virtual ~StateBlock()
+	{
+		block->Release();
+		proxy->Release();
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObj) override
+	{
+		if (ppvObj == nullptr)
+		{
+			return E_POINTER;
+		}
+
+		if (riid == __uuidof(IDirect3DStateBlock9) || riid == __uuidof(IUnknown))
+		{
+			AddRef();
+			*ppvObj = this;
+			return S_OK;
+		}
+
+		*ppvObj = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++references;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		const ULONG count = --references;
+
+		if (count == 0)
+		{
+			delete this;
+		}
+
+		return count;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) override
+	{
+		if (ppDevice == nullptr)
+		{
+			return D3DERR_INVALIDCALL;
+		}
+
+		proxy->AddRef();
+		*ppDevice = proxy;
+		return D3D_OK;
+	}
+
+	// The recorded values are replaced by the device's current ones.
+	HRESULT STDMETHODCALLTYPE Capture() override
+	{
+		const HRESULT result = block->Capture();
+
+		if (SUCCEEDED(result))
+		{
+			captured = true;
+		}
+
+		return result;
+	}
+
+	HRESULT STDMETHODCALLTYPE Apply() override
+	{
+		const HRESULT result = block->Apply();
+
+		if (FAILED(result))
+		{
+			proxy->invalidate_state();
+			return result;
+		}
+
+		if (everything)
+		{
+			proxy->invalidate_state();
+			return result;
+		}
+
+		for (auto& it : states)
+		{
+			auto& shadow = it.sampler == NO_SAMPLER
+				? proxy->render_states[it.type]
+				: proxy->sampler_states[it.sampler][it.type];
+
+			shadow = { it.value, !captured };
+		}
+
+		return result;
+	}
+
+private:
+	DeviceProxy* const proxy;
+	IDirect3DStateBlock9* const block;
+	const std::vector<RecordedState> states;
+	const bool everything;
+	bool captured = false;
+	std::atomic<ULONG> references { 1 };
+};
+
+void DeviceProxy::record(DWORD sampler, DWORD type, DWORD value)
+{
+	for (auto& it : recorded_states)
+	{
+		if (it.sampler == sampler && it.type == type)
+		{
+			it.value = value;
+			return;
+		}
+	}
+
+	recorded_states.push_back({ sampler, type, value });
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::QueryInterface(REFIID riid, void** ppvObj)
+{
+	if (ppvObj == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	if (riid == __uuidof(IDirect3DDevice9) || riid == __uuidof(IUnknown))
+	{
+		AddRef();
+		*ppvObj = this;
+		return S_OK;
+	}
+
+	return device->QueryInterface(riid, ppvObj);
+}
+
+ULONG STDMETHODCALLTYPE DeviceProxy::Release()
+{
+	const ULONG count = --references;
+
+	if (count == 0)
+	{
+		device->Release();
+		delete this;
+	}
+
+	return count;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::CreateStateBlock(D3DSTATEBLOCKTYPE Type, IDirect3DStateBlock9** ppSB)
+{
+	const HRESULT result = device->CreateStateBlock(Type, ppSB);
+
+	if (SUCCEEDED(result) && ppSB != nullptr && *ppSB != nullptr)
+	{
+		*ppSB = new StateBlock(this, *ppSB, {}, true);
+	}
+
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::BeginStateBlock()
+{
+	const HRESULT result = device->BeginStateBlock();
+
+	if (SUCCEEDED(result))
+	{
+		recording = true;
+		recorded_states.clear();
+	}
+
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::EndStateBlock(IDirect3DStateBlock9** ppSB)
+{
+	const HRESULT result = device->EndStateBlock(ppSB);
+	recording = false;
+
+	if (SUCCEEDED(result) && ppSB != nullptr && *ppSB != nullptr)
+	{
+		*ppSB = new StateBlock(this, *ppSB, std::move(recorded_states), false);
+	}
+
+	recorded_states.clear();
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::SetRenderState(D3DRENDERSTATETYPE State, DWORD Value)
+{
+	ShadowState* shadow = (!recording && State < RENDER_STATE_COUNT) ? &render_states[State] : nullptr;
+
+	if (shadow && shadow->valid && shadow->value == Value)
+	{
+		return D3D_OK;
+	}
+
+	const HRESULT result = hooks.SetRenderState
+		? hooks.SetRenderState(device, State, Value)
+		: device->SetRenderState(State, Value);
+
+	if (recording && State < RENDER_STATE_COUNT && SUCCEEDED(result))
+	{
+		record(NO_SAMPLER, State, Value);
+	}
+
+	if (shadow)
+	{
+		shadow->value = Value;
+		shadow->valid = SUCCEEDED(result);
+	}
+
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::GetRenderState(D3DRENDERSTATETYPE State, DWORD* pValue)
+{
+	if (!recording && pValue && State < RENDER_STATE_COUNT && render_states[State].valid)
+	{
+		*pValue = render_states[State].value;
+		return D3D_OK;
+	}
+
+	const HRESULT result = device->GetRenderState(State, pValue);
+
+	if (!recording && pValue && State < RENDER_STATE_COUNT && SUCCEEDED(result))
+	{
+		render_states[State] = { *pValue, true };
+	}
+
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::GetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD* pValue)
+{
+	const bool shadowed = !recording && pValue && Sampler < SAMPLER_COUNT && Type < SAMPLER_STATE_COUNT;
+
+	if (shadowed && sampler_states[Sampler][Type].valid)
+	{
+		*pValue = sampler_states[Sampler][Type].value;
+		return D3D_OK;
+	}
+
+	const HRESULT result = device->GetSamplerState(Sampler, Type, pValue);
+
+	if (shadowed && SUCCEEDED(result))
+	{
+		sampler_states[Sampler][Type] = { *pValue, true };
+	}
+
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceProxy::SetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value)
+{
+	ShadowState* shadow = (!recording && Sampler < SAMPLER_COUNT && Type < SAMPLER_STATE_COUNT)
+		? &sampler_states[Sampler][Type]
+		: nullptr;
+
+	if (shadow && shadow->valid && shadow->value == Value)
+	{
+		return D3D_OK;
+	}
+
+	const HRESULT result = hooks.SetSamplerState
+		? hooks.SetSamplerState(device, Sampler, Type, Value)
+		: device->SetSamplerState(Sampler, Type, Value);
+
+	if (recording && Sampler < SAMPLER_COUNT && Type < SAMPLER_STATE_COUNT && SUCCEEDED(result))
+	{
+		record(Sampler, Type, Value);
+	}
+
+	if (shadow)
+	{
+		shadow->value = Value;
+		shadow->valid = SUCCEEDED(result);
+	}
+
+	return result;
+}
@@ -0,0 +1,733 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <d3d9.h>
+
+// A thin IDirect3DDevice9 that forwards to the device created by d3d8to9.
+// It's handed to d3d8to9 in place of that device when it's created, so the
+// mod sees the calls it's interested in without patching the device's vtable.
+//
+// Hooks are called with the target device and are responsible for
+// forwarding the call themselves. Render and sampler states set through
+// the proxy are shadowed: redundant sets are dropped before they reach the
+// hooks or the device, and reads of shadowed states are answered directly.
+// State blocks created through the proxy are wrapped so that their Apply
+// updates the shadow, and a reset forgets it. Resources aren't wrapped;
+// their methods go straight to the objects the device created.
+class DeviceProxy : public IDirect3DDevice9
+{
+public:
+	struct Hooks
+	{
+		HRESULT (__stdcall* Present)(IDirect3DDevice9*, CONST RECT*, CONST RECT*, HWND, CONST RGNDATA*) = nullptr;
+		HRESULT (__stdcall* EndScene)(IDirect3DDevice9*) = nullptr;
+		HRESULT (__stdcall* Clear)(IDirect3DDevice9*, DWORD, CONST D3DRECT*, DWORD, D3DCOLOR, float, DWORD) = nullptr;
+		HRESULT (__stdcall* SetRenderTarget)(IDirect3DDevice9*, DWORD, IDirect3DSurface9*) = nullptr;
+		HRESULT (__stdcall* SetDepthStencilSurface)(IDirect3DDevice9*, IDirect3DSurface9*) = nullptr;
+		HRESULT (__stdcall* SetTransform)(IDirect3DDevice9*, D3DTRANSFORMSTATETYPE, CONST D3DMATRIX*) = nullptr;
+		HRESULT (__stdcall* SetViewport)(IDirect3DDevice9*, CONST D3DVIEWPORT9*) = nullptr;
+		HRESULT (__stdcall* SetMaterial)(IDirect3DDevice9*, CONST D3DMATERIAL9*) = nullptr;
+		HRESULT (__stdcall* SetLight)(IDirect3DDevice9*, DWORD, CONST D3DLIGHT9*) = nullptr;
+		HRESULT (__stdcall* LightEnable)(IDirect3DDevice9*, DWORD, BOOL) = nullptr;
+		HRESULT (__stdcall* SetClipPlane)(IDirect3DDevice9*, DWORD, CONST float*) = nullptr;
+		HRESULT (__stdcall* SetRenderState)(IDirect3DDevice9*, D3DRENDERSTATETYPE, DWORD) = nullptr;
+		HRESULT (__stdcall* SetTexture)(IDirect3DDevice9*, DWORD, IDirect3DBaseTexture9*) = nullptr;
+		HRESULT (__stdcall* SetTextureStageState)(IDirect3DDevice9*, DWORD, D3DTEXTURESTAGESTATETYPE, DWORD) = nullptr;
+		HRESULT (__stdcall* SetSamplerState)(IDirect3DDevice9*, DWORD, D3DSAMPLERSTATETYPE, DWORD) = nullptr;
+		HRESULT (__stdcall* SetScissorRect)(IDirect3DDevice9*, CONST RECT*) = nullptr;
+		HRESULT (__stdcall* UpdateSurface)(IDirect3DDevice9*, IDirect3DSurface9*, CONST RECT*, IDirect3DSurface9*, CONST POINT*) = nullptr;
+		HRESULT (__stdcall* UpdateTexture)(IDirect3DDevice9*, IDirect3DBaseTexture9*, IDirect3DBaseTexture9*) = nullptr;
+		HRESULT (__stdcall* DrawPrimitive)(IDirect3DDevice9*, D3DPRIMITIVETYPE, UINT, UINT) = nullptr;
+		HRESULT (__stdcall* DrawIndexedPrimitive)(IDirect3DDevice9*, D3DPRIMITIVETYPE, INT, UINT, UINT, UINT, UINT) = nullptr;
+		HRESULT (__stdcall* DrawPrimitiveUP)(IDirect3DDevice9*, D3DPRIMITIVETYPE, UINT, CONST void*, UINT) = nullptr;
+		HRESULT (__stdcall* DrawIndexedPrimitiveUP)(IDirect3DDevice9*, D3DPRIMITIVETYPE, UINT, UINT, UINT, CONST void*, D3DFORMAT, CONST void*, UINT) = nullptr;
+		HRESULT (__stdcall* SetVertexDeclaration)(IDirect3DDevice9*, IDirect3DVertexDeclaration9*) = nullptr;
+		HRESULT (__stdcall* SetFVF)(IDirect3DDevice9*, DWORD) = nullptr;
+		HRESULT (__stdcall* SetVertexShader)(IDirect3DDevice9*, IDirect3DVertexShader9*) = nullptr;
+		HRESULT (__stdcall* SetVertexShaderConstantF)(IDirect3DDevice9*, UINT, CONST float*, UINT) = nullptr;
+		HRESULT (__stdcall* SetVertexShaderConstantB)(IDirect3DDevice9*, UINT, CONST BOOL*, UINT) = nullptr;
+		HRESULT (__stdcall* SetStreamSource)(IDirect3DDevice9*, UINT, IDirect3DVertexBuffer9*, UINT, UINT) = nullptr;
+		HRESULT (__stdcall* SetIndices)(IDirect3DDevice9*, IDirect3DIndexBuffer9*) = nullptr;
+		HRESULT (__stdcall* SetPixelShader)(IDirect3DDevice9*, IDirect3DPixelShader9*) = nullptr;
+		HRESULT (__stdcall* SetPixelShaderConstantF)(IDirect3DDevice9*, UINT, CONST float*, UINT) = nullptr;
+		HRESULT (__stdcall* SetPixelShaderConstantB)(IDirect3DDevice9*, UINT, CONST BOOL*, UINT) = nullptr;
+	};
+
+	Hooks hooks;
+
+	// Takes over a reference to target, which is released with the proxy's last one.
+	explicit DeviceProxy(IDirect3DDevice9* target) : device(target)
+	{
+		invalidate_state();
+	}
+
+	DeviceProxy(const DeviceProxy&) = delete;
+	DeviceProxy& operator=(const DeviceProxy&) = delete;
+	virtual ~DeviceProxy() = default;
+
+	IDirect3DDevice9* target() const
+	{
+		return device;
+	}
+
+	// IUnknown
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObj) override;
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++references;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override;
+
+	// IDirect3DDevice9
+
+	HRESULT STDMETHODCALLTYPE TestCooperativeLevel() override
+	{
+		return device->TestCooperativeLevel();
+	}
+
+	UINT STDMETHODCALLTYPE GetAvailableTextureMem() override
+	{
+		return device->GetAvailableTextureMem();
+	}
+
+	HRESULT STDMETHODCALLTYPE EvictManagedResources() override
+	{
+		return device->EvictManagedResources();
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDirect3D(IDirect3D9** ppD3D9) override
+	{
+		return device->GetDirect3D(ppD3D9);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDeviceCaps(D3DCAPS9* pCaps) override
+	{
+		return device->GetDeviceCaps(pCaps);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDisplayMode(UINT iSwapChain, D3DDISPLAYMODE* pMode) override
+	{
+		return device->GetDisplayMode(iSwapChain, pMode);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetCreationParameters(D3DDEVICE_CREATION_PARAMETERS* pParameters) override
+	{
+		return device->GetCreationParameters(pParameters);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetCursorProperties(UINT XHotSpot, UINT YHotSpot, IDirect3DSurface9* pCursorBitmap) override
+	{
+		return device->SetCursorProperties(XHotSpot, YHotSpot, pCursorBitmap);
+	}
+
+	void STDMETHODCALLTYPE SetCursorPosition(int X, int Y, DWORD Flags) override
+	{
+		device->SetCursorPosition(X, Y, Flags);
+	}
+
+	BOOL STDMETHODCALLTYPE ShowCursor(BOOL bShow) override
+	{
+		return device->ShowCursor(bShow);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateAdditionalSwapChain(D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DSwapChain9** pSwapChain) override
+	{
+		return device->CreateAdditionalSwapChain(pPresentationParameters, pSwapChain);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetSwapChain(UINT iSwapChain, IDirect3DSwapChain9** pSwapChain) override
+	{
+		return device->GetSwapChain(iSwapChain, pSwapChain);
+	}
+
+	UINT STDMETHODCALLTYPE GetNumberOfSwapChains() override
+	{
+		return device->GetNumberOfSwapChains();
+	}
+
+	HRESULT STDMETHODCALLTYPE Reset(D3DPRESENT_PARAMETERS* pPresentationParameters) override
+	{
+		invalidate_state();
+		return device->Reset(pPresentationParameters);
+	}
+
+	HRESULT STDMETHODCALLTYPE Present(CONST RECT* pSourceRect, CONST RECT* pDestRect, HWND hDestWindowOverride, CONST RGNDATA* pDirtyRegion) override
+	{
+		return hooks.Present
+			? hooks.Present(device, pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion)
+			: device->Present(pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetBackBuffer(UINT iSwapChain, UINT iBackBuffer, D3DBACKBUFFER_TYPE Type, IDirect3DSurface9** ppBackBuffer) override
+	{
+		return device->GetBackBuffer(iSwapChain, iBackBuffer, Type, ppBackBuffer);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRasterStatus(UINT iSwapChain, D3DRASTER_STATUS* pRasterStatus) override
+	{
+		return device->GetRasterStatus(iSwapChain, pRasterStatus);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetDialogBoxMode(BOOL bEnableDialogs) override
+	{
+		return device->SetDialogBoxMode(bEnableDialogs);
+	}
+
+	void STDMETHODCALLTYPE SetGammaRamp(UINT iSwapChain, DWORD Flags, CONST D3DGAMMARAMP* pRamp) override
+	{
+		device->SetGammaRamp(iSwapChain, Flags, pRamp);
+	}
+
+	void STDMETHODCALLTYPE GetGammaRamp(UINT iSwapChain, D3DGAMMARAMP* pRamp) override
+	{
+		device->GetGammaRamp(iSwapChain, pRamp);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateTexture(UINT Width, UINT Height, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool,
+		IDirect3DTexture9** ppTexture, HANDLE* pSharedHandle) override
+	{
+		return device->CreateTexture(Width, Height, Levels, Usage, Format, Pool, ppTexture, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVolumeTexture(UINT Width, UINT Height, UINT Depth, UINT Levels, DWORD Usage, D3DFORMAT Format,
+		D3DPOOL Pool, IDirect3DVolumeTexture9** ppVolumeTexture, HANDLE* pSharedHandle) override
+	{
+		return device->CreateVolumeTexture(Width, Height, Depth, Levels, Usage, Format, Pool, ppVolumeTexture, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateCubeTexture(UINT EdgeLength, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool,
+		IDirect3DCubeTexture9** ppCubeTexture, HANDLE* pSharedHandle) override
+	{
+		return device->CreateCubeTexture(EdgeLength, Levels, Usage, Format, Pool, ppCubeTexture, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVertexBuffer(UINT Length, DWORD Usage, DWORD FVF, D3DPOOL Pool,
+		IDirect3DVertexBuffer9** ppVertexBuffer, HANDLE* pSharedHandle) override
+	{
+		return device->CreateVertexBuffer(Length, Usage, FVF, Pool, ppVertexBuffer, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateIndexBuffer(UINT Length, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool,
+		IDirect3DIndexBuffer9** ppIndexBuffer, HANDLE* pSharedHandle) override
+	{
+		return device->CreateIndexBuffer(Length, Usage, Format, Pool, ppIndexBuffer, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateRenderTarget(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample,
+		DWORD MultisampleQuality, BOOL Lockable, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return device->CreateRenderTarget(Width, Height, Format, MultiSample, MultisampleQuality, Lockable, ppSurface, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateDepthStencilSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample,
+		DWORD MultisampleQuality, BOOL Discard, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return device->CreateDepthStencilSurface(Width, Height, Format, MultiSample, MultisampleQuality, Discard, ppSurface, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE UpdateSurface(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect,
+		IDirect3DSurface9* pDestinationSurface, CONST POINT* pDestPoint) override
+	{
+		return hooks.UpdateSurface
+			? hooks.UpdateSurface(device, pSourceSurface, pSourceRect, pDestinationSurface, pDestPoint)
+			: device->UpdateSurface(pSourceSurface, pSourceRect, pDestinationSurface, pDestPoint);
+	}
+
+	HRESULT STDMETHODCALLTYPE UpdateTexture(IDirect3DBaseTexture9* pSourceTexture, IDirect3DBaseTexture9* pDestinationTexture) override
+	{
+		return hooks.UpdateTexture
+			? hooks.UpdateTexture(device, pSourceTexture, pDestinationTexture)
+			: device->UpdateTexture(pSourceTexture, pDestinationTexture);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRenderTargetData(IDirect3DSurface9* pRenderTarget, IDirect3DSurface9* pDestSurface) override
+	{
+		return device->GetRenderTargetData(pRenderTarget, pDestSurface);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetFrontBufferData(UINT iSwapChain, IDirect3DSurface9* pDestSurface) override
+	{
+		return device->GetFrontBufferData(iSwapChain, pDestSurface);
+	}
+
+	HRESULT STDMETHODCALLTYPE StretchRect(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect, IDirect3DSurface9* pDestSurface,
+		CONST RECT* pDestRect, D3DTEXTUREFILTERTYPE Filter) override
+	{
+		return device->StretchRect(pSourceSurface, pSourceRect, pDestSurface, pDestRect, Filter);
+	}
+
+	HRESULT STDMETHODCALLTYPE ColorFill(IDirect3DSurface9* pSurface, CONST RECT* pRect, D3DCOLOR color) override
+	{
+		return device->ColorFill(pSurface, pRect, color);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateOffscreenPlainSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DPOOL Pool,
+		IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) override
+	{
+		return device->CreateOffscreenPlainSurface(Width, Height, Format, Pool, ppSurface, pSharedHandle);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget) override
+	{
+		return hooks.SetRenderTarget
+			? hooks.SetRenderTarget(device, RenderTargetIndex, pRenderTarget)
+			: device->SetRenderTarget(RenderTargetIndex, pRenderTarget);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9** ppRenderTarget) override
+	{
+		return device->GetRenderTarget(RenderTargetIndex, ppRenderTarget);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetDepthStencilSurface(IDirect3DSurface9* pNewZStencil) override
+	{
+		return hooks.SetDepthStencilSurface
+			? hooks.SetDepthStencilSurface(device, pNewZStencil)
+			: device->SetDepthStencilSurface(pNewZStencil);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetDepthStencilSurface(IDirect3DSurface9** ppZStencilSurface) override
+	{
+		return device->GetDepthStencilSurface(ppZStencilSurface);
+	}
+
+	HRESULT STDMETHODCALLTYPE BeginScene() override
+	{
+		return device->BeginScene();
+	}
+
+	HRESULT STDMETHODCALLTYPE EndScene() override
+	{
+		return hooks.EndScene ? hooks.EndScene(device) : device->EndScene();
+	}
+
+	HRESULT STDMETHODCALLTYPE Clear(DWORD Count, CONST D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil) override
+	{
+		return hooks.Clear
+			? hooks.Clear(device, Count, pRects, Flags, Color, Z, Stencil)
+			: device->Clear(Count, pRects, Flags, Color, Z, Stencil);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) override
+	{
+		return hooks.SetTransform ? hooks.SetTransform(device, State, pMatrix) : device->SetTransform(State, pMatrix);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetTransform(D3DTRANSFORMSTATETYPE State, D3DMATRIX* pMatrix) override
+	{
+		return device->GetTransform(State, pMatrix);
+	}
+
+	HRESULT STDMETHODCALLTYPE MultiplyTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) override
+	{
+		return device->MultiplyTransform(State, pMatrix);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetViewport(CONST D3DVIEWPORT9* pViewport) override
+	{
+		return hooks.SetViewport ? hooks.SetViewport(device, pViewport) : device->SetViewport(pViewport);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetViewport(D3DVIEWPORT9* pViewport) override
+	{
+		return device->GetViewport(pViewport);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetMaterial(CONST D3DMATERIAL9* pMaterial) override
+	{
+		return hooks.SetMaterial ? hooks.SetMaterial(device, pMaterial) : device->SetMaterial(pMaterial);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetMaterial(D3DMATERIAL9* pMaterial) override
+	{
+		return device->GetMaterial(pMaterial);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetLight(DWORD Index, CONST D3DLIGHT9* pLight) override
+	{
+		return hooks.SetLight ? hooks.SetLight(device, Index, pLight) : device->SetLight(Index, pLight);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetLight(DWORD Index, D3DLIGHT9* pLight) override
+	{
+		return device->GetLight(Index, pLight);
+	}
+
+	HRESULT STDMETHODCALLTYPE LightEnable(DWORD Index, BOOL Enable) override
+	{
+		return hooks.LightEnable ? hooks.LightEnable(device, Index, Enable) : device->LightEnable(Index, Enable);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetLightEnable(DWORD Index, BOOL* pEnable) override
+	{
+		return device->GetLightEnable(Index, pEnable);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetClipPlane(DWORD Index, CONST float* pPlane) override
+	{
+		return hooks.SetClipPlane ? hooks.SetClipPlane(device, Index, pPlane) : device->SetClipPlane(Index, pPlane);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetClipPlane(DWORD Index, float* pPlane) override
+	{
+		return device->GetClipPlane(Index, pPlane);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetRenderState(D3DRENDERSTATETYPE State, DWORD Value) override;
+	HRESULT STDMETHODCALLTYPE GetRenderState(D3DRENDERSTATETYPE State, DWORD* pValue) override;
+
+	HRESULT STDMETHODCALLTYPE CreateStateBlock(D3DSTATEBLOCKTYPE Type, IDirect3DStateBlock9** ppSB) override;
+	HRESULT STDMETHODCALLTYPE BeginStateBlock() override;
+	HRESULT STDMETHODCALLTYPE EndStateBlock(IDirect3DStateBlock9** ppSB) override;
+
+	HRESULT STDMETHODCALLTYPE SetClipStatus(CONST D3DCLIPSTATUS9* pClipStatus) override
+	{
+		return device->SetClipStatus(pClipStatus);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetClipStatus(D3DCLIPSTATUS9* pClipStatus) override
+	{
+		return device->GetClipStatus(pClipStatus);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetTexture(DWORD Stage, IDirect3DBaseTexture9** ppTexture) override
+	{
+		return device->GetTexture(Stage, ppTexture);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture) override
+	{
+		return hooks.SetTexture ? hooks.SetTexture(device, Stage, pTexture) : device->SetTexture(Stage, pTexture);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD* pValue) override
+	{
+		return device->GetTextureStageState(Stage, Type, pValue);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value) override
+	{
+		return hooks.SetTextureStageState
+			? hooks.SetTextureStageState(device, Stage, Type, Value)
+			: device->SetTextureStageState(Stage, Type, Value);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD* pValue) override;
+	HRESULT STDMETHODCALLTYPE SetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value) override;
+
+	HRESULT STDMETHODCALLTYPE ValidateDevice(DWORD* pNumPasses) override
+	{
+		return device->ValidateDevice(pNumPasses);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY* pEntries) override
+	{
+		return device->SetPaletteEntries(PaletteNumber, pEntries);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY* pEntries) override
+	{
+		return device->GetPaletteEntries(PaletteNumber, pEntries);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetCurrentTexturePalette(UINT PaletteNumber) override
+	{
+		return device->SetCurrentTexturePalette(PaletteNumber);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetCurrentTexturePalette(UINT* PaletteNumber) override
+	{
+		return device->GetCurrentTexturePalette(PaletteNumber);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetScissorRect(CONST RECT* pRect) override
+	{
+		return hooks.SetScissorRect ? hooks.SetScissorRect(device, pRect) : device->SetScissorRect(pRect);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetScissorRect(RECT* pRect) override
+	{
+		return device->GetScissorRect(pRect);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetSoftwareVertexProcessing(BOOL bSoftware) override
+	{
+		return device->SetSoftwareVertexProcessing(bSoftware);
+	}
+
+	BOOL STDMETHODCALLTYPE GetSoftwareVertexProcessing() override
+	{
+		return device->GetSoftwareVertexProcessing();
+	}
+
+	HRESULT STDMETHODCALLTYPE SetNPatchMode(float nSegments) override
+	{
+		return device->SetNPatchMode(nSegments);
+	}
+
+	float STDMETHODCALLTYPE GetNPatchMode() override
+	{
+		return device->GetNPatchMode();
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount) override
+	{
+		return hooks.DrawPrimitive
+			? hooks.DrawPrimitive(device, PrimitiveType, StartVertex, PrimitiveCount)
+			: device->DrawPrimitive(PrimitiveType, StartVertex, PrimitiveCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex,
+		UINT NumVertices, UINT startIndex, UINT primCount) override
+	{
+		return hooks.DrawIndexedPrimitive
+			? hooks.DrawIndexedPrimitive(device, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount)
+			: device->DrawIndexedPrimitive(PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride) override
+	{
+		return hooks.DrawPrimitiveUP
+			? hooks.DrawPrimitiveUP(device, PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride)
+			: device->DrawPrimitiveUP(PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices,
+		UINT PrimitiveCount, CONST void* pIndexData, D3DFORMAT IndexDataFormat, CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride) override
+	{
+		return hooks.DrawIndexedPrimitiveUP
+			? hooks.DrawIndexedPrimitiveUP(device, PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData,
+				IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride)
+			: device->DrawIndexedPrimitiveUP(PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData,
+				IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
+	}
+
+	HRESULT STDMETHODCALLTYPE ProcessVertices(UINT SrcStartIndex, UINT DestIndex, UINT VertexCount, IDirect3DVertexBuffer9* pDestBuffer,
+		IDirect3DVertexDeclaration9* pVertexDecl, DWORD Flags) override
+	{
+		return device->ProcessVertices(SrcStartIndex, DestIndex, VertexCount, pDestBuffer, pVertexDecl, Flags);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVertexDeclaration(CONST D3DVERTEXELEMENT9* pVertexElements, IDirect3DVertexDeclaration9** ppDecl) override
+	{
+		return device->CreateVertexDeclaration(pVertexElements, ppDecl);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexDeclaration(IDirect3DVertexDeclaration9* pDecl) override
+	{
+		return hooks.SetVertexDeclaration ? hooks.SetVertexDeclaration(device, pDecl) : device->SetVertexDeclaration(pDecl);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexDeclaration(IDirect3DVertexDeclaration9** ppDecl) override
+	{
+		return device->GetVertexDeclaration(ppDecl);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetFVF(DWORD FVF) override
+	{
+		return hooks.SetFVF ? hooks.SetFVF(device, FVF) : device->SetFVF(FVF);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetFVF(DWORD* pFVF) override
+	{
+		return device->GetFVF(pFVF);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateVertexShader(CONST DWORD* pFunction, IDirect3DVertexShader9** ppShader) override
+	{
+		return device->CreateVertexShader(pFunction, ppShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShader(IDirect3DVertexShader9* pShader) override
+	{
+		return hooks.SetVertexShader ? hooks.SetVertexShader(device, pShader) : device->SetVertexShader(pShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexShader(IDirect3DVertexShader9** ppShader) override
+	{
+		return device->GetVertexShader(ppShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) override
+	{
+		return hooks.SetVertexShaderConstantF
+			? hooks.SetVertexShaderConstantF(device, StartRegister, pConstantData, Vector4fCount)
+			: device->SetVertexShaderConstantF(StartRegister, pConstantData, Vector4fCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) override
+	{
+		return device->GetVertexShaderConstantF(StartRegister, pConstantData, Vector4fCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) override
+	{
+		return device->SetVertexShaderConstantI(StartRegister, pConstantData, Vector4iCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) override
+	{
+		return device->GetVertexShaderConstantI(StartRegister, pConstantData, Vector4iCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) override
+	{
+		return hooks.SetVertexShaderConstantB
+			? hooks.SetVertexShaderConstantB(device, StartRegister, pConstantData, BoolCount)
+			: device->SetVertexShaderConstantB(StartRegister, pConstantData, BoolCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetVertexShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) override
+	{
+		return device->GetVertexShaderConstantB(StartRegister, pConstantData, BoolCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride) override
+	{
+		return hooks.SetStreamSource
+			? hooks.SetStreamSource(device, StreamNumber, pStreamData, OffsetInBytes, Stride)
+			: device->SetStreamSource(StreamNumber, pStreamData, OffsetInBytes, Stride);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9** ppStreamData, UINT* pOffsetInBytes, UINT* pStride) override
+	{
+		return device->GetStreamSource(StreamNumber, ppStreamData, pOffsetInBytes, pStride);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetStreamSourceFreq(UINT StreamNumber, UINT Setting) override
+	{
+		return device->SetStreamSourceFreq(StreamNumber, Setting);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting) override
+	{
+		return device->GetStreamSourceFreq(StreamNumber, pSetting);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetIndices(IDirect3DIndexBuffer9* pIndexData) override
+	{
+		return hooks.SetIndices ? hooks.SetIndices(device, pIndexData) : device->SetIndices(pIndexData);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetIndices(IDirect3DIndexBuffer9** ppIndexData) override
+	{
+		return device->GetIndices(ppIndexData);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreatePixelShader(CONST DWORD* pFunction, IDirect3DPixelShader9** ppShader) override
+	{
+		return device->CreatePixelShader(pFunction, ppShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPixelShader(IDirect3DPixelShader9* pShader) override
+	{
+		return hooks.SetPixelShader ? hooks.SetPixelShader(device, pShader) : device->SetPixelShader(pShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPixelShader(IDirect3DPixelShader9** ppShader) override
+	{
+		return device->GetPixelShader(ppShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) override
+	{
+		return hooks.SetPixelShaderConstantF
+			? hooks.SetPixelShaderConstantF(device, StartRegister, pConstantData, Vector4fCount)
+			: device->SetPixelShaderConstantF(StartRegister, pConstantData, Vector4fCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) override
+	{
+		return device->GetPixelShaderConstantF(StartRegister, pConstantData, Vector4fCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) override
+	{
+		return device->SetPixelShaderConstantI(StartRegister, pConstantData, Vector4iCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) override
+	{
+		return device->GetPixelShaderConstantI(StartRegister, pConstantData, Vector4iCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) override
+	{
+		return hooks.SetPixelShaderConstantB
+			? hooks.SetPixelShaderConstantB(device, StartRegister, pConstantData, BoolCount)
+			: device->SetPixelShaderConstantB(StartRegister, pConstantData, BoolCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE GetPixelShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) override
+	{
+		return device->GetPixelShaderConstantB(StartRegister, pConstantData, BoolCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawRectPatch(UINT Handle, CONST float* pNumSegs, CONST D3DRECTPATCH_INFO* pRectPatchInfo) override
+	{
+		return device->DrawRectPatch(Handle, pNumSegs, pRectPatchInfo);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawTriPatch(UINT Handle, CONST float* pNumSegs, CONST D3DTRIPATCH_INFO* pTriPatchInfo) override
+	{
+		return device->DrawTriPatch(Handle, pNumSegs, pTriPatchInfo);
+	}
+
+	HRESULT STDMETHODCALLTYPE DeletePatch(UINT Handle) override
+	{
+		return device->DeletePatch(Handle);
+	}
+
+	HRESULT STDMETHODCALLTYPE CreateQuery(D3DQUERYTYPE Type, IDirect3DQuery9** ppQuery) override
+	{
+		return device->CreateQuery(Type, ppQuery);
+	}
+
+private:
+	// D3DRS_BLENDOPALPHA is the last render state.
+	static constexpr DWORD RENDER_STATE_COUNT = D3DRS_BLENDOPALPHA + 1;
+	// Vertex texture samplers aren't shadowed.
+	static constexpr DWORD SAMPLER_COUNT = 16;
+	static constexpr DWORD SAMPLER_STATE_COUNT = D3DSAMP_DMAPOFFSET + 1;
+
+	// Sampler of recorded render states.
+	static constexpr DWORD NO_SAMPLER = ~0u;
+
+	struct ShadowState
+	{
+		DWORD value;
+		bool valid;
+	};
+
+	// A render or sampler state set while recording a state block.
+	struct RecordedState
+	{
+		DWORD sampler;
+		DWORD type;
+		DWORD value;
+	};
+
+	class StateBlock;
+
+	// Forgets every shadowed state so the next set of each goes through.
+	void invalidate_state();
+	void record(DWORD sampler, DWORD type, DWORD value);
+
+	IDirect3DDevice9* const device;
+	std::atomic<ULONG> references { 1 };
+
+	// State changes go into the state block being recorded rather than the
+	// device, so nothing is shadowed or skipped in the meantime. They're
+	// kept for the block instead.
+	bool recording = false;
+	std::vector<RecordedState> recorded_states;
+
+	ShadowState render_states[RENDER_STATE_COUNT];
+	ShadowState sampler_states[SAMPLER_COUNT][SAMPLER_STATE_COUNT];
+};
@@ -0,0 +1,782 @@
+#include "stdafx.h"
+
+#include "DrawRecorder.h"
+
+DrawRecorder::~DrawRecorder()
+{
+	clear();
+}
+
+int DrawRecorder::sampler_slot(DWORD sampler)
+{
+	if (sampler < 16)
+	{
+		return static_cast<int>(sampler);
+	}
+
+	if (sampler >= D3DDMAPSAMPLER && sampler <= D3DVERTEXTEXTURESAMPLER3)
+	{
+		return static_cast<int>(16 + sampler - D3DDMAPSAMPLER);
+	}
+
+	return -1;
+}
+
+void DrawRecorder::push(std::vector<Command>& list, Op op, DWORD a, DWORD b, DWORD c, IUnknown* object)
+{
+	if (object != nullptr)
+	{
+		object->AddRef();
+	}
+
+	list.push_back({ op, a, b, c, object });
+}
+
+void DrawRecorder::clear()
+{
+	for (auto& it : saved)
+	{
+		if (it.object != nullptr)
+		{
+			it.object->Release();
+		}
+	}
+
+	for (auto& it : commands)
+	{
+		if (it.object != nullptr)
+		{
+			it.object->Release();
+		}
+	}
+
+	saved.clear();
+	commands.clear();
+	draws.clear();
+	floats.clear();
+	bools.clear();
+
+	saved_render_states.reset();
+	saved_sampler_states.reset();
+	saved_textures.reset();
+	saved_vertex_constants.reset();
+	saved_pixel_constants.reset();
+	saved_vertex_bools.reset();
+	saved_pixel_bools.reset();
+	saved_streams.reset();
+	saved_vertex_format = false;
+	saved_vertex_shader = false;
+	saved_pixel_shader = false;
+	saved_indices = false;
+}
+
+// Only draws deferred before a state's first change need its old value.
+bool DrawRecorder::save(Op op, DWORD a, DWORD b)
+{
+	if (draws.empty())
+	{
+		return true;
+	}
+
+	switch (op)
+	{
+		case Op::render_state:
+		{
+			DWORD value;
+
+			if (FAILED(device->GetRenderState(static_cast<D3DRENDERSTATETYPE>(a), &value)))
+			{
+				return false;
+			}
+
+			push(saved, op, a, value, 0, nullptr);
+			return true;
+		}
+
+		case Op::sampler_state:
+		{
+			DWORD value;
+
+			if (FAILED(device->GetSamplerState(a, static_cast<D3DSAMPLERSTATETYPE>(b), &value)))
+			{
+				return false;
+			}
+
+			push(saved, op, a, b, value, nullptr);
+			return true;
+		}
+
+		case Op::texture:
+		{
+			IDirect3DBaseTexture9* texture = nullptr;
+
+			if (FAILED(device->GetTexture(a, &texture)))
+			{
+				return false;
+			}
+
+			push(saved, op, a, 0, 0, texture);
+
+			if (texture != nullptr)
+			{
+				texture->Release();
+			}
+
+			return true;
+		}
+
+		case Op::fvf:
+		case Op::vertex_declaration:
+		{
+			// Setting either replaces the other, so both are saved as one.
+			DWORD fvf = 0;
+
+			if (SUCCEEDED(device->GetFVF(&fvf)) && fvf != 0)
+			{
+				push(saved, Op::fvf, fvf, 0, 0, nullptr);
+				return true;
+			}
+
+			IDirect3DVertexDeclaration9* declaration = nullptr;
+
+			if (FAILED(device->GetVertexDeclaration(&declaration)))
+			{
+				return false;
+			}
+
+			push(saved, Op::vertex_declaration, 0, 0, 0, declaration);
+
+			if (declaration != nullptr)
+			{
+				declaration->Release();
+			}
+
+			return true;
+		}
+
+		case Op::vertex_shader:
+		{
+			IDirect3DVertexShader9* shader = nullptr;
+
+			if (FAILED(device->GetVertexShader(&shader)))
+			{
+				return false;
+			}
+
+			push(saved, op, 0, 0, 0, shader);
+
+			if (shader != nullptr)
+			{
+				shader->Release();
+			}
+
+			return true;
+		}
+
+		case Op::pixel_shader:
+		{
+			IDirect3DPixelShader9* shader = nullptr;
+
+			if (FAILED(device->GetPixelShader(&shader)))
+			{
+				return false;
+			}
+
+			push(saved, op, 0, 0, 0, shader);
+
+			if (shader != nullptr)
+			{
+				shader->Release();
+			}
+
+			return true;
+		}
+
+		case Op::stream_source:
+		{
+			IDirect3DVertexBuffer9* buffer = nullptr;
+			UINT offset = 0;
+			UINT stride = 0;
+
+			if (FAILED(device->GetStreamSource(a, &buffer, &offset, &stride)))
+			{
+				return false;
+			}
+
+			push(saved, op, a, offset, stride, buffer);
+
+			if (buffer != nullptr)
+			{
+				buffer->Release();
+			}
+
+			return true;
+		}
+
+		case Op::indices:
+		{
+			IDirect3DIndexBuffer9* buffer = nullptr;
+
+			if (FAILED(device->GetIndices(&buffer)))
+			{
+				return false;
+			}
+
+			push(saved, op, 0, 0, 0, buffer);
+
+			if (buffer != nullptr)
+			{
+				buffer->Release();
+			}
+
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+// Saves the registers in [start, start + count) that haven't been yet, a run at a time.
+bool DrawRecorder::save_constants(Op op, UINT start, UINT count)
+{
+	const bool is_bool = op == Op::vertex_bools || op == Op::pixel_bools;
+
+	auto& bits = op == Op::vertex_constants ? saved_vertex_constants : saved_pixel_constants;
+	auto& bool_bits = op == Op::vertex_bools ? saved_vertex_bools : saved_pixel_bools;
+
+	const auto is_saved = [&](UINT i) -> bool
+	{
+		return is_bool ? bool_bits[i] : bits[i];
+	};
+
+	bool result = true;
+	UINT i = start;
+
+	while (i < start + count)
+	{
+		if (is_saved(i))
+		{
+			++i;
+			continue;
+		}
+
+		UINT end = i + 1;
+
+		while (end < start + count && !is_saved(end))
+		{
+			++end;
+		}
+
+		if (!draws.empty())
+		{
+			HRESULT hr;
+			DWORD offset;
+
+			if (is_bool)
+			{
+				offset = static_cast<DWORD>(bools.size());
+				bools.resize(bools.size() + (end - i));
+
+				hr = op == Op::vertex_bools
+					? device->GetVertexShaderConstantB(i, &bools[offset], end - i)
+					: device->GetPixelShaderConstantB(i, &bools[offset], end - i);
+			}
+			else
+			{
+				offset = static_cast<DWORD>(floats.size());
+				floats.resize(floats.size() + (end - i) * 4);
+
+				hr = op == Op::vertex_constants
+					? device->GetVertexShaderConstantF(i, &floats[offset], end - i)
+					: device->GetPixelShaderConstantF(i, &floats[offset], end - i);
+			}
+
+			if (FAILED(hr))
+			{
+				result = false;
+				break;
+			}
+
+			push(saved, op, i, end - i, offset, nullptr);
+		}
+
+		for (UINT j = i; j < end; j++)
+		{
+			if (is_bool)
+			{
+				bool_bits[j] = true;
+			}
+			else
+			{
+				bits[j] = true;
+			}
+		}
+
+		i = end;
+	}
+
+	return result;
+}
+
+void DrawRecorder::submit(const Command& command)
+{
+	switch (command.op)
+	{
+		case Op::render_state:
+			device->SetRenderState(static_cast<D3DRENDERSTATETYPE>(command.a), command.b);
+			break;
+
+		case Op::sampler_state:
+			device->SetSamplerState(command.a, static_cast<D3DSAMPLERSTATETYPE>(command.b), command.c);
+			break;
+
+		case Op::texture:
+			device->SetTexture(command.a, static_cast<IDirect3DBaseTexture9*>(command.object));
+			break;
+
+		case Op::vertex_declaration:
+			device->SetVertexDeclaration(static_cast<IDirect3DVertexDeclaration9*>(command.object));
+			break;
+
+		case Op::fvf:
+			device->SetFVF(command.a);
+			break;
+
+		case Op::vertex_shader:
+			device->SetVertexShader(static_cast<IDirect3DVertexShader9*>(command.object));
+			break;
+
+		case Op::pixel_shader:
+			device->SetPixelShader(static_cast<IDirect3DPixelShader9*>(command.object));
+			break;
+
+		case Op::vertex_constants:
+			device->SetVertexShaderConstantF(command.a, &floats[command.c], command.b);
+			break;
+
+		case Op::pixel_constants:
+			device->SetPixelShaderConstantF(command.a, &floats[command.c], command.b);
+			break;
+
+		case Op::vertex_bools:
+			device->SetVertexShaderConstantB(command.a, &bools[command.c], command.b);
+			break;
+
+		case Op::pixel_bools:
+			device->SetPixelShaderConstantB(command.a, &bools[command.c], command.b);
+			break;
+
+		case Op::stream_source:
+			device->SetStreamSource(command.a, static_cast<IDirect3DVertexBuffer9*>(command.object), command.b, command.c);
+			break;
+
+		case Op::indices:
+			device->SetIndices(static_cast<IDirect3DIndexBuffer9*>(command.object));
+			break;
+
+		case Op::draw:
+		{
+			const auto& it = draws[command.a];
+
+			if (callback != nullptr)
+			{
+				callback(it.tag);
+			}
+
+			const auto& draw = it.draw;
+
+			if (draw.indexed)
+			{
+				device->DrawIndexedPrimitive(draw.type, draw.base_vertex, draw.min_index, draw.vertex_count,
+					draw.start, draw.primitive_count);
+			}
+			else
+			{
+				device->DrawPrimitive(draw.type, draw.start, draw.primitive_count);
+			}
+
+			break;
+		}
+	}
+}
+
+void DrawRecorder::begin(IDirect3DDevice9* device, DrawCallback callback)
+{
+	clear();
+
+	this->device = device;
+	this->callback = callback;
+	is_recording = true;
+}
+
+void DrawRecorder::end()
+{
+	replay();
+
+	device = nullptr;
+	callback = nullptr;
+	is_recording = false;
+}
+
+void DrawRecorder::replay()
+{
+	if (!is_recording || is_replaying)
+	{
+		return;
+	}
+
+	if (!draws.empty())
+	{
+		is_replaying = true;
+
+		for (auto& it : saved)
+		{
+			submit(it);
+		}
+
+		for (auto& it : commands)
+		{
+			submit(it);
+		}
+
+		is_replaying = false;
+	}
+
+	clear();
+}
+
+bool DrawRecorder::recording() const
+{
+	return is_recording && !is_replaying;
+}
+
+bool DrawRecorder::replaying() const
+{
+	return is_replaying;
+}
+
+size_t DrawRecorder::pending() const
+{
+	return draws.size();
+}
+
+// Each setter below saves the state's old value on its first change. If that
+// fails, the draws that would need it are submitted before the change instead.
+
+void DrawRecorder::render_state(D3DRENDERSTATETYPE state, DWORD value)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (static_cast<DWORD>(state) >= RENDER_STATE_COUNT)
+	{
+		replay();
+		return;
+	}
+
+	if (!saved_render_states[state])
+	{
+		if (!save(Op::render_state, state, 0))
+		{
+			replay();
+		}
+
+		saved_render_states[state] = true;
+	}
+
+	push(commands, Op::render_state, state, value, 0, nullptr);
+}
+
+void DrawRecorder::sampler_state(DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	const int slot = sampler_slot(sampler);
+
+	if (slot < 0 || static_cast<DWORD>(type) >= SAMPLER_STATE_COUNT)
+	{
+		replay();
+		return;
+	}
+
+	const size_t index = slot * SAMPLER_STATE_COUNT + type;
+
+	if (!saved_sampler_states[index])
+	{
+		if (!save(Op::sampler_state, sampler, type))
+		{
+			replay();
+		}
+
+		saved_sampler_states[index] = true;
+	}
+
+	push(commands, Op::sampler_state, sampler, type, value, nullptr);
+}
+
+void DrawRecorder::texture(DWORD stage, IDirect3DBaseTexture9* texture)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	const int slot = sampler_slot(stage);
+
+	if (slot < 0)
+	{
+		replay();
+		return;
+	}
+
+	if (!saved_textures[slot])
+	{
+		if (!save(Op::texture, stage, 0))
+		{
+			replay();
+		}
+
+		saved_textures[slot] = true;
+	}
+
+	push(commands, Op::texture, stage, 0, 0, texture);
+}
+
+void DrawRecorder::vertex_declaration(IDirect3DVertexDeclaration9* declaration)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (!saved_vertex_format)
+	{
+		if (!save(Op::vertex_declaration, 0, 0))
+		{
+			replay();
+		}
+
+		saved_vertex_format = true;
+	}
+
+	push(commands, Op::vertex_declaration, 0, 0, 0, declaration);
+}
+
+void DrawRecorder::fvf(DWORD fvf)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (!saved_vertex_format)
+	{
+		if (!save(Op::fvf, 0, 0))
+		{
+			replay();
+		}
+
+		saved_vertex_format = true;
+	}
+
+	push(commands, Op::fvf, fvf, 0, 0, nullptr);
+}
+
+void DrawRecorder::vertex_shader(IDirect3DVertexShader9* shader)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (!saved_vertex_shader)
+	{
+		if (!save(Op::vertex_shader, 0, 0))
+		{
+			replay();
+		}
+
+		saved_vertex_shader = true;
+	}
+
+	push(commands, Op::vertex_shader, 0, 0, 0, shader);
+}
+
+void DrawRecorder::pixel_shader(IDirect3DPixelShader9* shader)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (!saved_pixel_shader)
+	{
+		if (!save(Op::pixel_shader, 0, 0))
+		{
+			replay();
+		}
+
+		saved_pixel_shader = true;
+	}
+
+	push(commands, Op::pixel_shader, 0, 0, 0, shader);
+}
+
+void DrawRecorder::vertex_constants(UINT start, const float* data, UINT count)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (start >= FLOAT_REGISTERS || count > FLOAT_REGISTERS - start)
+	{
+		replay();
+		return;
+	}
+
+	if (!save_constants(Op::vertex_constants, start, count))
+	{
+		replay();
+		save_constants(Op::vertex_constants, start, count);
+	}
+
+	const auto offset = static_cast<DWORD>(floats.size());
+	floats.insert(floats.end(), data, data + count * 4);
+	push(commands, Op::vertex_constants, start, count, offset, nullptr);
+}
+
+void DrawRecorder::pixel_constants(UINT start, const float* data, UINT count)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (start >= FLOAT_REGISTERS || count > FLOAT_REGISTERS - start)
+	{
+		replay();
+		return;
+	}
+
+	if (!save_constants(Op::pixel_constants, start, count))
+	{
+		replay();
+		save_constants(Op::pixel_constants, start, count);
+	}
+
+	const auto offset = static_cast<DWORD>(floats.size());
+	floats.insert(floats.end(), data, data + count * 4);
+	push(commands, Op::pixel_constants, start, count, offset, nullptr);
+}
+
+void DrawRecorder::vertex_bools(UINT start, const BOOL* data, UINT count)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (start >= BOOL_REGISTERS || count > BOOL_REGISTERS - start)
+	{
+		replay();
+		return;
+	}
+
+	if (!save_constants(Op::vertex_bools, start, count))
+	{
+		replay();
+		save_constants(Op::vertex_bools, start, count);
+	}
+
+	const auto offset = static_cast<DWORD>(bools.size());
+	bools.insert(bools.end(), data, data + count);
+	push(commands, Op::vertex_bools, start, count, offset, nullptr);
+}
+
+void DrawRecorder::pixel_bools(UINT start, const BOOL* data, UINT count)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (start >= BOOL_REGISTERS || count > BOOL_REGISTERS - start)
+	{
+		replay();
+		return;
+	}
+
+	if (!save_constants(Op::pixel_bools, start, count))
+	{
+		replay();
+		save_constants(Op::pixel_bools, start, count);
+	}
+
+	const auto offset = static_cast<DWORD>(bools.size());
+	bools.insert(bools.end(), data, data + count);
+	push(commands, Op::pixel_bools, start, count, offset, nullptr);
+}
+
+void DrawRecorder::stream_source(UINT stream, IDirect3DVertexBuffer9* buffer, UINT offset, UINT stride)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (stream >= STREAMS)
+	{
+		replay();
+		return;
+	}
+
+	if (!saved_streams[stream])
+	{
+		if (!save(Op::stream_source, stream, 0))
+		{
+			replay();
+		}
+
+		saved_streams[stream] = true;
+	}
+
+	push(commands, Op::stream_source, stream, offset, stride, buffer);
+}
+
+void DrawRecorder::indices(IDirect3DIndexBuffer9* buffer)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	if (!saved_indices)
+	{
+		if (!save(Op::indices, 0, 0))
+		{
+			replay();
+		}
+
+		saved_indices = true;
+	}
+
+	push(commands, Op::indices, 0, 0, 0, buffer);
+}
+
+void DrawRecorder::defer(const Draw& draw, uint32_t tag)
+{
+	if (!recording())
+	{
+		return;
+	}
+
+	push(commands, Op::draw, static_cast<DWORD>(draws.size()), 0, 0, nullptr);
+	draws.push_back({ draw, tag });
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <vector>
+#include <d3d9.h>
+
+// Holds draws back while the states they depend on keep changing, and
+// submits them later with the states they were made with. The depth
+// pre-pass uses it to draw the land table only once: opaque draws are
+// rendered depth only as they come and shaded at the end (see d3d.cpp).
+//
+// The recorder only knows what it's told. State changes are given to it
+// before they're forwarded to the device, which they still are; the first
+// change of each state also saves the value the device had. Deferred draws
+// are only recorded. replay puts the saved values back, then submits every
+// recorded change and draw in order, which leaves the device's states as
+// they were.
+//
+// Render and sampler states, textures, shaders, float and boolean
+// constants, the vertex format, stream sources and indices are recorded.
+// Anything else a deferred draw depends on must not change while recording;
+// a change the recorder can't represent or save submits the pending draws
+// first. Submitted calls go through the device given to begin, so its hooks
+// have to pass them on unchanged while replaying.
+class DrawRecorder
+{
+public:
+	struct Draw
+	{
+		bool indexed;
+		D3DPRIMITIVETYPE type;
+		INT base_vertex;      // Indexed draws only.
+		UINT min_index;       // Indexed draws only.
+		UINT vertex_count;    // Indexed draws only.
+		UINT start;           // Start index, or start vertex.
+		UINT primitive_count;
+	};
+
+	// Called before a deferred draw is submitted, with the tag it was deferred with.
+	using DrawCallback = void (*)(uint32_t tag);
+
+	DrawRecorder() = default;
+	DrawRecorder(const DrawRecorder&) = delete;
+	DrawRecorder& operator=(const DrawRecorder&) = delete;
+	~DrawRecorder();
+
+	void begin(IDirect3DDevice9* device, DrawCallback callback = nullptr);
+	// Submits the pending draws and stops recording.
+	void end();
+	// Submits the pending draws and starts over. Does nothing without any.
+	void replay();
+
+	bool recording() const;
+	bool replaying() const;
+	// Draws deferred since the last replay.
+	size_t pending() const;
+
+	void render_state(D3DRENDERSTATETYPE state, DWORD value);
+	void sampler_state(DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value);
+	void texture(DWORD stage, IDirect3DBaseTexture9* texture);
+	void vertex_declaration(IDirect3DVertexDeclaration9* declaration);
+	void fvf(DWORD fvf);
+	void vertex_shader(IDirect3DVertexShader9* shader);
+	void pixel_shader(IDirect3DPixelShader9* shader);
+	void vertex_constants(UINT start, const float* data, UINT count);
+	void pixel_constants(UINT start, const float* data, UINT count);
+	void vertex_bools(UINT start, const BOOL* data, UINT count);
+	void pixel_bools(UINT start, const BOOL* data, UINT count);
+	void stream_source(UINT stream, IDirect3DVertexBuffer9* buffer, UINT offset, UINT stride);
+	void indices(IDirect3DIndexBuffer9* buffer);
+
+	// Records a draw without submitting it.
+	void defer(const Draw& draw, uint32_t tag);
+
+private:
+	static constexpr DWORD RENDER_STATE_COUNT  = D3DRS_BLENDOPALPHA + 1;
+	// Pixel samplers, the displacement map sampler and the vertex samplers.
+	static constexpr DWORD SAMPLER_SLOTS       = 21;
+	static constexpr DWORD SAMPLER_STATE_COUNT = D3DSAMP_DMAPOFFSET + 1;
+	static constexpr UINT  FLOAT_REGISTERS     = 256;
+	static constexpr UINT  BOOL_REGISTERS      = 16;
+	static constexpr UINT  STREAMS             = 16;
+
+	enum class Op : uint8_t
+	{
+		render_state,
+		sampler_state,
+		texture,
+		vertex_declaration,
+		fvf,
+		vertex_shader,
+		pixel_shader,
+		vertex_constants,
+		pixel_constants,
+		vertex_bools,
+		pixel_bools,
+		stream_source,
+		indices,
+		draw
+	};
+
+	// Arguments by op: a state, sampler, stage, first register or stream in a;
+	// then the value, sampler state type, register count or offset in b and c.
+	// Constants are stored in floats or bools, starting at c. object holds a
+	// reference of its own.
+	struct Command
+	{
+		Op op;
+		DWORD a;
+		DWORD b;
+		DWORD c;
+		IUnknown* object;
+	};
+
+	struct DeferredDraw
+	{
+		Draw draw;
+		uint32_t tag;
+	};
+
+	static int sampler_slot(DWORD sampler);
+
+	void push(std::vector<Command>& list, Op op, DWORD a, DWORD b, DWORD c, IUnknown* object);
+	// Saves the value of a state before its first change since the last replay.
+	// Returns false if the change can't be recorded.
+	bool save(Op op, DWORD a, DWORD b);
+	bool save_constants(Op op, UINT start, UINT count);
+	void submit(const Command& command);
+	void clear();
+
+	IDirect3DDevice9* device = nullptr;
+	DrawCallback callback = nullptr;
+	bool is_recording = false;
+	bool is_replaying = false;
+
+	// Values from before the first change of each state, put back first.
+	std::vector<Command> saved;
+	std::vector<Command> commands;
+	std::vector<DeferredDraw> draws;
+	std::vector<float> floats;
+	std::vector<BOOL> bools;
+
+	std::bitset<RENDER_STATE_COUNT> saved_render_states;
+	std::bitset<SAMPLER_SLOTS * SAMPLER_STATE_COUNT> saved_sampler_states;
+	std::bitset<SAMPLER_SLOTS> saved_textures;
+	std::bitset<FLOAT_REGISTERS> saved_vertex_constants;
+	std::bitset<FLOAT_REGISTERS> saved_pixel_constants;
+	std::bitset<BOOL_REGISTERS> saved_vertex_bools;
+	std::bitset<BOOL_REGISTERS> saved_pixel_bools;
+	std::bitset<STREAMS> saved_streams;
+	bool saved_vertex_format = false;
+	bool saved_vertex_shader = false;
+	bool saved_pixel_shader = false;
+	bool saved_indices = false;
+};
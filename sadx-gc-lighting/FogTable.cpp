@@ -0,0 +1,131 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "FogTable.h"
+
+namespace fog_table
+{
+	void config(const Fog& fog, float (&out)[4])
+	{
+		// linear: (end - d) / (end - start) = d * x + y
+		// exp:    1 / e^(d * density)       = exp2(d * z)
+		// exp2:   1 / e^((d * density)^2)   = exp2(d * d * w)
+		constexpr float LOG2_E = 1.44269504f;
+
+		float range = fog.end - fog.start;
+		if (fabsf(range) < FLT_EPSILON)
+		{
+			range = FLT_EPSILON;
+		}
+
+		out[0] = -1.0f / range;
+		out[1] = fog.end / range;
+		out[2] = -fog.density * LOG2_E;
+		out[3] = -fog.density * fog.density * LOG2_E;
+	}
+
+	float visibility(const Fog& fog, float d)
+	{
+		float folded[4];
+		config(fog, folded);
+
+		float result;
+
+		switch (fog.mode)
+		{
+			case Mode_Exp:
+				result = exp2f(d * folded[2]);
+				break;
+
+			case Mode_Exp2:
+				result = exp2f(d * d * folded[3]);
+				break;
+
+			default:
+				result = d * folded[0] + folded[1];
+				break;
+		}
+
+		return fminf(fmaxf(result, 0.0f), 1.0f);
+	}
+
+	float distance(const Fog& fog)
+	{
+		constexpr float LN_255 = 5.54126354f;
+
+		switch (fog.mode)
+		{
+			case Mode_Exp:
+				return fog.density > 0.0f ? LN_255 / fog.density : 0.0f;
+
+			case Mode_Exp2:
+				return fog.density > 0.0f ? sqrtf(LN_255) / fog.density : 0.0f;
+
+			default:
+				return fmaxf(fog.end, 0.0f);
+		}
+	}
+
+	void scale(float distance, float (&out)[2])
+	{
+		out[0] = (1.0f - 1.0f / SIZE) / distance;
+		out[1] = 0.5f / SIZE;
+	}
+
+	// The game's table resampled at view distance d, as visibility.
+	static float sample(const Fog& fog, const float* table, float value_scale, bool visibility, float d)
+	{
+		float start = 0.0f;
+		float length = distance(fog);
+
+		if (fog.mode != Mode_Exp && fog.mode != Mode_Exp2)
+		{
+			start = fog.start;
+			length = fog.end - fog.start;
+		}
+
+		const float t = length > FLT_EPSILON ? (d - start) / length : (d < start ? 0.0f : 1.0f);
+		const float x = fminf(fmaxf(t, 0.0f), 1.0f) * (SIZE - 1);
+		const auto i = (std::min)(static_cast<uint32_t>(x), SIZE - 2);
+		const float f = x - static_cast<float>(i);
+
+		float value = (table[i] + (table[i + 1] - table[i]) * f) * value_scale;
+		value = fminf(fmaxf(value, 0.0f), 1.0f);
+
+		return visibility ? value : 1.0f - value;
+	}
+
+	void build(const Fog& fog, const float* game_table, uint8_t (&texels)[SIZE])
+	{
+		const float covered = distance(fog);
+
+		float value_scale = 1.0f;
+		bool visibility = true;
+
+		if (game_table != nullptr)
+		{
+			float max_value = 0.0f;
+			for (uint32_t i = 0; i < SIZE; i++)
+			{
+				max_value = fmaxf(max_value, game_table[i]);
+			}
+
+			value_scale = max_value > 1.0f ? 1.0f / 255.0f : 1.0f;
+			visibility = game_table[0] >= game_table[SIZE - 1];
+		}
+
+		for (uint32_t i = 0; i < SIZE; i++)
+		{
+			// Texel centers, as mapped by scale.
+			const float d = covered * static_cast<float>(i) / (SIZE - 1);
+			const float value = game_table != nullptr
+				? sample(fog, game_table, value_scale, visibility, d)
+				: fog_table::visibility(fog, d);
+
+			texels[i] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+// Contents of the fog table texture that CalcFogFactor samples in place of
+// the fog formula. Kept free of Windows and Direct3D dependencies so it can
+// be checked against the shader reference.
+
+namespace fog_table
+{
+	// Entries in NJS_FOG_TABLE and texels in the texture.
+	constexpr uint32_t SIZE = 128;
+
+	// Same values as D3DFOGMODE.
+	enum Mode : uint32_t
+	{
+		Mode_None,
+		Mode_Exp,
+		Mode_Exp2,
+		Mode_Linear
+	};
+
+	// The fog states the game set. Any mode other than exp and exp2 uses
+	// the linear formula.
+	struct Fog
+	{
+		Mode mode;
+		float start;
+		float end;
+		float density;
+	};
+
+	// FogConfig in shader.hlsl: the fog formula folded so the shaders
+	// don't need a divide or pow per pixel.
+	void config(const Fog& fog, float (&out)[4]);
+
+	// The fog formula's visibility at view distance d.
+	float visibility(const Fog& fog, float d);
+
+	// The view distance the table covers from 0: the fog end for linear fog,
+	// or where visibility falls below 1/255 for exponential fog. 0 if there
+	// is no fog range to cover.
+	float distance(const Fog& fog);
+
+	// FogTableScale in shader.hlsl for a table covering distance: x maps
+	// view distances to texel centers, y is half a texel.
+	void scale(float distance, float (&out)[2]);
+
+	// Fills texels with visibility at the view distances they cover.
+	// game_table, if not null, is the game's NJS_FOG_TABLE, which spans the
+	// fog range: start to end for linear fog. Its entries are either 0-1 or
+	// 0-255 and either fog density or visibility, as detected from its
+	// contents. Without it, the fog formula is used.
+	void build(const Fog& fog, const float* game_table, uint8_t (&texels)[SIZE]);
+}
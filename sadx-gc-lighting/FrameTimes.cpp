@@ -0,0 +1,190 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "FrameTimes.h"
+
+// Weight of the current frame in the running draw and upload averages.
+static constexpr float AVERAGE_WEIGHT = 1.0f / 64.0f;
+
+static uint32_t floor_log2(uint32_t value)
+{
+	uint32_t result = 0;
+
+	while (value >>= 1)
+	{
+		++result;
+	}
+
+	return result;
+}
+
+uint32_t FrameHistogram::bucket_index(uint32_t us)
+{
+	us = (std::min)(us, (2u << MAX_EXPONENT) - 1);
+
+	if (us < SUB_BUCKETS)
+	{
+		return us;
+	}
+
+	const auto exponent = floor_log2(us);
+	const auto shift = exponent - SUB_BUCKET_BITS;
+	return (shift + 1) * SUB_BUCKETS + ((us >> shift) - SUB_BUCKETS);
+}
+
+uint32_t FrameHistogram::bucket_upper_bound(uint32_t index)
+{
+	if (index < SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	const auto shift = index / SUB_BUCKETS - 1;
+	const auto lower = (index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+	return lower + (1u << shift) - 1;
+}
+
+void FrameHistogram::record(uint32_t us)
+{
+	++buckets[bucket_index(us)];
+	++total;
+	highest = (std::max)(highest, us);
+}
+
+void FrameHistogram::reset()
+{
+	std::fill(std::begin(buckets), std::end(buckets), 0);
+	total = 0;
+	highest = 0;
+}
+
+uint64_t FrameHistogram::count() const
+{
+	return total;
+}
+
+uint32_t FrameHistogram::max() const
+{
+	return highest;
+}
+
+uint32_t FrameHistogram::percentile(double p) const
+{
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	p = (std::max)(0.0, (std::min)(1.0, p));
+	const auto target = (std::max)(static_cast<uint64_t>(1), static_cast<uint64_t>(ceil(p * static_cast<double>(total))));
+
+	uint64_t seen = 0;
+
+	for (uint32_t i = 0; i < BUCKET_COUNT; i++)
+	{
+		seen += buckets[i];
+
+		if (seen >= target)
+		{
+			return (std::min)(bucket_upper_bound(i), highest);
+		}
+	}
+
+	return highest;
+}
+
+HitchLog::HitchLog(size_t capacity)
+	: capacity(capacity)
+{
+}
+
+bool HitchLog::add(const FrameActivity& activity, uint32_t budget_us, HitchRecord& out)
+{
+	if (!has_average)
+	{
+		average_draws = static_cast<float>(activity.draws);
+		average_constant_bytes = static_cast<float>(activity.constant_bytes);
+		has_average = true;
+	}
+
+	const bool hitch = budget_us > 0 && activity.us > budget_us;
+
+	if (hitch)
+	{
+		uint32_t causes = HitchRecord::None;
+
+		if (activity.shader_compiles)
+		{
+			causes |= HitchRecord::ShaderCompile;
+		}
+
+		if (activity.shader_cache_loads)
+		{
+			causes |= HitchRecord::CacheLoad;
+		}
+
+		if (activity.device_resets)
+		{
+			causes |= HitchRecord::DeviceReset;
+		}
+
+		if (static_cast<float>(activity.draws) > average_draws * SPIKE_FACTOR)
+		{
+			causes |= HitchRecord::DrawSpike;
+		}
+
+		if (static_cast<float>(activity.constant_bytes) > average_constant_bytes * SPIKE_FACTOR)
+		{
+			causes |= HitchRecord::UploadSpike;
+		}
+
+		out = { activity, causes, average_draws, average_constant_bytes };
+
+		if (capacity > 0)
+		{
+			if (log.size() >= capacity)
+			{
+				log.pop_front();
+			}
+
+			log.push_back(out);
+		}
+	}
+
+	average_draws += (static_cast<float>(activity.draws) - average_draws) * AVERAGE_WEIGHT;
+	average_constant_bytes += (static_cast<float>(activity.constant_bytes) - average_constant_bytes) * AVERAGE_WEIGHT;
+
+	return hitch;
+}
+
+void HitchLog::clear()
+{
+	log.clear();
+	has_average = false;
+}
+
+const std::deque<HitchRecord>& HitchLog::records() const
+{
+	return log;
+}
+
+const char* HitchLog::cause_name(uint32_t cause)
+{
+	switch (cause)
+	{
+		case HitchRecord::ShaderCompile:
+			return "shader compile";
+		case HitchRecord::CacheLoad:
+			return "shader cache load";
+		case HitchRecord::DeviceReset:
+			return "device reset";
+		case HitchRecord::DrawSpike:
+			return "draw spike";
+		case HitchRecord::UploadSpike:
+			return "upload spike";
+		default:
+			return "unknown";
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+// Frame time aggregation. Kept free of Windows and Direct3D dependencies so it
+// can be fed synthetic timings outside of the game.
+
+// Log-linear histogram of frame times in microseconds, in the style of
+// HdrHistogram: every power of two is split into SUB_BUCKETS linear buckets,
+// so a reported percentile is within 1/SUB_BUCKETS of the recorded value.
+class FrameHistogram
+{
+public:
+	static constexpr uint32_t SUB_BUCKET_BITS = 5;
+	static constexpr uint32_t SUB_BUCKETS     = 1 << SUB_BUCKET_BITS;
+	// Frames longer than 2^MAX_EXPONENT microseconds (~67 seconds) are clamped.
+	static constexpr uint32_t MAX_EXPONENT    = 26;
+	static constexpr uint32_t BUCKET_COUNT    = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+	void record(uint32_t us);
+	void reset();
+
+	uint64_t count() const;
+	uint32_t max() const;
+
+	// Returns the smallest recorded value that at least p (0-1) of all
+	// frames are less than or equal to, rounded up to its bucket.
+	uint32_t percentile(double p) const;
+
+	static uint32_t bucket_index(uint32_t us);
+	static uint32_t bucket_upper_bound(uint32_t index);
+
+private:
+	uint32_t buckets[BUCKET_COUNT] {};
+	uint64_t total = 0;
+	uint32_t highest = 0;
+};
+
+// Everything noteworthy that happened during a single frame.
+struct FrameActivity
+{
+	uint32_t frame;
+	uint32_t us;
+	uint32_t shader_compiles;
+	uint32_t shader_cache_loads;
+	uint32_t device_resets;
+	uint32_t draws;
+	uint32_t constant_bytes;
+};
+
+struct HitchRecord
+{
+	enum Cause : uint32_t
+	{
+		None          = 0,
+		ShaderCompile = 1 << 0,
+		CacheLoad     = 1 << 1,
+		DeviceReset   = 1 << 2,
+		DrawSpike     = 1 << 3,
+		UploadSpike   = 1 << 4,
+	};
+
+	FrameActivity activity;
+	uint32_t causes;
+
+	// Running averages at the time of the hitch, for comparison.
+	float average_draws;
+	float average_constant_bytes;
+};
+
+// Captures frames over budget, keeping only the most recent records.
+class HitchLog
+{
+public:
+	// Draw or upload counts this many times above their running average are
+	// reported as a spike.
+	static constexpr float SPIKE_FACTOR = 2.0f;
+
+	explicit HitchLog(size_t capacity = 256);
+
+	// Returns true and fills out if the frame went over budget.
+	// A budget of 0 disables capturing.
+	bool add(const FrameActivity& activity, uint32_t budget_us, HitchRecord& out);
+	void clear();
+
+	const std::deque<HitchRecord>& records() const;
+
+	static const char* cause_name(uint32_t cause);
+
+private:
+	size_t capacity;
+	std::deque<HitchRecord> log;
+
+	bool has_average = false;
+	float average_draws = 0.0f;
+	float average_constant_bytes = 0.0f;
+};
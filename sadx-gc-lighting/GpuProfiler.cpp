@@ -0,0 +1,172 @@
+#include "stdafx.h"
+
+#include <vector>
+
+#include "GpuProfiler.h"
+
+GpuProfiler::GpuProfiler(ITimestampSource* source)
+	: source(source)
+{
+	for (auto& frame : frame_slots)
+	{
+		frame.runs.reserve(MAX_TIMESTAMPS);
+	}
+}
+
+void GpuProfiler::begin_frame()
+{
+	auto& frame = frame_slots[slot];
+	has_key = false;
+
+	// The slot is still waiting on the GPU; skip this frame instead of stalling.
+	if (frame.pending && !resolve(frame, slot))
+	{
+		++skipped;
+		active = false;
+		return;
+	}
+
+	frame.pending = false;
+	frame.timestamps = 0;
+	frame.runs.clear();
+
+	active = source->begin_frame(slot);
+}
+
+void GpuProfiler::end_frame()
+{
+	if (!active)
+	{
+		return;
+	}
+
+	auto& frame = frame_slots[slot];
+
+	// Closes the last run.
+	if (!frame.runs.empty())
+	{
+		source->timestamp(slot, frame.timestamps++);
+	}
+
+	source->end_frame(slot);
+
+	frame.pending = true;
+	active = false;
+	slot = (slot + 1) % FRAME_LATENCY;
+}
+
+void GpuProfiler::mark(uint32_t key)
+{
+	if (!active || (has_key && key == current_key))
+	{
+		return;
+	}
+
+	auto& frame = frame_slots[slot];
+
+	// One timestamp is kept for closing the last run.
+	if (frame.timestamps >= MAX_TIMESTAMPS - 1)
+	{
+		return;
+	}
+
+	source->timestamp(slot, frame.timestamps);
+	frame.runs.push_back({ key, frame.timestamps });
+	++frame.timestamps;
+
+	has_key = true;
+	current_key = key;
+}
+
+void GpuProfiler::reset()
+{
+	for (auto& frame : frame_slots)
+	{
+		frame.pending = false;
+		frame.timestamps = 0;
+		frame.runs.clear();
+	}
+
+	slot = 0;
+	active = false;
+	has_key = false;
+}
+
+void GpuProfiler::clear()
+{
+	permutation_totals.clear();
+	accumulated_us = 0.0;
+	resolved_frames = 0;
+	skipped = 0;
+}
+
+const std::map<uint32_t, GpuProfiler::Totals>& GpuProfiler::totals() const
+{
+	return permutation_totals;
+}
+
+double GpuProfiler::total_us() const
+{
+	return accumulated_us;
+}
+
+uint64_t GpuProfiler::frames() const
+{
+	return resolved_frames;
+}
+
+uint64_t GpuProfiler::skipped_frames() const
+{
+	return skipped;
+}
+
+bool GpuProfiler::resolve(Frame& frame, size_t frame_slot)
+{
+	uint64_t frequency = 0;
+	bool disjoint = false;
+
+	if (!source->frame_data(frame_slot, frequency, disjoint))
+	{
+		return false;
+	}
+
+	// The GPU clock changed during the frame, or there is nothing to read.
+	if (disjoint || frequency == 0 || frame.runs.empty())
+	{
+		return true;
+	}
+
+	uint64_t ticks[MAX_TIMESTAMPS];
+
+	for (size_t i = 0; i < frame.timestamps; i++)
+	{
+		if (!source->timestamp_data(frame_slot, i, ticks[i]))
+		{
+			return false;
+		}
+	}
+
+	const double to_us = 1000000.0 / static_cast<double>(frequency);
+
+	for (size_t i = 0; i < frame.runs.size(); i++)
+	{
+		const auto& run = frame.runs[i];
+		const auto end = i + 1 < frame.runs.size() ? frame.runs[i + 1].index : frame.timestamps - 1;
+
+		// Zero means the timestamp could not be issued.
+		if (ticks[run.index] == 0 || ticks[end] < ticks[run.index])
+		{
+			continue;
+		}
+
+		const double us = static_cast<double>(ticks[end] - ticks[run.index]) * to_us;
+
+		auto& totals = permutation_totals[run.key];
+		totals.us += us;
+		++totals.runs;
+		accumulated_us += us;
+	}
+
+	++resolved_frames;
+	return true;
+}
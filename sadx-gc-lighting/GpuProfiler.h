@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Source of GPU timestamps, split out so the profiler's scheduling and
+// resolution can be driven without a GPU. Every frame uses one of
+// GpuProfiler::FRAME_LATENCY slots, each with up to MAX_TIMESTAMPS timestamps.
+class ITimestampSource
+{
+public:
+	virtual ~ITimestampSource() = default;
+
+	// Starts a frame in the given slot. Returns false if it can't be profiled.
+	virtual bool begin_frame(size_t slot) = 0;
+	virtual void end_frame(size_t slot) = 0;
+	virtual void timestamp(size_t slot, size_t index) = 0;
+
+	// These must not block. They return false if the data isn't available yet.
+	// disjoint is set if the timestamps of the frame can't be compared.
+	virtual bool frame_data(size_t slot, uint64_t& frequency, bool& disjoint) = 0;
+	virtual bool timestamp_data(size_t slot, size_t index, uint64_t& ticks) = 0;
+};
+
+// Brackets runs of draws that share a shader permutation with GPU timestamps
+// and accumulates the time between them per permutation. Frames are resolved
+// FRAME_LATENCY frames later; if their results still aren't available, new
+// frames go unprofiled rather than waiting on the GPU.
+class GpuProfiler
+{
+public:
+	static constexpr size_t FRAME_LATENCY  = 4;
+	static constexpr size_t MAX_TIMESTAMPS = 1024;
+
+	struct Totals
+	{
+		double   us = 0.0;
+		uint64_t runs = 0;
+	};
+
+	explicit GpuProfiler(ITimestampSource* source);
+
+	void begin_frame();
+	void end_frame();
+
+	// Starts a run of draws using the given permutation. Does nothing if it
+	// is the permutation of the current run.
+	void mark(uint32_t key);
+
+	// Discards frames in flight, e.g. when the device is lost.
+	void reset();
+	// Clears the accumulated totals.
+	void clear();
+
+	const std::map<uint32_t, Totals>& totals() const;
+	double total_us() const;
+	uint64_t frames() const;
+	uint64_t skipped_frames() const;
+
+private:
+	struct Run
+	{
+		uint32_t key;
+		size_t   index; // Timestamp that starts the run.
+	};
+
+	struct Frame
+	{
+		bool pending = false;
+		size_t timestamps = 0;
+		std::vector<Run> runs;
+	};
+
+	bool resolve(Frame& frame, size_t frame_slot);
+
+	ITimestampSource* source;
+	Frame frame_slots[FRAME_LATENCY];
+	size_t slot = 0;
+	bool active = false;
+	bool has_key = false;
+	uint32_t current_key = 0;
+
+	std::map<uint32_t, Totals> permutation_totals;
+	double accumulated_us = 0.0;
+	uint64_t resolved_frames = 0;
+	uint64_t skipped = 0;
+};
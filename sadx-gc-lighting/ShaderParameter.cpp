@@ -1,7 +1,26 @@
 #include "stdafx.h"
 #include "ShaderParameter.h"
 
-std::vector<IShaderParameter*> IShaderParameter::values_assigned {};
+std::vector<IShaderParameter*> IShaderParameter::values_assigned = []
+{
+	std::vector<IShaderParameter*> result;
+	result.reserve(MAX_ASSIGNED);
+	return result;
+}();
+IShaderParameter::AssignCallback IShaderParameter::on_assign = nullptr;
+
+void IShaderParameter::upload(IDirect3DDevice9* device, Type::T type, int index, const float* data, UINT count)
+{
+	if (type & Type::vertex)
+	{
+		device->SetVertexShaderConstantF(index, data, count);
+	}
+
+	if (type & Type::pixel)
+	{
+		device->SetPixelShaderConstantF(index, data, count);
+	}
+}
 
 template <>
 bool ShaderParameter<bool>::commit(IDirect3DDevice9* device)
@@ -11,15 +30,7 @@ bool ShaderParameter<bool>::commit(IDirect3DDevice9* device)
 		const auto f = current ? 1.0f : 0.0f;
 		float buffer[4] = { f, f, f, f };
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, buffer, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, buffer, 1);
-		}
+		upload(device, type, index, buffer, 1);
 
 		clear();
 		return true;
@@ -37,15 +48,7 @@ bool ShaderParameter<int>::commit(IDirect3DDevice9* device)
 		const auto f = static_cast<float>(current);
 		float buffer[4] = { f, f, f, f };
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, buffer, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, buffer, 1);
-		}
+		upload(device, type, index, buffer, 1);
 
 		clear();
 		return true;
@@ -62,15 +65,7 @@ bool ShaderParameter<float>::commit(IDirect3DDevice9* device)
 	{
 		D3DXVECTOR4 value = { current, current, current, current };
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, value, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, value, 1);
-		}
+		upload(device, type, index, value, 1);
 
 		clear();
 		return true;
@@ -85,15 +80,7 @@ bool ShaderParameter<D3DXVECTOR4>::commit(IDirect3DDevice9* device)
 {
 	if (is_modified())
 	{
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, current, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, current, 1);
-		}
+		upload(device, type, index, current, 1);
 
 		clear();
 		return true;
@@ -110,15 +97,7 @@ bool ShaderParameter<D3DXVECTOR3>::commit(IDirect3DDevice9* device)
 	{
 		D3DXVECTOR4 value = { current.x, current.y, current.z, 0.0f };
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, value, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, value, 1);
-		}
+		upload(device, type, index, value, 1);
 
 		clear();
 		return true;
@@ -135,15 +114,7 @@ bool ShaderParameter<D3DXVECTOR2>::commit(IDirect3DDevice9* device)
 	{
 		D3DXVECTOR4 value = { current.x, current.y, 0.0f, 1.0f };
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, value, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, value, 1);
-		}
+		upload(device, type, index, value, 1);
 
 		clear();
 		return true;
@@ -160,15 +131,7 @@ bool ShaderParameter<D3DXCOLOR>::commit(IDirect3DDevice9* device)
 	{
 		static_assert(sizeof(D3DXCOLOR) == sizeof(D3DXVECTOR4), "D3DXCOLOR size does not match D3DXVECTOR4.");
 
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, current, 1);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, current, 1);
-		}
+		upload(device, type, index, current, 1);
 
 		clear();
 		return true;
@@ -183,15 +146,7 @@ bool ShaderParameter<D3DXMATRIX>::commit(IDirect3DDevice9* device)
 {
 	if (is_modified())
 	{
-		if (type & Type::vertex)
-		{
-			device->SetVertexShaderConstantF(index, current, 4);
-		}
-
-		if (type & Type::pixel)
-		{
-			device->SetPixelShaderConstantF(index, current, 4);
-		}
+		upload(device, type, index, current, 4);
 
 		clear();
 		return true;
@@ -231,3 +186,16 @@ void ShaderParameter<Texture>::release()
 	current = nullptr;
 	last = nullptr;
 }
+
+// Textures are bound rather than uploaded as constants.
+template <>
+UINT ShaderParameter<Texture>::upload_calls() const
+{
+	return 0;
+}
+
+template <>
+UINT ShaderParameter<Texture>::upload_bytes() const
+{
+	return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <type_traits>
 #include <vector>
 #include <atlbase.h>
 #include <d3d9.h>
@@ -9,6 +10,10 @@ using VertexShader = CComPtr<IDirect3DVertexShader9>;
 using PixelShader  = CComPtr<IDirect3DPixelShader9>;
 using Buffer       = CComPtr<ID3DXBuffer>;
 using Texture      = CComPtr<IDirect3DTexture9>;
+using VertexBuffer = CComPtr<IDirect3DVertexBuffer9>;
+using IndexBuffer  = CComPtr<IDirect3DIndexBuffer9>;
+using Query        = CComPtr<IDirect3DQuery9>;
+using StateBlock   = CComPtr<IDirect3DStateBlock9>;
 
 class IShaderParameter
 {
@@ -24,14 +29,31 @@ public:
 		};
 	};
 
+	// Every parameter is in here at most once, so this never grows past
+	// the number of parameters; enough room is reserved up front.
+	static constexpr size_t MAX_ASSIGNED = 128;
 	static std::vector<IShaderParameter*> values_assigned;
 
+	// Called with every assigned value if set. sampler is true for textures,
+	// in which case the value is the texture pointer.
+	using AssignCallback = void(*)(int index, Type::T type, bool sampler, const void* data, size_t size);
+	static AssignCallback on_assign;
+
 	virtual ~IShaderParameter() = default;
 	virtual bool is_modified() = 0;
 	virtual void clear() = 0;
 	virtual bool commit(IDirect3DDevice9* device) = 0;
 	virtual bool commit_now(IDirect3DDevice9* device) = 0;
 	virtual void release() = 0;
+	// Calls callback with the current value, the same way on_assign is called.
+	virtual void describe(AssignCallback callback) const = 0;
+
+	// Constant upload calls and bytes that a commit results in.
+	virtual UINT upload_calls() const = 0;
+	virtual UINT upload_bytes() const = 0;
+
+protected:
+	static void upload(IDirect3DDevice9* device, Type::T type, int index, const float* data, UINT count);
 };
 
 template<typename T>
@@ -59,6 +81,9 @@ public:
 	bool commit(IDirect3DDevice9* device) override;
 	bool commit_now(IDirect3DDevice9* device) override;
 	void release() override;
+	void describe(AssignCallback callback) const override;
+	UINT upload_calls() const override;
+	UINT upload_bytes() const override;
 	T value() const;
 	ShaderParameter<T>& operator=(const T& value);
 	ShaderParameter<T>& operator=(const ShaderParameter<T>& value);
@@ -90,6 +115,26 @@ void ShaderParameter<T>::release()
 {
 	clear();
 }
+
+template <typename T>
+void ShaderParameter<T>::describe(AssignCallback callback) const
+{
+	callback(index, type, std::is_same<T, Texture>::value, &current, sizeof(T));
+}
+
+template <typename T>
+UINT ShaderParameter<T>::upload_calls() const
+{
+	return (type & Type::vertex ? 1 : 0) + (type & Type::pixel ? 1 : 0);
+}
+
+template <typename T>
+UINT ShaderParameter<T>::upload_bytes() const
+{
+	// Constants are uploaded in whole registers.
+	return upload_calls() * static_cast<UINT>((sizeof(T) + 15) / 16 * 16);
+}
+
 template <typename T>
 T ShaderParameter<T>::value() const
 {
@@ -106,6 +151,12 @@ ShaderParameter<T>& ShaderParameter<T>::operator=(const T& value)
 
 	assigned = true;
 	current = value;
+
+	if (on_assign)
+	{
+		on_assign(index, type, std::is_same<T, Texture>::value, &current, sizeof(T));
+	}
+
 	return *this;
 }
 
@@ -126,3 +177,5 @@ template<> bool ShaderParameter<D3DXCOLOR>::commit(IDirect3DDevice9* device);
 template<> bool ShaderParameter<D3DXMATRIX>::commit(IDirect3DDevice9* device);
 template<> bool ShaderParameter<Texture>::commit(IDirect3DDevice9* device);
 template<> void ShaderParameter<Texture>::release();
+template<> UINT ShaderParameter<Texture>::upload_calls() const;
+template<> UINT ShaderParameter<Texture>::upload_bytes() const;
@@ -0,0 +1,483 @@
+#include "stdafx.h"
+
+#include <xmmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "ShaderReference.h"
+#include "ShaderSelection.h"
+
+using namespace shader_reference;
+
+static constexpr size_t LANES = 4;
+
+// Four lanes of a float4, one vertex or pixel per lane.
+struct Vec4
+{
+	__m128 x, y, z, w;
+};
+
+using Registers = float[Register_Count][4];
+
+static __m128 splat(float value)
+{
+	return _mm_set1_ps(value);
+}
+
+static Vec4 splat(const float (&value)[4])
+{
+	return { splat(value[0]), splat(value[1]), splat(value[2]), splat(value[3]) };
+}
+
+static __m128 saturate(__m128 value)
+{
+	return _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), splat(1.0f));
+}
+
+static __m128 dot3(const Vec4& a, const Vec4& b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+static Vec4 normalize3(const Vec4& v)
+{
+	const auto length = _mm_sqrt_ps(dot3(v, v));
+	return { _mm_div_ps(v.x, length), _mm_div_ps(v.y, length), _mm_div_ps(v.z, length), v.w };
+}
+
+// mul(v, m) with the row major matrix starting at register m.
+static Vec4 mul(const Vec4& v, const Registers& registers, Register m)
+{
+	const auto row = &registers[m];
+	Vec4 result;
+	__m128* out[] = { &result.x, &result.y, &result.z, &result.w };
+
+	for (int i = 0; i < 4; i++)
+	{
+		*out[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v.x, splat(row[0][i])), _mm_mul_ps(v.y, splat(row[1][i]))),
+		                     _mm_add_ps(_mm_mul_ps(v.z, splat(row[2][i])), _mm_mul_ps(v.w, splat(row[3][i]))));
+	}
+
+	return result;
+}
+
+// For functions without an SSE counterpart.
+template <typename F>
+static __m128 per_lane(__m128 value, F f)
+{
+	alignas(16) float lanes[LANES];
+	_mm_store_ps(lanes, value);
+
+	for (auto& lane : lanes)
+	{
+		lane = f(lane);
+	}
+
+	return _mm_load_ps(lanes);
+}
+
+// Rounds to the nearest half precision value. Colors stay far from its
+// limits, so only subnormals get special treatment.
+static float round_half(float value)
+{
+	if (value == 0.0f || !std::isfinite(value))
+	{
+		return value;
+	}
+
+	int exponent;
+	frexpf(value, &exponent);
+
+	// 11 significant bits; subnormals below 2^-14 share the smallest step.
+	const float step = ldexpf(1.0f, (std::max)(exponent, -13) - 11);
+	return nearbyintf(value / step) * step;
+}
+
+static Vec4 round_half(const Vec4& v)
+{
+	return { per_lane(v.x, [](float x) { return round_half(x); }), per_lane(v.y, [](float x) { return round_half(x); }),
+	         per_lane(v.z, [](float x) { return round_half(x); }), per_lane(v.w, [](float x) { return round_half(x); }) };
+}
+
+// Linear filtering with clamped addressing.
+static float sample_fog_table(const Constants& constants, float u)
+{
+	if (constants.fog_table == nullptr || constants.fog_table_size == 0)
+	{
+		return 1.0f;
+	}
+
+	const auto last = static_cast<int>(constants.fog_table_size) - 1;
+	const float x = u * static_cast<float>(constants.fog_table_size) - 0.5f;
+	const float i = floorf(x);
+	const float t = x - i;
+
+	const auto a = constants.fog_table[(std::min)((std::max)(static_cast<int>(i), 0), last)];
+	const auto b = constants.fog_table[(std::min)((std::max)(static_cast<int>(i) + 1, 0), last)];
+
+	return a + (b - a) * t;
+}
+
+// CalcFogFactor. table is false in the vertex shader, where the table can't be sampled.
+static __m128 calc_fog_factor(uint32_t flags, const Constants& constants, __m128 d, bool table)
+{
+	const auto& r = constants.registers;
+
+	if (table && flags & ShaderFlags_FogTable)
+	{
+		const float scale = r[Register_FogTableScale][0];
+		const float half_texel = r[Register_FogTableScale][1];
+
+		return per_lane(d, [&](float value)
+		{
+			const float u = (std::min)((std::max)(value * scale + half_texel, half_texel), 1.0f - half_texel);
+			return sample_fog_table(constants, u);
+		});
+	}
+
+	__m128 coefficient;
+
+	if (flags & ShaderFlags_FogExp)
+	{
+		coefficient = per_lane(_mm_mul_ps(d, splat(r[Register_FogConfig][2])), exp2f);
+	}
+	else if (flags & ShaderFlags_FogExp2)
+	{
+		coefficient = per_lane(_mm_mul_ps(_mm_mul_ps(d, d), splat(r[Register_FogConfig][3])), exp2f);
+	}
+	else
+	{
+		coefficient = _mm_add_ps(_mm_mul_ps(d, splat(r[Register_FogConfig][0])), splat(r[Register_FogConfig][1]));
+	}
+
+	return saturate(coefficient);
+}
+
+// CalcDiffuse
+static Vec4 calc_diffuse(uint32_t flags, const Registers& r, const Vec4& normal, const Vec4& vdiffuse)
+{
+	const auto d = dot3(splat(r[Register_LightDirection]), normal);
+
+	Vec4 combined = {
+		saturate(_mm_mul_ps(splat(r[Register_LightDiffuse][0]), d)),
+		saturate(_mm_mul_ps(splat(r[Register_LightDiffuse][1]), d)),
+		saturate(_mm_mul_ps(splat(r[Register_LightDiffuse][2]), d)),
+		_mm_setzero_ps(),
+	};
+
+	if (flags & ShaderFlags_MultiLight)
+	{
+		for (int i = 1; i < 4; i++)
+		{
+			const auto& direction = r[Register_StageLights + i * 4];
+			const auto& diffuse = r[Register_StageLights + i * 4 + 1];
+			const auto weight = splat(r[Register_LightWeights][i - 1]);
+
+			const auto d1 = dot3(splat(direction), normal);
+
+			combined.x = _mm_add_ps(combined.x, _mm_mul_ps(saturate(_mm_mul_ps(splat(diffuse[1]), d1)), weight));
+			combined.y = _mm_add_ps(combined.y, _mm_mul_ps(saturate(_mm_mul_ps(splat(diffuse[2]), d1)), weight));
+			combined.z = _mm_add_ps(combined.z, _mm_mul_ps(saturate(_mm_mul_ps(splat(diffuse[3]), d1)), weight));
+		}
+	}
+
+	const auto& ambient = r[Register_LightAmbient];
+
+	return {
+		_mm_mul_ps(saturate(_mm_add_ps(combined.x, splat(ambient[0]))), vdiffuse.x),
+		_mm_mul_ps(saturate(_mm_add_ps(combined.y, splat(ambient[1]))), vdiffuse.y),
+		_mm_mul_ps(saturate(_mm_add_ps(combined.z, splat(ambient[2]))), vdiffuse.z),
+		vdiffuse.w,
+	};
+}
+
+// CalcSpecular
+static Vec4 calc_specular(const Registers& r, const Vec4& normal, const Vec4& half_vector)
+{
+	const float power = (std::max)(1.0f, r[Register_MaterialPower][0]);
+	const auto d2 = _mm_max_ps(splat(0.0001f), dot3(normal, half_vector));
+	const auto intensity = per_lane(d2, [power](float value) { return powf(value, power); });
+
+	const auto& material = r[Register_MaterialSpecular];
+	const auto& light = r[Register_LightSpecular];
+
+	return {
+		_mm_mul_ps(splat(material[0]), saturate(_mm_mul_ps(splat(light[0]), intensity))),
+		_mm_mul_ps(splat(material[1]), saturate(_mm_mul_ps(splat(light[1]), intensity))),
+		_mm_mul_ps(splat(material[2]), saturate(_mm_mul_ps(splat(light[2]), intensity))),
+		_mm_setzero_ps(),
+	};
+}
+
+// Transposes up to four AoS values of size floats to lanes and back.
+static void gather(const float* source, size_t stride, size_t count, size_t size, __m128* out)
+{
+	for (size_t c = 0; c < size; c++)
+	{
+		alignas(16) float lanes[LANES] = {};
+
+		for (size_t i = 0; i < count; i++)
+		{
+			lanes[i] = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(source) + i * stride)[c];
+		}
+
+		out[c] = _mm_load_ps(lanes);
+	}
+}
+
+static void scatter(const __m128* in, size_t size, size_t count, float* destination, size_t stride)
+{
+	for (size_t c = 0; c < size; c++)
+	{
+		alignas(16) float lanes[LANES];
+		_mm_store_ps(lanes, in[c]);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(destination) + i * stride)[c] = lanes[i];
+		}
+	}
+}
+
+namespace shader_reference
+{
+	Constants::Constants()
+	{
+		memset(registers, 0, sizeof(registers));
+
+		const float texture_transform[16] = {
+			-0.5f, 0.0f, 0.0f, 0.0f,
+			 0.0f, 0.5f, 0.0f, 0.0f,
+			 0.0f, 0.0f, 1.0f, 0.0f,
+			 0.5f, 0.5f, 0.0f, 1.0f,
+		};
+
+		const float normal_scale[]      = { 1.0f, 1.0f, 1.0f };
+		const float light_direction[]   = { 0.0f, -1.0f, 0.0f };
+		const float fog_config[]        = { 0.0f, 1.0f, 0.0f, 0.0f };
+		const float material_diffuse[]  = { 1.0f, 1.0f, 1.0f, 1.0f };
+		const float material_power      = 1.0f;
+
+		set(Register_TextureTransform, texture_transform, sizeof(texture_transform));
+		set(Register_NormalScale, normal_scale, sizeof(normal_scale));
+		set(Register_LightDirection, light_direction, sizeof(light_direction));
+		set(Register_FogConfig, fog_config, sizeof(fog_config));
+		set(Register_MaterialDiffuse, material_diffuse, sizeof(material_diffuse));
+		set(Register_MaterialPower, &material_power, sizeof(material_power));
+	}
+
+	void Constants::set(uint16_t index, const void* data, size_t size)
+	{
+		if (index >= Register_Count)
+		{
+			return;
+		}
+
+		memcpy(registers[index], data, (std::min)(size, sizeof(registers) - index * sizeof(registers[0])));
+	}
+
+	void vs_main(uint32_t flags, const Constants& constants, const Vertex* input, Interpolants* output, size_t count)
+	{
+		const auto& r = constants.registers;
+		const auto zero = _mm_setzero_ps();
+		const auto one = splat(1.0f);
+
+		for (size_t start = 0; start < count; start += LANES)
+		{
+			const auto n = (std::min)(LANES, count - start);
+			const auto in = &input[start];
+			const auto out = &output[start];
+
+			Vec4 position, normal, color;
+			__m128 tex[2];
+
+			gather(in->position, sizeof(Vertex), n, 3, &position.x);
+			gather(in->normal, sizeof(Vertex), n, 3, &normal.x);
+			gather(in->tex, sizeof(Vertex), n, 2, tex);
+			gather(in->color, sizeof(Vertex), n, 4, &color.x);
+
+			position.w = one;
+			normal.w = one;
+
+			auto view_position = mul(position, r, Register_wvMatrix);
+			const auto fog_dist = view_position.z;
+			const auto clip_position = mul(view_position, r, Register_ProjectionMatrix);
+
+			if (flags & ShaderFlags_Texture && flags & ShaderFlags_EnvMap)
+			{
+				auto uv = mul(normal, r, Register_wvMatrixInvT);
+				uv = mul({ uv.x, uv.y, zero, one }, r, Register_TextureTransform);
+				tex[0] = uv.x;
+				tex[1] = uv.y;
+			}
+
+			auto diffuse = flags & ShaderFlags_VertexColor ? color : splat(r[Register_MaterialDiffuse]);
+
+			const Vec4 scaled_normal = {
+				_mm_mul_ps(normal.x, splat(r[Register_NormalScale][0])),
+				_mm_mul_ps(normal.y, splat(r[Register_NormalScale][1])),
+				_mm_mul_ps(normal.z, splat(r[Register_NormalScale][2])),
+				zero,
+			};
+
+			const auto world_normal = mul(scaled_normal, r, Register_WorldMatrix);
+			const auto world_position = mul(position, r, Register_WorldMatrix);
+
+			const auto& camera = r[Register_CameraPosition];
+			const auto& light = r[Register_LightDirection];
+
+			const auto to_camera = normalize3({
+				_mm_sub_ps(splat(camera[0]), world_position.x),
+				_mm_sub_ps(splat(camera[1]), world_position.y),
+				_mm_sub_ps(splat(camera[2]), world_position.z),
+				zero,
+			});
+
+			const auto half_vector = normalize3({
+				_mm_add_ps(to_camera.x, splat(light[0])),
+				_mm_add_ps(to_camera.y, splat(light[1])),
+				_mm_add_ps(to_camera.z, splat(light[2])),
+				zero,
+			});
+
+			for (size_t i = 0; i < n; i++)
+			{
+				out[i] = {};
+			}
+
+			scatter(&clip_position.x, 4, n, out->position, sizeof(Interpolants));
+			scatter(tex, 2, n, out->tex, sizeof(Interpolants));
+
+			if (flags & ShaderFlags_VertexLit)
+			{
+				Vec4 specular = { zero, zero, zero, zero };
+
+				if (flags & ShaderFlags_Light)
+				{
+					diffuse = calc_diffuse(flags, r, world_normal, diffuse);
+
+					if (flags & ShaderFlags_Specular)
+					{
+						specular = calc_specular(r, world_normal, half_vector);
+					}
+				}
+
+				const auto fog_factor = flags & ShaderFlags_Fog ? calc_fog_factor(flags, constants, fog_dist, false) : one;
+
+				scatter(&specular.x, 4, n, out->specular, sizeof(Interpolants));
+				scatter(&fog_factor, 1, n, &out->fog_factor, sizeof(Interpolants));
+			}
+			else
+			{
+				scatter(&world_normal.x, 3, n, out->world_normal, sizeof(Interpolants));
+				scatter(&half_vector.x, 3, n, out->half_vector, sizeof(Interpolants));
+				scatter(&fog_dist, 1, n, &out->fog_dist, sizeof(Interpolants));
+			}
+
+			scatter(&diffuse.x, 4, n, out->diffuse, sizeof(Interpolants));
+		}
+	}
+
+	void ps_main(uint32_t flags, const Constants& constants, const Pixel* input, PixelResult* output, size_t count,
+		bool partial_precision)
+	{
+		// The values declared as real in shader.hlsl.
+		const auto real = [partial_precision](const Vec4& v)
+		{
+			return partial_precision ? round_half(v) : v;
+		};
+
+		const auto& r = constants.registers;
+		const auto zero = _mm_setzero_ps();
+		const auto one = splat(1.0f);
+
+		for (size_t start = 0; start < count; start += LANES)
+		{
+			const auto n = (std::min)(LANES, count - start);
+			const auto in = &input[start];
+			const auto out = &output[start];
+
+			Vec4 diffuse, specular = { zero, zero, zero, zero };
+			gather(in->input.diffuse, sizeof(Pixel), n, 4, &diffuse.x);
+
+			__m128 fog_factor;
+
+			if (flags & ShaderFlags_VertexLit)
+			{
+				gather(in->input.specular, sizeof(Pixel), n, 4, &specular.x);
+				gather(&in->input.fog_factor, sizeof(Pixel), n, 1, &fog_factor);
+			}
+			else
+			{
+				Vec4 world_normal, half_vector;
+				__m128 fog_dist;
+
+				gather(in->input.world_normal, sizeof(Pixel), n, 3, &world_normal.x);
+				gather(in->input.half_vector, sizeof(Pixel), n, 3, &half_vector.x);
+				gather(&in->input.fog_dist, sizeof(Pixel), n, 1, &fog_dist);
+
+				if (flags & ShaderFlags_Light)
+				{
+					diffuse = calc_diffuse(flags, r, world_normal, diffuse);
+
+					if (flags & ShaderFlags_Specular)
+					{
+						specular = calc_specular(r, world_normal, half_vector);
+					}
+				}
+
+				fog_factor = flags & ShaderFlags_Fog ? calc_fog_factor(flags, constants, fog_dist, true) : one;
+			}
+
+			diffuse = real(diffuse);
+			specular = real(specular);
+
+			Vec4 result = diffuse;
+
+			if (flags & ShaderFlags_Texture)
+			{
+				Vec4 texel;
+				gather(in->texel, sizeof(Pixel), n, 4, &texel.x);
+
+				result.x = _mm_mul_ps(texel.x, diffuse.x);
+				result.y = _mm_mul_ps(texel.y, diffuse.y);
+				result.z = _mm_mul_ps(texel.z, diffuse.z);
+				result.w = _mm_mul_ps(texel.w, diffuse.w);
+				result = real(result);
+			}
+
+			result.x = _mm_add_ps(result.x, specular.x);
+			result.y = _mm_add_ps(result.y, specular.y);
+			result.z = _mm_add_ps(result.z, specular.z);
+			result.w = _mm_add_ps(result.w, specular.w);
+			result = real(result);
+
+			int clipped = 0;
+
+			if (flags & ShaderFlags_Alpha)
+			{
+				clipped = _mm_movemask_ps(_mm_cmplt_ps(result.w, splat(ALPHA_REF)));
+			}
+
+			if (flags & ShaderFlags_Fog)
+			{
+				const auto& fog_color = r[Register_FogColor];
+				const auto inverse = _mm_sub_ps(one, fog_factor);
+
+				result.x = _mm_add_ps(_mm_mul_ps(fog_factor, result.x), _mm_mul_ps(inverse, splat(fog_color[0])));
+				result.y = _mm_add_ps(_mm_mul_ps(fog_factor, result.y), _mm_mul_ps(inverse, splat(fog_color[1])));
+				result.z = _mm_add_ps(_mm_mul_ps(fog_factor, result.z), _mm_mul_ps(inverse, splat(fog_color[2])));
+				result = real(result);
+			}
+
+			scatter(&result.x, 4, n, out->color, sizeof(PixelResult));
+
+			for (size_t i = 0; i < n; i++)
+			{
+				out[i].clipped = (clipped >> i & 1) != 0;
+			}
+		}
+	}
+}
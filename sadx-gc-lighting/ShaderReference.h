@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU implementation of vs_main and ps_main from shader.hlsl for every
+// combination of ShaderFlags, at full float precision or with ps_main's color
+// math rounded like the partial precision variants. Kept free of Windows
+// and Direct3D dependencies so it can be used as a reference for changes to
+// the shaders or to how their constants are folded, without a GPU.
+//
+// Work is done four vertices or pixels at a time with SSE. Pixels are
+// evaluated from interpolants the caller provides (e.g. a fixed set of
+// samples of vs_main output) rather than by rasterizing.
+//
+// This has to be kept in sync with shader.hlsl. It isn't part of the mod;
+// tests/ShaderReferenceTest.cpp builds it and checks that the lighting tiers
+// agree with each other and with the fog and alpha test definitions, and
+// that the partial precision variants stay within their error budget.
+
+namespace shader_reference
+{
+	// Constant registers as declared in shader.hlsl.
+	enum Register : uint16_t
+	{
+		Register_WorldMatrix      = 0,
+		Register_wvMatrix         = 4,
+		Register_ProjectionMatrix = 8,
+		Register_wvMatrixInvT     = 12,
+		Register_TextureTransform = 16,
+		Register_NormalScale      = 20,
+		Register_LightDirection   = 21,
+		Register_FogTableScale    = 23,
+		Register_FogConfig        = 25,
+		Register_FogColor         = 26,
+		Register_CameraPosition   = 27,
+		Register_LightDiffuse     = 30,
+		Register_LightSpecular    = 31,
+		Register_LightAmbient     = 32,
+		Register_MaterialDiffuse  = 33,
+		Register_MaterialSpecular = 34,
+		Register_MaterialPower    = 35,
+		Register_StageLights      = 36,
+		Register_LightWeights     = 52,
+		Register_Count
+	};
+
+	// Same as AlphaRef in shader.hlsl.
+	constexpr float ALPHA_REF = 16.0f / 255.0f;
+
+	// The largest color difference allowed between the partial precision
+	// pixel shaders (USE_PARTIAL_PRECISION) and the full precision ones:
+	// one step of an 8-bit render target.
+	constexpr float PARTIAL_PRECISION_ERROR = 1.0f / 255.0f;
+
+	struct Constants
+	{
+		// Laid out like the shader's registers; matrices are row major.
+		float registers[Register_Count][4];
+
+		// Visibility by view distance, as uploaded to the fog table texture.
+		// Sampled with linear filtering and clamping like the GPU does.
+		const float* fog_table = nullptr;
+		size_t fog_table_size = 0;
+
+		// Initializes the registers to the defaults in shader.hlsl.
+		Constants();
+
+		// Writes size bytes starting at register index, the way
+		// Set*ShaderConstantF does. Writes past the end are dropped.
+		void set(uint16_t index, const void* data, size_t size);
+	};
+
+	struct Vertex
+	{
+		float position[3];
+		float normal[3];
+		float tex[2];
+		float color[4];
+	};
+
+	// PS_IN. Only the members of the flags' lighting tier are written.
+	struct Interpolants
+	{
+		float position[4];
+		float diffuse[4];
+		float tex[2];
+
+		// With ShaderFlags_VertexLit
+		float specular[4];
+		float fog_factor;
+
+		// Without ShaderFlags_VertexLit
+		float world_normal[3];
+		float half_vector[3];
+		float fog_dist;
+	};
+
+	struct Pixel
+	{
+		Interpolants input;
+		// The sampled base texture, used with ShaderFlags_Texture.
+		float texel[4];
+	};
+
+	struct PixelResult
+	{
+		// Not saturated; that's left to the render target format.
+		float color[4];
+		// Discarded by the alpha test.
+		bool clipped;
+	};
+
+	void vs_main(uint32_t flags, const Constants& constants, const Vertex* input, Interpolants* output, size_t count);
+	// With partial_precision, the values shader.hlsl declares as real are
+	// rounded to half precision wherever they're written.
+	void ps_main(uint32_t flags, const Constants& constants, const Pixel* input, PixelResult* output, size_t count,
+		bool partial_precision = false);
+}
@@ -0,0 +1,95 @@
+#include "stdafx.h"
+
+#include "ShaderSelection.h"
+
+namespace selection
+{
+	uint32_t sanitize(uint32_t flags)
+	{
+		flags &= ShaderFlags_Mask;
+
+		if (flags & ShaderFlags_EnvMap && !(flags & ShaderFlags_Texture))
+		{
+			flags &= ~ShaderFlags_EnvMap;
+		}
+
+		if (flags & ShaderFlags_MultiLight && !(flags & ShaderFlags_Light))
+		{
+			flags &= ~ShaderFlags_MultiLight;
+		}
+
+		// The fog table can't be sampled in the vertex shader, so the vertex
+		// lit tier falls back to the fog formula.
+		if (!(flags & ShaderFlags_Fog) || flags & ShaderFlags_VertexLit)
+		{
+			flags &= ~ShaderFlags_FogTable;
+		}
+
+		if (!(flags & ShaderFlags_Fog) || flags & ShaderFlags_FogTable || (flags & FOG_MODE_FLAGS) == FOG_MODE_FLAGS)
+		{
+			flags &= ~FOG_MODE_FLAGS;
+		}
+
+		return flags;
+	}
+
+	uint32_t vs_key(uint32_t flags, bool uber_shader)
+	{
+		if (uber_shader)
+		{
+			return flags & ShaderFlags_VertexLit;
+		}
+
+		return flags & (flags & ShaderFlags_VertexLit ? VS_VERTEX_LIT_FLAGS : VS_FLAGS);
+	}
+
+	uint32_t ps_key(uint32_t flags, bool uber_shader)
+	{
+		if (uber_shader)
+		{
+			return flags & ShaderFlags_VertexLit;
+		}
+
+		return flags & (flags & ShaderFlags_VertexLit ? PS_VERTEX_LIT_FLAGS : PS_FLAGS);
+	}
+
+	LodLevel lod_level(const LodSettings& settings, float depth, int previous)
+	{
+		const float thresholds[] = { settings.specular_distance, settings.vertex_lighting_distance };
+		auto level = LodLevel_Full;
+
+		for (int i = 0; i < 2; i++)
+		{
+			// A level that was previously reached has to be left by the
+			// hysteresis distance, and a new one entered by the same.
+			float bias = 0.0f;
+
+			if (previous >= 0)
+			{
+				bias = i < previous ? -settings.hysteresis : settings.hysteresis;
+			}
+
+			if (depth > thresholds[i] + bias)
+			{
+				level = static_cast<LodLevel>(i + 1);
+			}
+		}
+
+		return level;
+	}
+
+	uint32_t apply_lod(uint32_t flags, LodLevel level)
+	{
+		if (level >= LodLevel_NoSpecular)
+		{
+			flags &= ~ShaderFlags_Specular;
+		}
+
+		if (level >= LodLevel_VertexLit && flags & (ShaderFlags_Light | ShaderFlags_Fog))
+		{
+			flags |= ShaderFlags_VertexLit;
+		}
+
+		return flags;
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+// Shader permutation selection. Kept free of Windows and Direct3D
+// dependencies so captures can be replayed through it anywhere.
+
+enum ShaderFlags
+{
+	ShaderFlags_None        = 0,
+	ShaderFlags_Texture     = 0b1,
+	ShaderFlags_EnvMap      = 0b10,
+	ShaderFlags_Alpha       = 0b100,
+	ShaderFlags_Light       = 0b1000,
+	ShaderFlags_Specular    = 0b10000,
+	ShaderFlags_Fog         = 0b100000,
+	ShaderFlags_MultiLight  = 0b1000000,
+	ShaderFlags_VertexLit   = 0b10000000,
+	ShaderFlags_FogExp      = 0b100000000,
+	ShaderFlags_FogExp2     = 0b1000000000,
+	ShaderFlags_VertexColor = 0b10000000000,
+	ShaderFlags_FogTable    = 0b100000000000,
+	ShaderFlags_Mask        = 0b111111111111,
+	ShaderFlags_Count
+};
+
+namespace selection
+{
+	constexpr auto FOG_MODE_FLAGS = ShaderFlags_FogExp | ShaderFlags_FogExp2;
+	constexpr auto VS_FLAGS = ShaderFlags_Texture | ShaderFlags_EnvMap | ShaderFlags_VertexColor;
+	constexpr auto PS_FLAGS = ShaderFlags_Texture | ShaderFlags_Alpha | ShaderFlags_Fog | ShaderFlags_Light | ShaderFlags_Specular
+		| ShaderFlags_MultiLight | FOG_MODE_FLAGS | ShaderFlags_FogTable;
+
+	// In the vertex lit tier, lighting and fog move from the pixel shader to the vertex shader.
+	constexpr auto LIGHTING_FLAGS = ShaderFlags_Light | ShaderFlags_Specular | ShaderFlags_MultiLight | ShaderFlags_Fog
+		| FOG_MODE_FLAGS;
+	constexpr auto VS_VERTEX_LIT_FLAGS = VS_FLAGS | LIGHTING_FLAGS | ShaderFlags_VertexLit;
+	constexpr auto PS_VERTEX_LIT_FLAGS = ShaderFlags_Texture | ShaderFlags_Alpha | ShaderFlags_Fog | ShaderFlags_VertexLit;
+
+	enum LodLevel : uint8_t
+	{
+		LodLevel_Full,
+		LodLevel_NoSpecular,
+		LodLevel_VertexLit,
+		LodLevel_Count
+	};
+
+	struct LodSettings
+	{
+		float specular_distance;
+		float vertex_lighting_distance;
+		float hysteresis;
+	};
+
+	// Removes flags that have no effect in combination with the others.
+	uint32_t sanitize(uint32_t flags);
+
+	// Flags that select the vertex and pixel shader of a permutation.
+	// With the uber shader, only the lighting tier does.
+	uint32_t vs_key(uint32_t flags, bool uber_shader);
+	uint32_t ps_key(uint32_t flags, bool uber_shader);
+
+	// previous is the level the model was last drawn at, or -1.
+	LodLevel lod_level(const LodSettings& settings, float depth, int previous);
+	uint32_t apply_lod(uint32_t flags, LodLevel level);
+}
@@ -0,0 +1,313 @@
+#include "stdafx.h"
+
+#include <d3d9.h>
+
+#include "metrics.h"
+#include "ShaderParameter.h"
+#include "ShaderSelection.h"
+#include "ShaderState.h"
+
+// Sampler 1 states of the fog table permutations. The table is sampled between its entries.
+static const struct
+{
+	D3DSAMPLERSTATETYPE type;
+	DWORD value;
+} fog_sampler_states[] = {
+	{ D3DSAMP_MINFILTER, D3DTEXF_LINEAR },
+	{ D3DSAMP_MAGFILTER, D3DTEXF_LINEAR },
+	{ D3DSAMP_ADDRESSU, D3DTADDRESS_CLAMP },
+};
+
+ShaderState::ShaderState(IShaderSource& source, FrameCounters& counters)
+	: source(source),
+	  counters(counters)
+{
+}
+
+Uint32 ShaderState::states_key(Uint32 flags) const
+{
+	return uber_shader ? flags & ((1u << BOOL_REGISTER_COUNT) - 1) : flags & ShaderFlags_FogTable;
+}
+
+void ShaderState::set_bool_constants(Uint32 flags)
+{
+	BOOL values[BOOL_REGISTER_COUNT];
+
+	for (Uint32 i = 0; i < BOOL_REGISTER_COUNT; i++)
+	{
+		values[i] = (flags >> i) & 1;
+	}
+
+	device->SetVertexShaderConstantB(0, values, BOOL_REGISTER_COUNT);
+	device->SetPixelShaderConstantB(0, values, BOOL_REGISTER_COUNT);
+}
+
+void ShaderState::save_fog_sampler()
+{
+	if (fog_sampler.saved)
+	{
+		return;
+	}
+
+	device->GetSamplerState(1, D3DSAMP_MINFILTER, &fog_sampler.min_filter);
+	device->GetSamplerState(1, D3DSAMP_MAGFILTER, &fog_sampler.mag_filter);
+	device->GetSamplerState(1, D3DSAMP_ADDRESSU, &fog_sampler.address_u);
+	fog_sampler.saved = true;
+}
+
+void ShaderState::restore_fog_sampler()
+{
+	if (!fog_sampler.saved)
+	{
+		return;
+	}
+
+	device->SetSamplerState(1, D3DSAMP_MINFILTER, fog_sampler.min_filter);
+	device->SetSamplerState(1, D3DSAMP_MAGFILTER, fog_sampler.mag_filter);
+	device->SetSamplerState(1, D3DSAMP_ADDRESSU, fog_sampler.address_u);
+	fog_sampler.saved = false;
+
+	if (current_states & ShaderFlags_FogTable)
+	{
+		has_states = false;
+	}
+}
+
+void ShaderState::set_fog_sampler()
+{
+	for (auto& it : fog_sampler_states)
+	{
+		device->SetSamplerState(1, it.type, it.value);
+	}
+}
+
+// Sets the states for a states key.
+void ShaderState::set_states(Uint32 key)
+{
+	if (uber_shader)
+	{
+		set_bool_constants(key);
+	}
+
+	if (key & ShaderFlags_FogTable)
+	{
+		set_fog_sampler();
+	}
+}
+
+// Puts the states for a states key on the device unless they already are.
+void ShaderState::apply_states(Uint32 key)
+{
+	// Separate shaders without the fog table leave everything as it is.
+	if (!uber_shader && !(key & ShaderFlags_FogTable))
+	{
+		return;
+	}
+
+	if (has_states && key == current_states)
+	{
+		return;
+	}
+
+	IDirect3DStateBlock9* block = nullptr;
+
+	if (state_blocks)
+	{
+		auto& entry = blocks[key];
+
+		if (entry == nullptr)
+		{
+			build_state_block(key, entry);
+		}
+
+		block = entry;
+	}
+
+	if (block != nullptr)
+	{
+		source.flush();
+		block->Apply();
+		++counters.state_block_applies;
+	}
+	else
+	{
+		set_states(key);
+	}
+
+	current_states = key;
+	has_states = true;
+}
+
+// Binds the shaders that aren't already.
+void ShaderState::bind(IDirect3DVertexShader9* vs, IDirect3DPixelShader9* ps)
+{
+	if (!using_shader || vs != bound_vs)
+	{
+		device->SetVertexShader(vs);
+		bound_vs = vs;
+		++counters.vertex_shader_switches;
+	}
+
+	if (!using_shader || ps != bound_ps)
+	{
+		device->SetPixelShader(ps);
+		bound_ps = ps;
+		++counters.pixel_shader_switches;
+	}
+}
+
+// Records the states for a states key into a state block.
+void ShaderState::build_state_block(Uint32 key, StateBlock& block)
+{
+	block = nullptr;
+
+	// Nothing may be submitted while recording.
+	source.flush();
+
+	if (FAILED(device->BeginStateBlock()))
+	{
+		return;
+	}
+
+	set_states(key);
+
+	if (FAILED(device->EndStateBlock(&block)))
+	{
+		block = nullptr;
+		return;
+	}
+
+	++counters.state_block_builds;
+}
+
+void ShaderState::start(Uint32 flags)
+{
+	bool changes = false;
+
+	if (!has_flags || flags != last_flags)
+	{
+		const VertexShader vs = source.vertex_shader(flags);
+		const PixelShader ps = source.pixel_shader(flags);
+
+		changes = true;
+		has_flags = true;
+		last_flags = flags;
+
+		if (flags & ShaderFlags_FogTable)
+		{
+			save_fog_sampler();
+		}
+		else
+		{
+			restore_fog_sampler();
+		}
+
+		apply_states(states_key(flags));
+		bind(vs, ps);
+
+		vertex_shader = vs;
+		pixel_shader = ps;
+	}
+	else
+	{
+		// end restored the game's sampler states, and the depth pre-pass may
+		// have bound its own shaders. Nothing is set if neither happened.
+		if (flags & ShaderFlags_FogTable)
+		{
+			save_fog_sampler();
+		}
+
+		apply_states(states_key(flags));
+		bind(vertex_shader, pixel_shader);
+	}
+
+	if (changes || !IShaderParameter::values_assigned.empty())
+	{
+		commit_parameters();
+	}
+
+	using_shader = true;
+}
+
+void ShaderState::start(IDirect3DVertexShader9* vs, IDirect3DPixelShader9* ps)
+{
+	bind(vs, ps);
+	using_shader = true;
+
+	commit_parameters();
+}
+
+void ShaderState::end()
+{
+	if (using_shader)
+	{
+		device->SetPixelShader(nullptr);
+		device->SetVertexShader(nullptr);
+		restore_fog_sampler();
+		using_shader = false;
+		bound_vs = nullptr;
+		bound_ps = nullptr;
+	}
+}
+
+bool ShaderState::active() const
+{
+	return using_shader;
+}
+
+void ShaderState::commit_parameters()
+{
+	for (auto& it : IShaderParameter::values_assigned)
+	{
+		if (it->commit(device))
+		{
+			counters.constant_uploads += it->upload_calls();
+			counters.constant_bytes += it->upload_bytes();
+		}
+	}
+
+	IShaderParameter::values_assigned.clear();
+	++counters.parameter_flushes;
+}
+
+void ShaderState::reset(Uint32 flags)
+{
+	vertex_shader = source.vertex_shader(flags);
+	pixel_shader = source.pixel_shader(flags);
+	last_flags = flags;
+	has_flags = true;
+	has_states = false;
+
+	if (uber_shader)
+	{
+		set_bool_constants(flags);
+	}
+}
+
+void ShaderState::rebuild_state_blocks()
+{
+	for (auto& it : blocks)
+	{
+		build_state_block(it.first, it.second);
+	}
+}
+
+void ShaderState::release()
+{
+	for (auto& it : blocks)
+	{
+		it.second = nullptr;
+	}
+
+	vertex_shader = nullptr;
+	pixel_shader = nullptr;
+	bound_vs = nullptr;
+	bound_ps = nullptr;
+	has_states = false;
+}
+
+void ShaderState::device_reset()
+{
+	fog_sampler = {};
+	has_states = false;
+}
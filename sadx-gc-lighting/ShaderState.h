@@ -0,0 +1,114 @@
+#pragma once
+
+#include <unordered_map>
+#include <d3d9.h>
+#include <ninja.h>
+
+#include "ShaderParameter.h"
+
+struct FrameCounters;
+
+// Puts the shader permutation of a draw on the device and commits the
+// assigned shader parameters, and hands the device back to the fixed
+// function pipeline afterwards. Kept free of the game so captures can be
+// replayed through it against a counting device (see CaptureReplay.h).
+class ShaderState
+{
+public:
+	// Flags below this bit are mirrored to the boolean registers of the uber shader.
+	// The vertex lit bit (b7) is part of the shader key instead and goes unused.
+	static constexpr Uint32 BOOL_REGISTER_COUNT = 12;
+
+	class IShaderSource
+	{
+	public:
+		virtual ~IShaderSource() = default;
+
+		// Either may throw if the shader can't be built.
+		virtual VertexShader vertex_shader(Uint32 flags) = 0;
+		virtual PixelShader pixel_shader(Uint32 flags) = 0;
+
+		// Called before the device's state is changed in a way the device
+		// hooks don't see, i.e. state block recording and Apply.
+		virtual void flush() = 0;
+	};
+
+	IDirect3DDevice9* device = nullptr;
+
+	// Permutations share one shader per stage and lighting tier, and the
+	// remaining flags go to the boolean registers.
+	bool uber_shader = false;
+	// The boolean constants and fog table sampler states of a permutation are
+	// applied with a state block. Shaders are always bound on their own.
+	bool state_blocks = false;
+
+	// Shaders of the current permutation.
+	VertexShader vertex_shader;
+	PixelShader pixel_shader;
+
+	ShaderState(IShaderSource& source, FrameCounters& counters);
+
+	// Binds the permutation for flags if needed and commits the parameters.
+	// May throw if its shaders can't be built.
+	void start(Uint32 flags);
+	// Binds the given shaders in place of a permutation, e.g. for the depth pre-pass.
+	void start(IDirect3DVertexShader9* vs, IDirect3DPixelShader9* ps);
+	// Unbinds the shaders and restores the game's states.
+	void end();
+	bool active() const;
+
+	void commit_parameters();
+
+	// Makes flags the current permutation once its shaders exist. May throw.
+	void reset(Uint32 flags);
+	// Records every state block that existed before release.
+	void rebuild_state_blocks();
+	// Releases the shaders and state blocks; the blocks that existed are
+	// remembered for rebuild_state_blocks.
+	void release();
+	// Forgets the game's sampler states and the permutation states on the
+	// device after a device reset, which returns them to their defaults.
+	void device_reset();
+
+private:
+	// Sampler 1 states of the game, saved while a fog table permutation has them
+	// overridden and restored when the mod's shaders are no longer in use.
+	struct FogSamplerState
+	{
+		bool saved;
+		DWORD min_filter;
+		DWORD mag_filter;
+		DWORD address_u;
+	};
+
+	// The flags a permutation's states depend on.
+	Uint32 states_key(Uint32 flags) const;
+
+	void set_bool_constants(Uint32 flags);
+	void save_fog_sampler();
+	void restore_fog_sampler();
+	void set_fog_sampler();
+	void set_states(Uint32 key);
+	void apply_states(Uint32 key);
+	void bind(IDirect3DVertexShader9* vs, IDirect3DPixelShader9* ps);
+	void build_state_block(Uint32 key, StateBlock& block);
+
+	IShaderSource& source;
+	FrameCounters& counters;
+
+	Uint32 last_flags = 0;
+	bool has_flags = false;
+	bool using_shader = false;
+	FogSamplerState fog_sampler {};
+
+	// Shaders on the device while using_shader is set.
+	IDirect3DVertexShader9* bound_vs = nullptr;
+	IDirect3DPixelShader9* bound_ps = nullptr;
+
+	// Key of the states on the device, if they're known to be.
+	Uint32 current_states = 0;
+	bool has_states = false;
+
+	// One block per states key, shared by the permutations that only differ in their shaders.
+	std::unordered_map<Uint32, StateBlock> blocks;
+};
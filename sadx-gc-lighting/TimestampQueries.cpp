@@ -0,0 +1,133 @@
+#include "stdafx.h"
+
+#include <d3d9.h>
+
+#include "TimestampQueries.h"
+
+bool TimestampQueries::create(IDirect3DDevice9* device)
+{
+	release();
+
+	// Checks for support without creating anything.
+	if (FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, nullptr))
+		|| FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, nullptr))
+		|| FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, nullptr)))
+	{
+		return false;
+	}
+
+	this->device = device;
+	return true;
+}
+
+void TimestampQueries::release()
+{
+	for (auto& slot : slots)
+	{
+		slot.disjoint = nullptr;
+		slot.frequency = nullptr;
+		slot.timestamps.clear();
+	}
+
+	device = nullptr;
+}
+
+bool TimestampQueries::is_created() const
+{
+	return device != nullptr;
+}
+
+bool TimestampQueries::begin_frame(size_t slot)
+{
+	if (device == nullptr)
+	{
+		return false;
+	}
+
+	auto& s = slots[slot];
+
+	if (s.disjoint == nullptr
+		&& (FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &s.disjoint))
+			|| FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &s.frequency))))
+	{
+		s.disjoint = nullptr;
+		s.frequency = nullptr;
+		return false;
+	}
+
+	s.disjoint->Issue(D3DISSUE_BEGIN);
+	return true;
+}
+
+void TimestampQueries::end_frame(size_t slot)
+{
+	auto& s = slots[slot];
+	s.frequency->Issue(D3DISSUE_END);
+	s.disjoint->Issue(D3DISSUE_END);
+}
+
+void TimestampQueries::timestamp(size_t slot, size_t index)
+{
+	auto& timestamps = slots[slot].timestamps;
+
+	// Queries are created on first use and reused from then on.
+	while (timestamps.size() <= index)
+	{
+		Query query;
+
+		if (FAILED(device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &query)))
+		{
+			return;
+		}
+
+		timestamps.push_back(query);
+	}
+
+	timestamps[index]->Issue(D3DISSUE_END);
+}
+
+bool TimestampQueries::frame_data(size_t slot, uint64_t& frequency, bool& disjoint)
+{
+	auto& s = slots[slot];
+
+	if (s.disjoint == nullptr)
+	{
+		disjoint = true;
+		return true;
+	}
+
+	BOOL is_disjoint = FALSE;
+	UINT64 ticks_per_second = 0;
+
+	if (s.disjoint->GetData(&is_disjoint, sizeof(is_disjoint), 0) != S_OK
+		|| s.frequency->GetData(&ticks_per_second, sizeof(ticks_per_second), 0) != S_OK)
+	{
+		return false;
+	}
+
+	disjoint = is_disjoint != FALSE;
+	frequency = ticks_per_second;
+	return true;
+}
+
+bool TimestampQueries::timestamp_data(size_t slot, size_t index, uint64_t& ticks)
+{
+	auto& timestamps = slots[slot].timestamps;
+
+	// Creating the query failed; the run is dropped as if it were zero length.
+	if (index >= timestamps.size())
+	{
+		ticks = 0;
+		return true;
+	}
+
+	UINT64 value = 0;
+
+	if (timestamps[index]->GetData(&value, sizeof(value), 0) != S_OK)
+	{
+		return false;
+	}
+
+	ticks = value;
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <d3d9.h>
+
+#include "GpuProfiler.h"
+#include "ShaderParameter.h"
+
+// Direct3D 9 timestamp queries for GpuProfiler.
+class TimestampQueries : public ITimestampSource
+{
+public:
+	// Returns false if the device doesn't support timestamp queries.
+	bool create(IDirect3DDevice9* device);
+	void release();
+	bool is_created() const;
+
+	bool begin_frame(size_t slot) override;
+	void end_frame(size_t slot) override;
+	void timestamp(size_t slot, size_t index) override;
+	bool frame_data(size_t slot, uint64_t& frequency, bool& disjoint) override;
+	bool timestamp_data(size_t slot, size_t index, uint64_t& ticks) override;
+
+private:
+	struct Slot
+	{
+		Query disjoint;
+		Query frequency;
+		std::vector<Query> timestamps;
+	};
+
+	IDirect3DDevice9* device = nullptr;
+	Slot slots[GpuProfiler::FRAME_LATENCY];
+};
@@ -0,0 +1,279 @@
+#include "stdafx.h"
+
+#include <cstdint>
+#include <cstring>
+#include <d3d9.h>
+
+// Mod loader
+#include <SADXModLoader.h>
+
+#include "UPBatcher.h"
+
+static D3DPRIMITIVETYPE output_type(D3DPRIMITIVETYPE type)
+{
+	switch (type)
+	{
+		case D3DPT_LINELIST:
+		case D3DPT_LINESTRIP:
+			return D3DPT_LINELIST;
+
+		default:
+			return D3DPT_TRIANGLELIST;
+	}
+}
+
+static UINT index_count(D3DPRIMITIVETYPE type, UINT primitive_count)
+{
+	return primitive_count * (output_type(type) == D3DPT_LINELIST ? 2 : 3);
+}
+
+// Expands the source primitives into list indices relative to the start of the batch.
+template <typename T>
+static void write_indices(Uint16* out, D3DPRIMITIVETYPE type, UINT primitive_count, UINT base, const T& source)
+{
+	switch (type)
+	{
+		default:
+			break;
+
+		case D3DPT_LINELIST:
+		case D3DPT_TRIANGLELIST:
+		{
+			const auto count = index_count(type, primitive_count);
+
+			for (UINT i = 0; i < count; i++)
+			{
+				*out++ = static_cast<Uint16>(base + source(i));
+			}
+			break;
+		}
+
+		case D3DPT_LINESTRIP:
+			for (UINT i = 0; i < primitive_count; i++)
+			{
+				*out++ = static_cast<Uint16>(base + source(i));
+				*out++ = static_cast<Uint16>(base + source(i + 1));
+			}
+			break;
+
+		case D3DPT_TRIANGLESTRIP:
+			// Every other triangle in a strip has reversed winding.
+			for (UINT i = 0; i < primitive_count; i++)
+			{
+				const auto odd = i & 1;
+				*out++ = static_cast<Uint16>(base + source(i + odd));
+				*out++ = static_cast<Uint16>(base + source(i + 1 - odd));
+				*out++ = static_cast<Uint16>(base + source(i + 2));
+			}
+			break;
+
+		case D3DPT_TRIANGLEFAN:
+			for (UINT i = 0; i < primitive_count; i++)
+			{
+				*out++ = static_cast<Uint16>(base + source(0));
+				*out++ = static_cast<Uint16>(base + source(i + 1));
+				*out++ = static_cast<Uint16>(base + source(i + 2));
+			}
+			break;
+	}
+}
+
+void UPBatcher::create(IDirect3DDevice9* device)
+{
+	release();
+
+	if (!enabled || device == nullptr)
+	{
+		return;
+	}
+
+	auto result = device->CreateVertexBuffer(VERTEX_BUFFER_SIZE, D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+		0, D3DPOOL_DEFAULT, &vertices, nullptr);
+
+	if (SUCCEEDED(result))
+	{
+		result = device->CreateIndexBuffer(INDEX_BUFFER_COUNT * sizeof(Uint16), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+			D3DFMT_INDEX16, D3DPOOL_DEFAULT, &indices, nullptr);
+	}
+
+	if (FAILED(result))
+	{
+		PrintDebug("[lantern] Failed to create UP batch buffers: %08X\n", result);
+		release();
+	}
+}
+
+void UPBatcher::release()
+{
+	open = false;
+	discard_vertices = true;
+	discard_indices = true;
+	vertex_position = 0;
+	index_position = 0;
+	vertices = nullptr;
+	indices = nullptr;
+}
+
+bool UPBatcher::supports(D3DPRIMITIVETYPE type, D3DFORMAT index_format) const
+{
+	if (!enabled || vertices == nullptr || indices == nullptr)
+	{
+		return false;
+	}
+
+	if (index_format != D3DFMT_UNKNOWN && index_format != D3DFMT_INDEX16)
+	{
+		return false;
+	}
+
+	return type != D3DPT_POINTLIST;
+}
+
+bool UPBatcher::is_open() const
+{
+	return open;
+}
+
+bool UPBatcher::compatible(D3DPRIMITIVETYPE type, UINT stride, Uint32 key) const
+{
+	return open && batch.type == output_type(type) && batch.stride == stride && batch.key == key;
+}
+
+bool UPBatcher::append(D3DPRIMITIVETYPE type, UINT primitive_count, UINT min_index, UINT vertex_count,
+	const Uint16* source_indices, const void* source_vertices, UINT stride, Uint32 key)
+{
+	const auto count = index_count(type, primitive_count);
+	const auto vertex_bytes = vertex_count * stride;
+
+	if (!primitive_count || !vertex_count || vertex_count > MAX_VERTICES
+		|| vertex_bytes > VERTEX_BUFFER_SIZE || count > INDEX_BUFFER_COUNT)
+	{
+		return false;
+	}
+
+	if (!open)
+	{
+		// Stream offsets need to be DWORD aligned; keep a little extra headroom.
+		vertex_position = (vertex_position + 15) & ~15u;
+
+		if (vertex_position + vertex_bytes > VERTEX_BUFFER_SIZE)
+		{
+			vertex_position = 0;
+			discard_vertices = true;
+		}
+
+		if (index_position + count > INDEX_BUFFER_COUNT)
+		{
+			index_position = 0;
+			discard_indices = true;
+		}
+
+		batch = { output_type(type), stride, vertex_position, 0, index_position, 0, 0, key };
+		open = true;
+	}
+	else if (!compatible(type, stride, key)
+		|| batch.vertex_count + vertex_count > MAX_VERTICES
+		|| vertex_position + vertex_bytes > VERTEX_BUFFER_SIZE
+		|| index_position + count > INDEX_BUFFER_COUNT)
+	{
+		return false;
+	}
+
+	void* vertex_data = nullptr;
+	const DWORD vertex_lock = discard_vertices ? D3DLOCK_DISCARD : D3DLOCK_NOOVERWRITE;
+
+	if (FAILED(vertices->Lock(vertex_position, vertex_bytes, &vertex_data, vertex_lock)))
+	{
+		return false;
+	}
+
+	memcpy(vertex_data, reinterpret_cast<const uint8_t*>(source_vertices) + min_index * stride, vertex_bytes);
+	vertices->Unlock();
+	discard_vertices = false;
+
+	void* index_data = nullptr;
+	const DWORD index_lock = discard_indices ? D3DLOCK_DISCARD : D3DLOCK_NOOVERWRITE;
+
+	if (FAILED(indices->Lock(index_position * sizeof(Uint16), count * sizeof(Uint16), &index_data, index_lock)))
+	{
+		return false;
+	}
+
+	const auto out = reinterpret_cast<Uint16*>(index_data);
+
+	if (source_indices != nullptr)
+	{
+		write_indices(out, type, primitive_count, batch.vertex_count,
+			[&](UINT i) { return static_cast<UINT>(source_indices[i] - min_index); });
+	}
+	else
+	{
+		write_indices(out, type, primitive_count, batch.vertex_count,
+			[](UINT i) { return i; });
+	}
+
+	indices->Unlock();
+	discard_indices = false;
+
+	vertex_position += vertex_bytes;
+	index_position += count;
+
+	batch.vertex_count += vertex_count;
+	batch.index_count += count;
+	batch.primitive_count += primitive_count;
+
+	return true;
+}
+
+bool UPBatcher::close(Batch& out)
+{
+	if (!open)
+	{
+		return false;
+	}
+
+	open = false;
+
+	if (!batch.primitive_count)
+	{
+		return false;
+	}
+
+	out = batch;
+	return true;
+}
+
+IDirect3DVertexBuffer9* UPBatcher::vertex_buffer() const
+{
+	return vertices;
+}
+
+IDirect3DIndexBuffer9* UPBatcher::index_buffer() const
+{
+	return indices;
+}
+
+UINT UPBatcher::vertex_count(D3DPRIMITIVETYPE type, UINT primitive_count)
+{
+	switch (type)
+	{
+		case D3DPT_POINTLIST:
+			return primitive_count;
+
+		case D3DPT_LINELIST:
+			return primitive_count * 2;
+
+		case D3DPT_LINESTRIP:
+			return primitive_count + 1;
+
+		case D3DPT_TRIANGLELIST:
+			return primitive_count * 3;
+
+		case D3DPT_TRIANGLESTRIP:
+		case D3DPT_TRIANGLEFAN:
+			return primitive_count + 2;
+
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <d3d9.h>
+#include <ninja.h>
+
+#include "ShaderParameter.h"
+
+// Collects DrawPrimitiveUP/DrawIndexedPrimitiveUP geometry into dynamic ring
+// buffers so that consecutive compatible draws can be submitted as a single
+// DrawIndexedPrimitive. Strips, fans and line strips are expanded into lists.
+class UPBatcher
+{
+public:
+	static constexpr UINT VERTEX_BUFFER_SIZE = 1024 * 1024;
+	static constexpr UINT INDEX_BUFFER_COUNT = 128 * 1024;
+	static constexpr UINT MAX_VERTICES       = 0xFFFF;
+
+	struct Batch
+	{
+		D3DPRIMITIVETYPE type;
+		UINT stride;
+		UINT offset; // Vertex buffer offset in bytes.
+		UINT vertex_count;
+		UINT start_index;
+		UINT index_count;
+		UINT primitive_count;
+		Uint32 key; // Shader state the batch was opened with.
+	};
+
+	bool enabled = false;
+
+	void create(IDirect3DDevice9* device);
+	void release();
+
+	bool supports(D3DPRIMITIVETYPE type, D3DFORMAT index_format) const;
+	bool is_open() const;
+	bool compatible(D3DPRIMITIVETYPE type, UINT stride, Uint32 key) const;
+
+	// Returns false if the geometry does not fit in the current batch.
+	bool append(D3DPRIMITIVETYPE type, UINT primitive_count, UINT min_index, UINT vertex_count,
+		const Uint16* source_indices, const void* source_vertices, UINT stride, Uint32 key);
+
+	// Closes the current batch. Returns false if there is nothing to draw.
+	bool close(Batch& out);
+
+	IDirect3DVertexBuffer9* vertex_buffer() const;
+	IDirect3DIndexBuffer9* index_buffer() const;
+
+	static UINT vertex_count(D3DPRIMITIVETYPE type, UINT primitive_count);
+
+private:
+	VertexBuffer vertices;
+	IndexBuffer indices;
+
+	bool open = false;
+	bool discard_vertices = true;
+	bool discard_indices = true;
+	UINT vertex_position = 0;
+	UINT index_position = 0;
+
+	Batch batch {};
+};
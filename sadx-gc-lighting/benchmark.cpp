@@ -0,0 +1,538 @@
+#include "stdafx.h"
+
+#include <Windows.h>
+#include <atlbase.h>
+#include <d3d9.h>
+#include <d3dx9math.h>
+
+#include <SADXModLoader.h>
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "d3d.h"
+#include "lights.h"
+#include "materials.h"
+#include "ShaderParameter.h"
+#include "ShaderSelection.h"
+
+// Unused by the shaders, with room for StageLights (16 registers) below the pixel shader limit of 224.
+static constexpr int FIRST_REGISTER = 192;
+static constexpr int ITERATIONS     = 2000;
+
+// Number of parameters touched per simulated draw.
+static const size_t working_sets[] = { 1, 16, 64 };
+// Fraction of assignments that change the value.
+static const double dirty_ratios[] = { 0.0, 0.1, 0.5, 1.0 };
+
+struct Result
+{
+	const char* name;
+	const char* type;
+	size_t working_set;
+	double dirty_ratio;
+	double ns_per_op;
+};
+
+static long long now()
+{
+	LARGE_INTEGER result;
+	QueryPerformanceCounter(&result);
+	return result.QuadPart;
+}
+
+static double to_ns(long long ticks, size_t ops)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return static_cast<double>(ticks) * 1e9 / static_cast<double>(frequency.QuadPart) / static_cast<double>(ops);
+}
+
+static void make_value(float seed, bool& out)
+{
+	out = static_cast<int>(seed) % 2 != 0;
+}
+
+static void make_value(float seed, int& out)
+{
+	out = static_cast<int>(seed);
+}
+
+static void make_value(float seed, float& out)
+{
+	out = seed;
+}
+
+static void make_value(float seed, D3DXVECTOR2& out)
+{
+	out = D3DXVECTOR2(seed, seed);
+}
+
+static void make_value(float seed, D3DXVECTOR3& out)
+{
+	out = D3DXVECTOR3(seed, seed, seed);
+}
+
+static void make_value(float seed, D3DXVECTOR4& out)
+{
+	out = D3DXVECTOR4(seed, seed, seed, seed);
+}
+
+static void make_value(float seed, D3DXCOLOR& out)
+{
+	out = D3DXCOLOR(seed, seed, seed, 1.0f);
+}
+
+static void make_value(float seed, D3DXMATRIX& out)
+{
+	D3DXMatrixScaling(&out, seed, seed, seed);
+}
+
+static void make_value(float seed, MaterialBlock& out)
+{
+	out = { D3DXCOLOR(seed, seed, seed, 1.0f), D3DXCOLOR(seed, seed, seed, 1.0f), D3DXVECTOR4(seed, 0.0f, 0.0f, 0.0f) };
+}
+
+static void make_value(float seed, StageLights& out)
+{
+	out = {};
+
+	for (auto& light : out.lights)
+	{
+		light.multiplier = seed;
+	}
+}
+
+static std::vector<uint8_t> dirty_pattern(size_t count, double ratio)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	std::vector<uint8_t> result(count);
+
+	for (auto& dirty : result)
+	{
+		dirty = distribution(rng) < ratio;
+	}
+
+	return result;
+}
+
+// Simulates draws that assign, compare and commit a working set of parameters.
+// Each batch of draws is timed as a whole. The phases are measured cumulatively:
+// the batch is run with assignment only, then with the comparison added, then
+// with the commit added, and each phase is the difference from the run before.
+// Parameters are only queued again once committed, so that cost lands in commit.
+template <typename T>
+static void bench_parameter(const char* type, std::vector<Result>& results)
+{
+	enum Phase
+	{
+		Phase_Assign,
+		Phase_Compare,
+		Phase_Commit,
+		Phase_Count
+	};
+
+	const auto device = d3d::device;
+
+	T values[2];
+	make_value(1.0f, values[0]);
+	make_value(2.0f, values[1]);
+
+	for (auto working_set : working_sets)
+	{
+		for (auto ratio : dirty_ratios)
+		{
+			std::vector<std::unique_ptr<ShaderParameter<T>>> parameters;
+			std::vector<uint8_t> current(working_set);
+
+			for (size_t i = 0; i < working_set; i++)
+			{
+				parameters.push_back(std::make_unique<ShaderParameter<T>>(FIRST_REGISTER, values[0], IShaderParameter::Type::both));
+			}
+
+			const auto dirty = dirty_pattern(ITERATIONS * working_set, ratio);
+			long long ticks[Phase_Count] {};
+			size_t modified = 0;
+
+			for (int last = Phase_Assign; last < Phase_Count; last++)
+			{
+				for (size_t j = 0; j < working_set; j++)
+				{
+					*parameters[j] = values[0];
+					parameters[j]->commit_now(device);
+					current[j] = 0;
+				}
+
+				IShaderParameter::values_assigned.clear();
+
+				const auto start = now();
+
+				for (size_t i = 0; i < ITERATIONS; i++)
+				{
+					const auto draw_dirty = &dirty[i * working_set];
+
+					for (size_t j = 0; j < working_set; j++)
+					{
+						current[j] ^= draw_dirty[j];
+						*parameters[j] = values[current[j]];
+					}
+
+					if (last >= Phase_Compare)
+					{
+						for (size_t j = 0; j < working_set; j++)
+						{
+							modified += parameters[j]->is_modified();
+						}
+					}
+
+					if (last >= Phase_Commit)
+					{
+						for (size_t j = 0; j < working_set; j++)
+						{
+							parameters[j]->commit(device);
+						}
+					}
+
+					IShaderParameter::values_assigned.clear();
+				}
+
+				ticks[last] = now() - start;
+			}
+
+			const auto ops = ITERATIONS * working_set;
+			results.push_back({ "assign", type, working_set, ratio, to_ns(ticks[Phase_Assign], ops) });
+			results.push_back({ "is_modified", type, working_set, ratio, to_ns(ticks[Phase_Compare] - ticks[Phase_Assign], ops) });
+			results.push_back({ "commit", type, working_set, ratio, to_ns(ticks[Phase_Commit] - ticks[Phase_Compare], ops) });
+			results.push_back({ "draw", type, working_set, ratio, to_ns(ticks[Phase_Commit], ops) });
+
+			// Keeps the comparisons from being optimized out.
+			if (modified == static_cast<size_t>(-1))
+			{
+				PrintDebug("[lantern] %u\n", static_cast<Uint32>(modified));
+			}
+		}
+	}
+}
+
+// Same math as Direct3D_SetWorldTransform_r.
+static void bench_world_transform(std::vector<Result>& results)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+
+	D3DXMATRIX view;
+	D3DXMatrixRotationYawPitchRoll(&view, 0.5f, 0.25f, 0.0f);
+
+	for (auto working_set : working_sets)
+	{
+		std::vector<D3DXMATRIX> worlds(working_set);
+
+		for (auto& world : worlds)
+		{
+			D3DXMatrixTranslation(&world, distribution(rng), distribution(rng), distribution(rng));
+		}
+
+		D3DXMATRIX sink {};
+		const auto start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			for (auto& world : worlds)
+			{
+				auto wv = world * view;
+				D3DXMatrixInverse(&wv, nullptr, &wv);
+				D3DXMatrixTranspose(&wv, &wv);
+				sink += wv;
+			}
+		}
+
+		results.push_back({ "world_transform", "D3DXMATRIX", working_set, 1.0, to_ns(now() - start, ITERATIONS * working_set) });
+
+		if (sink._11 == 12345.0f)
+		{
+			PrintDebug("[lantern] %f\n", sink._11);
+		}
+	}
+}
+
+static void bench_selection(std::vector<Result>& results)
+{
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<uint32_t> distribution(0, ShaderFlags_Mask);
+
+	for (auto working_set : working_sets)
+	{
+		std::vector<uint32_t> flags(working_set);
+
+		for (auto& f : flags)
+		{
+			f = distribution(rng);
+		}
+
+		uint32_t sink = 0;
+		const auto start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			for (auto f : flags)
+			{
+				f = selection::apply_lod(selection::sanitize(f), static_cast<selection::LodLevel>(i % selection::LodLevel_Count));
+				sink += selection::vs_key(f, false) ^ selection::ps_key(f, false);
+			}
+		}
+
+		results.push_back({ "selection", "Uint32", working_set, 1.0, to_ns(now() - start, ITERATIONS * working_set) });
+
+		if (sink == 12345)
+		{
+			PrintDebug("[lantern] %u\n", sink);
+		}
+	}
+}
+
+// The lookups CorrectMaterial_r makes for a material it has seen before: by
+// the parsed NJS_MATERIAL, or by the D3D material read back from the device.
+// Materials are stored on a miss, as there; the caches are cleared afterwards.
+static void bench_materials(std::vector<Result>& results)
+{
+	constexpr float power = 8.0f;
+
+	for (auto working_set : working_sets)
+	{
+		std::vector<D3DMATERIAL9> uncorrected(working_set);
+		std::vector<materials::Source> sources(working_set);
+		std::vector<NJS_MATERIAL> parsed(working_set);
+
+		for (size_t i = 0; i < working_set; i++)
+		{
+			const auto value = static_cast<float>(i);
+			uncorrected[i] = {};
+			uncorrected[i].Diffuse = { value, value, value, 255.0f };
+			uncorrected[i].Specular = { 255.0f, 255.0f, 255.0f, 255.0f };
+
+			const auto color = static_cast<Uint32>(0xFF000000 | i);
+			sources[i] = { &parsed[i], 0, color, 0xFFFFFFFF, 16.0f, power };
+		}
+
+		float sink = 0.0f;
+		auto start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			for (auto& material : uncorrected)
+			{
+				D3DMATERIAL9 current;
+				d3d::device->GetMaterial(&current);
+
+				auto entry = materials::find(material, power);
+
+				if (entry == nullptr)
+				{
+					entry = &materials::store(material, power);
+				}
+
+				sink += current.Power + entry->block.power.x;
+			}
+		}
+
+		results.push_back({ "material_lookup", "contents", working_set, 0.0, to_ns(now() - start, ITERATIONS * working_set) });
+		start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			for (size_t j = 0; j < working_set; j++)
+			{
+				auto entry = materials::find(sources[j]);
+
+				if (entry == nullptr)
+				{
+					materials::store(sources[j], materials::store(uncorrected[j], power));
+					entry = materials::find(sources[j]);
+				}
+
+				sink += entry->block.power.x;
+			}
+		}
+
+		results.push_back({ "material_lookup", "source", working_set, 0.0, to_ns(now() - start, ITERATIONS * working_set) });
+
+		if (sink == 12345.0f)
+		{
+			PrintDebug("[lantern] %f\n", sink);
+		}
+	}
+
+	materials::clear();
+}
+
+// Render state sets and gets, texture sets and UP draws through d3d::device, i.e.
+// whichever interception is active, against the same calls made on the device
+// behind it. Without the proxy both go through the hooked vtable. The draws are
+// of a degenerate triangle, which rasterizes nothing. D3DRS_TEXTUREFACTOR, the
+// vertex declaration and stream 0 are restored afterwards.
+static void bench_device_calls(std::vector<Result>& results)
+{
+	const auto target = d3d::target_device();
+	const char* interception = d3d::device_proxy_installed() ? "proxy" : "hook";
+
+	DWORD original = 0;
+	d3d::device->GetRenderState(D3DRS_TEXTUREFACTOR, &original);
+
+	struct Case
+	{
+		IDirect3DDevice9* device;
+		const char* type;
+	};
+
+	const Case cases[] = {
+		{ d3d::device, interception },
+		{ target, "direct" }
+	};
+
+	for (const auto& c : cases)
+	{
+		for (auto ratio : { 0.0, 1.0 })
+		{
+			const auto start = now();
+
+			for (size_t i = 0; i < ITERATIONS; i++)
+			{
+				c.device->SetRenderState(D3DRS_TEXTUREFACTOR, ratio > 0.0 ? static_cast<DWORD>(i) : original);
+			}
+
+			results.push_back({ "set_render_state", c.type, 1, ratio, to_ns(now() - start, ITERATIONS) });
+		}
+
+		DWORD sink = 0;
+		const auto start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			DWORD value = 0;
+			c.device->GetRenderState(D3DRS_TEXTUREFACTOR, &value);
+			sink += value;
+		}
+
+		results.push_back({ "get_render_state", c.type, 1, 0.0, to_ns(now() - start, ITERATIONS) });
+
+		if (sink == 12345)
+		{
+			PrintDebug("[lantern] %u\n", static_cast<Uint32>(sink));
+		}
+	}
+
+	// Through the proxy too, so its shadow agrees with the device.
+	target->SetRenderState(D3DRS_TEXTUREFACTOR, original);
+	d3d::device->SetRenderState(D3DRS_TEXTUREFACTOR, original);
+
+	CComPtr<IDirect3DBaseTexture9> texture;
+	CComPtr<IDirect3DVertexDeclaration9> declaration;
+	CComPtr<IDirect3DVertexBuffer9> stream;
+	UINT offset = 0;
+	UINT stride = 0;
+
+	d3d::device->GetTexture(0, &texture);
+	d3d::device->GetVertexDeclaration(&declaration);
+	d3d::device->GetStreamSource(0, &stream, &offset, &stride);
+
+	const float triangle[3][4] = {
+		{ 0.0f, 0.0f, 0.0f, 1.0f },
+		{ 0.0f, 0.0f, 0.0f, 1.0f },
+		{ 0.0f, 0.0f, 0.0f, 1.0f },
+	};
+
+	for (const auto& c : cases)
+	{
+		auto start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			c.device->SetTexture(0, texture);
+		}
+
+		results.push_back({ "set_texture", c.type, 1, 0.0, to_ns(now() - start, ITERATIONS) });
+
+		c.device->SetFVF(D3DFVF_XYZRHW);
+		start = now();
+
+		for (size_t i = 0; i < ITERATIONS; i++)
+		{
+			c.device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, triangle, sizeof(triangle[0]));
+		}
+
+		results.push_back({ "draw_primitive_up", c.type, 1, 0.0, to_ns(now() - start, ITERATIONS) });
+
+		// Through the hooks, which submit any UP batch the draws left open.
+		d3d::device->SetVertexDeclaration(declaration);
+	}
+
+	d3d::device->SetStreamSource(0, stream, offset, stride);
+}
+
+namespace benchmark
+{
+	bool run(const std::string& path)
+	{
+		if (d3d::device == nullptr)
+		{
+			return false;
+		}
+
+		// The cases assign parameters of their own; the game's pending ones are restored afterwards.
+		std::vector<IShaderParameter*> assigned;
+		assigned.swap(IShaderParameter::values_assigned);
+		const auto on_assign = IShaderParameter::on_assign;
+		IShaderParameter::on_assign = nullptr;
+
+		std::vector<Result> results;
+
+		bench_parameter<bool>("bool", results);
+		bench_parameter<int>("int", results);
+		bench_parameter<float>("float", results);
+		bench_parameter<D3DXVECTOR2>("D3DXVECTOR2", results);
+		bench_parameter<D3DXVECTOR3>("D3DXVECTOR3", results);
+		bench_parameter<D3DXVECTOR4>("D3DXVECTOR4", results);
+		bench_parameter<D3DXCOLOR>("D3DXCOLOR", results);
+		bench_parameter<D3DXMATRIX>("D3DXMATRIX", results);
+		bench_parameter<MaterialBlock>("MaterialBlock", results);
+		bench_parameter<StageLights>("StageLights", results);
+		bench_world_transform(results);
+		bench_selection(results);
+		bench_materials(results);
+		bench_device_calls(results);
+
+		IShaderParameter::values_assigned.swap(assigned);
+		IShaderParameter::on_assign = on_assign;
+
+		std::ofstream file(path, std::ios::out | std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			PrintDebug("[lantern] Failed to open benchmark file: %s\n", path.c_str());
+			return false;
+		}
+
+		file << "{\n\t\"iterations\": " << ITERATIONS << ",\n\t\"cases\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const auto& r = results[i];
+
+			file << "\t\t{ \"name\": \"" << r.name << "\", \"type\": \"" << r.type
+				<< "\", \"working_set\": " << r.working_set
+				<< ", \"dirty_ratio\": " << r.dirty_ratio
+				<< ", \"ns_per_op\": " << r.ns_per_op
+				<< (i + 1 < results.size() ? " },\n" : " }\n");
+		}
+
+		file << "\t]\n}\n";
+
+		PrintDebug("[lantern] Wrote %u benchmark results to %s\n", static_cast<Uint32>(results.size()), path.c_str());
+		return true;
+	}
+}
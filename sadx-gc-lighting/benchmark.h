@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+// Microbenchmarks of the per-draw CPU work: shader parameter assignment,
+// comparison and commits, the world transform math, shader selection,
+// material lookups and the overhead of intercepting state, texture and draw
+// calls.
+// Must be called from the render thread while the device is idle between
+// draws, e.g. from OnFrame. Commits go to constant registers the shaders
+// don't use.
+
+namespace benchmark
+{
+	// Runs every case and writes the results as JSON to path.
+	bool run(const std::string& path);
+}
@@ -0,0 +1,225 @@
+#include "stdafx.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "ShaderParameter.h"
+
+using namespace capture_format;
+
+// Initial capacity of a frame buffer. Buffers are reused between frames.
+static constexpr size_t FRAME_BUFFER_SIZE = 1024 * 1024;
+
+static std::vector<uint8_t> frame_buffer;
+static unsigned int frames_left = 0;
+static bool limited = false;
+static uint32_t frame_number = 0;
+
+static std::thread writer_thread;
+static std::mutex writer_mutex;
+static std::condition_variable writer_condition;
+static std::deque<std::vector<uint8_t>> writer_queue;
+static std::vector<std::vector<uint8_t>> spare_buffers;
+static bool writer_running = false;
+
+static void writer(std::ofstream file)
+{
+	std::vector<uint8_t> buffer;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(writer_mutex);
+
+			// Hands the last buffer back to the render thread for reuse.
+			if (buffer.capacity() > 0)
+			{
+				buffer.clear();
+				spare_buffers.push_back(std::move(buffer));
+			}
+
+			writer_condition.wait(lock, [] { return !writer_running || !writer_queue.empty(); });
+
+			if (writer_queue.empty() && !writer_running)
+			{
+				break;
+			}
+
+			buffer = std::move(writer_queue.front());
+			writer_queue.pop_front();
+		}
+
+		file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	}
+
+	file.flush();
+}
+
+static void on_assign(int index, IShaderParameter::Type::T type, bool sampler, const void* data, size_t size)
+{
+	Parameter parameter {};
+	parameter.index = static_cast<uint16_t>(index);
+	parameter.kind = static_cast<uint8_t>(type | (sampler ? ParameterKind_Sampler : 0));
+
+	capture::write(EventType::parameter, &parameter, sizeof(Parameter), data, size);
+}
+
+static void submit_frame()
+{
+	std::vector<uint8_t> next;
+
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex);
+
+		writer_queue.push_back(std::move(frame_buffer));
+
+		if (!spare_buffers.empty())
+		{
+			next = std::move(spare_buffers.back());
+			spare_buffers.pop_back();
+		}
+	}
+
+	writer_condition.notify_one();
+
+	frame_buffer = std::move(next);
+	frame_buffer.reserve(FRAME_BUFFER_SIZE);
+}
+
+namespace capture
+{
+	bool recording = false;
+
+	bool start(const std::string& path, unsigned int frames)
+	{
+		stop();
+
+		std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			PrintDebug("[lantern] Failed to open capture file: %s\n", path.c_str());
+			return false;
+		}
+
+		FileHeader header {};
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.header_size = sizeof(FileHeader);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+
+		frame_buffer.clear();
+		frame_buffer.reserve(FRAME_BUFFER_SIZE);
+
+		frames_left = frames;
+		limited = frames > 0;
+		frame_number = 0;
+
+		writer_running = true;
+		writer_thread = std::thread(writer, std::move(file));
+
+		// The first frame record is written once the current frame ends.
+		PrintDebug("[lantern] Capturing %u frames to %s\n", frames, path.c_str());
+		return true;
+	}
+
+	void stop()
+	{
+		if (!writer_thread.joinable())
+		{
+			return;
+		}
+
+		if (recording && !frame_buffer.empty())
+		{
+			submit_frame();
+		}
+
+		recording = false;
+		IShaderParameter::on_assign = nullptr;
+
+		{
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			writer_running = false;
+		}
+
+		writer_condition.notify_one();
+		writer_thread.join();
+
+		frame_buffer = {};
+		spare_buffers.clear();
+
+		PrintDebug("[lantern] Capture finished after %u frames\n", frame_number);
+	}
+
+	void end_frame()
+	{
+		if (!writer_running)
+		{
+			return;
+		}
+
+		if (recording)
+		{
+			submit_frame();
+
+			if (limited && --frames_left == 0)
+			{
+				stop();
+				return;
+			}
+		}
+
+		recording = true;
+		IShaderParameter::on_assign = on_assign;
+		write(EventType::frame, Frame { frame_number++ });
+	}
+
+	void write(EventType type, const void* data, size_t size)
+	{
+		write(type, data, size, nullptr, 0);
+	}
+
+	bool first_frame()
+	{
+		return recording && frame_number == 1;
+	}
+
+	void write(EventType type, const void* header, size_t header_size, const void* data, size_t size,
+		const void* more_data, size_t more_size)
+	{
+		if (header_size + size + more_size > MAX_RECORD_SIZE)
+		{
+			size = 0;
+			more_size = 0;
+		}
+
+		const auto record_size = static_cast<uint32_t>(header_size + size + more_size);
+		const RecordHeader record = { type, static_cast<uint8_t>(record_size >> 16), static_cast<uint16_t>(record_size) };
+		const auto offset = frame_buffer.size();
+
+		frame_buffer.resize(offset + sizeof(RecordHeader) + record_size);
+
+		auto p = frame_buffer.data() + offset;
+		memcpy(p, &record, sizeof(RecordHeader));
+		memcpy(p + sizeof(RecordHeader), header, header_size);
+		p += sizeof(RecordHeader) + header_size;
+
+		if (size > 0)
+		{
+			memcpy(p, data, size);
+		}
+
+		if (more_size > 0)
+		{
+			memcpy(p + size, more_data, more_size);
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+#include "CaptureFormat.h"
+
+// Records the events the mod sees into a binary capture (see CaptureFormat.h).
+// Events are appended to an in-memory buffer and handed to a background
+// thread once per frame, so call sites only pay for a copy while recording
+// and a single branch on capture::recording otherwise.
+
+namespace capture
+{
+	extern bool recording;
+
+	// Records the given number of frames (0 for no limit) to path, starting with the next frame.
+	bool start(const std::string& path, unsigned int frames);
+	void stop();
+
+	void end_frame();
+	// True during the first captured frame, which starts with a snapshot of the state.
+	bool first_frame();
+
+	void write(capture_format::EventType type, const void* data, size_t size);
+	// Data that would make the record larger than MAX_RECORD_SIZE is left out.
+	void write(capture_format::EventType type, const void* header, size_t header_size, const void* data, size_t size,
+		const void* more_data = nullptr, size_t more_size = 0);
+
+	template <typename T>
+	void write(capture_format::EventType type, const T& data)
+	{
+		write(type, &data, sizeof(T));
+	}
+
+	// Identity of a Direct3D object within a capture.
+	inline uint32_t id(const void* object)
+	{
+		return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(object));
+	}
+}
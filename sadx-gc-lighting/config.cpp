@@ -0,0 +1,81 @@
+#include "stdafx.h"
+
+#include <Windows.h>
+#include <cstdlib>
+#include <string>
+
+#include "config.h"
+
+namespace config
+{
+	bool batch_up = false;
+	bool vertex_lighting = false;
+	bool uber_shader = false;
+	bool state_blocks = false;
+	bool device_proxy = false;
+	bool partial_precision = false;
+	bool multi_light = false;
+	bool fog_table = false;
+
+	bool  lod_enabled                  = false;
+	float lod_specular_distance        = 1500.0f;
+	float lod_vertex_lighting_distance = 4000.0f;
+	float lod_hysteresis               = 100.0f;
+
+	bool depth_prepass        = false;
+	bool depth_prepass_report = false;
+
+	bool alpha_analysis = false;
+	bool alpha_report   = false;
+
+	bool metrics_csv = false;
+	bool trace       = false;
+
+	float hitch_budget      = 0.0f;
+	bool  frame_time_report = false;
+
+	bool gpu_profile = false;
+
+	static bool get_bool(const char* section, const char* key, bool default_value, const std::string& path)
+	{
+		return GetPrivateProfileIntA(section, key, default_value ? 1 : 0, path.c_str()) != 0;
+	}
+
+	static float get_float(const char* section, const char* key, float default_value, const std::string& path)
+	{
+		char buffer[32] {};
+		GetPrivateProfileStringA(section, key, "", buffer, sizeof(buffer), path.c_str());
+		return buffer[0] ? static_cast<float>(atof(buffer)) : default_value;
+	}
+
+	void load(const std::string& path)
+	{
+		batch_up = get_bool("Performance", "BatchUP", batch_up, path);
+		vertex_lighting = get_bool("Performance", "VertexLighting", vertex_lighting, path);
+		uber_shader = get_bool("Performance", "UberShader", uber_shader, path);
+		state_blocks = get_bool("Performance", "StateBlocks", state_blocks, path);
+		device_proxy = get_bool("Performance", "DeviceProxy", device_proxy, path);
+		partial_precision = get_bool("Performance", "PartialPrecision", partial_precision, path);
+		multi_light = get_bool("Lighting", "MultiLight", multi_light, path);
+		fog_table = get_bool("Lighting", "FogTable", fog_table, path);
+
+		lod_enabled                  = get_bool("LOD", "Enabled", lod_enabled, path);
+		lod_specular_distance        = get_float("LOD", "SpecularDistance", lod_specular_distance, path);
+		lod_vertex_lighting_distance = get_float("LOD", "VertexLightingDistance", lod_vertex_lighting_distance, path);
+		lod_hysteresis               = get_float("LOD", "Hysteresis", lod_hysteresis, path);
+
+		depth_prepass        = get_bool("DepthPrepass", "Enabled", depth_prepass, path);
+		depth_prepass_report = get_bool("DepthPrepass", "Report", depth_prepass_report, path);
+
+		alpha_analysis = get_bool("Performance", "AlphaAnalysis", alpha_analysis, path);
+		alpha_report   = get_bool("Performance", "AlphaReport", alpha_report, path);
+
+		metrics_csv = get_bool("Metrics", "CSV", metrics_csv, path);
+		trace       = get_bool("Metrics", "Trace", trace, path);
+
+		hitch_budget      = get_float("Metrics", "HitchBudget", hitch_budget, path);
+		frame_time_report = get_bool("Metrics", "FrameTimeReport", frame_time_report, path);
+
+		gpu_profile = get_bool("Metrics", "GpuProfile", gpu_profile, path);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+namespace config
+{
+	// Route DrawPrimitiveUP/DrawIndexedPrimitiveUP through dynamic ring buffers
+	// and merge consecutive compatible draws.
+	extern bool batch_up;
+
+	// Performance tier: evaluate lighting and fog per vertex instead of per pixel.
+	extern bool vertex_lighting;
+
+	// Compile one shader per stage and lighting tier, selecting features with
+	// static branches on boolean registers instead of switching permutations.
+	extern bool uber_shader;
+
+	// Record the boolean constants (uber shader) and fog table sampler states
+	// of a permutation into a state block and apply it with one call when
+	// they change. Shaders are bound on their own, so without the uber shader
+	// only fog table permutations use a block.
+	extern bool state_blocks;
+
+	// Intercept device calls by standing in for d3d8to9's Direct3D 9 device
+	// rather than hooking its vtable. Drops redundant render and sampler states.
+	extern bool device_proxy;
+
+	// Use partial precision for color math in the pixel shaders.
+	extern bool partial_precision;
+
+	// Let objects lit by the stage lights receive the secondary stage lights as well.
+	extern bool multi_light;
+
+	// Sample the game's fog table from a texture instead of evaluating the fog formula.
+	extern bool fog_table;
+
+	// Distance based shader level of detail, using view space depth.
+	extern bool  lod_enabled;
+	extern float lod_specular_distance;
+	extern float lod_vertex_lighting_distance;
+	extern float lod_hysteresis;
+
+	// Draw opaque land table geometry depth only first, then shade it with an equal depth test.
+	extern bool depth_prepass;
+	// Measure land table pixel shader invocations and print a summary per stage.
+	extern bool depth_prepass_report;
+
+	// Skip the alpha test for materials whose textures never go below the alpha reference.
+	extern bool alpha_analysis;
+	// Print the number of draws that skipped the alpha test per stage.
+	extern bool alpha_report;
+
+	// Write per-frame rendering counters to metrics.csv in the mod folder.
+	extern bool metrics_csv;
+
+	// Record timing zones from startup. The trace is written by DumpTrace.
+	extern bool trace;
+
+	// Frames taking longer than this many milliseconds are logged as hitches. 0 disables it.
+	extern float hitch_budget;
+	// Print frame time percentiles per stage.
+	extern bool frame_time_report;
+
+	// Measure GPU time per shader permutation with timestamp queries and print it per stage.
+	extern bool gpu_profile;
+
+	void load(const std::string& path);
+}
@@ -17,6 +17,9 @@
 #include <MinHook.h>
 
 // Standard library
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iomanip>
 #include <sstream>
 #include <vector>
@@ -28,6 +31,20 @@
 #include "globals.h"
 #include "ShaderParameter.h"
 #include "FileSystem.h"
+#include "UPBatcher.h"
+#include "config.h"
+#include "materials.h"
+#include "textures.h"
+#include "metrics.h"
+#include "trace.h"
+#include "TimestampQueries.h"
+#include "capture.h"
+#include "DeviceProxy.h"
+#include "ShaderState.h"
+#include "DrawRecorder.h"
+
+// For hooking IDirect3D9::CreateDevice.
+#pragma comment(lib, "d3d9.lib")
 
 namespace param
 {
@@ -39,19 +56,22 @@ namespace param
 
 	ShaderParameter<D3DXVECTOR3> NormalScale(20, { 1.0f, 1.0f, 1.0f }, IShaderParameter::Type::vertex);
 	ShaderParameter<D3DXVECTOR3> LightDirection(21, { 0.0f, -1.0f, 0.0f }, IShaderParameter::Type::both);
-	ShaderParameter<int>         DiffuseSource(22, 0, IShaderParameter::Type::vertex);
-	ShaderParameter<D3DXCOLOR>   MaterialDiffuse(23, {}, IShaderParameter::Type::vertex);
+	ShaderParameter<D3DXVECTOR2> FogTableScale(23, { 0.0f, 0.0f }, IShaderParameter::Type::pixel);
 
-	ShaderParameter<int>         FogMode(24, 0, IShaderParameter::Type::pixel);
-	ShaderParameter<D3DXVECTOR3> FogConfig(25, {}, IShaderParameter::Type::pixel);
+	ShaderParameter<D3DXVECTOR4> FogConfig(25, { 0.0f, 1.0f, 0.0f, 0.0f }, IShaderParameter::Type::both);
 	ShaderParameter<D3DXCOLOR>   FogColor(26, {}, IShaderParameter::Type::pixel);
+	ShaderParameter<Texture>     FogTable(1, nullptr, IShaderParameter::Type::pixel);
 
 	ShaderParameter<D3DXVECTOR3> CameraPosition(27, { 0.0f, 0.0f, 0.0f }, IShaderParameter::Type::vertex);
-	ShaderParameter<D3DXCOLOR>   MaterialSpecular(28, {}, IShaderParameter::Type::pixel);
-	ShaderParameter<float>       MaterialPower(29, 1.0f, IShaderParameter::Type::pixel);
-	ShaderParameter<D3DXCOLOR>   LightDiffuse(30, {}, IShaderParameter::Type::pixel);
-	ShaderParameter<D3DXCOLOR>   LightSpecular(31, {}, IShaderParameter::Type::pixel);
-	ShaderParameter<D3DXCOLOR>   LightAmbient(32, {}, IShaderParameter::Type::pixel);
+	ShaderParameter<D3DXCOLOR>   LightDiffuse(30, {}, IShaderParameter::Type::both);
+	ShaderParameter<D3DXCOLOR>   LightSpecular(31, {}, IShaderParameter::Type::both);
+	ShaderParameter<D3DXCOLOR>   LightAmbient(32, {}, IShaderParameter::Type::both);
+
+	ShaderParameter<MaterialBlock> Material(33, { { 1.0f, 1.0f, 1.0f, 1.0f }, {}, { 1.0f, 0.0f, 0.0f, 0.0f } },
+		IShaderParameter::Type::both);
+
+	ShaderParameter<StageLights> Lights(36, {}, IShaderParameter::Type::both);
+	ShaderParameter<D3DXVECTOR4> LightWeights(52, {}, IShaderParameter::Type::both);
 
 	IShaderParameter* const parameters[] = {
 		&WorldMatrix,
@@ -61,17 +81,17 @@ namespace param
 		&TextureTransform,
 		&NormalScale,
 		&LightDirection,
-		&DiffuseSource,
-		&MaterialDiffuse,
-		&FogMode,
 		&FogConfig,
 		&FogColor,
+		&FogTableScale,
+		&FogTable,
 		&CameraPosition,
-		&MaterialSpecular,
-		&MaterialPower,
 		&LightDiffuse,
 		&LightSpecular,
-		&LightAmbient
+		&LightAmbient,
+		&Material,
+		&Lights,
+		&LightWeights
 	};
 
 	static void release_parameters()
@@ -123,28 +143,158 @@ namespace local
 		CONST void* pVertexStreamZeroData,
 		UINT VertexStreamZeroStride);
 
+	static HRESULT __stdcall Present_r(IDirect3DDevice9* _this,
+		CONST RECT* pSourceRect,
+		CONST RECT* pDestRect,
+		HWND hDestWindowOverride,
+		CONST RGNDATA* pDirtyRegion);
+	static HRESULT __stdcall EndScene_r(IDirect3DDevice9* _this);
+	static HRESULT __stdcall Clear_r(IDirect3DDevice9* _this,
+		DWORD Count,
+		CONST D3DRECT* pRects,
+		DWORD Flags,
+		D3DCOLOR Color,
+		float Z,
+		DWORD Stencil);
+	static HRESULT __stdcall SetRenderTarget_r(IDirect3DDevice9* _this, DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget);
+	static HRESULT __stdcall SetDepthStencilSurface_r(IDirect3DDevice9* _this, IDirect3DSurface9* pNewZStencil);
+	static HRESULT __stdcall SetTransform_r(IDirect3DDevice9* _this, D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix);
+	static HRESULT __stdcall SetViewport_r(IDirect3DDevice9* _this, CONST D3DVIEWPORT9* pViewport);
+	static HRESULT __stdcall SetMaterial_r(IDirect3DDevice9* _this, CONST D3DMATERIAL9* pMaterial);
+	static HRESULT __stdcall SetLight_r(IDirect3DDevice9* _this, DWORD Index, CONST D3DLIGHT9* pLight);
+	static HRESULT __stdcall LightEnable_r(IDirect3DDevice9* _this, DWORD Index, BOOL Enable);
+	static HRESULT __stdcall SetClipPlane_r(IDirect3DDevice9* _this, DWORD Index, CONST float* pPlane);
+	static HRESULT __stdcall SetRenderState_r(IDirect3DDevice9* _this, D3DRENDERSTATETYPE State, DWORD Value);
+	static HRESULT __stdcall SetTexture_r(IDirect3DDevice9* _this, DWORD Stage, IDirect3DBaseTexture9* pTexture);
+	static HRESULT __stdcall SetTextureStageState_r(IDirect3DDevice9* _this, DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value);
+	static HRESULT __stdcall SetSamplerState_r(IDirect3DDevice9* _this, DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value);
+	static HRESULT __stdcall SetScissorRect_r(IDirect3DDevice9* _this, CONST RECT* pRect);
+	static HRESULT __stdcall SetVertexDeclaration_r(IDirect3DDevice9* _this, IDirect3DVertexDeclaration9* pDecl);
+	static HRESULT __stdcall SetFVF_r(IDirect3DDevice9* _this, DWORD FVF);
+	static HRESULT __stdcall SetVertexShader_r(IDirect3DDevice9* _this, IDirect3DVertexShader9* pShader);
+	static HRESULT __stdcall SetVertexShaderConstantF_r(IDirect3DDevice9* _this, UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount);
+	static HRESULT __stdcall SetVertexShaderConstantB_r(IDirect3DDevice9* _this, UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount);
+	static HRESULT __stdcall SetStreamSource_r(IDirect3DDevice9* _this, UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride);
+	static HRESULT __stdcall SetIndices_r(IDirect3DDevice9* _this, IDirect3DIndexBuffer9* pIndexData);
+	static HRESULT __stdcall SetPixelShader_r(IDirect3DDevice9* _this, IDirect3DPixelShader9* pShader);
+	static HRESULT __stdcall SetPixelShaderConstantF_r(IDirect3DDevice9* _this, UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount);
+	static HRESULT __stdcall SetPixelShaderConstantB_r(IDirect3DDevice9* _this, UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount);
+
 	static decltype(DrawPrimitive_r)*          DrawPrimitive_t          = nullptr;
 	static decltype(DrawIndexedPrimitive_r)*   DrawIndexedPrimitive_t   = nullptr;
 	static decltype(DrawPrimitiveUP_r)*        DrawPrimitiveUP_t        = nullptr;
 	static decltype(DrawIndexedPrimitiveUP_r)* DrawIndexedPrimitiveUP_t = nullptr;
 
+	static decltype(Present_r)*                  Present_t                  = nullptr;
+	static decltype(EndScene_r)*                 EndScene_t                 = nullptr;
+	static decltype(Clear_r)*                    Clear_t                    = nullptr;
+	static decltype(SetRenderTarget_r)*          SetRenderTarget_t          = nullptr;
+	static decltype(SetDepthStencilSurface_r)*   SetDepthStencilSurface_t   = nullptr;
+	static decltype(SetTransform_r)*             SetTransform_t             = nullptr;
+	static decltype(SetViewport_r)*              SetViewport_t              = nullptr;
+	static decltype(SetMaterial_r)*              SetMaterial_t              = nullptr;
+	static decltype(SetLight_r)*                 SetLight_t                 = nullptr;
+	static decltype(LightEnable_r)*              LightEnable_t              = nullptr;
+	static decltype(SetClipPlane_r)*             SetClipPlane_t             = nullptr;
+	static decltype(SetRenderState_r)*           SetRenderState_t           = nullptr;
+	static decltype(SetTexture_r)*               SetTexture_t               = nullptr;
+	static decltype(SetTextureStageState_r)*     SetTextureStageState_t     = nullptr;
+	static decltype(SetSamplerState_r)*          SetSamplerState_t          = nullptr;
+	static decltype(SetScissorRect_r)*           SetScissorRect_t           = nullptr;
+	static decltype(SetVertexDeclaration_r)*     SetVertexDeclaration_t     = nullptr;
+	static decltype(SetFVF_r)*                   SetFVF_t                   = nullptr;
+	static decltype(SetVertexShader_r)*          SetVertexShader_t          = nullptr;
+	static decltype(SetVertexShaderConstantF_r)* SetVertexShaderConstantF_t = nullptr;
+	static decltype(SetVertexShaderConstantB_r)* SetVertexShaderConstantB_t = nullptr;
+	static decltype(SetStreamSource_r)*          SetStreamSource_t          = nullptr;
+	static decltype(SetIndices_r)*               SetIndices_t               = nullptr;
+	static decltype(SetPixelShader_r)*           SetPixelShader_t           = nullptr;
+	static decltype(SetPixelShaderConstantF_r)*  SetPixelShaderConstantF_t  = nullptr;
+	static decltype(SetPixelShaderConstantB_r)*  SetPixelShaderConstantB_t  = nullptr;
+
 	constexpr auto COMPILER_FLAGS = D3DXSHADER_PACKMATRIX_ROWMAJOR | D3DXSHADER_OPTIMIZATION_LEVEL3;
 
 	constexpr auto DEFAULT_FLAGS = ShaderFlags_Alpha | ShaderFlags_Fog | ShaderFlags_Light | ShaderFlags_Specular | ShaderFlags_Texture;
-	constexpr auto VS_FLAGS = ShaderFlags_Texture | ShaderFlags_EnvMap;
-	constexpr auto PS_FLAGS = ShaderFlags_Texture | ShaderFlags_Alpha | ShaderFlags_Fog | ShaderFlags_Light | ShaderFlags_Specular;
 
 	static Uint32 shader_flags = DEFAULT_FLAGS;
-	static Uint32 last_flags = DEFAULT_FLAGS;
+
+	// When set, each lighting tier compiles to a single shader per stage and the
+	// remaining flags are evaluated as static branches on boolean registers.
+	static bool uber_shader = false;
+
+	// Pixel shaders use partial precision color math. Cached separately.
+	static bool partial_precision = false;
 
 	static std::vector<uint8_t> shader_file;
 	static std::unordered_map<ShaderFlags, VertexShader> vertex_shaders;
 	static std::unordered_map<ShaderFlags, PixelShader> pixel_shaders;
 
+	// Stands in for d3d8to9's Direct3D 9 device when config::device_proxy is
+	// set and could be installed; otherwise the device's vtable is hooked.
+	static DeviceProxy* device_proxy = nullptr;
+
+	// The texture last set on stage 0, so alpha analysis doesn't ask the
+	// device (and AddRef it) on every draw. The device holds the reference.
+	static IDirect3DBaseTexture9* stage0_texture = nullptr;
+
 	static bool initialized = false;
 	static Uint32 drawing = 0;
-	static bool using_shader = false;
+	// Enough for every USE_ define plus the terminator; reserved once.
+	constexpr size_t MAX_MACROS = 20;
 	static std::vector<D3DXMACRO> macros;
+	static UPBatcher up_batcher;
+
+	// View space depth of the current world transform.
+	static float view_depth = 0.0f;
+	// The model currently being drawn, used to apply hysteresis per model.
+	static const NJS_MODEL_SADX* current_model = nullptr;
+
+	// Last level of detail per model, for hysteresis. Direct mapped by address so
+	// the draw path never allocates; a model whose slot was taken by another one
+	// simply starts over without hysteresis.
+	struct ModelLod
+	{
+		const NJS_MODEL_SADX* model;
+		selection::LodLevel level;
+	};
+
+	constexpr size_t MODEL_LOD_SLOTS = 4096;
+	static ModelLod model_lod[MODEL_LOD_SLOTS] {};
+	static LodCounters lod_counters {};
+	static LodCounters lod_counters_last {};
+
+	static DepthPass depth_pass = DepthPass::none;
+	static VertexShader depth_vs;
+	static PixelShader depth_ps;
+	// Opaque draws of the pre-pass, shaded once their depth is in.
+	static DrawRecorder draw_recorder;
+
+	// Color writes of the game, restored after each depth only draw.
+	static bool color_masked = false;
+	static DWORD color_write = 0;
+
+	// Allocation count at the start of the current draw.
+	static Uint32 draw_allocations = 0;
+
+	static Query prepass_query;
+	static Query main_query;
+	static bool prepass_query_pending = false;
+	static bool main_query_pending = false;
+	static DWORD main_query_viewport = 0;
+	static DepthPassCounters depth_counters {};
+	static int report_level = -1;
+	static int report_act = -1;
+
+	// Same as AlphaRef in the shader.
+	constexpr float ALPHA_REF = 16.0f / 255.0f;
+	static AlphaCounters alpha_counters {};
+
+	// GPU time per shader permutation. Runs of draws without the mod's
+	// shaders are attributed to these pseudo permutations instead.
+	constexpr Uint32 GPU_KEY_FIXED_FUNCTION = 0xFFFFFFFF;
+	constexpr Uint32 GPU_KEY_DEPTH          = 0xFFFFFFFE;
+	static TimestampQueries timestamp_queries;
+	static GpuProfiler gpu_profiler(&timestamp_queries);
 
 	DataPointer(Direct3DDevice8*, Direct3D_Device, 0x03D128B0);
 	DataPointer(D3DXMATRIX, TransformationMatrix, 0x03D0FD80);
@@ -153,24 +303,43 @@ namespace local
 	DataPointer(D3DXMATRIX, _ProjectionMatrix, 0x03D129C0);
 	DataPointer(int, TransformAndViewportInvalid, 0x03D0FD1C);
 
-	static auto sanitize(Uint32& flags)
+	// The view matrix last written to the capture; it's only written when it changes.
+	static D3DXMATRIX capture_view {};
+
+	static VertexShader get_vertex_shader(Uint32 flags);
+	static PixelShader get_pixel_shader(Uint32 flags);
+	static void flush_batch();
+
+	class ShaderSource : public ShaderState::IShaderSource
 	{
-		flags &= ShaderFlags_Mask;
+	public:
+		VertexShader vertex_shader(Uint32 flags) override
+		{
+			return get_vertex_shader(flags);
+		}
 
-		if (flags & ShaderFlags_EnvMap && !(flags & ShaderFlags_Texture))
+		PixelShader pixel_shader(Uint32 flags) override
 		{
-			flags &= ~ShaderFlags_EnvMap;
+			return get_pixel_shader(flags);
 		}
 
-		return flags;
-	}
+		// Batched draws must go out with the states they were queued with.
+		void flush() override
+		{
+			flush_batch();
+		}
+	};
+
+	static ShaderSource shader_source;
+	static ShaderState shader_state(shader_source, metrics::current);
 
 	static void free_shaders()
 	{
+		shader_state.release();
 		vertex_shaders.clear();
 		pixel_shaders.clear();
-		d3d::vertex_shader = nullptr;
-		d3d::pixel_shader = nullptr;
+		depth_vs = nullptr;
+		depth_ps = nullptr;
 	}
 
 	static void clear_shaders()
@@ -179,29 +348,32 @@ namespace local
 		free_shaders();
 	}
 
-	static VertexShader get_vertex_shader(Uint32 flags);
-	static PixelShader get_pixel_shader(Uint32 flags);
-
 	static void create_shaders()
 	{
 		try
 		{
-			d3d::vertex_shader = get_vertex_shader(DEFAULT_FLAGS);
-			d3d::pixel_shader = get_pixel_shader(DEFAULT_FLAGS);
+			shader_state.uber_shader = uber_shader;
+			shader_state.reset(DEFAULT_FLAGS);
 
 		#ifdef PRECOMPILE_SHADERS
 			for (Uint32 i = 0; i < ShaderFlags_Count; i++)
 			{
-				auto flags = i;
-				local::sanitize(flags);
+				const auto flags = selection::sanitize(i);
 
-				auto vs = static_cast<ShaderFlags>(flags & VS_FLAGS);
+				// Only the active lighting tier is precompiled; the other is compiled on demand.
+				// Shader LOD uses both tiers, so everything is precompiled in that case.
+				if (!config::lod_enabled && (flags & ShaderFlags_VertexLit) != (shader_flags & ShaderFlags_VertexLit))
+				{
+					continue;
+				}
+
+				auto vs = static_cast<ShaderFlags>(selection::vs_key(flags, uber_shader));
 				if (vertex_shaders.find(vs) == vertex_shaders.end())
 				{
 					get_vertex_shader(flags);
 				}
 
-				auto ps = static_cast<ShaderFlags>(flags & PS_FLAGS);
+				auto ps = static_cast<ShaderFlags>(selection::ps_key(flags, uber_shader));
 				if (pixel_shaders.find(ps) == pixel_shaders.end())
 				{
 					get_pixel_shader(flags);
@@ -213,11 +385,12 @@ namespace local
 			{
 				i->commit_now(d3d::device);
 			}
+
+			shader_state.rebuild_state_blocks();
 		}
 		catch (std::exception& ex)
 		{
-			d3d::vertex_shader = nullptr;
-			d3d::pixel_shader = nullptr;
+			shader_state.release();
 			MessageBoxA(WindowHandle, ex.what(), "Shader creation failed", MB_OK | MB_ICONERROR);
 		}
 	}
@@ -244,6 +417,38 @@ namespace local
 				continue;
 			}
 
+			if (flags & ShaderFlags_FogExp)
+			{
+				flags &= ~ShaderFlags_FogExp;
+				result << "USE_FOG_EXP";
+				thing = true;
+				continue;
+			}
+
+			if (flags & ShaderFlags_FogExp2)
+			{
+				flags &= ~ShaderFlags_FogExp2;
+				result << "USE_FOG_EXP2";
+				thing = true;
+				continue;
+			}
+
+			if (flags & ShaderFlags_VertexColor)
+			{
+				flags &= ~ShaderFlags_VertexColor;
+				result << "USE_VERTEX_COLOR";
+				thing = true;
+				continue;
+			}
+
+			if (flags & ShaderFlags_FogTable)
+			{
+				flags &= ~ShaderFlags_FogTable;
+				result << "USE_FOG_TABLE";
+				thing = true;
+				continue;
+			}
+
 			if (flags & ShaderFlags_Light)
 			{
 				flags &= ~ShaderFlags_Light;
@@ -252,6 +457,22 @@ namespace local
 				continue;
 			}
 
+			if (flags & ShaderFlags_MultiLight)
+			{
+				flags &= ~ShaderFlags_MultiLight;
+				result << "USE_MULTILIGHT";
+				thing = true;
+				continue;
+			}
+
+			if (flags & ShaderFlags_VertexLit)
+			{
+				flags &= ~ShaderFlags_VertexLit;
+				result << "USE_VERTEX_LIGHTING";
+				thing = true;
+				continue;
+			}
+
 			if (flags & ShaderFlags_Specular)
 			{
 				flags &= ~ShaderFlags_Specular;
@@ -412,26 +633,33 @@ namespace local
 		file.close();
 	}
 
-	static auto shader_id(Uint32 flags)
+	static std::string shader_id(Uint32 flags)
 	{
-		std::stringstream result;
-
-		result << std::hex
-			<< std::setw(2)
-			<< std::setfill('0')
-			<< flags;
-
-		return move(result.str());
+		char result[16];
+		snprintf(result, sizeof(result), "%s%02x", uber_shader ? "uber_" : "", static_cast<unsigned int>(flags));
+		return result;
 	}
 
-	static void populate_macros(Uint32 flags)
+	static void populate_macros(Uint32 flags, bool partial = false)
 	{
+		macros.reserve(MAX_MACROS);
+
 	//#define USE_SMOOTH_LIGHTING
 
 	#ifdef USE_SMOOTH_LIGHTING
 		macros.push_back({ "USE_SMOOTH_LIGHTING", "1" });
 	#endif
 
+		if (uber_shader)
+		{
+			macros.push_back({ "USE_UBER_SHADER", "1" });
+		}
+
+		if (partial)
+		{
+			macros.push_back({ "USE_PARTIAL_PRECISION", "1" });
+		}
+
 		while (flags != 0)
 		{
 			using namespace d3d;
@@ -457,6 +685,20 @@ namespace local
 				continue;
 			}
 
+			if (flags & ShaderFlags_MultiLight)
+			{
+				flags &= ~ShaderFlags_MultiLight;
+				macros.push_back({ "USE_MULTILIGHT", "1" });
+				continue;
+			}
+
+			if (flags & ShaderFlags_VertexLit)
+			{
+				flags &= ~ShaderFlags_VertexLit;
+				macros.push_back({ "USE_VERTEX_LIGHTING", "1" });
+				continue;
+			}
+
 			if (flags & ShaderFlags_Specular)
 			{
 				flags &= ~ShaderFlags_Specular;
@@ -478,6 +720,34 @@ namespace local
 				continue;
 			}
 
+			if (flags & ShaderFlags_FogExp)
+			{
+				flags &= ~ShaderFlags_FogExp;
+				macros.push_back({ "USE_FOG_EXP", "1" });
+				continue;
+			}
+
+			if (flags & ShaderFlags_FogExp2)
+			{
+				flags &= ~ShaderFlags_FogExp2;
+				macros.push_back({ "USE_FOG_EXP2", "1" });
+				continue;
+			}
+
+			if (flags & ShaderFlags_VertexColor)
+			{
+				flags &= ~ShaderFlags_VertexColor;
+				macros.push_back({ "USE_VERTEX_COLOR", "1" });
+				continue;
+			}
+
+			if (flags & ShaderFlags_FogTable)
+			{
+				flags &= ~ShaderFlags_FogTable;
+				macros.push_back({ "USE_FOG_TABLE", "1" });
+				continue;
+			}
+
 			break;
 		}
 
@@ -541,6 +811,8 @@ namespace local
 
 	static void load_cached_shader(const std::string& sid_path, std::vector<uint8_t>& data)
 	{
+		TRACE_ZONE("load_cached_shader");
+
 		std::ifstream file(sid_path, std::ios_base::ate | std::ios_base::binary);
 		auto size = file.tellg();
 		file.seekg(0);
@@ -556,6 +828,8 @@ namespace local
 
 	static void save_cached_shader(const std::string& sid_path, std::vector<uint8_t>& data)
 	{
+		TRACE_ZONE("save_cached_shader");
+
 		std::ofstream file(sid_path, std::ios_base::binary);
 
 		if (!file.is_open())
@@ -570,8 +844,7 @@ namespace local
 	{
 		using namespace std;
 
-		sanitize(flags);
-		flags &= VS_FLAGS;
+		flags = selection::vs_key(selection::sanitize(flags), uber_shader);
 
 		if (shader_file.empty())
 		{
@@ -582,6 +855,7 @@ namespace local
 			const auto it = vertex_shaders.find(static_cast<ShaderFlags>(flags));
 			if (it != vertex_shaders.end())
 			{
+				++metrics::current.shader_cache_hits;
 				return it->second;
 			}
 		}
@@ -599,14 +873,18 @@ namespace local
 				vertex_shaders.size(), flags, to_string(flags).c_str());
 
 			load_cached_shader(sid_path, data);
+			++metrics::current.shader_cache_loads;
 		}
 		else
 		{
+			++metrics::current.shader_compiles;
 			PrintDebug("[lantern] Compiling vertex shader #%02d: %08X (%s)\n",
 				vertex_shaders.size(), flags, to_string(flags).c_str());
 
 			populate_macros(flags);
 
+			TRACE_ZONE("compile_shader");
+
 			Buffer errors;
 			Buffer buffer;
 
@@ -649,19 +927,20 @@ namespace local
 		}
 		else
 		{
-			const auto it = pixel_shaders.find(static_cast<ShaderFlags>(flags & PS_FLAGS));
+			const auto it = pixel_shaders.find(static_cast<ShaderFlags>(selection::ps_key(flags, uber_shader)));
 			if (it != pixel_shaders.end())
 			{
+				++metrics::current.shader_cache_hits;
 				return it->second;
 			}
 		}
 
 		macros.clear();
 
-		sanitize(flags);
-		flags &= PS_FLAGS;
+		flags = selection::ps_key(selection::sanitize(flags), uber_shader);
 
-		const string sid_path = move(filesystem::combine_path(globals::cache_path, shader_id(flags) + ".ps"));
+		const string sid_path = move(filesystem::combine_path(globals::cache_path,
+			(partial_precision ? "pp_" : "") + shader_id(flags) + ".ps"));
 		bool is_cached = filesystem::exists(sid_path);
 
 		vector<uint8_t> data;
@@ -672,13 +951,17 @@ namespace local
 				pixel_shaders.size(), flags, to_string(flags).c_str());
 
 			load_cached_shader(sid_path, data);
+			++metrics::current.shader_cache_loads;
 		}
 		else
 		{
-			PrintDebug("[lantern] Compiling pixel shader #%02d: %08X (%s)\n",
-				pixel_shaders.size(), flags, to_string(flags).c_str());
+			++metrics::current.shader_compiles;
+			PrintDebug("[lantern] Compiling pixel shader #%02d: %08X (%s)%s\n",
+				pixel_shaders.size(), flags, to_string(flags).c_str(), partial_precision ? " (partial precision)" : "");
 
-			populate_macros(flags);
+			populate_macros(flags, partial_precision);
+
+			TRACE_ZONE("compile_shader");
 
 			Buffer errors;
 			Buffer buffer;
@@ -708,342 +991,1589 @@ namespace local
 			save_cached_shader(sid_path, data);
 		}
 
-		pixel_shaders[static_cast<ShaderFlags>(flags & PS_FLAGS)] = shader;
+		pixel_shaders[static_cast<ShaderFlags>(flags)] = shader;
 		return shader;
 	}
 
-	static void begin()
+	// Loads a depth pre-pass shader from the cache, or compiles and caches it.
+	static void load_depth_shader(const char* entry, const char* profile, const char* file_name, std::vector<uint8_t>& data,
+		bool& is_cached)
 	{
-		++drawing;
-	}
+		const std::string sid_path = filesystem::combine_path(globals::cache_path, file_name);
+		is_cached = filesystem::exists(sid_path);
 
-	static void end()
-	{
-		if (drawing > 0 && --drawing < 1)
+		if (is_cached)
 		{
-			drawing = 0;
-			d3d::do_effect = false;
+			PrintDebug("[lantern] Loading cached depth shader %s\n", file_name);
+			load_cached_shader(sid_path, data);
+			++metrics::current.shader_cache_loads;
+			return;
 		}
-	}
 
-	static void shader_end()
-	{
-		if (using_shader)
+		++metrics::current.shader_compiles;
+		PrintDebug("[lantern] Compiling depth shader %s\n", file_name);
+
+		TRACE_ZONE("compile_shader");
+
+		Buffer errors;
+		Buffer buffer;
+
+		auto result = D3DXCompileShader(reinterpret_cast<char*>(shader_file.data()), shader_file.size(), nullptr, nullptr,
+			entry, profile, COMPILER_FLAGS, &buffer, &errors, nullptr);
+
+		if (FAILED(result) || errors != nullptr)
 		{
-			d3d::device->SetPixelShader(nullptr);
-			d3d::device->SetVertexShader(nullptr);
-			using_shader = false;
+			d3d_exception(errors, result);
 		}
+
+		data.resize(static_cast<size_t>(buffer->GetBufferSize()));
+		memcpy(data.data(), buffer->GetBufferPointer(), data.size());
 	}
 
-	static void shader_start()
+	// The depth pre-pass shaders use the same profile as the permutations: the
+	// equal depth test in the main pass needs the position computed the same way.
+	static void get_depth_shaders()
 	{
-		if (!d3d::do_effect || !drawing)
+		using namespace std;
+
+		if (depth_vs != nullptr && depth_ps != nullptr)
 		{
-			shader_end();
 			return;
 		}
 
-		if (Camera_Data1)
+		if (shader_file.empty())
 		{
-			param::CameraPosition = *reinterpret_cast<D3DXVECTOR3*>(&Camera_Data1->Position);
+			check_shader_cache();
 		}
 
-		DWORD specular;
-		d3d::device->GetRenderState(D3DRS_SPECULARENABLE, &specular);
-		d3d::set_flags(ShaderFlags_Specular, specular == TRUE);
-
-		bool changes = false;
+		vector<uint8_t> vs_data;
+		vector<uint8_t> ps_data;
+		bool vs_cached;
+		bool ps_cached;
 
-		// The value here is copied so that UseBlend can be safely removed
-		// when possible without permanently removing it. It's required by
-		// Sky Deck, and it's only added to the flags once on stage load.
-		auto flags = shader_flags;
-		sanitize(flags);
+		load_depth_shader("vs_depth", "vs_3_0", "depth.vs", vs_data, vs_cached);
+		load_depth_shader("ps_depth", "ps_3_0", "depth.ps", ps_data, ps_cached);
 
-		if (flags != last_flags)
-		{
-			VertexShader vs;
-			PixelShader ps;
+		VertexShader vs;
+		PixelShader ps;
 
-			changes = true;
-			last_flags = flags;
+		auto result = d3d::device->CreateVertexShader(reinterpret_cast<const DWORD*>(vs_data.data()), &vs);
 
-			try
-			{
-				vs = get_vertex_shader(flags);
-				ps = get_pixel_shader(flags);
-			}
-			catch (std::exception& ex)
-			{
-				shader_end();
-				MessageBoxA(WindowHandle, ex.what(), "Shader creation failed", MB_OK | MB_ICONERROR);
-				return;
-			}
+		if (FAILED(result))
+		{
+			d3d_exception(nullptr, result);
+		}
 
-			if (!using_shader || vs != d3d::vertex_shader)
-			{
-				d3d::vertex_shader = vs;
-				d3d::device->SetVertexShader(d3d::vertex_shader);
-			}
+		result = d3d::device->CreatePixelShader(reinterpret_cast<const DWORD*>(ps_data.data()), &ps);
 
-			if (!using_shader || ps != d3d::pixel_shader)
-			{
-				d3d::pixel_shader = ps;
-				d3d::device->SetPixelShader(d3d::pixel_shader);
-			}
+		if (FAILED(result))
+		{
+			d3d_exception(nullptr, result);
 		}
-		else if (!using_shader)
+
+		if (!vs_cached)
 		{
-			d3d::device->SetVertexShader(d3d::vertex_shader);
-			d3d::device->SetPixelShader(d3d::pixel_shader);
+			save_cached_shader(filesystem::combine_path(globals::cache_path, "depth.vs"), vs_data);
 		}
 
-		if (changes || !IShaderParameter::values_assigned.empty())
+		if (!ps_cached)
 		{
-			for (auto& it : IShaderParameter::values_assigned)
-			{
-				it->commit(d3d::device);
-			}
+			save_cached_shader(filesystem::combine_path(globals::cache_path, "depth.ps"), ps_data);
+		}
+
+		depth_vs = vs;
+		depth_ps = ps;
+	}
+
+	static void begin()
+	{
+		++drawing;
+	}
 
-			IShaderParameter::values_assigned.clear();
+	static void end()
+	{
+		if (drawing > 0 && --drawing < 1)
+		{
+			drawing = 0;
+			d3d::do_effect = false;
 		}
+	}
 
-		using_shader = true;
+	static void shader_end()
+	{
+		shader_state.end();
 	}
 
-	static void hook_vtable()
+	static void apply_lod(Uint32& flags)
 	{
-		enum
+		if (!config::lod_enabled)
 		{
-			IndexOf_SetTexture = 65,
-			IndexOf_DrawPrimitive = 81,
-			IndexOf_DrawIndexedPrimitive,
-			IndexOf_DrawPrimitiveUP,
-			IndexOf_DrawIndexedPrimitiveUP
+			return;
+		}
+
+		const selection::LodSettings settings = {
+			config::lod_specular_distance, config::lod_vertex_lighting_distance, config::lod_hysteresis
 		};
 
-		auto vtbl = (void**)(*(void**)d3d::device);
+		selection::LodLevel level;
 
-	#define HOOK(NAME) \
-	MH_CreateHook(vtbl[IndexOf_ ## NAME], NAME ## _r, (LPVOID*)& ## NAME ## _t)
+		if (current_model != nullptr)
+		{
+			const auto address = reinterpret_cast<uintptr_t>(current_model);
+			auto& entry = model_lod[((address >> 4) ^ (address >> 16)) & (MODEL_LOD_SLOTS - 1)];
 
-		HOOK(DrawPrimitive);
-		HOOK(DrawIndexedPrimitive);
-		HOOK(DrawPrimitiveUP);
-		HOOK(DrawIndexedPrimitiveUP);
+			level = selection::lod_level(settings, view_depth, entry.model == current_model ? entry.level : -1);
+			entry = { current_model, level };
+		}
+		else
+		{
+			level = selection::lod_level(settings, view_depth, -1);
+		}
 
-		MH_EnableHook(MH_ALL_HOOKS);
+		flags = selection::apply_lod(flags, level);
 	}
 
-#pragma region Trampolines
-
-	template<typename T, typename... Args>
-	static void run_trampoline(const T& original, Args... args)
+	static void count_lod(Uint32 flags)
 	{
-		begin();
-		original(args...);
-		end();
+		if (!config::lod_enabled)
+		{
+			return;
+		}
+
+		if (flags & ShaderFlags_VertexLit && !(shader_flags & ShaderFlags_VertexLit))
+		{
+			++lod_counters.vertex_lit;
+		}
+		else if (!(flags & ShaderFlags_Specular) && shader_flags & ShaderFlags_Specular)
+		{
+			++lod_counters.no_specular;
+		}
+		else
+		{
+			++lod_counters.full;
+		}
 	}
 
-	static void __cdecl sub_77EAD0_r(void* a1, int a2, int a3)
+	// clip() only discards pixels below AlphaRef. Without vertex colors, the output
+	// alpha is the texture's alpha times the material's, so opaque textures
+	// can use the permutation without the alpha test and keep early-Z.
+	static bool needs_alpha_test(Uint32 flags)
 	{
-		begin();
-		run_trampoline(TARGET_DYNAMIC(sub_77EAD0), a1, a2, a3);
-		end();
+		if (flags & ShaderFlags_VertexColor)
+		{
+			return true;
+		}
+
+		float alpha = param::Material.value().diffuse.a;
+
+		if (flags & ShaderFlags_Texture)
+		{
+			alpha *= textures::min_alpha(stage0_texture) / 255.0f;
+		}
+
+		return alpha < ALPHA_REF + 0.5f / 255.0f;
 	}
 
-	static void __cdecl sub_77EBA0_r(void* a1, int a2, int a3)
+	static void count_alpha(Uint32 flags)
 	{
-		begin();
-		run_trampoline(TARGET_DYNAMIC(sub_77EBA0), a1, a2, a3);
-		end();
+		if (!(shader_flags & ShaderFlags_Alpha))
+		{
+			return;
+		}
+
+		if (flags & ShaderFlags_Alpha)
+		{
+			++alpha_counters.clipped;
+		}
+		else
+		{
+			++alpha_counters.opaque;
+		}
 	}
 
-	static void __cdecl njDrawModel_SADX_r(NJS_MODEL_SADX* a1)
+	DataArray(StageLightData, CurrentStageLights, 0x3ABD9F8, 4);
+
+	// Secondary lights dimmer than this are skipped for the object.
+	constexpr float LIGHT_THRESHOLD = 1.0f / 255.0f;
+
+	// Set when the object being drawn is lit by the stage lights (lighting type 0),
+	// which is the only case where lights 1 through 3 apply.
+	static bool stage_lit = false;
+
+	// Whether a light reaches an object with the given diffuse color enough to be visible.
+	static bool significant(const StageLight& light, const D3DXCOLOR& diffuse)
 	{
-		begin();
-		run_trampoline(TARGET_DYNAMIC(njDrawModel_SADX), a1);
-		end();
+		const auto& d = light.direction;
+		const auto& c = light.diffuse;
+
+		return (d.x * d.x + d.y * d.y + d.z * d.z) > FLT_EPSILON
+			&& fmaxf(c.x * diffuse.r, fmaxf(c.y * diffuse.g, c.z * diffuse.b)) >= LIGHT_THRESHOLD;
 	}
 
-	static void __cdecl njDrawModel_SADX_Dynamic_r(NJS_MODEL_SADX* a1)
+	static void update_stage_lights(int type)
 	{
-		begin();
-		run_trampoline(TARGET_DYNAMIC(njDrawModel_SADX_Dynamic), a1);
-		end();
+		StageLights lights;
+
+		for (size_t i = 0; i < 4; i++)
+		{
+			memcpy(&lights.lights[i], &CurrentStageLights[i].direction, sizeof(StageLight));
+
+			// Pre-negated and normalized so the shader can use it as-is.
+			auto& d = lights.lights[i].direction;
+			auto direction = -D3DXVECTOR3(d.x, d.y, d.z);
+			D3DXVec3Normalize(&direction, &direction);
+			d = { direction.x, direction.y, direction.z };
+		}
+
+		// Only uploaded when the stage lights actually change.
+		param::Lights = lights;
+		stage_lit = type == 0;
 	}
 
-	static void __fastcall PolyBuff_DrawTriangleStrip_r(PolyBuff* _this)
+	// Light 0 is handled by the regular light parameters; this selects which of
+	// lights 1 through 3 apply to the object about to be drawn, based on how much
+	// each one can contribute given the object's material, and sets the
+	// permutation bit only if at least one does.
+	static void select_object_lights(Uint32& flags)
 	{
-		begin();
+		D3DXVECTOR4 weights(0.0f, 0.0f, 0.0f, 0.0f);
+		bool any = false;
+
+		if (config::multi_light && stage_lit && flags & ShaderFlags_Light)
+		{
+			// Vertex colors replace the material's diffuse per vertex, so
+			// the light alone has to decide for those objects.
+			const D3DXCOLOR diffuse = flags & ShaderFlags_VertexColor
+				? D3DXCOLOR(1.0f, 1.0f, 1.0f, 1.0f)
+				: param::Material.value().diffuse;
+
+			const auto lights = param::Lights.value();
+
+			for (size_t i = 1; i < 4; i++)
+			{
+				if (significant(lights.lights[i], diffuse))
+				{
+					weights[i - 1] = 1.0f;
+					any = true;
+				}
+			}
+		}
+
+		if (weights != param::LightWeights.value())
+		{
+			param::LightWeights = weights;
+		}
+
+		if (any)
+		{
+			flags |= ShaderFlags_MultiLight;
+		}
+		else
+		{
+			flags &= ~ShaderFlags_MultiLight;
+		}
+	}
+
+	// Updates the per-draw state and returns false if the
+	// draw is going to use the fixed function pipeline.
+	static bool prepare_shader(Uint32& flags)
+	{
+		if (!d3d::do_effect || !drawing)
+		{
+			return false;
+		}
+
+		if (Camera_Data1)
+		{
+			param::CameraPosition = *reinterpret_cast<D3DXVECTOR3*>(&Camera_Data1->Position);
+		}
+
+		DWORD specular;
+		d3d::device->GetRenderState(D3DRS_SPECULARENABLE, &specular);
+		d3d::set_flags(ShaderFlags_Specular, specular == TRUE);
+
+		// The value here is copied so that UseBlend can be safely removed
+		// when possible without permanently removing it. It's required by
+		// Sky Deck, and it's only added to the flags once on stage load.
+		flags = shader_flags;
+
+		// Vertex color is only used if the vertex format actually has one.
+		if (flags & ShaderFlags_VertexColor)
+		{
+			DWORD fvf;
+			if (FAILED(d3d::device->GetFVF(&fvf)) || !(fvf & D3DFVF_DIFFUSE))
+			{
+				flags &= ~ShaderFlags_VertexColor;
+			}
+		}
+
+		if (config::alpha_analysis && flags & ShaderFlags_Alpha && !needs_alpha_test(flags))
+		{
+			flags &= ~ShaderFlags_Alpha;
+		}
+
+		select_object_lights(flags);
+
+		// The vertex lit tier can't use the fog table, which sanitize has to
+		// drop after the LOD picks it.
+		apply_lod(flags);
+		flags = selection::sanitize(flags);
+		return true;
+	}
+
+	// Counts a draw by the result of prepare_shader, including UP draws that
+	// join a batch without starting a shader of their own.
+	static void count_draw(bool shaded, Uint32 flags)
+	{
+		if (!shaded)
+		{
+			++metrics::current.fixed_function_draws;
+			return;
+		}
+
+		++metrics::current.shaded_draws;
+
+		count_lod(flags);
+		count_alpha(flags);
+	}
+
+	// Starts the shader for flags as computed by prepare_shader, which
+	// returned shaded. Returns the key the draw's GPU time is attributed to.
+	// It's marked by the caller where the draw is actually submitted, since
+	// UP draws are batched.
+	static Uint32 shader_start(bool shaded, Uint32 flags)
+	{
+		TRACE_ZONE("shader_start");
+
+		if (!shaded)
+		{
+			shader_end();
+			return GPU_KEY_FIXED_FUNCTION;
+		}
+
+		try
+		{
+			shader_state.start(flags);
+		}
+		catch (std::exception& ex)
+		{
+			shader_end();
+			MessageBoxA(WindowHandle, ex.what(), "Shader creation failed", MB_OK | MB_ICONERROR);
+			return GPU_KEY_FIXED_FUNCTION;
+		}
+
+		return flags;
+	}
+
+	static Uint32 shader_start()
+	{
+		Uint32 flags = 0;
+		const bool shaded = prepare_shader(flags);
+
+		count_draw(shaded, flags);
+		return shader_start(shaded, flags);
+	}
+
+	// Whether a draw's result depends on the draws before it other than through
+	// the depth test, i.e. it blends or has depth states of its own.
+	static bool order_dependent()
+	{
+		DWORD blend, z_enable, z_write, z_func;
+		d3d::device->GetRenderState(D3DRS_ALPHABLENDENABLE, &blend);
+		d3d::device->GetRenderState(D3DRS_ZENABLE, &z_enable);
+		d3d::device->GetRenderState(D3DRS_ZWRITEENABLE, &z_write);
+		d3d::device->GetRenderState(D3DRS_ZFUNC, &z_func);
+
+		return blend || z_enable != D3DZB_TRUE || z_write != TRUE || z_func != D3DCMP_LESSEQUAL;
+	}
+
+	// Only draws that are guaranteed to write depth for every pixel they cover
+	// are rendered in the pre-pass. Draws with their own depth states are left
+	// alone, since the pre-pass would replace them.
+	static bool depth_prepass_eligible(Uint32 flags)
+	{
+		if (flags & ShaderFlags_Alpha)
+		{
+			return false;
+		}
+
+		DWORD test;
+		d3d::device->GetRenderState(D3DRS_ALPHATESTENABLE, &test);
+
+		return !test && !order_dependent();
+	}
+
+	// Deferred draws read their buffers when they're shaded, by which time the
+	// game may have refilled a dynamic one.
+	static bool static_buffers(bool indexed)
+	{
+		CComPtr<IDirect3DVertexBuffer9> vertex_buffer;
+		UINT offset, stride;
+		D3DVERTEXBUFFER_DESC vertex_desc;
+
+		if (FAILED(d3d::device->GetStreamSource(0, &vertex_buffer, &offset, &stride)) || vertex_buffer == nullptr
+			|| FAILED(vertex_buffer->GetDesc(&vertex_desc)) || (vertex_desc.Usage & D3DUSAGE_DYNAMIC))
+		{
+			return false;
+		}
+
+		if (!indexed)
+		{
+			return true;
+		}
+
+		CComPtr<IDirect3DIndexBuffer9> index_buffer;
+		D3DINDEXBUFFER_DESC index_desc;
+
+		return SUCCEEDED(d3d::device->GetIndices(&index_buffer)) && index_buffer != nullptr
+			&& SUCCEEDED(index_buffer->GetDesc(&index_desc)) && !(index_desc.Usage & D3DUSAGE_DYNAMIC);
+	}
+
+	static void mark_deferred_draw(uint32_t tag)
+	{
+		gpu_profiler.mark(tag);
+	}
+
+	// Draws in the pre-pass that can be shaded later are drawn depth only and
+	// deferred with an equal depth test; the rest are drawn as they come. draw
+	// is null for UP draws, whose vertices can't be kept.
+	static void draw_start(const DrawRecorder::Draw* draw)
+	{
+		draw_allocations = metrics::allocations();
+
+		if (!draw_recorder.recording())
+		{
+			gpu_profiler.mark(shader_start());
+			return;
+		}
+
+		Uint32 flags = 0;
+		const bool shaded = prepare_shader(flags);
+
+		count_draw(shaded, flags);
+
+		if (draw == nullptr || !shaded || !depth_prepass_eligible(flags)
+			|| !static_buffers(draw->indexed) || depth_vs == nullptr)
+		{
+			// Deferred draws have to be shaded before anything that depends on them.
+			if (draw_recorder.pending() && order_dependent())
+			{
+				draw_recorder.replay();
+				++depth_counters.early_replays;
+			}
+
+			++depth_counters.skipped_draws;
+			gpu_profiler.mark(shader_start(shaded, flags));
+			return;
+		}
+
+		// The shaded draw is recorded with its own depth states, which the
+		// device doesn't see until it's replayed.
+		const Uint32 key = shader_start(true, flags);
+		draw_recorder.render_state(D3DRS_ZFUNC, D3DCMP_EQUAL);
+		draw_recorder.render_state(D3DRS_ZWRITEENABLE, FALSE);
+		draw_recorder.defer(*draw, key);
+		draw_recorder.render_state(D3DRS_ZFUNC, D3DCMP_LESSEQUAL);
+		draw_recorder.render_state(D3DRS_ZWRITEENABLE, TRUE);
+
+		shader_state.start(depth_vs, depth_ps);
+		d3d::device->GetRenderState(D3DRS_COLORWRITEENABLE, &color_write);
+		d3d::device->SetRenderState(D3DRS_COLORWRITEENABLE, 0);
+		color_masked = true;
+
+		gpu_profiler.mark(GPU_KEY_DEPTH);
+		++depth_counters.depth_draws;
+	}
+
+	static void draw_end()
+	{
+		if (color_masked)
+		{
+			d3d::device->SetRenderState(D3DRS_COLORWRITEENABLE, color_write);
+			color_masked = false;
+		}
+
+		shader_end();
+
+		metrics::current.draw_allocations += metrics::allocations() - draw_allocations;
+	}
+
+	// Non-blocking; a query that is still in flight is simply not reissued.
+	static bool poll_query(Query& query, bool& pending, DWORD& samples)
+	{
+		if (!pending)
+		{
+			return false;
+		}
+
+		if (query->GetData(&samples, sizeof(DWORD), 0) != S_OK)
+		{
+			return false;
+		}
+
+		pending = false;
+		return true;
+	}
+
+	static void poll_depth_queries()
+	{
+		DWORD samples;
+
+		if (poll_query(prepass_query, prepass_query_pending, samples))
+		{
+			depth_counters.prepass_samples += samples;
+		}
+
+		if (poll_query(main_query, main_query_pending, samples))
+		{
+			++depth_counters.frames;
+			depth_counters.shaded_samples += samples;
+			depth_counters.viewport_pixels += main_query_viewport;
+		}
+	}
+
+	static void begin_depth_query(DepthPass pass)
+	{
+		if (!config::depth_prepass_report)
+		{
+			return;
+		}
+
+		auto& query = pass == DepthPass::prepass ? prepass_query : main_query;
+		auto& pending = pass == DepthPass::prepass ? prepass_query_pending : main_query_pending;
+
+		if (query == nullptr && FAILED(d3d::device->CreateQuery(D3DQUERYTYPE_OCCLUSION, &query)))
+		{
+			return;
+		}
+
+		poll_depth_queries();
+
+		if (pending)
+		{
+			return;
+		}
+
+		if (pass == DepthPass::main)
+		{
+			D3DVIEWPORT9 viewport;
+			d3d::device->GetViewport(&viewport);
+			main_query_viewport = viewport.Width * viewport.Height;
+		}
+
+		query->Issue(D3DISSUE_BEGIN);
+		pending = true;
+	}
+
+	static void end_depth_query(DepthPass pass)
+	{
+		auto& query = pass == DepthPass::prepass ? prepass_query : main_query;
+
+		if (query != nullptr && (pass == DepthPass::prepass ? prepass_query_pending : main_query_pending))
+		{
+			query->Issue(D3DISSUE_END);
+		}
+	}
+
+	static void release_depth_queries()
+	{
+		prepass_query = nullptr;
+		main_query = nullptr;
+		prepass_query_pending = false;
+		main_query_pending = false;
+	}
+
+	static void report_depth_pass()
+	{
+		const auto& c = depth_counters;
+
+		if (c.frames > 0 && c.viewport_pixels > 0)
+		{
+			PrintDebug("[lantern] Land table pixels, level %d act %d over %u frames: shaded %llu per frame (%.2fx viewport)",
+				report_level, report_act, c.frames, c.shaded_samples / c.frames,
+				static_cast<double>(c.shaded_samples) / static_cast<double>(c.viewport_pixels));
+
+			if (config::depth_prepass)
+			{
+				PrintDebug(", pre-pass %llu per frame (%.2fx viewport), %u draws in pre-pass, %u skipped, %u shaded early",
+					c.prepass_samples / c.frames,
+					static_cast<double>(c.prepass_samples) / static_cast<double>(c.viewport_pixels),
+					c.depth_draws, c.skipped_draws, c.early_replays);
+			}
+
+			PrintDebug("\n");
+		}
+
+		depth_counters = {};
+	}
+
+	static void report_alpha()
+	{
+		const auto& c = alpha_counters;
+
+		if (c.clipped + c.opaque > 0)
+		{
+			PrintDebug("[lantern] Alpha test, level %d act %d: %u of %u draws regained early-Z\n",
+				report_level, report_act, c.opaque, c.clipped + c.opaque);
+		}
+
+		alpha_counters = {};
+	}
+
+	static void report_gpu_profile()
+	{
+		const auto frames = gpu_profiler.frames();
+
+		if (frames == 0)
+		{
+			return;
+		}
+
+		std::vector<std::pair<Uint32, GpuProfiler::Totals>> sorted(gpu_profiler.totals().begin(), gpu_profiler.totals().end());
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.us > b.second.us; });
+
+		PrintDebug("[lantern] GPU time, level %d act %d: %.3f ms per frame over %u frames (%u skipped)\n",
+			report_level, report_act, gpu_profiler.total_us() / frames / 1000.0,
+			static_cast<Uint32>(frames), static_cast<Uint32>(gpu_profiler.skipped_frames()));
+
+		for (size_t i = 0; i < sorted.size() && i < 10; i++)
+		{
+			const auto key = sorted[i].first;
+			const auto& totals = sorted[i].second;
+
+			const auto name = key == GPU_KEY_FIXED_FUNCTION ? std::string("fixed function")
+				: key == GPU_KEY_DEPTH ? std::string("depth pre-pass")
+				: to_string(key);
+
+			PrintDebug("[lantern]   %.3f ms (%4.1f%%), %u runs: %08X %s\n",
+				totals.us / frames / 1000.0, 100.0 * totals.us / gpu_profiler.total_us(),
+				static_cast<Uint32>(totals.runs), key, name.c_str());
+		}
+	}
+
+	static bool parameters_modified()
+	{
+		for (auto& it : IShaderParameter::values_assigned)
+		{
+			if (it->is_modified())
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Copies UP geometry into the batch ring buffers, merging it with the
+	// currently open batch when the shader state has not changed since.
+	static bool batch_draw(D3DPRIMITIVETYPE type, UINT min_index, UINT vertex_count, UINT primitive_count,
+		const void* indices, D3DFORMAT index_format, const void* vertices, UINT stride)
+	{
+		if (depth_pass != DepthPass::none || !up_batcher.supports(type, index_format))
+		{
+			return false;
+		}
+
+		Uint32 flags = 0;
+		const bool shaded = prepare_shader(flags);
+		const Uint32 key = shaded ? flags : GPU_KEY_FIXED_FUNCTION;
+
+		if (up_batcher.is_open() && (!up_batcher.compatible(type, stride, key) || parameters_modified()))
+		{
+			flush_batch();
+		}
+
+		const auto index_data = reinterpret_cast<const Uint16*>(indices);
+
+		if (up_batcher.is_open())
+		{
+			if (up_batcher.append(type, primitive_count, min_index, vertex_count, index_data, vertices, stride, key))
+			{
+				count_draw(shaded, flags);
+				++metrics::current.up_absorbed_calls;
+				++metrics::current.up_merged_draws;
+				return true;
+			}
+
+			flush_batch();
+		}
+
+		shader_start(shaded, flags);
+
+		if (!up_batcher.append(type, primitive_count, min_index, vertex_count, index_data, vertices, stride, key))
+		{
+			return false;
+		}
+
+		count_draw(shaded, flags);
+		++metrics::current.up_absorbed_calls;
+		return true;
+	}
+
+	// Hooks a device method: either as a hook point of the proxy, with the
+	// original taken from the device's vtable as-is, or by detouring it.
+	template <typename T>
+	static void hook_method(void** vtbl, size_t index, T* hook, T*& original, T* DeviceProxy::Hooks::* hook_point)
+	{
+		if (device_proxy)
+		{
+			original = reinterpret_cast<T*>(vtbl[index]);
+			device_proxy->hooks.*hook_point = hook;
+		}
+		else
+		{
+			MH_CreateHook(vtbl[index], hook, reinterpret_cast<LPVOID*>(&original));
+		}
+	}
+
+	static void hook_vtable()
+	{
+		enum
+		{
+			IndexOf_Present = 17,
+			IndexOf_SetRenderTarget = 37,
+			IndexOf_SetDepthStencilSurface = 39,
+			IndexOf_EndScene = 42,
+			IndexOf_Clear,
+			IndexOf_SetTransform,
+			IndexOf_SetViewport = 47,
+			IndexOf_SetMaterial = 49,
+			IndexOf_SetLight = 51,
+			IndexOf_LightEnable = 53,
+			IndexOf_SetClipPlane = 55,
+			IndexOf_SetRenderState = 57,
+			IndexOf_SetTexture = 65,
+			IndexOf_SetTextureStageState = 67,
+			IndexOf_SetSamplerState = 69,
+			IndexOf_SetScissorRect = 75,
+			IndexOf_DrawPrimitive = 81,
+			IndexOf_DrawIndexedPrimitive,
+			IndexOf_DrawPrimitiveUP,
+			IndexOf_DrawIndexedPrimitiveUP,
+			IndexOf_SetVertexDeclaration = 87,
+			IndexOf_SetFVF = 89,
+			IndexOf_SetVertexShader = 92,
+			IndexOf_SetVertexShaderConstantF = 94,
+			IndexOf_SetVertexShaderConstantB = 98,
+			IndexOf_SetStreamSource = 100,
+			IndexOf_SetIndices = 104,
+			IndexOf_SetPixelShader = 107,
+			IndexOf_SetPixelShaderConstantF = 109,
+			IndexOf_SetPixelShaderConstantB = 113
+		};
+
+		auto vtbl = (void**)(*(void**)(device_proxy ? device_proxy->target() : d3d::device));
+
+	#define HOOK(NAME) \
+	hook_method(vtbl, IndexOf_ ## NAME, NAME ## _r, NAME ## _t, &DeviceProxy::Hooks::NAME)
+
+		HOOK(DrawPrimitive);
+		HOOK(DrawIndexedPrimitive);
+		HOOK(DrawPrimitiveUP);
+		HOOK(DrawIndexedPrimitiveUP);
+
+		// Any state change has to submit the pending UP batch first, and is
+		// recorded for the draws the depth pre-pass defers.
+		if (up_batcher.enabled || config::depth_prepass)
+		{
+			HOOK(Present);
+			HOOK(EndScene);
+			HOOK(Clear);
+			HOOK(SetRenderTarget);
+			HOOK(SetDepthStencilSurface);
+			HOOK(SetTransform);
+			HOOK(SetViewport);
+			HOOK(SetMaterial);
+			HOOK(SetLight);
+			HOOK(LightEnable);
+			HOOK(SetClipPlane);
+			HOOK(SetRenderState);
+			HOOK(SetTextureStageState);
+			HOOK(SetSamplerState);
+			HOOK(SetScissorRect);
+			HOOK(SetVertexDeclaration);
+			HOOK(SetFVF);
+			HOOK(SetVertexShader);
+			HOOK(SetVertexShaderConstantF);
+			HOOK(SetVertexShaderConstantB);
+			HOOK(SetStreamSource);
+			HOOK(SetIndices);
+			HOOK(SetPixelShader);
+			HOOK(SetPixelShaderConstantF);
+			HOOK(SetPixelShaderConstantB);
+		}
+
+		// Also keeps track of stage 0's texture for alpha analysis.
+		if (up_batcher.enabled || config::depth_prepass || config::alpha_analysis)
+		{
+			HOOK(SetTexture);
+		}
+
+	#undef HOOK
+
+		if (!device_proxy)
+		{
+			MH_EnableHook(MH_ALL_HOOKS);
+		}
+	}
+
+	static HRESULT __stdcall CreateDevice_r(IDirect3D9* _this, UINT Adapter, D3DDEVTYPE DeviceType, HWND hFocusWindow,
+		DWORD BehaviorFlags, D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DDevice9** ppReturnedDeviceInterface);
+
+	static decltype(CreateDevice_r)* CreateDevice_t = nullptr;
+	static void* create_device_target = nullptr;
+
+	// Hands d3d8to9 the proxy in place of the device it creates for the game.
+	static HRESULT __stdcall CreateDevice_r(IDirect3D9* _this, UINT Adapter, D3DDEVTYPE DeviceType, HWND hFocusWindow,
+		DWORD BehaviorFlags, D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DDevice9** ppReturnedDeviceInterface)
+	{
+		const HRESULT result = CreateDevice_t(_this, Adapter, DeviceType, hFocusWindow, BehaviorFlags,
+			pPresentationParameters, ppReturnedDeviceInterface);
+
+		if (SUCCEEDED(result) && device_proxy == nullptr && ppReturnedDeviceInterface != nullptr)
+		{
+			// The proxy takes over the reference d3d8to9 would have held.
+			device_proxy = new DeviceProxy(*ppReturnedDeviceInterface);
+			*ppReturnedDeviceInterface = device_proxy;
+		}
+
+		return result;
+	}
+
+	// Hooks IDirect3D9::CreateDevice for the creation of the game's device.
+	// Every IDirect3D9 shares its vtable, so a temporary one is enough to find it.
+	static bool hook_create_device()
+	{
+		constexpr size_t IndexOf_CreateDevice = 16;
+
+		IDirect3D9* d3d9 = Direct3DCreate9(D3D_SDK_VERSION);
+
+		if (d3d9 == nullptr)
+		{
+			return false;
+		}
+
+		create_device_target = (*reinterpret_cast<void***>(d3d9))[IndexOf_CreateDevice];
+		d3d9->Release();
+
+		if (MH_CreateHook(create_device_target, CreateDevice_r, reinterpret_cast<LPVOID*>(&CreateDevice_t)) != MH_OK)
+		{
+			create_device_target = nullptr;
+			return false;
+		}
+
+		if (MH_EnableHook(create_device_target) != MH_OK)
+		{
+			MH_RemoveHook(create_device_target);
+			create_device_target = nullptr;
+			return false;
+		}
+
+		return true;
+	}
+
+	static void unhook_create_device()
+	{
+		if (create_device_target != nullptr)
+		{
+			MH_DisableHook(create_device_target);
+			MH_RemoveHook(create_device_target);
+			create_device_target = nullptr;
+		}
+	}
+
+#pragma region Trampolines
+
+	template<typename T, typename... Args>
+	static void run_trampoline(const T& original, Args... args)
+	{
+		begin();
+		original(args...);
+		end();
+	}
+
+	static void __cdecl sub_77EAD0_r(void* a1, int a2, int a3)
+	{
+		begin();
+		run_trampoline(TARGET_DYNAMIC(sub_77EAD0), a1, a2, a3);
+		end();
+	}
+
+	static void __cdecl sub_77EBA0_r(void* a1, int a2, int a3)
+	{
+		begin();
+		run_trampoline(TARGET_DYNAMIC(sub_77EBA0), a1, a2, a3);
+		end();
+	}
+
+	static void __cdecl njDrawModel_SADX_r(NJS_MODEL_SADX* a1)
+	{
+		begin();
+		current_model = a1;
+		run_trampoline(TARGET_DYNAMIC(njDrawModel_SADX), a1);
+		current_model = nullptr;
+		end();
+	}
+
+	static void __cdecl njDrawModel_SADX_Dynamic_r(NJS_MODEL_SADX* a1)
+	{
+		begin();
+		current_model = a1;
+		run_trampoline(TARGET_DYNAMIC(njDrawModel_SADX_Dynamic), a1);
+		current_model = nullptr;
+		end();
+	}
+
+	static void __fastcall PolyBuff_DrawTriangleStrip_r(PolyBuff* _this)
+	{
+		begin();
 		run_trampoline(TARGET_DYNAMIC(PolyBuff_DrawTriangleStrip), _this);
 		end();
 	}
 
-	static void __fastcall PolyBuff_DrawTriangleList_r(PolyBuff* _this)
+	static void __fastcall PolyBuff_DrawTriangleList_r(PolyBuff* _this)
+	{
+		begin();
+		run_trampoline(TARGET_DYNAMIC(PolyBuff_DrawTriangleList), _this);
+		end();
+	}
+
+	// ReSharper disable once CppDeclaratorNeverUsed
+	static void __cdecl CreateDirect3DDevice_c(int behavior, int type)
+	{
+		auto orig = CreateDirect3DDevice_t->Target();
+		auto _type = type;
+
+		(void)orig;
+		(void)_type;
+
+		if (config::device_proxy && !initialized)
+		{
+			hook_create_device();
+		}
+
+		__asm
+		{
+			push _type
+			mov edx, behavior
+			call orig
+		}
+
+		unhook_create_device();
+
+		if (Direct3D_Device != nullptr && !initialized)
+		{
+			// This is the proxy if CreateDevice_r installed it.
+			d3d::device = Direct3D_Device->GetProxyInterface();
+
+			if (config::device_proxy && device_proxy == nullptr)
+			{
+				PrintDebug("[lantern] Unable to install the device proxy; hooking the device instead.\n");
+			}
+
+			initialized = true;
+			d3d::set_vertex_lighting(config::vertex_lighting);
+			uber_shader = config::uber_shader;
+
+			shader_state.device = d3d::device;
+			shader_state.state_blocks = config::state_blocks;
+
+		#ifdef PARTIAL_PRECISION_SHADERS
+			partial_precision = config::partial_precision;
+		#endif
+
+			d3d::load_shader();
+
+			up_batcher.enabled = config::batch_up;
+			up_batcher.create(d3d::device);
+
+			if (config::gpu_profile && !timestamp_queries.create(d3d::device))
+			{
+				PrintDebug("[lantern] Timestamp queries are not supported; GPU profiling is disabled.\n");
+			}
+
+			hook_vtable();
+
+			// Stored analysis results have to be dropped when the game changes a texture.
+			if (config::alpha_analysis)
+			{
+				textures::hook(device_proxy ? device_proxy->target() : d3d::device, device_proxy);
+			}
+		}
+	}
+
+	static void __declspec(naked) CreateDirect3DDevice_r()
 	{
-		begin();
-		run_trampoline(TARGET_DYNAMIC(PolyBuff_DrawTriangleList), _this);
-		end();
+		__asm
+		{
+			push [esp + 04h] // type
+			push edx // behavior
+
+			call CreateDirect3DDevice_c
+
+			pop edx // behavior
+			add esp, 4
+			retn 4
+		}
 	}
 
-	// ReSharper disable once CppDeclaratorNeverUsed
-	static void __cdecl CreateDirect3DDevice_c(int behavior, int type)
+	// Writes the state set before the capture started, so its first frame can
+	// be replayed on its own. Fog and lighting are covered by their parameters.
+	static void write_capture_state()
 	{
-		auto orig = CreateDirect3DDevice_t->Target();
-		auto _type = type;
+		using namespace capture_format;
+
+		const auto device = d3d::device;
+
+		capture_view = ViewMatrix;
+		const D3DXMATRIX projection = param::ProjectionMatrix.value();
+
+		capture::write(EventType::world_matrix, &WorldMatrix, sizeof(D3DXMATRIX));
+		capture::write(EventType::view_matrix, &capture_view, sizeof(D3DXMATRIX));
+		capture::write(EventType::projection_matrix, &projection, sizeof(D3DXMATRIX));
+
+		DWORD fog;
+		device->GetRenderState(D3DRS_FOGENABLE, &fog);
+		capture::write(EventType::fog_enable, FogEnable { static_cast<uint8_t>(fog ? 1 : 0) });
+
+		DWORD fvf = 0;
+		device->GetFVF(&fvf);
+		capture::write(EventType::fvf, Fvf { fvf });
+
+		CComPtr<IDirect3DVertexBuffer9> vertex_buffer;
+		UINT offset = 0, stride = 0;
+		device->GetStreamSource(0, &vertex_buffer, &offset, &stride);
+		capture::write(EventType::stream_source, StreamSource { 0, capture::id(vertex_buffer), offset, stride });
+
+		CComPtr<IDirect3DIndexBuffer9> index_buffer;
+		device->GetIndices(&index_buffer);
+		capture::write(EventType::indices, Indices { capture::id(index_buffer) });
+
+		// on_assign is capture's own while it's recording.
+		for (auto& it : param::parameters)
+		{
+			it->describe(IShaderParameter::on_assign);
+		}
+	}
+
+	static void __cdecl Direct3D_SetWorldTransform_r()
+	{
+		TRACE_ZONE("SetWorldTransform");
+
+		TARGET_DYNAMIC(Direct3D_SetWorldTransform)();
+
+		if (capture::recording)
+		{
+			capture::write(capture_format::EventType::world_matrix, &WorldMatrix, sizeof(D3DXMATRIX));
+
+			if (ViewMatrix != capture_view)
+			{
+				capture_view = ViewMatrix;
+				capture::write(capture_format::EventType::view_matrix, &capture_view, sizeof(D3DXMATRIX));
+			}
+		}
+
+		param::WorldMatrix = WorldMatrix;
+
+		auto wvMatrix = WorldMatrix * ViewMatrix;
+		param::wvMatrix = wvMatrix;
+		view_depth = fabsf(wvMatrix._43);
+
+		D3DXMatrixInverse(&wvMatrix, nullptr, &wvMatrix);
+		D3DXMatrixTranspose(&wvMatrix, &wvMatrix);
+		// The inverse transpose matrix is used for environment mapping.
+		param::wvMatrixInvT = wvMatrix;
+	}
+
+	static void __stdcall Direct3D_SetProjectionMatrix_r(float hfov, float nearPlane, float farPlane)
+	{
+		TARGET_DYNAMIC(Direct3D_SetProjectionMatrix)(hfov, nearPlane, farPlane);
+
+		// The view matrix can also be set here if necessary.
+		param::ProjectionMatrix = _ProjectionMatrix * TransformationMatrix;
+
+		if (capture::recording)
+		{
+			const D3DXMATRIX projection = _ProjectionMatrix * TransformationMatrix;
+			capture::write(capture_format::EventType::projection_matrix, &projection, sizeof(D3DXMATRIX));
+		}
+	}
+
+	static void __cdecl Direct3D_SetViewportAndTransform_r()
+	{
+		const auto original = TARGET_DYNAMIC(Direct3D_SetViewportAndTransform);
+		bool invalid = TransformAndViewportInvalid != 0;
+		original();
+
+		if (invalid)
+		{
+			param::ProjectionMatrix = _ProjectionMatrix * TransformationMatrix;
+		}
+	}
+
+	static void __cdecl Direct3D_PerformLighting_r(int type)
+	{
+		const auto target = TARGET_DYNAMIC(Direct3D_PerformLighting);
+		target(type);
+
+		if (capture::recording)
+		{
+			capture::write(capture_format::EventType::lighting, capture_format::Lighting { type });
+		}
+
+		d3d::set_flags(ShaderFlags_Light, true);
+
+		if (config::multi_light)
+		{
+			update_stage_lights(type);
+		}
+
+		D3DLIGHT9 light {};
+		d3d::device->GetLight(0, &light);
+
+		// Normalized here once instead of per vertex and per pixel.
+		D3DXVECTOR3 direction = -D3DXVECTOR3(light.Direction);
+		D3DXVec3Normalize(&direction, &direction);
+		param::LightDirection = direction;
+
+		if (type == 0)
+		{
+			auto& sl = CurrentStageLights[0];
+			
+			param::LightDiffuse = D3DXCOLOR(sl.diffuse[0], sl.diffuse[1], sl.diffuse[2], 1.0f);
+			param::LightSpecular = D3DXCOLOR(sl.specular, sl.specular, sl.specular, 0.0f);
+			param::LightAmbient = D3DXCOLOR(sl.ambient[0], sl.ambient[1], sl.ambient[2], 0.0f);
+		}
+		else
+		{
+			param::LightDiffuse = light.Diffuse;
+			param::LightSpecular = light.Specular;
+			param::LightAmbient = light.Ambient;
+		}
+	}
+
+
+#define D3D_ORIG(NAME) \
+	NAME ## _t
+
+	static HRESULT __stdcall DrawPrimitive_r(IDirect3DDevice9* _this,
+		D3DPRIMITIVETYPE PrimitiveType,
+		UINT StartVertex,
+		UINT PrimitiveCount)
+	{
+		// Deferred draws go to the device as they are.
+		if (draw_recorder.replaying())
+		{
+			return D3D_ORIG(DrawPrimitive)(_this, PrimitiveType, StartVertex, PrimitiveCount);
+		}
+
+		TRACE_ZONE("DrawPrimitive");
+		++metrics::current.draw_primitive;
+
+		if (capture::recording)
+		{
+			capture::write(capture_format::EventType::draw_primitive,
+				capture_format::DrawPrimitive { static_cast<uint32_t>(PrimitiveType), StartVertex, PrimitiveCount });
+		}
+
+		flush_batch();
+
+		const DrawRecorder::Draw draw { false, PrimitiveType, 0, 0, 0, StartVertex, PrimitiveCount };
+		draw_start(&draw);
+
+		auto result = D3D_ORIG(DrawPrimitive)(_this, PrimitiveType, StartVertex, PrimitiveCount);
+		draw_end();
+		return result;
+	}
+	static HRESULT __stdcall DrawIndexedPrimitive_r(IDirect3DDevice9* _this,
+		D3DPRIMITIVETYPE PrimitiveType,
+		INT BaseVertexIndex,
+		UINT MinVertexIndex,
+		UINT NumVertices,
+		UINT startIndex,
+		UINT primCount)
+	{
+		if (draw_recorder.replaying())
+		{
+			return D3D_ORIG(DrawIndexedPrimitive)(_this, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+		}
+
+		TRACE_ZONE("DrawIndexedPrimitive");
+		++metrics::current.draw_indexed_primitive;
+
+		if (capture::recording)
+		{
+			capture::write(capture_format::EventType::draw_indexed_primitive,
+				capture_format::DrawIndexedPrimitive { static_cast<uint32_t>(PrimitiveType), BaseVertexIndex,
+					MinVertexIndex, NumVertices, startIndex, primCount });
+		}
+
+		flush_batch();
+
+		const DrawRecorder::Draw draw { true, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount };
+		draw_start(&draw);
+
+		auto result = D3D_ORIG(DrawIndexedPrimitive)(_this, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+		draw_end();
+		return result;
+	}
+	static HRESULT __stdcall DrawPrimitiveUP_r(IDirect3DDevice9* _this,
+		D3DPRIMITIVETYPE PrimitiveType,
+		UINT PrimitiveCount,
+		CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride)
+	{
+		TRACE_ZONE("DrawPrimitiveUP");
+		++metrics::current.draw_primitive_up;
+
+		if (capture::recording)
+		{
+			const capture_format::DrawPrimitiveUP record = { static_cast<uint32_t>(PrimitiveType), PrimitiveCount, VertexStreamZeroStride };
+			const UINT vertex_bytes = UPBatcher::vertex_count(PrimitiveType, PrimitiveCount) * VertexStreamZeroStride;
+
+			capture::write(capture_format::EventType::draw_primitive_up, &record, sizeof(record),
+				pVertexStreamZeroData, vertex_bytes);
+		}
+
+		if (batch_draw(PrimitiveType, 0, UPBatcher::vertex_count(PrimitiveType, PrimitiveCount), PrimitiveCount,
+			nullptr, D3DFMT_UNKNOWN, pVertexStreamZeroData, VertexStreamZeroStride))
+		{
+			return D3D_OK;
+		}
+
+		flush_batch();
+
+		draw_start(nullptr);
+
+		auto result = D3D_ORIG(DrawPrimitiveUP)(_this, PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
+		draw_end();
+		return result;
+	}
+	static HRESULT __stdcall DrawIndexedPrimitiveUP_r(IDirect3DDevice9* _this,
+		D3DPRIMITIVETYPE PrimitiveType,
+		UINT MinVertexIndex,
+		UINT NumVertices,
+		UINT PrimitiveCount,
+		CONST void* pIndexData,
+		D3DFORMAT IndexDataFormat,
+		CONST void* pVertexStreamZeroData,
+		UINT VertexStreamZeroStride)
+	{
+		TRACE_ZONE("DrawIndexedPrimitiveUP");
+		++metrics::current.draw_indexed_primitive_up;
+
+		if (capture::recording)
+		{
+			const capture_format::DrawIndexedPrimitiveUP record = { static_cast<uint32_t>(PrimitiveType), MinVertexIndex, NumVertices,
+				PrimitiveCount, static_cast<uint32_t>(IndexDataFormat), VertexStreamZeroStride };
+			const UINT index_bytes = UPBatcher::vertex_count(PrimitiveType, PrimitiveCount) * (IndexDataFormat == D3DFMT_INDEX32 ? 4 : 2);
+
+			capture::write(capture_format::EventType::draw_indexed_primitive_up, &record, sizeof(record),
+				pIndexData, index_bytes,
+				static_cast<const uint8_t*>(pVertexStreamZeroData) + MinVertexIndex * VertexStreamZeroStride,
+				NumVertices * VertexStreamZeroStride);
+		}
+
+		if (batch_draw(PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount,
+			pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride))
+		{
+			return D3D_OK;
+		}
+
+		flush_batch();
+
+		draw_start(nullptr);
+
+		auto result = D3D_ORIG(DrawIndexedPrimitiveUP)(_this, PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
+		draw_end();
+		return result;
+	}
+
+	static void flush_batch()
+	{
+		UPBatcher::Batch batch {};
+
+		if (!up_batcher.close(batch))
+		{
+			return;
+		}
+
+		// The originals have to be called on the device they came from.
+		const auto device = device_proxy ? device_proxy->target() : d3d::device;
+
+		gpu_profiler.mark(batch.key);
+
+		// UP draws leave stream 0 and the index buffer unset, so the same is done here.
+		D3D_ORIG(SetStreamSource)(device, 0, up_batcher.vertex_buffer(), batch.offset, batch.stride);
+		D3D_ORIG(SetIndices)(device, up_batcher.index_buffer());
+		D3D_ORIG(DrawIndexedPrimitive)(device, batch.type, 0, 0, batch.vertex_count, batch.start_index, batch.primitive_count);
+		D3D_ORIG(SetStreamSource)(device, 0, nullptr, 0, 0);
+		D3D_ORIG(SetIndices)(device, nullptr);
+
+		shader_end();
+	}
+
+	static HRESULT __stdcall Present_r(IDirect3DDevice9* _this,
+		CONST RECT* pSourceRect,
+		CONST RECT* pDestRect,
+		HWND hDestWindowOverride,
+		CONST RGNDATA* pDirtyRegion)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(Present)(_this, pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion);
+	}
+	static HRESULT __stdcall EndScene_r(IDirect3DDevice9* _this)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(EndScene)(_this);
+	}
+	static HRESULT __stdcall Clear_r(IDirect3DDevice9* _this,
+		DWORD Count,
+		CONST D3DRECT* pRects,
+		DWORD Flags,
+		D3DCOLOR Color,
+		float Z,
+		DWORD Stencil)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(Clear)(_this, Count, pRects, Flags, Color, Z, Stencil);
+	}
+	static HRESULT __stdcall SetRenderTarget_r(IDirect3DDevice9* _this, DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(SetRenderTarget)(_this, RenderTargetIndex, pRenderTarget);
+	}
+	static HRESULT __stdcall SetDepthStencilSurface_r(IDirect3DDevice9* _this, IDirect3DSurface9* pNewZStencil)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(SetDepthStencilSurface)(_this, pNewZStencil);
+	}
+
+	// The state setters below only break the current batch if the value actually changes,
+	// since the game re-applies most of its state before every draw.
+
+	static HRESULT __stdcall SetTransform_r(IDirect3DDevice9* _this, D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix)
+	{
+		if (up_batcher.is_open())
+		{
+			D3DMATRIX current;
+			if (FAILED(_this->GetTransform(State, &current)) || memcmp(&current, pMatrix, sizeof(D3DMATRIX)))
+			{
+				flush_batch();
+			}
+		}
+
+		return D3D_ORIG(SetTransform)(_this, State, pMatrix);
+	}
+	static HRESULT __stdcall SetViewport_r(IDirect3DDevice9* _this, CONST D3DVIEWPORT9* pViewport)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(SetViewport)(_this, pViewport);
+	}
+	static HRESULT __stdcall SetMaterial_r(IDirect3DDevice9* _this, CONST D3DMATERIAL9* pMaterial)
+	{
+		if (up_batcher.is_open())
+		{
+			D3DMATERIAL9 current;
+			if (FAILED(_this->GetMaterial(&current)) || memcmp(&current, pMaterial, sizeof(D3DMATERIAL9)))
+			{
+				flush_batch();
+			}
+		}
+
+		return D3D_ORIG(SetMaterial)(_this, pMaterial);
+	}
+	static HRESULT __stdcall SetLight_r(IDirect3DDevice9* _this, DWORD Index, CONST D3DLIGHT9* pLight)
+	{
+		flush_batch();
+		return D3D_ORIG(SetLight)(_this, Index, pLight);
+	}
+	static HRESULT __stdcall LightEnable_r(IDirect3DDevice9* _this, DWORD Index, BOOL Enable)
+	{
+		flush_batch();
+		return D3D_ORIG(LightEnable)(_this, Index, Enable);
+	}
+	static HRESULT __stdcall SetClipPlane_r(IDirect3DDevice9* _this, DWORD Index, CONST float* pPlane)
+	{
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(SetClipPlane)(_this, Index, pPlane);
+	}
+	static HRESULT __stdcall SetRenderState_r(IDirect3DDevice9* _this, D3DRENDERSTATETYPE State, DWORD Value)
+	{
+		if (up_batcher.is_open())
+		{
+			DWORD current;
+			if (FAILED(_this->GetRenderState(State, &current)) || current != Value)
+			{
+				flush_batch();
+			}
+		}
+
+		draw_recorder.render_state(State, Value);
+		return D3D_ORIG(SetRenderState)(_this, State, Value);
+	}
+	static HRESULT __stdcall SetTexture_r(IDirect3DDevice9* _this, DWORD Stage, IDirect3DBaseTexture9* pTexture)
+	{
+		if (up_batcher.is_open())
+		{
+			CComPtr<IDirect3DBaseTexture9> current;
+			if (FAILED(_this->GetTexture(Stage, &current)) || current != pTexture)
+			{
+				flush_batch();
+			}
+		}
 
-		(void)orig;
-		(void)_type;
+		draw_recorder.texture(Stage, pTexture);
+		const HRESULT result = D3D_ORIG(SetTexture)(_this, Stage, pTexture);
 
-		__asm
+		if (Stage == 0 && SUCCEEDED(result))
 		{
-			push _type
-			mov edx, behavior
-			call orig
+			stage0_texture = pTexture;
 		}
 
-		if (Direct3D_Device != nullptr && !initialized)
+		return result;
+	}
+	static HRESULT __stdcall SetTextureStageState_r(IDirect3DDevice9* _this, DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value)
+	{
+		if (up_batcher.is_open())
 		{
-			d3d::device = Direct3D_Device->GetProxyInterface();
-
-			initialized = true;
-			d3d::load_shader();
-			hook_vtable();
+			DWORD current;
+			if (FAILED(_this->GetTextureStageState(Stage, Type, &current)) || current != Value)
+			{
+				flush_batch();
+			}
 		}
-	}
 
-	static void __declspec(naked) CreateDirect3DDevice_r()
+		return D3D_ORIG(SetTextureStageState)(_this, Stage, Type, Value);
+	}
+	static HRESULT __stdcall SetSamplerState_r(IDirect3DDevice9* _this, DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value)
 	{
-		__asm
+		if (up_batcher.is_open())
 		{
-			push [esp + 04h] // type
-			push edx // behavior
-
-			call CreateDirect3DDevice_c
-
-			pop edx // behavior
-			add esp, 4
-			retn 4
+			DWORD current;
+			if (FAILED(_this->GetSamplerState(Sampler, Type, &current)) || current != Value)
+			{
+				flush_batch();
+			}
 		}
-	}
 
-	static void __cdecl Direct3D_SetWorldTransform_r()
+		draw_recorder.sampler_state(Sampler, Type, Value);
+		return D3D_ORIG(SetSamplerState)(_this, Sampler, Type, Value);
+	}
+	static HRESULT __stdcall SetScissorRect_r(IDirect3DDevice9* _this, CONST RECT* pRect)
 	{
-		TARGET_DYNAMIC(Direct3D_SetWorldTransform)();
-
-		param::WorldMatrix = WorldMatrix;
-
-		auto wvMatrix = WorldMatrix * ViewMatrix;
-		param::wvMatrix = wvMatrix;
-
-		D3DXMatrixInverse(&wvMatrix, nullptr, &wvMatrix);
-		D3DXMatrixTranspose(&wvMatrix, &wvMatrix);
-		// The inverse transpose matrix is used for environment mapping.
-		param::wvMatrixInvT = wvMatrix;
+		flush_batch();
+		draw_recorder.replay();
+		return D3D_ORIG(SetScissorRect)(_this, pRect);
 	}
-
-	static void __stdcall Direct3D_SetProjectionMatrix_r(float hfov, float nearPlane, float farPlane)
+	static HRESULT __stdcall SetVertexDeclaration_r(IDirect3DDevice9* _this, IDirect3DVertexDeclaration9* pDecl)
 	{
-		TARGET_DYNAMIC(Direct3D_SetProjectionMatrix)(hfov, nearPlane, farPlane);
-
-		// The view matrix can also be set here if necessary.
-		param::ProjectionMatrix = _ProjectionMatrix * TransformationMatrix;
+		flush_batch();
+		draw_recorder.vertex_declaration(pDecl);
+		return D3D_ORIG(SetVertexDeclaration)(_this, pDecl);
 	}
-
-	static void __cdecl Direct3D_SetViewportAndTransform_r()
+	static HRESULT __stdcall SetFVF_r(IDirect3DDevice9* _this, DWORD FVF)
 	{
-		const auto original = TARGET_DYNAMIC(Direct3D_SetViewportAndTransform);
-		bool invalid = TransformAndViewportInvalid != 0;
-		original();
-
-		if (invalid)
+		if (up_batcher.is_open())
 		{
-			param::ProjectionMatrix = _ProjectionMatrix * TransformationMatrix;
+			DWORD current;
+			if (FAILED(_this->GetFVF(&current)) || current != FVF)
+			{
+				flush_batch();
+			}
 		}
-	}
 
-	DataArray(StageLightData, CurrentStageLights, 0x3ABD9F8, 4);
+		if (capture::recording && !draw_recorder.replaying())
+		{
+			capture::write(capture_format::EventType::fvf, capture_format::Fvf { FVF });
+		}
 
-	static void __cdecl Direct3D_PerformLighting_r(int type)
+		draw_recorder.fvf(FVF);
+		return D3D_ORIG(SetFVF)(_this, FVF);
+	}
+	static HRESULT __stdcall SetVertexShader_r(IDirect3DDevice9* _this, IDirect3DVertexShader9* pShader)
 	{
-		const auto target = TARGET_DYNAMIC(Direct3D_PerformLighting);
-		target(type);
-		d3d::set_flags(ShaderFlags_Light, true);
-
-		D3DLIGHT9 light {};
-		d3d::device->GetLight(0, &light);
-		param::LightDirection = -D3DXVECTOR3(light.Direction);
-
-		if (type == 0)
+		if (up_batcher.is_open())
 		{
-			auto& sl = CurrentStageLights[0];
-			
-			param::LightDiffuse = D3DXCOLOR(sl.diffuse[0], sl.diffuse[1], sl.diffuse[2], 1.0f);
-			param::LightSpecular = D3DXCOLOR(sl.specular, sl.specular, sl.specular, 0.0f);
-			param::LightAmbient = D3DXCOLOR(sl.ambient[0], sl.ambient[1], sl.ambient[2], 0.0f);
+			VertexShader current;
+			if (FAILED(_this->GetVertexShader(&current)) || current != pShader)
+			{
+				flush_batch();
+			}
 		}
-		else
+
+		draw_recorder.vertex_shader(pShader);
+		return D3D_ORIG(SetVertexShader)(_this, pShader);
+	}
+	static HRESULT __stdcall SetVertexShaderConstantF_r(IDirect3DDevice9* _this, UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount)
+	{
+		flush_batch();
+		draw_recorder.vertex_constants(StartRegister, pConstantData, Vector4fCount);
+		return D3D_ORIG(SetVertexShaderConstantF)(_this, StartRegister, pConstantData, Vector4fCount);
+	}
+	static HRESULT __stdcall SetVertexShaderConstantB_r(IDirect3DDevice9* _this, UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount)
+	{
+		flush_batch();
+		draw_recorder.vertex_bools(StartRegister, pConstantData, BoolCount);
+		return D3D_ORIG(SetVertexShaderConstantB)(_this, StartRegister, pConstantData, BoolCount);
+	}
+	static HRESULT __stdcall SetStreamSource_r(IDirect3DDevice9* _this, UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride)
+	{
+		flush_batch();
+
+		if (capture::recording && !draw_recorder.replaying())
 		{
-			param::LightDiffuse = light.Diffuse;
-			param::LightSpecular = light.Specular;
-			param::LightAmbient = light.Ambient;
+			capture::write(capture_format::EventType::stream_source,
+				capture_format::StreamSource { StreamNumber, capture::id(pStreamData), OffsetInBytes, Stride });
 		}
-	}
 
+		draw_recorder.stream_source(StreamNumber, pStreamData, OffsetInBytes, Stride);
+		return D3D_ORIG(SetStreamSource)(_this, StreamNumber, pStreamData, OffsetInBytes, Stride);
+	}
+	static HRESULT __stdcall SetIndices_r(IDirect3DDevice9* _this, IDirect3DIndexBuffer9* pIndexData)
+	{
+		flush_batch();
 
-#define D3D_ORIG(NAME) \
-	NAME ## _t
+		if (capture::recording && !draw_recorder.replaying())
+		{
+			capture::write(capture_format::EventType::indices, capture_format::Indices { capture::id(pIndexData) });
+		}
 
-	static HRESULT __stdcall DrawPrimitive_r(IDirect3DDevice9* _this,
-		D3DPRIMITIVETYPE PrimitiveType,
-		UINT StartVertex,
-		UINT PrimitiveCount)
-	{
-		shader_start();
-		auto result = D3D_ORIG(DrawPrimitive)(_this, PrimitiveType, StartVertex, PrimitiveCount);
-		shader_end();
-		return result;
+		draw_recorder.indices(pIndexData);
+		return D3D_ORIG(SetIndices)(_this, pIndexData);
 	}
-	static HRESULT __stdcall DrawIndexedPrimitive_r(IDirect3DDevice9* _this,
-		D3DPRIMITIVETYPE PrimitiveType,
-		INT BaseVertexIndex,
-		UINT MinVertexIndex,
-		UINT NumVertices,
-		UINT startIndex,
-		UINT primCount)
+	static HRESULT __stdcall SetPixelShader_r(IDirect3DDevice9* _this, IDirect3DPixelShader9* pShader)
 	{
-		shader_start();
-		auto result = D3D_ORIG(DrawIndexedPrimitive)(_this, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
-		shader_end();
-		return result;
+		if (up_batcher.is_open())
+		{
+			PixelShader current;
+			if (FAILED(_this->GetPixelShader(&current)) || current != pShader)
+			{
+				flush_batch();
+			}
+		}
+
+		draw_recorder.pixel_shader(pShader);
+		return D3D_ORIG(SetPixelShader)(_this, pShader);
 	}
-	static HRESULT __stdcall DrawPrimitiveUP_r(IDirect3DDevice9* _this,
-		D3DPRIMITIVETYPE PrimitiveType,
-		UINT PrimitiveCount,
-		CONST void* pVertexStreamZeroData,
-		UINT VertexStreamZeroStride)
+	static HRESULT __stdcall SetPixelShaderConstantF_r(IDirect3DDevice9* _this, UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount)
 	{
-		shader_start();
-		auto result = D3D_ORIG(DrawPrimitiveUP)(_this, PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
-		shader_end();
-		return result;
+		flush_batch();
+		draw_recorder.pixel_constants(StartRegister, pConstantData, Vector4fCount);
+		return D3D_ORIG(SetPixelShaderConstantF)(_this, StartRegister, pConstantData, Vector4fCount);
 	}
-	static HRESULT __stdcall DrawIndexedPrimitiveUP_r(IDirect3DDevice9* _this,
-		D3DPRIMITIVETYPE PrimitiveType,
-		UINT MinVertexIndex,
-		UINT NumVertices,
-		UINT PrimitiveCount,
-		CONST void* pIndexData,
-		D3DFORMAT IndexDataFormat,
-		CONST void* pVertexStreamZeroData,
-		UINT VertexStreamZeroStride)
+	static HRESULT __stdcall SetPixelShaderConstantB_r(IDirect3DDevice9* _this, UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount)
 	{
-		shader_start();
-		auto result = D3D_ORIG(DrawIndexedPrimitiveUP)(_this, PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
-		shader_end();
-		return result;
+		flush_batch();
+		draw_recorder.pixel_bools(StartRegister, pConstantData, BoolCount);
+		return D3D_ORIG(SetPixelShaderConstantB)(_this, StartRegister, pConstantData, BoolCount);
 	}
 
 	// ReSharper disable once CppDeclaratorNeverUsed
@@ -1107,8 +2637,6 @@ namespace local
 namespace d3d
 {
 	IDirect3DDevice9* device = nullptr;
-	VertexShader vertex_shader;
-	PixelShader pixel_shader;
 	bool do_effect = false;
 
 	void load_shader()
@@ -1124,6 +2652,8 @@ namespace d3d
 
 	void set_flags(Uint32 flags, bool add)
 	{
+		const auto last = local::shader_flags;
+
 		if (add)
 		{
 			local::shader_flags |= flags;
@@ -1132,11 +2662,195 @@ namespace d3d
 		{
 			local::shader_flags &= ~flags;
 		}
+
+		if (capture::recording && local::shader_flags != last)
+		{
+			capture::write(capture_format::EventType::shader_flags, capture_format::ShaderFlags { local::shader_flags });
+		}
+	}
+
+	void set_vertex_lighting(bool enabled)
+	{
+		// Shaders for either tier are compiled on demand, so this is safe to change at any time.
+		set_flags(ShaderFlags_VertexLit, enabled);
+	}
+
+	bool vertex_lighting()
+	{
+		return (local::shader_flags & ShaderFlags_VertexLit) != 0;
+	}
+
+	void set_partial_precision(bool enabled)
+	{
+	#ifndef PARTIAL_PRECISION_SHADERS
+		enabled = false;
+	#endif
+
+		if (enabled == local::partial_precision)
+		{
+			return;
+		}
+
+		local::partial_precision = enabled;
+		load_shader();
+	}
+
+	bool partial_precision()
+	{
+		return local::partial_precision;
+	}
+
+	void set_uber_shader(bool enabled)
+	{
+		if (enabled == local::uber_shader)
+		{
+			return;
+		}
+
+		local::uber_shader = enabled;
+		load_shader();
+	}
+
+	bool uber_shader()
+	{
+		return local::uber_shader;
 	}
 
 	bool shaders_not_null()
 	{
-		return vertex_shader != nullptr && pixel_shader != nullptr;
+		return local::shader_state.vertex_shader != nullptr && local::shader_state.pixel_shader != nullptr;
+	}
+
+
+	const LodCounters& lod_counters()
+	{
+		return local::lod_counters_last;
+	}
+
+	void end_frame()
+	{
+		metrics::end_frame();
+		capture::end_frame();
+
+		// Makes every captured frame start from known flags.
+		if (capture::recording)
+		{
+			capture::write(capture_format::EventType::shader_flags, capture_format::ShaderFlags { local::shader_flags });
+
+			if (capture::first_frame())
+			{
+				local::write_capture_state();
+			}
+		}
+
+		local::gpu_profiler.end_frame();
+		local::gpu_profiler.begin_frame();
+
+		local::lod_counters_last = local::lod_counters;
+		local::lod_counters = {};
+
+		if (config::depth_prepass_report)
+		{
+			local::poll_depth_queries();
+		}
+
+		if (CurrentLevel != local::report_level || CurrentAct != local::report_act)
+		{
+			if (config::depth_prepass_report)
+			{
+				local::report_depth_pass();
+			}
+
+			if (config::alpha_report)
+			{
+				local::report_alpha();
+			}
+
+			if (config::frame_time_report)
+			{
+				metrics::report_frame_times();
+			}
+
+			metrics::reset_frame_times();
+
+			if (config::gpu_profile)
+			{
+				local::report_gpu_profile();
+			}
+
+			local::gpu_profiler.clear();
+
+			local::report_level = CurrentLevel;
+			local::report_act = CurrentAct;
+		}
+	}
+
+	void set_depth_pass(DepthPass pass)
+	{
+		using namespace local;
+
+		if (pass == depth_pass || !initialized)
+		{
+			return;
+		}
+
+		flush_batch();
+		end_depth_query(depth_pass);
+
+		// The deferred draws are shaded in a pass of their own.
+		if (depth_pass == DepthPass::prepass)
+		{
+			begin_depth_query(DepthPass::main);
+			draw_recorder.end();
+			end_depth_query(DepthPass::main);
+			shader_state.state_blocks = config::state_blocks;
+		}
+
+		if (pass == DepthPass::prepass)
+		{
+			try
+			{
+				get_depth_shaders();
+			}
+			catch (std::exception& ex)
+			{
+				PrintDebug("[lantern] Depth pre-pass disabled: %s\n", ex.what());
+			}
+
+			if (depth_vs == nullptr)
+			{
+				pass = DepthPass::main;
+			}
+			else
+			{
+				// Applying a state block bypasses the recorder.
+				shader_state.state_blocks = false;
+				draw_recorder.begin(target_device(), &mark_deferred_draw);
+			}
+		}
+
+		depth_pass = pass;
+		begin_depth_query(pass);
+	}
+
+	const DepthPassCounters& depth_pass_counters()
+	{
+		return local::depth_counters;
+	}
+
+	const AlphaCounters& alpha_counters()
+	{
+		return local::alpha_counters;
+	}
+
+	IDirect3DDevice9* target_device()
+	{
+		return local::device_proxy ? local::device_proxy->target() : device;
+	}
+
+	bool device_proxy_installed()
+	{
+		return local::device_proxy != nullptr;
 	}
 
 	void init_trampolines()
@@ -1174,17 +2888,37 @@ extern "C"
 	EXPORT void __cdecl OnRenderDeviceLost()
 	{
 		end();
+		up_batcher.release();
+		release_depth_queries();
+		gpu_profiler.reset();
+		timestamp_queries.release();
 		free_shaders();
 	}
 
 	EXPORT void __cdecl OnRenderDeviceReset()
 	{
+		++metrics::current.device_resets;
+		stage0_texture = nullptr;
+
+		shader_state.device_reset();
 		create_shaders();
+		up_batcher.create(d3d::device);
+
+		if (config::gpu_profile)
+		{
+			timestamp_queries.create(d3d::device);
+		}
 	}
 
 	EXPORT void __cdecl OnExit()
 	{
 		param::release_parameters();
+		metrics::stop_csv();
+		capture::stop();
+		up_batcher.release();
+		release_depth_queries();
+		gpu_profiler.reset();
+		timestamp_queries.release();
 		free_shaders();
 	}
 }
@@ -1,36 +1,77 @@
 #pragma once
 
+#include <cstdint>
 #include <d3d9.h>
 #include <d3dx9effect.h>
 #include <d3d8to9.hpp>
 #include <ninja.h>
 
 #include "ShaderParameter.h"
+#include "UPBatcher.h"
+#include "materials.h"
+#include "lights.h"
+#include "ShaderSelection.h"
 
-enum ShaderFlags
+// Draws served by each shader level of detail.
+struct LodCounters
 {
-	ShaderFlags_None     = 0,
-	ShaderFlags_Texture  = 0b1,
-	ShaderFlags_EnvMap   = 0b10,
-	ShaderFlags_Alpha    = 0b100,
-	ShaderFlags_Light    = 0b1000,
-	ShaderFlags_Specular = 0b10000,
-	ShaderFlags_Fog      = 0b100000,
-	ShaderFlags_Mask     = 0b111111,
-	ShaderFlags_Count
+	Uint32 full;
+	Uint32 no_specular;
+	Uint32 vertex_lit;
+};
+
+// Draws inside the land table. In the pre-pass, opaque draws are rendered
+// depth only as they come and shaded with an equal depth test when it ends;
+// the main pass draws them as they are.
+enum class DepthPass
+{
+	none,
+	prepass,
+	main
+};
+
+// Land table pixel shader statistics, accumulated per stage.
+struct DepthPassCounters
+{
+	Uint32 frames;          // Frames with a completed main pass query.
+	uint64_t shaded_samples;  // Samples that passed the depth test in the main pass, or in the deferred draws.
+	uint64_t prepass_samples; // Samples that passed the depth test in the pre-pass, other than its deferred draws.
+	uint64_t viewport_pixels;
+	Uint32 depth_draws;     // Draws rendered depth only and deferred.
+	Uint32 skipped_draws;   // Draws not eligible for the pre-pass.
+	Uint32 early_replays;   // Times deferred draws were shaded before a draw that depends on them.
+};
+
+// Draws with the alpha flag, by whether they still needed the alpha test.
+struct AlphaCounters
+{
+	Uint32 clipped;
+	Uint32 opaque; // Regained early depth rejection.
 };
 
 namespace d3d
 {
 	extern IDirect3DDevice9* device;
-	extern VertexShader vertex_shader;
-	extern PixelShader pixel_shader;
 
 	extern bool do_effect;
 	void load_shader();
 	void set_flags(Uint32 flags, bool add = true);
+	void set_vertex_lighting(bool enabled);
+	bool vertex_lighting();
+	void set_partial_precision(bool enabled);
+	bool partial_precision();
+	void set_uber_shader(bool enabled);
+	bool uber_shader();
 	bool shaders_not_null();
 	void init_trampolines();
+	const LodCounters& lod_counters();
+	void end_frame();
+	void set_depth_pass(DepthPass pass);
+	const DepthPassCounters& depth_pass_counters();
+	const AlphaCounters& alpha_counters();
+	// The device behind the proxy, or device itself without it.
+	IDirect3DDevice9* target_device();
+	bool device_proxy_installed();
 }
 
 namespace param
@@ -41,20 +82,20 @@ namespace param
 	extern ShaderParameter<D3DXMATRIX> wvMatrixInvT;
 	extern ShaderParameter<D3DXMATRIX> TextureTransform;
 
-	extern ShaderParameter<int> FogMode;
-	extern ShaderParameter<D3DXVECTOR3> FogConfig;
+	extern ShaderParameter<D3DXVECTOR4> FogConfig;
 	extern ShaderParameter<D3DXCOLOR> FogColor;
+	extern ShaderParameter<D3DXVECTOR2> FogTableScale;
+	extern ShaderParameter<Texture> FogTable;
 
 	extern ShaderParameter<D3DXVECTOR3> LightDirection;
 	extern ShaderParameter<D3DXVECTOR3> CameraPosition;
-	extern ShaderParameter<int> DiffuseSource;
-	extern ShaderParameter<D3DXCOLOR> MaterialDiffuse;
 	extern ShaderParameter<D3DXVECTOR3> NormalScale;
-	extern ShaderParameter<D3DXCOLOR> MaterialSpecular;
-	extern ShaderParameter<float> MaterialPower;
 	extern ShaderParameter<D3DXCOLOR> LightDiffuse;
 	extern ShaderParameter<D3DXCOLOR> LightSpecular;
 	extern ShaderParameter<D3DXCOLOR> LightAmbient;
+	extern ShaderParameter<MaterialBlock> Material;
+	extern ShaderParameter<StageLights> Lights;
+	extern ShaderParameter<D3DXVECTOR4> LightWeights;
 }
 
 // Same as in the mod loader except with d3d8to9 types.
@@ -6,11 +6,21 @@
 // Mod loader
 #include <Trampoline.h>
 
+// Standard library
+#include <cstring>
+
 // Local
 #include "d3d.h"
+#include "config.h"
+#include "capture.h"
+#include "FogTable.h"
 
 static D3DFOGMODE fog_mode = D3DFOG_NONE;
 
+static_assert(fog_table::SIZE == sizeof(NJS_FOG_TABLE) / sizeof(Float), "Fog table size mismatch");
+static uint8_t last_texels[fog_table::SIZE] {};
+static Texture fog_texture;
+
 static void __cdecl njDisableFog_r();
 static void __cdecl njEnableFog_r();
 static void __cdecl njSetFogColor_r(Uint32 c);
@@ -23,23 +33,122 @@ static Trampoline njSetFogTable_t(0x00794E40, 0x00794E46, njSetFogTable_r);
 
 using namespace d3d;
 
+// Enables fog and selects the shader variant with the matching fog formula.
+// Fog is enabled regardless of the mode, as it always has been; any mode
+// other than exp and exp2 uses the linear formula.
+static void set_fog_flags()
+{
+	set_flags(ShaderFlags_Fog, true);
+	set_flags(ShaderFlags_FogExp, fog_mode == D3DFOG_EXP);
+	set_flags(ShaderFlags_FogExp2, fog_mode == D3DFOG_EXP2);
+	set_flags(ShaderFlags_FogTable, fog_texture != nullptr);
+}
+
+// Drops the fog table so set_fog_flags falls back to the fog formula.
+static void release_fog_table()
+{
+	fog_texture = nullptr;
+	param::FogTable = nullptr;
+	memset(last_texels, 0, sizeof(last_texels));
+}
+
+// A table of zeros is what the game leaves when it never set one.
+static bool is_set(const Float* table)
+{
+	for (UINT i = 0; i < fog_table::SIZE; i++)
+	{
+		if (table[i] != 0.0f)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Uploads the fog table as a fog_table::SIZE x 1 texture, built from the
+// game's table if it set one and from the fog formula otherwise.
+static void update_fog_table(const Float* table, const fog_table::Fog& fog)
+{
+	if (!config::fog_table)
+	{
+		release_fog_table();
+		return;
+	}
+
+	const float distance = fog_table::distance(fog);
+
+	// No fog range to map the table to.
+	if (distance <= 0.0f)
+	{
+		release_fog_table();
+		return;
+	}
+
+	float scale[2];
+	fog_table::scale(distance, scale);
+	param::FogTableScale = D3DXVECTOR2(scale[0], scale[1]);
+
+	uint8_t texels[fog_table::SIZE];
+	fog_table::build(fog, is_set(table) ? table : nullptr, texels);
+
+	if (fog_texture != nullptr && !memcmp(last_texels, texels, sizeof(texels)))
+	{
+		return;
+	}
+
+	if (fog_texture == nullptr
+		&& FAILED(device->CreateTexture(fog_table::SIZE, 1, 1, 0, D3DFMT_L8, D3DPOOL_MANAGED, &fog_texture, nullptr)))
+	{
+		release_fog_table();
+		return;
+	}
+
+	// The texture would still hold the previous table.
+	D3DLOCKED_RECT rect;
+	if (FAILED(fog_texture->LockRect(0, &rect, nullptr, 0)))
+	{
+		release_fog_table();
+		return;
+	}
+
+	memcpy(rect.pBits, texels, sizeof(texels));
+	fog_texture->UnlockRect(0);
+	memcpy(last_texels, texels, sizeof(texels));
+	param::FogTable = fog_texture;
+}
+
 static void __cdecl njDisableFog_r()
 {
 	TARGET_STATIC(njDisableFog)();
 	set_flags(ShaderFlags_Fog, false);
+
+	if (capture::recording)
+	{
+		capture::write(capture_format::EventType::fog_enable, capture_format::FogEnable { 0 });
+	}
 }
 
 static void __cdecl njEnableFog_r()
 {
 	TARGET_STATIC(njEnableFog)();
-	param::FogMode = fog_mode;
-	set_flags(ShaderFlags_Fog, true);
+	set_fog_flags();
+
+	if (capture::recording)
+	{
+		capture::write(capture_format::EventType::fog_enable, capture_format::FogEnable { 1 });
+	}
 }
 
 static void __cdecl njSetFogColor_r(Uint32 c)
 {
 	TARGET_STATIC(njSetFogColor)(c);
 	param::FogColor = D3DXCOLOR(c);
+
+	if (capture::recording)
+	{
+		capture::write(capture_format::EventType::fog_color, capture_format::FogColor { c });
+	}
 }
 
 static void __cdecl njSetFogTable_r(NJS_FOG_TABLE fogtable)
@@ -52,23 +161,30 @@ static void __cdecl njSetFogTable_r(NJS_FOG_TABLE fogtable)
 	}
 
 	device->GetRenderState(D3DRS_FOGTABLEMODE, reinterpret_cast<DWORD*>(&fog_mode));
-	param::FogMode = fog_mode;
-	set_flags(ShaderFlags_Fog, true);
 
-	D3DXVECTOR3 fog_config {};
-
-	float start, end, density;
+	float start, end, density = 0.0f;
 	device->GetRenderState(D3DRS_FOGSTART, reinterpret_cast<DWORD*>(&start));
 	device->GetRenderState(D3DRS_FOGEND, reinterpret_cast<DWORD*>(&end));
 
-	fog_config.x = start;
-	fog_config.y = end;
-
 	if (fog_mode != D3DFOG_LINEAR)
 	{
 		device->GetRenderState(D3DRS_FOGDENSITY, reinterpret_cast<DWORD*>(&density));
-		fog_config.z = density;
 	}
 
-	param::FogConfig = fog_config;
+	if (capture::recording)
+	{
+		capture_format::FogTable record = { static_cast<uint32_t>(fog_mode), start, end, density };
+		static_assert(sizeof(record.table) == sizeof(NJS_FOG_TABLE), "Fog table size mismatch");
+		memcpy(record.table, fogtable, sizeof(record.table));
+		capture::write(capture_format::EventType::fog_table, record);
+	}
+
+	const fog_table::Fog fog = { static_cast<fog_table::Mode>(fog_mode), start, end, density };
+
+	float fog_config[4];
+	fog_table::config(fog, fog_config);
+	param::FogConfig = D3DXVECTOR4(fog_config);
+
+	update_fog_table(fogtable, fog);
+	set_fog_flags();
 }
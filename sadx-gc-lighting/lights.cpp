@@ -36,12 +36,15 @@ bool ShaderParameter<StageLights>::commit(IDirect3DDevice9* device)
 {
 	if (is_modified())
 	{
-		device->SetVertexShaderConstantF(index, reinterpret_cast<float*>(&current), 16);
-		device->SetPixelShaderConstantF(index, reinterpret_cast<float*>(&current), 16);
+		// All four lights are uploaded as one contiguous block.
+		const auto data = reinterpret_cast<const float*>(&current);
+
+		upload(device, type, index, data, 16);
 
 		clear();
 		return true;
 	}
 
+	assigned = false;
 	return false;
 }
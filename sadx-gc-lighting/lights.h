@@ -1,5 +1,10 @@
 #pragma once
 
+#include <d3d9.h>
+#include <ninja.h>
+
+#include "ShaderParameter.h"
+
 struct StageLight
 {
 	NJS_VECTOR direction;
@@ -13,6 +18,8 @@ struct StageLight
 	bool operator!=(const StageLight& rhs) const;
 };
 
+static_assert(sizeof(StageLight) == sizeof(float) * 16, "StageLight must be exactly four registers.");
+
 struct StageLights
 {
 	StageLight lights[4] {};
@@ -20,3 +27,5 @@ struct StageLights
 	bool operator==(const StageLights& rhs) const;
 	bool operator!=(const StageLights& rhs) const;
 };
+
+template<> bool ShaderParameter<StageLights>::commit(IDirect3DDevice9* device);
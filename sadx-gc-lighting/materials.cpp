@@ -0,0 +1,181 @@
+#include "stdafx.h"
+
+#include <d3d9.h>
+#include <cstdint>
+#include <cstring>
+#include <d3dx9math.h>
+#include <xmmintrin.h>
+
+#include "ShaderParameter.h"
+#include "materials.h"
+
+bool MaterialBlock::operator==(const MaterialBlock& rhs) const
+{
+	return diffuse == rhs.diffuse
+		&& specular == rhs.specular
+		&& power == rhs.power;
+}
+
+bool MaterialBlock::operator!=(const MaterialBlock& rhs) const
+{
+	return !(*this == rhs);
+}
+
+template<>
+bool ShaderParameter<MaterialBlock>::commit(IDirect3DDevice9* device)
+{
+	if (is_modified())
+	{
+		static_assert(sizeof(MaterialBlock) == sizeof(D3DXVECTOR4) * 3, "MaterialBlock must be exactly three registers.");
+		const auto data = reinterpret_cast<const float*>(&current);
+
+		upload(device, type, index, data, 3);
+
+		clear();
+		return true;
+	}
+
+	assigned = false;
+	return false;
+}
+
+namespace materials
+{
+	// Everything the corrected material is derived from: the complete material
+	// as the game set it, before correction, and the palette's specular power.
+	struct Key
+	{
+		D3DMATERIAL9 material;
+		float power;
+
+		bool operator==(const Key& rhs) const
+		{
+			return !memcmp(this, &rhs, sizeof(Key));
+		}
+	};
+
+	// Both caches are direct mapped: a key evicts whatever was in its slot,
+	// so animated and constant materials never make them grow or get dropped.
+	struct Slot
+	{
+		Key key;
+		Entry entry;
+		bool used;
+	};
+
+	struct SourceSlot
+	{
+		Source source;
+		Entry entry;
+		bool used;
+	};
+
+	static constexpr size_t SLOT_COUNT        = 2048;
+	static constexpr size_t SOURCE_SLOT_COUNT = 1024;
+
+	static Slot slots[SLOT_COUNT] {};
+	static SourceSlot source_slots[SOURCE_SLOT_COUNT] {};
+
+	static Slot& slot(const Key& key)
+	{
+		static_assert(sizeof(Key) % sizeof(uint32_t) == 0, "Key must be whole dwords.");
+
+		uint32_t words[sizeof(Key) / sizeof(uint32_t)];
+		memcpy(words, &key, sizeof(Key));
+
+		// FNV-1a over the key's dwords.
+		uint32_t h = 2166136261u;
+
+		for (auto word : words)
+		{
+			h = (h ^ word) * 16777619u;
+		}
+
+		return slots[(h ^ (h >> 16)) & (SLOT_COUNT - 1)];
+	}
+
+	static SourceSlot& slot(const Source& source)
+	{
+		const auto address = reinterpret_cast<uintptr_t>(source.material);
+		return source_slots[((address >> 4) ^ (address >> 16) ^ source.flags) & (SOURCE_SLOT_COUNT - 1)];
+	}
+
+	bool Source::operator==(const Source& rhs) const
+	{
+		return material == rhs.material
+			&& flags == rhs.flags
+			&& diffuse == rhs.diffuse
+			&& specular == rhs.specular
+			&& exponent == rhs.exponent
+			&& power == rhs.power;
+	}
+
+	static void correct_color(D3DCOLORVALUE& color)
+	{
+		static_assert(sizeof(D3DCOLORVALUE) == sizeof(__m128), "D3DCOLORVALUE must be four floats.");
+		const auto scale = _mm_set1_ps(1.0f / 255.0f);
+		_mm_storeu_ps(&color.r, _mm_mul_ps(_mm_loadu_ps(&color.r), scale));
+	}
+
+	void correct(D3DMATERIAL9& material, float power)
+	{
+		material.Power = power;
+		correct_color(material.Ambient);
+		correct_color(material.Diffuse);
+		correct_color(material.Specular);
+	}
+
+	MaterialBlock make_block(const D3DMATERIAL9& material)
+	{
+		return { material.Diffuse, material.Specular, { material.Power, 0.0f, 0.0f, 0.0f } };
+	}
+
+	const Entry* find(const D3DMATERIAL9& uncorrected, float power)
+	{
+		const Key key = { uncorrected, power };
+		const auto& it = slot(key);
+		return it.used && it.key == key ? &it.entry : nullptr;
+	}
+
+	const Entry& store(const D3DMATERIAL9& uncorrected, float power)
+	{
+		const Key key = { uncorrected, power };
+		auto& it = slot(key);
+
+		it.key = key;
+		it.entry = { uncorrected, {} };
+		correct(it.entry.material, power);
+		it.entry.block = make_block(it.entry.material);
+		it.used = true;
+
+		return it.entry;
+	}
+
+	const Entry* find(const Source& source)
+	{
+		const auto& it = slot(source);
+		return it.used && it.source == source ? &it.entry : nullptr;
+	}
+
+	void store(const Source& source, const Entry& entry)
+	{
+		auto& it = slot(source);
+
+		it.source = source;
+		it.entry = entry;
+		it.used = true;
+	}
+
+	void clear()
+	{
+		for (auto& it : slots)
+		{
+			it.used = false;
+		}
+
+		for (auto& it : source_slots)
+		{
+			it.used = false;
+		}
+	}
+}
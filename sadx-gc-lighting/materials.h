@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <d3d9.h>
+#include <d3dx9math.h>
+
+#include "ShaderParameter.h"
+
+// Material constants in the order they appear in the shader's
+// registers so they can be uploaded with a single call.
+struct MaterialBlock
+{
+	D3DXCOLOR   diffuse;
+	D3DXCOLOR   specular;
+	D3DXVECTOR4 power; // Only x is used.
+
+	bool operator==(const MaterialBlock& rhs) const;
+	bool operator!=(const MaterialBlock& rhs) const;
+};
+
+template<> bool ShaderParameter<MaterialBlock>::commit(IDirect3DDevice9* device);
+
+namespace materials
+{
+	struct Entry
+	{
+		D3DMATERIAL9  material; // Corrected material for the fixed function pipeline.
+		MaterialBlock block;
+	};
+
+	// What the game derives a D3D material from when it parses an NJS_MATERIAL
+	// without a constant or offset material, along with the palette's
+	// specular power. Compared instead of the D3D material itself, which
+	// would have to be read back from the device.
+	struct Source
+	{
+		const void* material; // The NJS_MATERIAL
+		uint32_t flags;       // Attribute flags after the constant attributes.
+		uint32_t diffuse;
+		uint32_t specular;
+		float exponent;
+		float power;
+
+		bool operator==(const Source& rhs) const;
+	};
+
+	// Converts the game's 0-255 material colors to 0-1 in place.
+	void correct(D3DMATERIAL9& material, float power);
+	MaterialBlock make_block(const D3DMATERIAL9& material);
+
+	// Looks up the corrected form of a material as the game set it.
+	// Returns nullptr if that material and power have not been seen.
+	const Entry* find(const D3DMATERIAL9& uncorrected, float power);
+	const Entry& store(const D3DMATERIAL9& uncorrected, float power);
+
+	// Looks up the corrected material last stored for a source.
+	// Returns nullptr if it isn't cached or the material has changed since.
+	const Entry* find(const Source& source);
+	void store(const Source& source, const Entry& entry);
+
+	void clear();
+}
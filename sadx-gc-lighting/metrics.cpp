@@ -0,0 +1,312 @@
+#include "stdafx.h"
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "metrics.h"
+#include "FrameTimes.h"
+
+static const char* const column_names[] = {
+	"frame",
+	"draw_primitive",
+	"draw_indexed_primitive",
+	"draw_primitive_up",
+	"draw_indexed_primitive_up",
+	"shaded_draws",
+	"fixed_function_draws",
+	"vertex_shader_switches",
+	"pixel_shader_switches",
+	"constant_uploads",
+	"constant_bytes",
+	"shader_cache_hits",
+	"shader_cache_loads",
+	"shader_compiles",
+	"parameter_flushes",
+	"device_resets",
+	"frame_time_us",
+	"draw_allocations",
+	"state_block_builds",
+	"state_block_applies",
+	"up_absorbed_calls",
+	"up_merged_draws",
+};
+
+static_assert(sizeof(column_names) / sizeof(*column_names) * sizeof(Uint32) == sizeof(FrameCounters),
+	"Every FrameCounters field needs a CSV column.");
+
+// Frames that haven't been written yet are dropped beyond this.
+static constexpr size_t MAX_QUEUED_FRAMES = 1024;
+
+// Frames between allocation warnings; the ones in between are only counted.
+static constexpr Uint32 ALLOCATION_WARNING_INTERVAL = 600;
+
+static FrameCounters previous {};
+static Uint32 frame_count = 0;
+
+static LARGE_INTEGER frequency {};
+static LARGE_INTEGER frame_start {};
+
+static FrameHistogram histogram;
+static HitchLog hitch_log;
+static Uint32 hitch_budget_us = 0;
+static Uint32 hitch_count = 0;
+
+static bool allocation_warned = false;
+static Uint32 allocation_warning_frame = 0;
+static Uint32 allocation_frames = 0;
+
+static std::thread csv_thread;
+static std::mutex csv_mutex;
+static std::condition_variable csv_condition;
+static std::deque<FrameCounters> csv_queue;
+static bool csv_running = false;
+
+#ifdef COUNT_ALLOCATIONS
+static std::atomic<Uint32> allocation_count { 0 };
+
+// Replaces the global allocator for this module only. The array and sized
+// forms forward to these.
+void* operator new(size_t size)
+{
+	++allocation_count;
+
+	if (auto result = malloc(size ? size : 1))
+	{
+		return result;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+#endif
+
+static void write_row(std::ofstream& file, const FrameCounters& counters)
+{
+	const auto fields = reinterpret_cast<const Uint32*>(&counters);
+
+	for (size_t i = 0; i < sizeof(FrameCounters) / sizeof(Uint32); i++)
+	{
+		if (i > 0)
+		{
+			file << ',';
+		}
+
+		file << fields[i];
+	}
+
+	file << '\n';
+}
+
+static void csv_writer(std::string path)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+
+	if (!file.is_open())
+	{
+		PrintDebug("[lantern] Failed to open metrics file: %s\n", path.c_str());
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(column_names) / sizeof(*column_names); i++)
+	{
+		file << (i > 0 ? "," : "") << column_names[i];
+	}
+
+	file << '\n';
+
+	std::deque<FrameCounters> frames;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(csv_mutex);
+			csv_condition.wait(lock, [] { return !csv_running || !csv_queue.empty(); });
+
+			if (csv_queue.empty() && !csv_running)
+			{
+				break;
+			}
+
+			frames.swap(csv_queue);
+		}
+
+		for (auto& frame : frames)
+		{
+			write_row(file, frame);
+		}
+
+		frames.clear();
+		file.flush();
+	}
+}
+
+namespace metrics
+{
+	FrameCounters current {};
+
+	const FrameCounters& last_frame()
+	{
+		return previous;
+	}
+
+	void end_frame()
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+
+		if (frequency.QuadPart == 0)
+		{
+			QueryPerformanceFrequency(&frequency);
+		}
+		else
+		{
+			current.frame_time_us = static_cast<Uint32>((now.QuadPart - frame_start.QuadPart) * 1000000 / frequency.QuadPart);
+			histogram.record(current.frame_time_us);
+		}
+
+		frame_start = now;
+		current.frame = frame_count++;
+
+		const FrameActivity activity = {
+			current.frame,
+			current.frame_time_us,
+			current.shader_compiles,
+			current.shader_cache_loads,
+			current.device_resets,
+			current.draw_primitive + current.draw_indexed_primitive + current.draw_primitive_up + current.draw_indexed_primitive_up,
+			current.constant_bytes
+		};
+
+		HitchRecord hitch;
+		if (hitch_log.add(activity, hitch_budget_us, hitch))
+		{
+			++hitch_count;
+
+			std::string causes;
+			for (Uint32 cause = 1; cause <= hitch.causes; cause <<= 1)
+			{
+				if (hitch.causes & cause)
+				{
+					causes += causes.empty() ? "" : ", ";
+					causes += HitchLog::cause_name(cause);
+				}
+			}
+
+			PrintDebug("[lantern] Hitch: frame %u took %.2f ms (%s); draws: %u (avg %.0f), constant bytes: %u (avg %.0f)\n",
+				activity.frame, static_cast<float>(activity.us) / 1000.0f, causes.empty() ? "no known cause" : causes.c_str(),
+				activity.draws, hitch.average_draws, activity.constant_bytes, hitch.average_constant_bytes);
+		}
+
+		// Shader compilation, cache loads and new state blocks are expected to allocate.
+		if (current.draw_allocations > 0 && current.shader_compiles == 0 && current.shader_cache_loads == 0
+			&& current.state_block_builds == 0)
+		{
+			++allocation_frames;
+
+			if (!allocation_warned || current.frame - allocation_warning_frame >= ALLOCATION_WARNING_INTERVAL)
+			{
+				PrintDebug("[lantern] Frame %u: %u allocations while drawing (%u frames with allocations since the last warning)\n",
+					current.frame, current.draw_allocations, allocation_frames);
+
+				allocation_warned = true;
+				allocation_warning_frame = current.frame;
+				allocation_frames = 0;
+			}
+		}
+
+		previous = current;
+		current = {};
+
+		std::lock_guard<std::mutex> lock(csv_mutex);
+
+		if (csv_running && csv_queue.size() < MAX_QUEUED_FRAMES)
+		{
+			csv_queue.push_back(previous);
+			csv_condition.notify_one();
+		}
+	}
+
+	void start_csv(const std::string& path)
+	{
+		stop_csv();
+
+		csv_running = true;
+		csv_thread = std::thread(csv_writer, path);
+	}
+
+	Uint32 allocations()
+	{
+	#ifdef COUNT_ALLOCATIONS
+		return allocation_count.load(std::memory_order_relaxed);
+	#else
+		return 0;
+	#endif
+	}
+
+	void set_hitch_budget(float ms)
+	{
+		hitch_budget_us = ms > 0.0f ? static_cast<Uint32>(ms * 1000.0f) : 0;
+	}
+
+	FrameTimeSummary frame_times()
+	{
+		return {
+			static_cast<Uint32>(histogram.count()),
+			histogram.percentile(0.5),
+			histogram.percentile(0.99),
+			histogram.percentile(0.999),
+			histogram.max(),
+			hitch_count
+		};
+	}
+
+	const HitchLog& hitches()
+	{
+		return hitch_log;
+	}
+
+	void report_frame_times()
+	{
+		const auto summary = frame_times();
+
+		if (summary.frames > 0)
+		{
+			PrintDebug("[lantern] Frame times over %u frames: p50: %.2f ms, p99: %.2f ms, p99.9: %.2f ms, max: %.2f ms, hitches: %u\n",
+				summary.frames, summary.p50_us / 1000.0f, summary.p99_us / 1000.0f, summary.p999_us / 1000.0f,
+				summary.max_us / 1000.0f, summary.hitches);
+		}
+	}
+
+	void reset_frame_times()
+	{
+		histogram.reset();
+		hitch_count = 0;
+	}
+
+	void stop_csv()
+	{
+		{
+			std::lock_guard<std::mutex> lock(csv_mutex);
+			csv_running = false;
+		}
+
+		csv_condition.notify_one();
+
+		if (csv_thread.joinable())
+		{
+			csv_thread.join();
+		}
+	}
+}
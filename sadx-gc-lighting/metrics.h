@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <ninja.h>
+
+#include "FrameTimes.h"
+
+// Rendering counters for a single frame. This is part of the exported
+// GetFrameCounters interface, so fields are only ever appended.
+struct FrameCounters
+{
+	Uint32 frame;
+
+	// Calls into each draw hook, including UP draws absorbed by batching.
+	Uint32 draw_primitive;
+	Uint32 draw_indexed_primitive;
+	Uint32 draw_primitive_up;
+	Uint32 draw_indexed_primitive_up;
+
+	// Draws submitted with the mod's shaders and with the fixed function pipeline.
+	Uint32 shaded_draws;
+	Uint32 fixed_function_draws;
+
+	Uint32 vertex_shader_switches;
+	Uint32 pixel_shader_switches;
+
+	Uint32 constant_uploads;
+	Uint32 constant_bytes;
+
+	// Shader lookups served from memory, loaded from the disk cache, and compiled.
+	Uint32 shader_cache_hits;
+	Uint32 shader_cache_loads;
+	Uint32 shader_compiles;
+
+	// Commits of the assigned shader parameters.
+	Uint32 parameter_flushes;
+
+	Uint32 device_resets;
+
+	// Time since the end of the previous frame.
+	Uint32 frame_time_us;
+
+	// Heap allocations made by the mod while drawing. Only counted with COUNT_ALLOCATIONS.
+	Uint32 draw_allocations;
+
+	// Permutation state blocks recorded and applied (with StateBlocks).
+	Uint32 state_block_builds;
+	Uint32 state_block_applies;
+
+	// UP calls copied into the batch ring buffers instead of reaching the
+	// device, and those of them merged into a batch another call started.
+	Uint32 up_absorbed_calls;
+	Uint32 up_merged_draws;
+};
+
+// Frame time percentiles since the last report. Part of the exported
+// GetFrameTimes interface, so fields are only ever appended.
+struct FrameTimeSummary
+{
+	Uint32 frames;
+	Uint32 p50_us;
+	Uint32 p99_us;
+	Uint32 p999_us;
+	Uint32 max_us;
+	Uint32 hitches;
+};
+
+namespace metrics
+{
+	// Counters for the frame in progress. Only touched from the render thread.
+	extern FrameCounters current;
+
+	const FrameCounters& last_frame();
+
+	// Finishes the current frame and queues it for the CSV writer if it's running.
+	void end_frame();
+
+	// Number of heap allocations made by the mod so far, or 0 without COUNT_ALLOCATIONS.
+	Uint32 allocations();
+
+	// Writes every frame to a CSV file from a background thread.
+	void start_csv(const std::string& path);
+	void stop_csv();
+
+	// Frames taking longer than this are logged as hitches. 0 disables it.
+	void set_hitch_budget(float ms);
+
+	FrameTimeSummary frame_times();
+	const HitchLog& hitches();
+
+	void report_frame_times();
+	// Starts a new frame time histogram.
+	void reset_frame_times();
+}
@@ -8,10 +8,22 @@
 // MinHook
 #include <MinHook.h>
 
+// Standard library
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
 // Local
 #include "d3d.h"
 #include "datapointers.h"
 #include "globals.h"
+#include "config.h"
+#include "materials.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "CaptureReplay.h"
+#include "benchmark.h"
 
 static Trampoline* Direct3D_ParseMaterial_t        = nullptr;
 static Trampoline* DrawLandTable_t                 = nullptr;
@@ -19,7 +31,14 @@ static Trampoline* DrawLandTable_t                 = nullptr;
 DataPointer(PaletteLight, LSPalette, 0x03ABDAF0);
 DataPointer(NJS_VECTOR, NormalScaleMultiplier, 0x03B121F8);
 
-static void update_material(const D3DMATERIAL9& material)
+// Set by CorrectMaterial_r, which is called from within Direct3D_ParseMaterial.
+static bool material_updated = false;
+
+// The material Direct3D_ParseMaterial is parsing, for CorrectMaterial_r.
+// material is null if the game's D3D material depends on more than it.
+static materials::Source parsed_material {};
+
+static void update_material(const MaterialBlock& block)
 {
 	using namespace d3d;
 
@@ -31,42 +50,84 @@ static void update_material(const D3DMATERIAL9& material)
 	D3DMATERIALCOLORSOURCE colorsource;
 	device->GetRenderState(D3DRS_DIFFUSEMATERIALSOURCE, reinterpret_cast<DWORD*>(&colorsource));
 
-	param::DiffuseSource    = colorsource;
-	param::MaterialDiffuse  = material.Diffuse;
-	param::MaterialSpecular = material.Specular;
-	param::MaterialPower    = material.Power;
+	set_flags(ShaderFlags_VertexColor, colorsource == D3DMCS_COLOR1);
+	param::Material  = block;
+	material_updated = true;
 }
 
 static void __cdecl CorrectMaterial_r()
 {
 	using namespace d3d;
 
-	D3DMATERIAL9 material;
-	device->GetMaterial(&material);
-
-	material.Power = LSPalette.SP_pow;
-	material.Ambient.r /= 255.0f;
-	material.Ambient.g /= 255.0f;
-	material.Ambient.b /= 255.0f;
-	material.Ambient.a /= 255.0f;
-	material.Diffuse.r /= 255.0f;
-	material.Diffuse.g /= 255.0f;
-	material.Diffuse.b /= 255.0f;
-	material.Diffuse.a /= 255.0f;
-	material.Specular.r /= 255.0f;
-	material.Specular.g /= 255.0f;
-	material.Specular.b /= 255.0f;
-	material.Specular.a /= 255.0f;
-
-	update_material(material);
-	device->SetMaterial(&material);
+	const auto power = LSPalette.SP_pow;
+	parsed_material.power = power;
+
+	const materials::Entry* entry = nullptr;
+
+	if (parsed_material.material != nullptr)
+	{
+		entry = materials::find(parsed_material);
+	}
+
+	if (entry == nullptr)
+	{
+		// Otherwise the material is keyed by its full contents, so constant
+		// and offset materials set up by the game are cached like any other.
+		D3DMATERIAL9 material;
+		device->GetMaterial(&material);
+
+		entry = materials::find(material, power);
+
+		if (entry == nullptr)
+		{
+			entry = &materials::store(material, power);
+		}
+
+		if (parsed_material.material != nullptr)
+		{
+			materials::store(parsed_material, *entry);
+		}
+	}
+
+	update_material(entry->block);
+	device->SetMaterial(&entry->material);
 }
 
 static void __fastcall Direct3D_ParseMaterial_r(NJS_MATERIAL* material)
 {
+	TRACE_ZONE("ParseMaterial");
+
 	using namespace d3d;
 
+	Uint32 flags = material->attrflags;
+
+	if (_nj_control_3d_flag_ & NJD_CONTROL_3D_CONSTANT_ATTR)
+	{
+		flags = _nj_constant_attr_or_ | _nj_constant_attr_and_ & flags;
+	}
+
+	if (capture::recording)
+	{
+		const capture_format::Material record = {
+			material->diffuse.color, material->specular.color, material->exponent,
+			material->attr_texId, material->attrflags, flags
+		};
+
+		capture::write(capture_format::EventType::material, record);
+	}
+
+	material_updated = false;
+
+	constexpr Uint32 material_control = NJD_CONTROL_3D_CONSTANT_MATERIAL | NJD_CONTROL_3D_OFFSET_MATERIAL
+		| NJD_CONTROL_3D_CONSTANT_TEXTURE_MATERIAL;
+
+	parsed_material = {
+		_nj_control_3d_flag_ & material_control ? nullptr : material,
+		flags, material->diffuse.color, material->specular.color, material->exponent
+	};
+
 	TARGET_DYNAMIC(Direct3D_ParseMaterial)(material);
+	parsed_material.material = nullptr;
 
 	if (!shaders_not_null())
 	{
@@ -83,13 +144,6 @@ static void __fastcall Direct3D_ParseMaterial_r(NJS_MATERIAL* material)
 	}
 #endif
 
-	Uint32 flags = material->attrflags;
-
-	if (_nj_control_3d_flag_ & NJD_CONTROL_3D_CONSTANT_ATTR)
-	{
-		flags = _nj_constant_attr_or_ | _nj_constant_attr_and_ & flags;
-	}
-
 	set_flags(ShaderFlags_Texture, (flags & NJD_FLAG_USE_TEXTURE) != 0);
 	set_flags(ShaderFlags_Alpha, (flags & NJD_FLAG_USE_ALPHA) != 0);
 	set_flags(ShaderFlags_EnvMap, (flags & NJD_FLAG_USE_ENV) != 0);
@@ -98,9 +152,13 @@ static void __fastcall Direct3D_ParseMaterial_r(NJS_MATERIAL* material)
 	// Environment map matrix
 	param::TextureTransform = *reinterpret_cast<D3DXMATRIX*>(0x038A5DD0);
 
-	D3DMATERIAL9 mat;
-	device->GetMaterial(&mat);
-	update_material(mat);
+	// The material callback has usually uploaded the material already.
+	if (!material_updated)
+	{
+		D3DMATERIAL9 mat;
+		device->GetMaterial(&mat);
+		update_material(materials::make_block(mat));
+	}
 
 	do_effect = true;
 }
@@ -113,7 +171,18 @@ static void __cdecl DrawLandTable_r()
 	_nj_control_3d_flag_ |= NJD_CONTROL_3D_CONSTANT_ATTR;
 	_nj_constant_attr_or_ |= NJD_FLAG_IGNORE_SPECULAR;
 
-	TARGET_DYNAMIC(DrawLandTable)();
+	if (config::depth_prepass || config::depth_prepass_report)
+	{
+		// The land table is drawn once either way; the pre-pass shades its
+		// deferred draws when it ends.
+		d3d::set_depth_pass(config::depth_prepass ? DepthPass::prepass : DepthPass::main);
+		TARGET_DYNAMIC(DrawLandTable)();
+		d3d::set_depth_pass(DepthPass::none);
+	}
+	else
+	{
+		TARGET_DYNAMIC(DrawLandTable)();
+	}
 
 	_nj_control_3d_flag_ = flag;
 	_nj_constant_attr_or_ = or;
@@ -153,6 +222,16 @@ extern "C"
 		globals::cache_path  = globals::mod_path + "\\cache\\";
 		globals::shader_path = globals::system_path + "shader.hlsl";
 
+		config::load(globals::mod_path + "\\config.ini");
+
+		if (config::metrics_csv)
+		{
+			metrics::start_csv(globals::mod_path + "\\metrics.csv");
+		}
+
+		trace::enabled = config::trace;
+		metrics::set_hitch_budget(config::hitch_budget);
+
 		d3d::init_trampolines();
 
 		Direct3D_ParseMaterial_t        = new Trampoline(0x00784850, 0x00784858, Direct3D_ParseMaterial_r);
@@ -171,9 +250,131 @@ extern "C"
 		NormalScaleMultiplier = { 1.0f, 1.0f, 1.0f };
 	}
 
-#ifdef _DEBUG
+	// Switches between the per-pixel and per-vertex lighting tiers at runtime.
+	EXPORT void __cdecl SetVertexLighting(bool enabled)
+	{
+		d3d::set_vertex_lighting(enabled);
+	}
+
+	// Switches between shader permutations and the uber shader at runtime.
+	EXPORT void __cdecl SetUberShader(bool enabled)
+	{
+		d3d::set_uber_shader(enabled);
+	}
+
+	// Switches the pixel shaders to their partial precision variants at
+	// runtime, reloading them. Ignored in builds without the variants.
+	EXPORT void __cdecl SetPartialPrecision(bool enabled)
+	{
+		d3d::set_partial_precision(enabled);
+	}
+
+	// Copies the rendering counters of the last completed frame into out.
+	// size is sizeof(FrameCounters) as known to the caller, so older callers
+	// keep working as fields are added. Returns false if out is null.
+	EXPORT bool __cdecl GetFrameCounters(FrameCounters* out, size_t size)
+	{
+		if (out == nullptr)
+		{
+			return false;
+		}
+
+		memcpy(out, &metrics::last_frame(), (std::min)(size, sizeof(FrameCounters)));
+		return true;
+	}
+
+	// Copies the frame time percentiles since the last stage change into out.
+	// size is sizeof(FrameTimeSummary) as known to the caller.
+	EXPORT bool __cdecl GetFrameTimes(FrameTimeSummary* out, size_t size)
+	{
+		if (out == nullptr)
+		{
+			return false;
+		}
+
+		const auto summary = metrics::frame_times();
+		memcpy(out, &summary, (std::min)(size, sizeof(FrameTimeSummary)));
+		return true;
+	}
+
+	// Starts or stops recording timing zones. Recorded zones are kept.
+	EXPORT void __cdecl SetTracing(bool enabled)
+	{
+		trace::enabled = enabled;
+	}
+
+	// Writes the most recent timing zones to a Chrome trace_event JSON file.
+	// If path is null, the trace is written to trace.json in the mod folder.
+	EXPORT bool __cdecl DumpTrace(const char* path)
+	{
+		return trace::dump(path ? path : globals::mod_path + "\\trace.json");
+	}
+
+	// Captures the events the mod sees for the given number of frames
+	// (0 until StopCapture) to a binary file. See CaptureFormat.h.
+	// If path is null, the capture is written to capture.bin in the mod folder.
+	EXPORT bool __cdecl StartCapture(const char* path, unsigned int frames)
+	{
+		return capture::start(path ? path : globals::mod_path + "\\capture.bin", frames);
+	}
+
+	EXPORT void __cdecl StopCapture()
+	{
+		capture::stop();
+	}
+
+	// Replays a capture through the mod's shader switching against a counting
+	// device and prints the per-frame cost to the debug output. State blocks
+	// are used if they're enabled in the config. See CaptureReplay.h.
+	EXPORT bool __cdecl ReplayCapture(const char* path, bool uber_shader, unsigned int passes)
+	{
+		if (path == nullptr)
+		{
+			PrintDebug("[lantern] ReplayCapture needs the path of a capture.\n");
+			return false;
+		}
+
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+
+		CaptureReplay::Options options;
+		options.uber_shader = uber_shader;
+		options.state_blocks = config::state_blocks;
+		options.passes = passes;
+
+		CaptureReplay::Results results;
+
+		if (!file.is_open() || !CaptureReplay::run(file, options, results))
+		{
+			PrintDebug("[lantern] Failed to read capture: %s\n", path);
+			return false;
+		}
+
+		const double frames = results.frames > 0 ? results.frames : 1.0;
+		const auto& device = results.device;
+
+		PrintDebug("[lantern] Replayed %u frames, %u draws: %.1f ns/draw; per frame: %.1f device calls, "
+			"%.1f VS / %.1f PS binds, %.1f constant uploads, %.0f constant bytes, %.1f state block applies\n",
+			results.frames, static_cast<Uint32>(results.draws), results.ns_per_draw, device.calls / frames,
+			device.vertex_shaders / frames, device.pixel_shaders / frames,
+			(device.float_constants + device.bool_constants) / frames, device.constant_bytes / frames,
+			device.state_block_applies / frames);
+
+		return true;
+	}
+
+	// Runs the CPU microbenchmarks and writes the results as JSON. Call from
+	// the render thread. If path is null, they are written to benchmark.json
+	// in the mod folder.
+	EXPORT bool __cdecl RunBenchmarks(const char* path)
+	{
+		return benchmark::run(path ? path : globals::mod_path + "\\benchmark.json");
+	}
+
 	EXPORT void __cdecl OnFrame()
 	{
+		d3d::end_frame();
+
+	#ifdef _DEBUG
 		const auto pad = ControllerPointers[0];
 		if (pad)
 		{
@@ -182,7 +383,28 @@ extern "C"
 			{
 				d3d::load_shader();
 			}
+
+			if (pressed & Buttons_Y)
+			{
+				d3d::set_vertex_lighting(!d3d::vertex_lighting());
+			}
+
+			if (pressed & Buttons_X)
+			{
+				d3d::set_uber_shader(!d3d::uber_shader());
+			}
+
+			// Z is held to bypass the shaders, so the trace is dumped with the
+			// other diagnostics on D, which the game leaves unused.
+			if (pressed & Buttons_D)
+			{
+				trace::dump(globals::mod_path + "\\trace.json");
+
+				const auto& lod = d3d::lod_counters();
+				PrintDebug("[lantern] LOD draws: full: %u, no specular: %u, vertex lit: %u\n",
+					lod.full, lod.no_specular, lod.vertex_lit);
+			}
 		}
+	#endif
 	}
-#endif
 }
@@ -11,26 +11,114 @@ struct PS_IN
 	float4 position    : POSITION0;
 	float4 diffuse     : COLOR0;
 	float2 tex         : TEXCOORD0;
+#ifdef USE_VERTEX_LIGHTING
+	// Lighting and fog are evaluated per vertex and interpolated.
+	float4 specular    : COLOR1;
+	float  fogFactor   : FOG;
+#else
 	float3 worldNormal : TEXCOORD1;
 	float3 halfVector  : TEXCOORD2;
 	float  fogDist     : FOG;
+#endif
 };
 
-// From FixedFuncEMU.fx
-// Copyright (c) 2005 Microsoft Corporation. All rights reserved.
-#define FOGMODE_NONE   0
-#define FOGMODE_EXP    1
-#define FOGMODE_EXP2   2
-#define FOGMODE_LINEAR 3
-#define E 2.71828
-
-#define D3DMCS_MATERIAL 0 // Color from material is used
-#define D3DMCS_COLOR1   1 // Diffuse vertex color is used
-#define D3DMCS_COLOR2   2 // Specular vertex color is used
-
 // This never changes
 static const float AlphaRef = 16.0f / 255.0f;
 
+// Color math in ps_main (texture modulate, specular add and fog blend) can run
+// at partial precision. Lighting vectors and the fog factor stay at full precision.
+#ifdef USE_PARTIAL_PRECISION
+typedef half  real;
+typedef half4 real4;
+#else
+typedef float  real;
+typedef float4 real4;
+#endif
+
+// Feature switches. In the uber shader, these are uploaded to the boolean
+// registers (indexed by ShaderFlags bit) and evaluated as static branches.
+// Otherwise they are compile time constants and the branches fold away.
+#ifdef USE_UBER_SHADER
+bool UseTexture    : register(b0);
+bool UseEnvMap     : register(b1);
+bool UseAlpha      : register(b2);
+bool UseLight      : register(b3);
+bool UseSpecular   : register(b4);
+bool UseFog        : register(b5);
+bool UseMultiLight : register(b6);
+// b7 is the vertex lit tier, which is always compiled in.
+bool UseFogExp      : register(b8);
+bool UseFogExp2     : register(b9);
+bool UseVertexColor : register(b10);
+bool UseFogTable    : register(b11);
+#else
+	#ifdef USE_TEXTURE
+static const bool UseTexture = true;
+	#else
+static const bool UseTexture = false;
+	#endif
+
+	#ifdef USE_ENVMAP
+static const bool UseEnvMap = true;
+	#else
+static const bool UseEnvMap = false;
+	#endif
+
+	#ifdef USE_ALPHA
+static const bool UseAlpha = true;
+	#else
+static const bool UseAlpha = false;
+	#endif
+
+	#ifdef USE_LIGHT
+static const bool UseLight = true;
+	#else
+static const bool UseLight = false;
+	#endif
+
+	#ifdef USE_SPECULAR
+static const bool UseSpecular = true;
+	#else
+static const bool UseSpecular = false;
+	#endif
+
+	#ifdef USE_FOG
+static const bool UseFog = true;
+	#else
+static const bool UseFog = false;
+	#endif
+
+	#ifdef USE_MULTILIGHT
+static const bool UseMultiLight = true;
+	#else
+static const bool UseMultiLight = false;
+	#endif
+
+	#ifdef USE_FOG_EXP
+static const bool UseFogExp = true;
+	#else
+static const bool UseFogExp = false;
+	#endif
+
+	#ifdef USE_FOG_EXP2
+static const bool UseFogExp2 = true;
+	#else
+static const bool UseFogExp2 = false;
+	#endif
+
+	#ifdef USE_VERTEX_COLOR
+static const bool UseVertexColor = true;
+	#else
+static const bool UseVertexColor = false;
+	#endif
+
+	#ifdef USE_FOG_TABLE
+static const bool UseFogTable = true;
+	#else
+static const bool UseFogTable = false;
+	#endif
+#endif
+
 // Diffuse texture
 Texture2D BaseTexture : register(t0);
 
@@ -40,6 +128,14 @@ SamplerState baseSampler : register(s0) = sampler_state
 	Texture = BaseTexture;
 };
 
+// The game's fog table: visibility by view distance.
+Texture2D FogTableTexture : register(t1);
+
+SamplerState fogSampler : register(s1) = sampler_state
+{
+	Texture = FogTableTexture;
+};
+
 // Parameters
 
 float4x4 WorldMatrix      : register(c0);
@@ -56,26 +152,37 @@ float4x4 TextureTransform : register(c16) = {
 };
 
 float3 NormalScale     : register(c20) = float3(1, 1, 1);
-float3 LightDirection  : register(c21) = float3(0.0f, -1.0f, 0.0f);
-uint   DiffuseSource   : register(c22) = (uint)D3DMCS_COLOR1;
-float4 MaterialDiffuse : register(c23) = float4(1.0f, 1.0f, 1.0f, 1.0f);
-
-// FogMode cannot be merged with FogConfig because of
-// Shader Model 3 restrictions on acceptable values.
-uint FogMode : register(c24) = (uint)FOGMODE_NONE;
-// x y and z are start, end, and density respectively
-float3 FogConfig : register(c25);
+float3 LightDirection  : register(c21) = float3(0.0f, -1.0f, 0.0f); // Normalized on the CPU.
+// Maps view distance to fog table texels: x is the scale, y is half a texel.
+float2 FogTableScale   : register(c23);
+
+// The fog mode is selected by UseFogExp and UseFogExp2; linear otherwise.
+// Folded on the CPU: x and y are the linear scale and bias,
+// z and w are the exp and exp2 coefficients for exp2().
+float4 FogConfig : register(c25) = float4(0.0f, 1.0f, 0.0f, 0.0f);
 float4 FogColor  : register(c26);
 
 float3 CameraPosition : register(c27);
 
-float4 MaterialSpecular : register(c28) = float4(0.0f, 0.0f, 0.0f, 0.0f);
-float  MaterialPower    : register(c29) = 1.0f;
-
 float4 LightDiffuse  : register(c30);
 float4 LightSpecular : register(c31);
 float4 LightAmbient  : register(c32);
 
+// The material registers are contiguous so that they
+// can be uploaded in one call per material switch.
+float4 MaterialDiffuse  : register(c33) = float4(1.0f, 1.0f, 1.0f, 1.0f);
+float4 MaterialSpecular : register(c34) = float4(0.0f, 0.0f, 0.0f, 0.0f);
+float  MaterialPower    : register(c35) = 1.0f;
+
+// All four stage lights, four registers each:
+// [0] direction (pre-negated and normalized), specular
+// [1] multiplier, diffuse
+// [2] ambient
+// [3] padding
+float4 StageLights[16] : register(c36);
+// Per-object weights of stage lights 1 through 3.
+float4 LightWeights : register(c52);
+
 // Helpers
 
 // From FixedFuncEMU.fx
@@ -84,30 +191,34 @@ float CalcFogFactor(float d)
 {
 	float fogCoeff;
 
-	switch (FogMode)
+#ifndef USE_VERTEX_LIGHTING
+	if (UseFogTable)
 	{
-		default:
-			break;
-
-		case FOGMODE_EXP:
-			fogCoeff = 1.0 / pow(E, d * FogConfig.z);
-			break;
-
-		case FOGMODE_EXP2:
-			fogCoeff = 1.0 / pow(E, d * d * FogConfig.z * FogConfig.z);
-			break;
+		float u = clamp(d * FogTableScale.x + FogTableScale.y, FogTableScale.y, 1.0 - FogTableScale.y);
+		return tex2D(fogSampler, float2(u, 0.5)).r;
+	}
+#endif
 
-		case FOGMODE_LINEAR:
-			fogCoeff = (FogConfig.y - d) / (FogConfig.y - FogConfig.x);
-			break;
+	if (UseFogExp)
+	{
+		fogCoeff = exp2(d * FogConfig.z);
+	}
+	else if (UseFogExp2)
+	{
+		fogCoeff = exp2(d * d * FogConfig.w);
+	}
+	else
+	{
+		fogCoeff = d * FogConfig.x + FogConfig.y;
 	}
 
-	return clamp(fogCoeff, 0, 1);
+	return saturate(fogCoeff);
 }
 
 float4 GetDiffuse(in float4 vcolor)
 {
-	float4 color = (DiffuseSource == D3DMCS_COLOR1 && any(vcolor)) ? vcolor : MaterialDiffuse;
+	// Only set when the material uses vertex color and the vertex format has one.
+	float4 color = UseVertexColor ? vcolor : MaterialDiffuse;
 
 #if 0
 	int3 icolor = color.rgb * 255.0;
@@ -120,87 +231,176 @@ float4 GetDiffuse(in float4 vcolor)
 	return color;
 }
 
-PS_IN vs_main(VS_IN input)
+// Returns the lit diffuse color. Input diffuse is specifically
+// applied after everything else to ensure its vibrancy.
+float4 CalcDiffuse(in float3 normal, in float4 vdiffuse)
 {
-	PS_IN output;
+	float4 ambient = float4(LightAmbient.rgb, 0);
 
-	output.position = mul(float4(input.position, 1), wvMatrix);
-	output.fogDist = output.position.z;
-	output.position = mul(output.position, ProjectionMatrix);
+	float d = dot(LightDirection, normal);
 
-#if defined(USE_TEXTURE) && defined(USE_ENVMAP)
-	output.tex = (float2)mul(float4(input.normal, 1), wvMatrixInvT);
-	output.tex = (float2)mul(float4(output.tex, 0, 1), TextureTransform);
-#else
-	output.tex = input.tex;
-#endif
+	float3 combined = saturate(LightDiffuse.rgb * d);
 
-	output.diffuse = GetDiffuse(input.color);
-	output.worldNormal = mul(input.normal * NormalScale, (float3x3)WorldMatrix);
+	if (UseMultiLight)
+	{
+		[unroll]
+		for (int i = 1; i < 4; i++)
+		{
+			float d1 = dot(StageLights[i * 4].xyz, normal);
+			combined += saturate(StageLights[i * 4 + 1].yzw * d1) * LightWeights[i - 1];
+		}
+	}
 
-	float3 worldPos = mul(float4(input.position, 1), WorldMatrix).xyz;
-	output.halfVector = normalize(normalize(CameraPosition - worldPos) + normalize(LightDirection));
+	float4 diffuse = float4(combined, 1);
 
-	return output;
+	// Apply the ambient, clamping it to a sane value.
+	diffuse = saturate(diffuse + ambient);
+
+	return diffuse * vdiffuse;
 }
 
-float4 ps_main(PS_IN input) : COLOR
+float4 CalcSpecular(in float3 normal, in float3 halfVector)
 {
-	float4 result;
-
-	float4 ambient = 0;
-	float4 diffuse = 0;
 	float4 specular = 0;
 
-#ifdef USE_LIGHT
-	ambient = float4(LightAmbient.rgb, 0);
+#ifdef USE_SMOOTH_LIGHTING
+	normal = normalize(normal);
+#endif
 
-	float d = dot(normalize(LightDirection), input.worldNormal);
+	// funny joke
+	float d2 = dot(normal, halfVector);
 
-	float3 combined = saturate(LightDiffuse.rgb * d);
-	diffuse = float4(combined, 1);
+	// TODO: fix material power of 0 (for real though)
+	specular.rgb = MaterialSpecular.rgb * saturate(LightSpecular.rgb * pow(max(0.0001f, d2), max(1.0, MaterialPower)));
+	return specular;
+}
 
-	// Apply the ambient, clamping it to a sane value.
-	diffuse = saturate(diffuse + ambient);
+// Shared by vs_main and vs_depth: the equal depth test after the
+// pre-pass needs both to compute the position the same way.
+float4 GetPosition(float3 position, out float fogDist)
+{
+	float4 result = mul(float4(position, 1), wvMatrix);
+	fogDist = result.z;
+	return mul(result, ProjectionMatrix);
+}
+
+PS_IN vs_main(VS_IN input)
+{
+	PS_IN output;
 
-	// Input diffuse is specifically applied after
-	// everything else to ensure its vibrancy.
-	diffuse *= input.diffuse;
+	float fogDist;
+	output.position = GetPosition(input.position, fogDist);
 
-	#ifdef USE_SPECULAR
+	if (UseTexture && UseEnvMap)
+	{
+		output.tex = (float2)mul(float4(input.normal, 1), wvMatrixInvT);
+		output.tex = (float2)mul(float4(output.tex, 0, 1), TextureTransform);
+	}
+	else
 	{
-		float3 normal = input.worldNormal;
+		output.tex = input.tex;
+	}
 
-	#ifdef USE_SMOOTH_LIGHTING
-		normal = normalize(normal);
-	#endif
+	output.diffuse = GetDiffuse(input.color);
+	float3 worldNormal = mul(input.normal * NormalScale, (float3x3)WorldMatrix);
+
+	float3 worldPos = mul(float4(input.position, 1), WorldMatrix).xyz;
+	float3 halfVector = normalize(normalize(CameraPosition - worldPos) + LightDirection);
+
+#ifdef USE_VERTEX_LIGHTING
+	output.specular = 0;
 
-		// funny joke
-		float d2 = dot(normal, input.halfVector);
+	if (UseLight)
+	{
+		output.diffuse = CalcDiffuse(worldNormal, output.diffuse);
 
-		// TODO: fix material power of 0 (for real though)
-		specular.rgb = MaterialSpecular.rgb * saturate(LightSpecular.rgb * pow(max(0.0001f, d2), max(1.0, MaterialPower)));
+		if (UseSpecular)
+		{
+			output.specular = CalcSpecular(worldNormal, halfVector);
+		}
+	}
+
+	if (UseFog)
+	{
+		output.fogFactor = CalcFogFactor(fogDist);
+	}
+	else
+	{
+		output.fogFactor = 1;
 	}
-	#endif
 #else
-	diffuse = input.diffuse;
+	output.worldNormal = worldNormal;
+	output.halfVector = halfVector;
+	output.fogDist = fogDist;
 #endif
 
-#ifdef USE_TEXTURE
-	result = tex2D(baseSampler, input.tex);
-	result = (result * diffuse) + specular;
+	return output;
+}
+
+// Position only, for the depth pre-pass.
+float4 vs_depth(float3 position : POSITION) : POSITION
+{
+	float fogDist;
+	return GetPosition(position, fogDist);
+}
+
+// Color writes are off in the pre-pass; vs_3_0 just needs a ps_3_0 to go with it.
+float4 ps_depth() : COLOR
+{
+	return 0;
+}
+
+float4 ps_main(PS_IN input) : COLOR
+{
+	real4 result;
+
+	real4 diffuse = 0;
+	real4 specular = 0;
+
+#ifdef USE_VERTEX_LIGHTING
+	diffuse = input.diffuse;
+	specular = input.specular;
 #else
-	result = diffuse + specular;
-#endif
+	if (UseLight)
+	{
+		diffuse = CalcDiffuse(input.worldNormal, input.diffuse);
 
-#ifdef USE_ALPHA
-	clip(result.a < AlphaRef ? -1 : 1);
+		if (UseSpecular)
+		{
+			specular = CalcSpecular(input.worldNormal, input.halfVector);
+		}
+	}
+	else
+	{
+		diffuse = input.diffuse;
+	}
 #endif
 
-#ifdef USE_FOG
-	float factor = CalcFogFactor(input.fogDist);
-	result.rgb = (factor * result + (1.0 - factor) * FogColor).rgb;
-#endif
+	if (UseTexture)
+	{
+		result = tex2D(baseSampler, input.tex);
+		result = (result * diffuse) + specular;
+	}
+	else
+	{
+		result = diffuse + specular;
+	}
+
+	if (UseAlpha)
+	{
+		clip(result.a < AlphaRef ? -1 : 1);
+	}
+
+	if (UseFog)
+	{
+	#ifdef USE_VERTEX_LIGHTING
+		float factor = input.fogFactor;
+	#else
+		float factor = CalcFogFactor(input.fogDist);
+	#endif
+
+		result.rgb = (factor * result + (1.0 - factor) * FogColor).rgb;
+	}
 
 	return result;
 }
@@ -19,6 +19,17 @@
 #define PRECOMPILE_SHADERS
 #endif
 
+// Build partial precision variants of the pixel shaders for hardware that benefits from them
+#define PARTIAL_PRECISION_SHADERS
+
+// Compile in timing zones for Chrome trace dumps (enabled at runtime)
+#define TRACE_ZONES
+
+// Count heap allocations made while drawing (in debug builds)
+#ifdef _DEBUG
+#define COUNT_ALLOCATIONS
+#endif
+
 #define WIN32_LEAN_AND_MEAN
 
 #ifdef _DEBUG
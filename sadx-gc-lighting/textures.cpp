@@ -0,0 +1,241 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atlbase.h>
+#include <cstdint>
+#include <d3d9.h>
+#include <ninja.h>
+
+#include <MinHook.h>
+
+#include "DeviceProxy.h"
+#include "textures.h"
+
+// {FDAB42E9-8868-445F-8965-045FB44F9B03}
+static const GUID min_alpha_guid = { 0xfdab42e9, 0x8868, 0x445f, { 0x89, 0x65, 0x04, 0x5f, 0xb4, 0x4f, 0x9b, 0x03 } };
+
+template <typename T, typename F>
+static Uint8 scan(const D3DLOCKED_RECT& rect, UINT width, UINT height, F alpha)
+{
+	Uint8 result = 255;
+
+	for (UINT y = 0; y < height && result > 0; y++)
+	{
+		auto row = reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(rect.pBits) + y * rect.Pitch);
+
+		for (UINT x = 0; x < width; x++)
+		{
+			result = (std::min)(result, alpha(row[x]));
+		}
+	}
+
+	return result;
+}
+
+static Uint8 analyze(IDirect3DTexture9* texture)
+{
+	D3DSURFACE_DESC desc;
+	if (FAILED(texture->GetLevelDesc(0, &desc)))
+	{
+		return 0;
+	}
+
+	switch (desc.Format)
+	{
+		case D3DFMT_X8R8G8B8:
+		case D3DFMT_R5G6B5:
+		case D3DFMT_X1R5G5B5:
+		case D3DFMT_R8G8B8:
+			return 255;
+
+		case D3DFMT_A8R8G8B8:
+		case D3DFMT_A4R4G4B4:
+		case D3DFMT_A1R5G5B5:
+			break;
+
+		default:
+			return 0;
+	}
+
+	D3DLOCKED_RECT rect;
+	if (FAILED(texture->LockRect(0, &rect, nullptr, D3DLOCK_READONLY)))
+	{
+		return 0;
+	}
+
+	Uint8 result;
+
+	switch (desc.Format)
+	{
+		default:
+			result = 0;
+			break;
+
+		case D3DFMT_A8R8G8B8:
+			result = scan<Uint32>(rect, desc.Width, desc.Height, [](Uint32 c) { return static_cast<Uint8>(c >> 24); });
+			break;
+
+		case D3DFMT_A4R4G4B4:
+			result = scan<Uint16>(rect, desc.Width, desc.Height, [](Uint16 c) { return static_cast<Uint8>((c >> 12) * 17); });
+			break;
+
+		case D3DFMT_A1R5G5B5:
+			result = scan<Uint16>(rect, desc.Width, desc.Height, [](Uint16 c) { return static_cast<Uint8>(c & 0x8000 ? 255 : 0); });
+			break;
+	}
+
+	texture->UnlockRect(0);
+	return result;
+}
+
+using TextureLockRect = HRESULT(__stdcall*)(IDirect3DTexture9*, UINT, D3DLOCKED_RECT*, const RECT*, DWORD);
+using SurfaceLockRect = HRESULT(__stdcall*)(IDirect3DSurface9*, D3DLOCKED_RECT*, const RECT*, DWORD);
+using UpdateSurface   = HRESULT(__stdcall*)(IDirect3DDevice9*, IDirect3DSurface9*, const RECT*, IDirect3DSurface9*, const POINT*);
+using UpdateTexture   = HRESULT(__stdcall*)(IDirect3DDevice9*, IDirect3DBaseTexture9*, IDirect3DBaseTexture9*);
+
+static TextureLockRect TextureLockRect_t = nullptr;
+static SurfaceLockRect SurfaceLockRect_t = nullptr;
+static UpdateSurface   UpdateSurface_t   = nullptr;
+static UpdateTexture   UpdateTexture_t   = nullptr;
+
+static void invalidate_container(IDirect3DSurface9* surface)
+{
+	CComPtr<IDirect3DBaseTexture9> texture;
+
+	if (surface != nullptr
+		&& SUCCEEDED(surface->GetContainer(__uuidof(IDirect3DBaseTexture9), reinterpret_cast<void**>(&texture))))
+	{
+		textures::invalidate(texture);
+	}
+}
+
+// Read-only locks include the ones made by analyze itself.
+static HRESULT __stdcall TextureLockRect_r(IDirect3DTexture9* _this, UINT Level, D3DLOCKED_RECT* pLockedRect, const RECT* pRect, DWORD Flags)
+{
+	if (Level == 0 && !(Flags & D3DLOCK_READONLY))
+	{
+		textures::invalidate(_this);
+	}
+
+	return TextureLockRect_t(_this, Level, pLockedRect, pRect, Flags);
+}
+
+static HRESULT __stdcall SurfaceLockRect_r(IDirect3DSurface9* _this, D3DLOCKED_RECT* pLockedRect, const RECT* pRect, DWORD Flags)
+{
+	if (!(Flags & D3DLOCK_READONLY))
+	{
+		invalidate_container(_this);
+	}
+
+	return SurfaceLockRect_t(_this, pLockedRect, pRect, Flags);
+}
+
+static HRESULT __stdcall UpdateSurface_r(IDirect3DDevice9* _this, IDirect3DSurface9* pSourceSurface, const RECT* pSourceRect,
+	IDirect3DSurface9* pDestinationSurface, const POINT* pDestPoint)
+{
+	invalidate_container(pDestinationSurface);
+	return UpdateSurface_t(_this, pSourceSurface, pSourceRect, pDestinationSurface, pDestPoint);
+}
+
+static HRESULT __stdcall UpdateTexture_r(IDirect3DDevice9* _this, IDirect3DBaseTexture9* pSourceTexture,
+	IDirect3DBaseTexture9* pDestinationTexture)
+{
+	textures::invalidate(pDestinationTexture);
+	return UpdateTexture_t(_this, pSourceTexture, pDestinationTexture);
+}
+
+template <typename T>
+static void hook_method(void* object, size_t index, T hook, T& original)
+{
+	const auto target = (*reinterpret_cast<void***>(object))[index];
+
+	if (MH_CreateHook(target, hook, reinterpret_cast<LPVOID*>(&original)) == MH_OK)
+	{
+		MH_EnableHook(target);
+	}
+}
+
+// Device methods are hook points of the proxy if there is one, with the
+// original taken from the device's vtable as-is.
+template <typename T>
+static void hook_method(IDirect3DDevice9* device, size_t index, T hook, T& original, DeviceProxy* proxy, T DeviceProxy::Hooks::* hook_point)
+{
+	if (proxy != nullptr)
+	{
+		original = reinterpret_cast<T>((*reinterpret_cast<void***>(device))[index]);
+		proxy->hooks.*hook_point = hook;
+		return;
+	}
+
+	hook_method(static_cast<void*>(device), index, hook, original);
+}
+
+namespace textures
+{
+	Uint8 min_alpha(IDirect3DBaseTexture9* texture)
+	{
+		if (texture == nullptr)
+		{
+			return 255;
+		}
+
+		Uint8 result = 0;
+		DWORD size = sizeof(result);
+
+		if (SUCCEEDED(texture->GetPrivateData(min_alpha_guid, &result, &size)))
+		{
+			return result;
+		}
+
+		CComPtr<IDirect3DTexture9> texture2d;
+
+		if (texture->GetType() == D3DRTYPE_TEXTURE
+			&& SUCCEEDED(texture->QueryInterface(__uuidof(IDirect3DTexture9), reinterpret_cast<void**>(&texture2d))))
+		{
+			result = analyze(texture2d);
+		}
+
+		texture->SetPrivateData(min_alpha_guid, &result, sizeof(result), 0);
+		return result;
+	}
+
+	void invalidate(IDirect3DBaseTexture9* texture)
+	{
+		if (texture != nullptr)
+		{
+			texture->FreePrivateData(min_alpha_guid);
+		}
+	}
+
+	void hook(IDirect3DDevice9* device, DeviceProxy* proxy)
+	{
+		enum
+		{
+			IndexOf_UpdateSurface = 30,
+			IndexOf_UpdateTexture = 31,
+			IndexOf_SurfaceLockRect = 13,
+			IndexOf_TextureLockRect = 19
+		};
+
+		if (UpdateTexture_t != nullptr)
+		{
+			return;
+		}
+
+		// Textures and surfaces share their vtables, so any one will do.
+		CComPtr<IDirect3DTexture9> texture;
+		CComPtr<IDirect3DSurface9> surface;
+
+		if (FAILED(device->CreateTexture(1, 1, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &texture, nullptr))
+			|| FAILED(texture->GetSurfaceLevel(0, &surface)))
+		{
+			PrintDebug("[lantern] Unable to hook texture locks; alpha analysis results won't be updated.\n");
+			return;
+		}
+
+		hook_method(device, IndexOf_UpdateSurface, &UpdateSurface_r, UpdateSurface_t, proxy, &DeviceProxy::Hooks::UpdateSurface);
+		hook_method(device, IndexOf_UpdateTexture, &UpdateTexture_r, UpdateTexture_t, proxy, &DeviceProxy::Hooks::UpdateTexture);
+		hook_method(texture.p, IndexOf_TextureLockRect, &TextureLockRect_r, TextureLockRect_t);
+		hook_method(surface.p, IndexOf_SurfaceLockRect, &SurfaceLockRect_r, SurfaceLockRect_t);
+	}
+}
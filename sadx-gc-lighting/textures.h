@@ -0,0 +1,23 @@
+#pragma once
+
+#include <d3d9.h>
+#include <ninja.h>
+
+class DeviceProxy;
+
+namespace textures
+{
+	// Returns the lowest alpha value (0-255) in the top level of the texture.
+	// The result is computed on first use and stored with the texture itself.
+	// Textures that can't be read are treated as fully transparent.
+	Uint8 min_alpha(IDirect3DBaseTexture9* texture);
+
+	// Drops the stored result so the texture is analyzed again on next use.
+	void invalidate(IDirect3DBaseTexture9* texture);
+
+	// Hooks texture and surface locks and UpdateTexture/UpdateSurface
+	// so that textures are invalidated whenever their contents change.
+	// device is the real device. With a proxy, the device methods are its
+	// hook points; the locks belong to the resources and are detoured.
+	void hook(IDirect3DDevice9* device, DeviceProxy* proxy);
+}
@@ -0,0 +1,150 @@
+#include "stdafx.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+// Must be a power of two.
+static constexpr uint32_t RING_SIZE = 64 * 1024;
+
+struct Event
+{
+	const char* name;
+	long long start;
+	long long end;
+};
+
+// Only the owning thread writes to a ring. head is published after the
+// event is written so the dump never reads an event that was never filled in.
+struct Ring
+{
+	DWORD thread_id = 0;
+	std::atomic<uint32_t> head { 0 };
+	Event events[RING_SIZE] {};
+};
+
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<Ring>> rings;
+static thread_local Ring* thread_ring = nullptr;
+
+static Ring* get_ring()
+{
+	if (thread_ring == nullptr)
+	{
+		auto ring = std::make_unique<Ring>();
+		ring->thread_id = GetCurrentThreadId();
+		thread_ring = ring.get();
+
+		std::lock_guard<std::mutex> lock(rings_mutex);
+		rings.push_back(std::move(ring));
+	}
+
+	return thread_ring;
+}
+
+static long long frequency()
+{
+	static const long long value = []
+	{
+		LARGE_INTEGER result;
+		QueryPerformanceFrequency(&result);
+		return result.QuadPart;
+	}();
+
+	return value;
+}
+
+namespace trace
+{
+	bool enabled = false;
+
+	long long now()
+	{
+		LARGE_INTEGER result;
+		QueryPerformanceCounter(&result);
+		return result.QuadPart;
+	}
+
+	void record(const char* name, long long start, long long end)
+	{
+		auto ring = get_ring();
+		const auto head = ring->head.load(std::memory_order_relaxed);
+
+		ring->events[head & (RING_SIZE - 1)] = { name, start, end };
+		ring->head.store(head + 1, std::memory_order_release);
+	}
+
+	bool dump(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::out | std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			PrintDebug("[lantern] Failed to open trace file: %s\n", path.c_str());
+			return false;
+		}
+
+		const double to_us = 1000000.0 / static_cast<double>(frequency());
+		long long origin = LLONG_MAX;
+
+		std::lock_guard<std::mutex> lock(rings_mutex);
+
+		for (auto& ring : rings)
+		{
+			const auto head = ring->head.load(std::memory_order_acquire);
+			const auto count = (std::min)(head, RING_SIZE);
+
+			for (uint32_t i = head - count; i != head; i++)
+			{
+				origin = (std::min)(origin, ring->events[i & (RING_SIZE - 1)].start);
+			}
+		}
+
+		file << "{\"traceEvents\":[\n";
+		file.precision(3);
+		file << std::fixed;
+
+		bool first = true;
+		size_t written = 0;
+
+		for (auto& ring : rings)
+		{
+			const auto head = ring->head.load(std::memory_order_acquire);
+			const auto count = (std::min)(head, RING_SIZE);
+
+			for (uint32_t i = head - count; i != head; i++)
+			{
+				const auto& e = ring->events[i & (RING_SIZE - 1)];
+
+				if (!first)
+				{
+					file << ",\n";
+				}
+
+				first = false;
+
+				file << "{\"name\":\"" << e.name
+					<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread_id
+					<< ",\"ts\":" << static_cast<double>(e.start - origin) * to_us
+					<< ",\"dur\":" << static_cast<double>(e.end - e.start) * to_us
+					<< "}";
+
+				++written;
+			}
+		}
+
+		file << "\n]}\n";
+
+		PrintDebug("[lantern] Wrote %u trace events to %s\n", static_cast<unsigned>(written), path.c_str());
+		return true;
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+
+// Scoped timing zones, dumped as a Chrome trace (chrome://tracing, Perfetto).
+// Zones are written to a fixed size ring per thread, so only the most recent
+// events are kept. Names must be string literals or otherwise outlive the dump.
+//
+// Without TRACE_ZONES, TRACE_ZONE compiles to nothing. With it, a zone costs
+// a single branch on trace::enabled while tracing is off.
+
+namespace trace
+{
+	extern bool enabled;
+
+	void record(const char* name, long long start, long long end);
+	long long now();
+
+	// Writes the contents of every thread's ring to a trace_event JSON file.
+	// Events being recorded by other threads while dumping may be torn.
+	bool dump(const std::string& path);
+
+	class Zone
+	{
+		const char* name;
+		long long start;
+		bool active;
+
+	public:
+		explicit Zone(const char* name)
+			: name(name), start(0), active(enabled)
+		{
+			if (active)
+			{
+				start = now();
+			}
+		}
+
+		~Zone()
+		{
+			if (active)
+			{
+				record(name, start, now());
+			}
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+	};
+}
+
+#ifdef TRACE_ZONES
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) trace::Zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#else
+#define TRACE_ZONE(name)
+#endif
@@ -0,0 +1,323 @@
+#include "test.h"
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <d3dx9math.h>
+
+#include "CaptureReplay.h"
+#include "CaptureWriter.h"
+#include "ShaderParameter.h"
+#include "ShaderSelection.h"
+
+using namespace capture_format;
+
+static uint32_t allocation_count = 0;
+
+void* operator new(size_t size)
+{
+	++allocation_count;
+
+	if (auto result = malloc(size ? size : 1))
+	{
+		return result;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static uint32_t allocations()
+{
+	return allocation_count;
+}
+
+constexpr uint32_t LIT = ShaderFlags_Texture | ShaderFlags_Light | ShaderFlags_Fog;
+constexpr uint32_t UNLIT = ShaderFlags_Texture | ShaderFlags_Fog;
+
+static CaptureReplay::Results replay(const CaptureWriter& capture, bool uber_shader = false, bool state_blocks = false)
+{
+	CaptureReplay::Options options;
+	options.uber_shader = uber_shader;
+	options.state_blocks = state_blocks;
+
+	CaptureReplay::Results results;
+	auto stream = capture.stream();
+	CHECK(CaptureReplay::run(stream, options, results));
+	return results;
+}
+
+TEST(rejects_streams_that_are_not_captures)
+{
+	std::istringstream stream("not a capture");
+	CaptureReplay::Results results;
+	CHECK(!CaptureReplay::run(stream, {}, results));
+}
+
+TEST(version_1_captures_are_still_read)
+{
+	CaptureWriter capture(1);
+	capture.flags(LIT);
+	capture.draw();
+
+	const auto results = replay(capture);
+	CHECK_EQUAL(results.draws, 1u);
+}
+
+TEST(up_draws_are_read_with_their_vertices)
+{
+	// More than the 16 bit record size of version 1 allowed.
+	std::vector<uint8_t> vertices(70000);
+	vertices.back() = 0x5A;
+
+	CaptureWriter capture;
+	capture.record(EventType::draw_primitive_up, DrawPrimitiveUP { 4, 2000, 35 }, vertices.data(), vertices.size());
+	capture.frame(0);
+
+	auto stream = capture.stream();
+	Reader reader(stream);
+	EventType type;
+	std::vector<uint8_t> payload;
+
+	CHECK(reader.next(type, payload));
+	CHECK(type == EventType::draw_primitive_up);
+	CHECK_EQUAL(payload.size(), sizeof(DrawPrimitiveUP) + vertices.size());
+	CHECK_EQUAL(static_cast<int>(payload.back()), 0x5A);
+
+	CHECK(reader.next(type, payload));
+	CHECK(type == EventType::frame);
+}
+
+static std::vector<uint8_t> last_value;
+
+static void keep_value(int, IShaderParameter::Type::T, bool, const void* data, size_t size)
+{
+	const auto bytes = static_cast<const uint8_t*>(data);
+	last_value.assign(bytes, bytes + size);
+}
+
+TEST(described_parameters_match_their_assignment)
+{
+	ShaderParameter<D3DXVECTOR4> parameter(25, {}, IShaderParameter::Type::pixel);
+
+	IShaderParameter::on_assign = &keep_value;
+	parameter = D3DXVECTOR4(1.0f, 2.0f, 3.0f, 4.0f);
+	IShaderParameter::on_assign = nullptr;
+
+	const auto assigned = last_value;
+	last_value.clear();
+	parameter.describe(&keep_value);
+
+	CHECK(last_value == assigned);
+	IShaderParameter::values_assigned.clear();
+}
+
+TEST(shaders_are_rebound_after_every_draw)
+{
+	CaptureWriter capture;
+	capture.frame(0);
+	capture.flags(LIT);
+	capture.draw();
+	capture.draw();
+	capture.draw();
+
+	const auto results = replay(capture);
+
+	CHECK_EQUAL(results.frames, 1u);
+	CHECK_EQUAL(results.draws, 3u);
+	CHECK_EQUAL(results.permutation_changes, 1u);
+	CHECK_EQUAL(results.device.draws, 3u);
+	// Bound for each draw and unbound after it.
+	CHECK_EQUAL(results.device.vertex_shaders, 6u);
+	CHECK_EQUAL(results.device.pixel_shaders, 6u);
+	CHECK_EQUAL(results.counters.shaded_draws, 0u);
+}
+
+TEST(unchanged_parameters_are_not_uploaded_again)
+{
+	D3DXMATRIX world {};
+	world._11 = world._22 = world._33 = world._44 = 1.0f;
+
+	CaptureWriter capture;
+	capture.flags(LIT);
+	capture.parameter(0, ParameterKind_Vertex, world);
+	capture.draw();
+	capture.parameter(0, ParameterKind_Vertex, world);
+	capture.draw();
+	world._41 = 2.0f;
+	capture.parameter(0, ParameterKind_Vertex, world);
+	capture.draw();
+
+	const auto results = replay(capture);
+
+	CHECK_EQUAL(results.device.float_constants, 2u);
+	CHECK_EQUAL(results.device.constant_bytes, 2u * 64);
+	CHECK_EQUAL(results.counters.constant_uploads, 2u);
+}
+
+TEST(parameters_for_both_stages_upload_twice)
+{
+	CaptureWriter capture;
+	capture.flags(LIT);
+	capture.parameter(25, ParameterKind_Vertex | ParameterKind_Pixel, D3DXVECTOR4(0.0f, 1.0f, 2.0f, 3.0f));
+	capture.draw();
+
+	const auto results = replay(capture);
+	CHECK_EQUAL(results.device.float_constants, 2u);
+	CHECK_EQUAL(results.device.constant_bytes, 32u);
+}
+
+TEST(textures_are_bound_by_identity)
+{
+	const uint64_t first = 0x1000;
+	const uint64_t second = 0x2000;
+
+	CaptureWriter capture;
+	capture.flags(LIT);
+	capture.parameter(1, ParameterKind_Pixel | ParameterKind_Sampler, first);
+	capture.draw();
+	capture.parameter(1, ParameterKind_Pixel | ParameterKind_Sampler, first);
+	capture.draw();
+	capture.parameter(1, ParameterKind_Pixel | ParameterKind_Sampler, second);
+	capture.draw();
+
+	const auto results = replay(capture);
+	CHECK_EQUAL(results.device.textures, 2u);
+}
+
+TEST(uber_shader_sets_bool_constants_per_switch)
+{
+	CaptureWriter capture;
+	capture.flags(LIT);
+	capture.draw();
+	capture.flags(UNLIT);
+	capture.draw();
+	capture.draw();
+
+	const auto separate = replay(capture);
+	const auto uber = replay(capture, true);
+
+	CHECK_EQUAL(separate.permutation_changes, 2u);
+	CHECK_EQUAL(separate.device.bool_constants, 0u);
+	CHECK_EQUAL(uber.device.bool_constants, 4u);
+	// One per draw, since end unbinds the shaders.
+	CHECK_EQUAL(uber.counters.vertex_shader_switches, 3u);
+}
+
+TEST(vertex_color_needs_a_diffuse_fvf)
+{
+	CaptureWriter capture;
+	capture.flags(LIT | ShaderFlags_VertexColor);
+	capture.fvf(0x002);
+	capture.draw();
+	capture.fvf(0x042);
+	capture.draw();
+
+	const auto results = replay(capture);
+	CHECK_EQUAL(results.permutation_changes, 2u);
+}
+
+TEST(state_blocks_hold_only_the_permutation_states)
+{
+	CaptureWriter capture;
+
+	for (int i = 0; i < 10; i++)
+	{
+		capture.flags(i & 1 ? LIT : UNLIT | ShaderFlags_FogTable);
+		capture.draw();
+	}
+
+	const auto direct = replay(capture);
+	const auto blocks = replay(capture, false, true);
+
+	// Only the fog table permutation has states, and end restores them after each draw.
+	CHECK_EQUAL(direct.device.state_block_applies, 0u);
+	CHECK_EQUAL(blocks.device.state_block_applies, 5u);
+	CHECK_EQUAL(blocks.counters.state_block_builds, 1u);
+	CHECK_EQUAL(blocks.device.applied_states, 5u * 3);
+	CHECK_EQUAL(blocks.device.vertex_shaders, direct.device.vertex_shaders);
+	CHECK_EQUAL(blocks.device.pixel_shaders, direct.device.pixel_shaders);
+	CHECK_EQUAL(blocks.device.draws, direct.device.draws);
+}
+
+TEST(uber_state_blocks_are_applied_when_the_constants_change)
+{
+	CaptureWriter capture;
+	const uint32_t sequence[] = { LIT, LIT, LIT, UNLIT, UNLIT, LIT };
+
+	for (auto flags : sequence)
+	{
+		capture.flags(flags);
+		capture.draw();
+	}
+
+	const auto results = replay(capture, true, true);
+
+	CHECK_EQUAL(results.device.state_block_applies, 3u);
+	CHECK_EQUAL(results.counters.state_block_builds, 2u);
+}
+
+TEST(passes_give_the_same_totals)
+{
+	CaptureWriter capture;
+	capture.flags(LIT);
+	capture.parameter(25, ParameterKind_Pixel, D3DXVECTOR4(0.0f, 1.0f, 2.0f, 3.0f));
+	capture.draw();
+
+	CaptureReplay::Options options;
+	options.passes = 3;
+
+	CaptureReplay::Results results;
+	auto stream = capture.stream();
+	CHECK(CaptureReplay::run(stream, options, results));
+	CHECK_EQUAL(results.device.float_constants, 1u);
+	CHECK(results.ns_per_draw > 0.0);
+}
+
+TEST(draws_do_not_allocate_after_the_first_frame)
+{
+	const uint64_t textures[] = { 0x1000, 0x2000 };
+	D3DXMATRIX world {};
+
+	CaptureWriter capture;
+
+	for (uint32_t frame = 0; frame < 3; frame++)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			world._41 = static_cast<float>(i);
+
+			capture.flags(i & 1 ? LIT : UNLIT | ShaderFlags_FogTable);
+			capture.fvf(i & 2 ? 0x042 : 0x002);
+			capture.parameter(0, ParameterKind_Vertex, world);
+			capture.parameter(1, ParameterKind_Pixel | ParameterKind_Sampler, textures[i & 1]);
+			capture.parameter(25, ParameterKind_Vertex | ParameterKind_Pixel, D3DXVECTOR4(1.0f, 0.0f, 0.0f, static_cast<float>(i)));
+			capture.draw();
+		}
+
+		capture.frame(frame);
+	}
+
+	for (int mode = 0; mode < 4; mode++)
+	{
+		CaptureReplay::Options options;
+		options.uber_shader = (mode & 1) != 0;
+		options.state_blocks = (mode & 2) != 0;
+		options.allocations = &allocations;
+
+		CaptureReplay::Results results;
+		auto stream = capture.stream();
+		CHECK(CaptureReplay::run(stream, options, results));
+		CHECK_EQUAL(results.draws, 24u);
+		CHECK_EQUAL(results.draw_allocations, 0u);
+	}
+}
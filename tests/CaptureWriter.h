@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "CaptureFormat.h"
+
+// Builds captures in memory the way capture.cpp writes them.
+class CaptureWriter
+{
+public:
+	explicit CaptureWriter(uint16_t version = capture_format::VERSION)
+	{
+		capture_format::FileHeader header {};
+		memcpy(header.magic, capture_format::MAGIC, sizeof(header.magic));
+		header.version = version;
+		header.header_size = sizeof(header);
+		write(&header, sizeof(header));
+	}
+
+	template <typename T>
+	void record(capture_format::EventType type, const T& payload, const void* extra = nullptr, size_t extra_size = 0)
+	{
+		const auto size = static_cast<uint32_t>(sizeof(T) + extra_size);
+
+		capture_format::RecordHeader header {};
+		header.type = type;
+		header.size_high = static_cast<uint8_t>(size >> 16);
+		header.size = static_cast<uint16_t>(size);
+		write(&header, sizeof(header));
+		write(&payload, sizeof(T));
+
+		if (extra_size)
+		{
+			write(extra, extra_size);
+		}
+	}
+
+	void frame(uint32_t index)
+	{
+		record(capture_format::EventType::frame, capture_format::Frame { index });
+	}
+
+	void flags(uint32_t flags)
+	{
+		record(capture_format::EventType::shader_flags, capture_format::ShaderFlags { flags });
+	}
+
+	void fvf(uint32_t fvf)
+	{
+		record(capture_format::EventType::fvf, capture_format::Fvf { fvf });
+	}
+
+	template <typename T>
+	void parameter(uint16_t index, uint8_t kind, const T& value)
+	{
+		record(capture_format::EventType::parameter, capture_format::Parameter { index, kind, 0 }, &value, sizeof(T));
+	}
+
+	void draw()
+	{
+		record(capture_format::EventType::draw_indexed_primitive,
+			capture_format::DrawIndexedPrimitive { 4, 0, 0, 3, 0, 1 });
+	}
+
+	std::istringstream stream() const
+	{
+		return std::istringstream(data.str());
+	}
+
+private:
+	void write(const void* source, size_t size)
+	{
+		data.write(reinterpret_cast<const char*>(source), static_cast<std::streamsize>(size));
+	}
+
+	std::ostringstream data;
+};
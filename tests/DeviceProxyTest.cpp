@@ -0,0 +1,292 @@
+#include "test.h"
+
+#include "CountingDevice.h"
+#include "DeviceProxy.h"
+#include "metrics.h"
+#include "ShaderSelection.h"
+#include "ShaderState.h"
+
+// A proxy over a counting device, owning one reference to it like the
+// device d3d8to9 gets back from CreateDevice.
+struct Fixture
+{
+	CountingDevice device;
+	DeviceProxy* proxy;
+
+	Fixture()
+	{
+		device.AddRef();
+		proxy = new DeviceProxy(&device);
+	}
+
+	~Fixture()
+	{
+		if (proxy)
+		{
+			proxy->Release();
+		}
+	}
+
+	DWORD state(D3DRENDERSTATETYPE type) const
+	{
+		return device.state.render_states[type];
+	}
+
+	// Records a block setting one render state and one sampler state.
+	IDirect3DStateBlock9* record(DWORD zfunc, DWORD filter)
+	{
+		IDirect3DStateBlock9* block = nullptr;
+		proxy->BeginStateBlock();
+		proxy->SetRenderState(D3DRS_ZFUNC, zfunc);
+		proxy->SetSamplerState(1, D3DSAMP_MINFILTER, filter);
+		proxy->EndStateBlock(&block);
+		return block;
+	}
+};
+
+TEST(redundant_states_are_dropped)
+{
+	Fixture f;
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	f.proxy->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+	f.proxy->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+
+	CHECK_EQUAL(f.device.counts.render_states, 1u);
+	CHECK_EQUAL(f.device.counts.sampler_states, 1u);
+
+	DWORD value = 0;
+	f.proxy->GetRenderState(D3DRS_ZFUNC, &value);
+	CHECK_EQUAL(value, static_cast<DWORD>(D3DCMP_LESS));
+	CHECK_EQUAL(f.device.counts.state_reads, 0u);
+}
+
+TEST(states_set_while_recording_are_not_shadowed)
+{
+	Fixture f;
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	auto block = f.record(D3DCMP_LESS, D3DTEXF_LINEAR);
+
+	// Recording didn't change the device, so nothing may be skipped.
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_LESS));
+	CHECK_EQUAL(f.device.counts.render_states, 2u);
+
+	block->Release();
+}
+
+TEST(applying_a_recorded_block_updates_the_shadow)
+{
+	Fixture f;
+	auto block = f.record(D3DCMP_ALWAYS, D3DTEXF_LINEAR);
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	f.proxy->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_POINT);
+	block->Apply();
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_ALWAYS));
+
+	// Has to reach the device even though it was the last value set through the proxy.
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	f.proxy->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_POINT);
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_LESS));
+	CHECK_EQUAL(f.device.state.sampler_states[1][D3DSAMP_MINFILTER], static_cast<DWORD>(D3DTEXF_POINT));
+
+	// The block's values are known, so these are redundant.
+	const auto sets = f.device.counts.render_states;
+	block->Apply();
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_ALWAYS);
+	CHECK_EQUAL(f.device.counts.render_states, sets);
+
+	DWORD value = 0;
+	f.proxy->GetSamplerState(1, D3DSAMP_MINFILTER, &value);
+	CHECK_EQUAL(value, static_cast<DWORD>(D3DTEXF_LINEAR));
+	CHECK_EQUAL(f.device.counts.state_reads, 0u);
+
+	block->Release();
+}
+
+TEST(captured_blocks_forget_their_recorded_values)
+{
+	Fixture f;
+	auto block = f.record(D3DCMP_ALWAYS, D3DTEXF_LINEAR);
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_GREATER);
+	block->Capture();
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	block->Apply();
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_GREATER));
+
+	DWORD value = 0;
+	f.proxy->GetRenderState(D3DRS_ZFUNC, &value);
+	CHECK_EQUAL(value, static_cast<DWORD>(D3DCMP_GREATER));
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_ALWAYS);
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_ALWAYS));
+
+	block->Release();
+}
+
+// What d3d8to9 does for the game's CreateStateBlock and ApplyStateBlock.
+TEST(applying_a_created_block_invalidates_the_shadow)
+{
+	Fixture f;
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_ALWAYS);
+
+	IDirect3DStateBlock9* block = nullptr;
+	CHECK(SUCCEEDED(f.proxy->CreateStateBlock(D3DSBT_ALL, &block)));
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	block->Apply();
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_ALWAYS));
+
+	f.proxy->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+	CHECK_EQUAL(f.state(D3DRS_ZFUNC), static_cast<DWORD>(D3DCMP_LESS));
+
+	block->Release();
+}
+
+TEST(state_blocks_belong_to_the_proxy)
+{
+	Fixture f;
+	auto block = f.record(D3DCMP_ALWAYS, D3DTEXF_LINEAR);
+
+	IDirect3DDevice9* device = nullptr;
+	block->GetDevice(&device);
+	CHECK(device == f.proxy);
+	device->Release();
+
+	IDirect3DStateBlock9* same = nullptr;
+	CHECK(SUCCEEDED(block->QueryInterface(__uuidof(IDirect3DStateBlock9), reinterpret_cast<void**>(&same))));
+	CHECK(same == block);
+	same->Release();
+
+	// A block keeps the proxy alive.
+	f.proxy->Release();
+	f.proxy = nullptr;
+	CHECK_EQUAL(f.device.reference_count(), 1u);
+
+	block->Release();
+	CHECK_EQUAL(f.device.reference_count(), 0u);
+}
+
+TEST(the_proxy_counts_its_own_references)
+{
+	Fixture f;
+
+	IDirect3DDevice9* same = nullptr;
+	CHECK(SUCCEEDED(f.proxy->QueryInterface(__uuidof(IDirect3DDevice9), reinterpret_cast<void**>(&same))));
+	CHECK(same == f.proxy);
+	CHECK_EQUAL(f.device.reference_count(), 1u);
+
+	// Other holders of the device don't keep the proxy alive, nor the other way around.
+	f.device.AddRef();
+	CHECK_EQUAL(same->Release(), 1u);
+	CHECK_EQUAL(f.device.reference_count(), 2u);
+
+	CHECK_EQUAL(f.proxy->Release(), 0u);
+	f.proxy = nullptr;
+	CHECK_EQUAL(f.device.reference_count(), 1u);
+	f.device.Release();
+}
+
+static unsigned int texture_updates = 0;
+
+static HRESULT __stdcall UpdateTexture_hook(IDirect3DDevice9* device, IDirect3DBaseTexture9* source, IDirect3DBaseTexture9* destination)
+{
+	++texture_updates;
+	return device->UpdateTexture(source, destination);
+}
+
+// Texture updates reach the hook with the device behind the proxy, which
+// still gets the call.
+TEST(texture_updates_reach_the_hooks)
+{
+	Fixture f;
+	texture_updates = 0;
+
+	f.proxy->UpdateTexture(nullptr, nullptr);
+	CHECK_EQUAL(texture_updates, 0u);
+
+	f.proxy->hooks.UpdateTexture = &UpdateTexture_hook;
+	const auto calls = f.device.counts.calls;
+	f.proxy->UpdateTexture(nullptr, nullptr);
+
+	CHECK_EQUAL(texture_updates, 1u);
+	CHECK_EQUAL(f.device.counts.calls, calls + 1);
+}
+
+class Shaders : public ShaderState::IShaderSource
+{
+public:
+	explicit Shaders(IDirect3DDevice9* device) : device(device)
+	{
+	}
+
+	~Shaders() override
+	{
+		vs->Release();
+		ps->Release();
+	}
+
+	VertexShader vertex_shader(Uint32) override
+	{
+		if (vs == nullptr)
+		{
+			device->CreateVertexShader(nullptr, &vs);
+		}
+
+		return vs;
+	}
+
+	PixelShader pixel_shader(Uint32) override
+	{
+		if (ps == nullptr)
+		{
+			device->CreatePixelShader(nullptr, &ps);
+		}
+
+		return ps;
+	}
+
+	void flush() override
+	{
+	}
+
+private:
+	IDirect3DDevice9* device;
+	IDirect3DVertexShader9* vs = nullptr;
+	IDirect3DPixelShader9* ps = nullptr;
+};
+
+// The mod's fog table state block, applied through the proxy, must leave
+// the shadow agreeing with the device.
+TEST(shader_state_blocks_keep_the_shadow_in_sync)
+{
+	Fixture f;
+	Shaders shaders(&f.device);
+	FrameCounters counters {};
+	ShaderState state(shaders, counters);
+
+	state.device = f.proxy;
+	state.state_blocks = true;
+
+	const Uint32 flags = ShaderFlags_Fog | ShaderFlags_FogTable;
+	f.proxy->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_POINT);
+
+	for (int i = 0; i < 3; i++)
+	{
+		state.start(flags);
+		CHECK_EQUAL(f.device.state.sampler_states[1][D3DSAMP_MINFILTER], static_cast<DWORD>(D3DTEXF_LINEAR));
+		state.end();
+		CHECK_EQUAL(f.device.state.sampler_states[1][D3DSAMP_MINFILTER], static_cast<DWORD>(D3DTEXF_POINT));
+	}
+
+	CHECK_EQUAL(counters.state_block_builds, 1u);
+	CHECK_EQUAL(f.device.counts.state_block_applies, 3u);
+	// The game's states are saved from the shadow.
+	CHECK_EQUAL(f.device.counts.state_reads, 2u);
+
+	state.release();
+}
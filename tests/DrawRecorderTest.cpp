@@ -0,0 +1,304 @@
+#include "test.h"
+
+#include <cstring>
+#include <vector>
+
+#include "CountingDevice.h"
+#include "DrawRecorder.h"
+
+// The states the tests look at, as they were when a draw reached the device.
+struct Snapshot
+{
+	uint32_t tag;
+	DWORD zfunc;
+	IDirect3DBaseTexture9* texture;
+	IDirect3DVertexShader9* vertex_shader;
+	float constant[4];
+	BOOL boolean;
+	DWORD fvf;
+};
+
+static uint32_t last_tag = 0;
+
+static void on_draw(uint32_t tag)
+{
+	last_tag = tag;
+}
+
+// A counting device with the recorder hooked in like d3d.cpp does: state
+// changes are recorded before they're applied, and draws are taken down.
+class HookedDevice : public CountingDevice
+{
+public:
+	DrawRecorder recorder;
+	std::vector<Snapshot> draws;
+
+	HRESULT STDMETHODCALLTYPE SetRenderState(D3DRENDERSTATETYPE State, DWORD Value) override
+	{
+		recorder.render_state(State, Value);
+		return CountingDevice::SetRenderState(State, Value);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture) override
+	{
+		recorder.texture(Stage, pTexture);
+		return CountingDevice::SetTexture(Stage, pTexture);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShader(IDirect3DVertexShader9* pShader) override
+	{
+		recorder.vertex_shader(pShader);
+		return CountingDevice::SetVertexShader(pShader);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetVertexShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) override
+	{
+		recorder.vertex_constants(StartRegister, pConstantData, Vector4fCount);
+		return CountingDevice::SetVertexShaderConstantF(StartRegister, pConstantData, Vector4fCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetPixelShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) override
+	{
+		recorder.pixel_bools(StartRegister, pConstantData, BoolCount);
+		return CountingDevice::SetPixelShaderConstantB(StartRegister, pConstantData, BoolCount);
+	}
+
+	HRESULT STDMETHODCALLTYPE SetFVF(DWORD FVF) override
+	{
+		recorder.fvf(FVF);
+		return CountingDevice::SetFVF(FVF);
+	}
+
+	// The counting device doesn't keep stream sources, so they can't be saved.
+	HRESULT STDMETHODCALLTYPE SetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride) override
+	{
+		recorder.stream_source(StreamNumber, pStreamData, OffsetInBytes, Stride);
+		return CountingDevice::SetStreamSource(StreamNumber, pStreamData, OffsetInBytes, Stride);
+	}
+
+	HRESULT STDMETHODCALLTYPE DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex,
+		UINT NumVertices, UINT startIndex, UINT primCount) override
+	{
+		draws.push_back(snapshot(recorder.replaying() ? last_tag : 0));
+		return CountingDevice::DrawIndexedPrimitive(PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+	}
+
+	Snapshot snapshot(uint32_t tag) const
+	{
+		Snapshot result {};
+		result.tag = tag;
+		result.zfunc = state.render_states[D3DRS_ZFUNC];
+		result.texture = state.textures[0];
+		result.vertex_shader = state.vertex_shader;
+		memcpy(result.constant, state.vertex_constants[4], sizeof(result.constant));
+		result.boolean = state.pixel_bools[2];
+		result.fvf = state.fvf;
+		return result;
+	}
+};
+
+static bool same(const Snapshot& a, const Snapshot& b)
+{
+	return a.tag == b.tag && a.zfunc == b.zfunc && a.texture == b.texture && a.vertex_shader == b.vertex_shader
+		&& !memcmp(a.constant, b.constant, sizeof(a.constant)) && a.boolean == b.boolean && a.fvf == b.fvf;
+}
+
+static ULONG references(IUnknown* object)
+{
+	object->AddRef();
+	return object->Release();
+}
+
+struct Fixture
+{
+	HookedDevice device;
+	IDirect3DTexture9* textures[2] {};
+	IDirect3DVertexShader9* shaders[2] {};
+
+	Fixture()
+	{
+		for (auto& it : textures)
+		{
+			device.CreateTexture(1, 1, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &it, nullptr);
+		}
+
+		for (auto& it : shaders)
+		{
+			device.CreateVertexShader(nullptr, &it);
+		}
+
+		device.state.render_states[D3DRS_ZFUNC] = D3DCMP_LESSEQUAL;
+	}
+
+	~Fixture()
+	{
+		device.recorder.end();
+
+		for (auto& it : textures)
+		{
+			it->Release();
+		}
+
+		for (auto& it : shaders)
+		{
+			it->Release();
+		}
+	}
+
+	// Sets every state the snapshots look at, numbered by i.
+	void set_states(int i)
+	{
+		const float constant[4] = { static_cast<float>(i), 1.0f, 2.0f, 3.0f };
+		const BOOL boolean = i & 1;
+
+		device.SetRenderState(D3DRS_ZFUNC, i & 1 ? D3DCMP_LESS : D3DCMP_GREATER);
+		device.SetTexture(0, textures[i & 1]);
+		device.SetVertexShader(shaders[i & 1]);
+		device.SetVertexShaderConstantF(4, constant, 1);
+		device.SetPixelShaderConstantB(2, &boolean, 1);
+		device.SetFVF(D3DFVF_XYZ | (i & 1 ? D3DFVF_DIFFUSE : D3DFVF_NORMAL));
+	}
+
+	void defer(uint32_t tag)
+	{
+		DrawRecorder::Draw draw {};
+		draw.indexed = true;
+		draw.type = D3DPT_TRIANGLELIST;
+		draw.primitive_count = 1;
+		device.recorder.defer(draw, tag);
+	}
+};
+
+TEST(deferred_draws_are_replayed_with_their_states)
+{
+	Fixture f;
+	f.device.recorder.begin(&f.device, &on_draw);
+
+	std::vector<Snapshot> expected;
+
+	for (int i = 1; i <= 3; i++)
+	{
+		f.set_states(i);
+		expected.push_back(f.device.snapshot(i));
+		f.defer(i);
+	}
+
+	// States changed after the last deferred draw are left as they are.
+	f.set_states(4);
+	const Snapshot before = f.device.snapshot(0);
+
+	CHECK(f.device.draws.empty());
+	CHECK_EQUAL(f.device.recorder.pending(), 3u);
+
+	f.device.recorder.replay();
+
+	CHECK_EQUAL(f.device.recorder.pending(), 0u);
+	CHECK_EQUAL(f.device.draws.size(), expected.size());
+
+	for (size_t i = 0; i < expected.size() && i < f.device.draws.size(); i++)
+	{
+		CHECK(same(f.device.draws[i], expected[i]));
+	}
+
+	CHECK(same(f.device.snapshot(0), before));
+}
+
+TEST(states_set_before_recording_are_put_back_for_earlier_draws)
+{
+	Fixture f;
+	f.set_states(1);
+	const Snapshot initial = f.device.snapshot(7);
+
+	f.device.recorder.begin(&f.device, &on_draw);
+	f.defer(7);
+	f.set_states(2);
+
+	const Snapshot after = f.device.snapshot(0);
+	f.device.recorder.end();
+
+	CHECK_EQUAL(f.device.draws.size(), 1u);
+
+	if (!f.device.draws.empty())
+	{
+		CHECK(same(f.device.draws[0], initial));
+	}
+
+	CHECK(same(f.device.snapshot(0), after));
+}
+
+TEST(nothing_is_submitted_without_deferred_draws)
+{
+	Fixture f;
+	f.device.recorder.begin(&f.device);
+
+	f.set_states(1);
+	const auto calls = f.device.counts.calls;
+
+	f.device.recorder.replay();
+	f.set_states(2);
+	f.device.recorder.end();
+
+	// Only set_states(2) reached the device after the replay.
+	CHECK_EQUAL(f.device.counts.calls, calls + 6);
+	CHECK(f.device.draws.empty());
+}
+
+TEST(changes_that_cant_be_saved_submit_pending_draws_first)
+{
+	Fixture f;
+	f.device.recorder.begin(&f.device, &on_draw);
+
+	f.set_states(1);
+	const Snapshot expected = f.device.snapshot(1);
+	f.defer(1);
+
+	// The stream source's old value can't be read back.
+	f.device.SetStreamSource(0, nullptr, 0, 0);
+
+	CHECK_EQUAL(f.device.draws.size(), 1u);
+	CHECK_EQUAL(f.device.recorder.pending(), 0u);
+
+	f.set_states(2);
+	f.defer(2);
+
+	// Nor can the recorder represent a texture stage that doesn't exist.
+	f.device.SetTexture(300, nullptr);
+
+	CHECK_EQUAL(f.device.draws.size(), 2u);
+
+	if (!f.device.draws.empty())
+	{
+		CHECK(same(f.device.draws[0], expected));
+	}
+
+	// Once nothing is pending, the change is recorded without its old value.
+	f.set_states(3);
+	f.device.SetStreamSource(0, nullptr, 0, 0);
+	f.defer(3);
+	f.device.recorder.end();
+
+	CHECK_EQUAL(f.device.draws.size(), 3u);
+}
+
+TEST(replays_release_their_references)
+{
+	Fixture f;
+	const ULONG texture_references = references(f.textures[1]);
+	const ULONG shader_references = references(f.shaders[1]);
+
+	f.device.recorder.begin(&f.device);
+
+	for (int i = 0; i < 4; i++)
+	{
+		f.set_states(i);
+		f.defer(i);
+	}
+
+	CHECK(references(f.textures[1]) > texture_references);
+
+	f.device.recorder.end();
+
+	// The device doesn't hold references to what's set on it.
+	CHECK_EQUAL(references(f.textures[1]), texture_references);
+	CHECK_EQUAL(references(f.shaders[1]), shader_references);
+}
@@ -0,0 +1,193 @@
+#include "test.h"
+
+#include <string>
+
+#include "FrameTimes.h"
+
+TEST(bucket_index_is_exact_below_sub_buckets)
+{
+	for (uint32_t us = 0; us < FrameHistogram::SUB_BUCKETS; us++)
+	{
+		CHECK_EQUAL(FrameHistogram::bucket_index(us), us);
+		CHECK_EQUAL(FrameHistogram::bucket_upper_bound(us), us);
+	}
+}
+
+TEST(bucket_bounds_contain_their_values)
+{
+	// Every value maps to a bucket whose upper bound is at or above it and
+	// within 1/SUB_BUCKETS of it, and buckets never go backwards.
+	uint32_t previous = 0;
+
+	for (uint32_t us = 1; us < (1u << 20); us += 1 + us / 97)
+	{
+		const auto index = FrameHistogram::bucket_index(us);
+		const auto upper = FrameHistogram::bucket_upper_bound(index);
+
+		CHECK(index < FrameHistogram::BUCKET_COUNT);
+		CHECK(index >= previous);
+		CHECK(upper >= us);
+		CHECK(upper - us <= us / FrameHistogram::SUB_BUCKETS);
+
+		if (index > 0)
+		{
+			CHECK(FrameHistogram::bucket_upper_bound(index - 1) < us);
+		}
+
+		previous = index;
+	}
+}
+
+TEST(bucket_index_clamps_long_frames)
+{
+	const auto last = FrameHistogram::BUCKET_COUNT - 1;
+	CHECK_EQUAL(FrameHistogram::bucket_index(0xFFFFFFFF), last);
+	CHECK_EQUAL(FrameHistogram::bucket_index((2u << FrameHistogram::MAX_EXPONENT) - 1), last);
+	CHECK(FrameHistogram::bucket_index(1u << FrameHistogram::MAX_EXPONENT) <= last);
+}
+
+TEST(empty_histogram_reports_zero)
+{
+	FrameHistogram histogram;
+	CHECK_EQUAL(histogram.count(), 0u);
+	CHECK_EQUAL(histogram.max(), 0u);
+	CHECK_EQUAL(histogram.percentile(0.5), 0u);
+	CHECK_EQUAL(histogram.percentile(0.99), 0u);
+}
+
+TEST(percentiles_of_uniform_frames)
+{
+	FrameHistogram histogram;
+
+	for (uint32_t us = 1; us <= 1000; us++)
+	{
+		histogram.record(us * 100);
+	}
+
+	CHECK_EQUAL(histogram.count(), 1000u);
+	CHECK_EQUAL(histogram.max(), 100000u);
+
+	const auto p50 = histogram.percentile(0.5);
+	const auto p99 = histogram.percentile(0.99);
+
+	CHECK(p50 >= 50000 && p50 - 50000 <= 50000 / FrameHistogram::SUB_BUCKETS);
+	CHECK(p99 >= 99000 && p99 - 99000 <= 99000 / FrameHistogram::SUB_BUCKETS);
+	CHECK_EQUAL(histogram.percentile(1.0), 100000u);
+	CHECK_EQUAL(histogram.percentile(2.0), 100000u);
+	CHECK(histogram.percentile(0.0) <= 100 + 100 / FrameHistogram::SUB_BUCKETS);
+}
+
+TEST(percentile_never_exceeds_max)
+{
+	FrameHistogram histogram;
+	histogram.record(16667);
+	CHECK_EQUAL(histogram.percentile(0.5), 16667u);
+	CHECK_EQUAL(histogram.percentile(1.0), 16667u);
+}
+
+TEST(reset_clears_histogram)
+{
+	FrameHistogram histogram;
+	histogram.record(1000);
+	histogram.record(2000);
+	histogram.reset();
+
+	CHECK_EQUAL(histogram.count(), 0u);
+	CHECK_EQUAL(histogram.max(), 0u);
+	CHECK_EQUAL(histogram.percentile(0.5), 0u);
+}
+
+static FrameActivity frame(uint32_t index, uint32_t us, uint32_t draws = 1000, uint32_t constant_bytes = 64000)
+{
+	FrameActivity activity {};
+	activity.frame = index;
+	activity.us = us;
+	activity.draws = draws;
+	activity.constant_bytes = constant_bytes;
+	return activity;
+}
+
+TEST(hitch_log_ignores_frames_within_budget)
+{
+	HitchLog log;
+	HitchRecord record {};
+
+	CHECK(!log.add(frame(0, 16000), 16667, record));
+	CHECK(!log.add(frame(1, 16667), 16667, record));
+	CHECK(log.records().empty());
+}
+
+TEST(hitch_log_budget_zero_disables)
+{
+	HitchLog log;
+	HitchRecord record {};
+
+	CHECK(!log.add(frame(0, 1000000), 0, record));
+	CHECK(log.records().empty());
+}
+
+TEST(hitch_log_attributes_causes)
+{
+	HitchLog log;
+	HitchRecord record {};
+
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		log.add(frame(i, 16000), 16667, record);
+	}
+
+	auto activity = frame(10, 40000, 3000, 64000);
+	activity.shader_compiles = 2;
+	activity.device_resets = 1;
+
+	CHECK(log.add(activity, 16667, record));
+	CHECK_EQUAL(record.activity.frame, 10u);
+	CHECK_EQUAL(record.causes, static_cast<uint32_t>(HitchRecord::ShaderCompile | HitchRecord::DeviceReset | HitchRecord::DrawSpike));
+	CHECK_NEAR(record.average_draws, 1000.0, 0.01);
+	CHECK_NEAR(record.average_constant_bytes, 64000.0, 0.5);
+
+	CHECK(log.add(frame(11, 20000, 1000, 200000), 16667, record));
+	CHECK_EQUAL(record.causes, static_cast<uint32_t>(HitchRecord::UploadSpike));
+
+	activity = frame(12, 20000);
+	activity.shader_cache_loads = 1;
+	CHECK(log.add(activity, 16667, record));
+	CHECK_EQUAL(record.causes, static_cast<uint32_t>(HitchRecord::CacheLoad));
+
+	CHECK_EQUAL(log.records().size(), 3u);
+}
+
+TEST(hitch_log_keeps_most_recent_records)
+{
+	HitchLog log(4);
+	HitchRecord record {};
+
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		log.add(frame(i, 20000), 16667, record);
+	}
+
+	CHECK_EQUAL(log.records().size(), 4u);
+	CHECK_EQUAL(log.records().front().activity.frame, 6u);
+	CHECK_EQUAL(log.records().back().activity.frame, 9u);
+
+	log.clear();
+	CHECK(log.records().empty());
+}
+
+TEST(hitch_log_zero_capacity_still_reports)
+{
+	HitchLog log(0);
+	HitchRecord record {};
+
+	CHECK(log.add(frame(0, 20000), 16667, record));
+	CHECK_EQUAL(record.activity.frame, 0u);
+	CHECK(log.records().empty());
+}
+
+TEST(hitch_cause_names)
+{
+	CHECK_EQUAL(std::string(HitchLog::cause_name(HitchRecord::ShaderCompile)), "shader compile");
+	CHECK_EQUAL(std::string(HitchLog::cause_name(HitchRecord::UploadSpike)), "upload spike");
+	CHECK_EQUAL(std::string(HitchLog::cause_name(HitchRecord::None)), "unknown");
+}
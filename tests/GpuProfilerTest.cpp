@@ -0,0 +1,208 @@
+#include "test.h"
+
+#include "GpuProfiler.h"
+#include "MockTimestampSource.h"
+
+// Runs frames until the first one has been resolved.
+static void flush(GpuProfiler& profiler)
+{
+	for (size_t i = 0; i < GpuProfiler::FRAME_LATENCY; i++)
+	{
+		profiler.end_frame();
+		profiler.begin_frame();
+	}
+}
+
+TEST(runs_are_attributed_to_their_keys)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(1);
+	source.clock += 100;
+	profiler.mark(2);
+	source.clock += 250;
+	profiler.mark(1);
+	source.clock += 50;
+	flush(profiler);
+
+	CHECK_EQUAL(profiler.frames(), 1u);
+	CHECK_EQUAL(profiler.totals().size(), 2u);
+	CHECK_NEAR(profiler.totals().at(1).us, 150.0, 1e-9);
+	CHECK_EQUAL(profiler.totals().at(1).runs, 2u);
+	CHECK_NEAR(profiler.totals().at(2).us, 250.0, 1e-9);
+	CHECK_EQUAL(profiler.totals().at(2).runs, 1u);
+	CHECK_NEAR(profiler.total_us(), 400.0, 1e-9);
+}
+
+TEST(repeated_marks_extend_the_run)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+
+	for (int i = 0; i < 10; i++)
+	{
+		profiler.mark(7);
+		source.clock += 10;
+	}
+
+	profiler.end_frame();
+
+	// One to open the run and one to close it.
+	CHECK_EQUAL(source.timestamps_issued, 2u);
+
+	flush(profiler);
+	CHECK_EQUAL(profiler.totals().at(7).runs, 1u);
+	CHECK_NEAR(profiler.totals().at(7).us, 100.0, 1e-9);
+}
+
+TEST(frequency_converts_ticks)
+{
+	MockTimestampSource source;
+	source.frequency = 4000000;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(3);
+	source.clock += 1000;
+	flush(profiler);
+
+	CHECK_NEAR(profiler.totals().at(3).us, 250.0, 1e-9);
+}
+
+TEST(frames_are_resolved_after_the_latency)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	for (size_t i = 0; i < GpuProfiler::FRAME_LATENCY; i++)
+	{
+		profiler.begin_frame();
+		profiler.mark(1);
+		source.clock += 10;
+		profiler.end_frame();
+	}
+
+	CHECK_EQUAL(profiler.frames(), 0u);
+
+	profiler.begin_frame();
+	CHECK_EQUAL(profiler.frames(), 1u);
+}
+
+TEST(unavailable_results_skip_frames_without_waiting)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(1);
+	source.clock += 10;
+	profiler.end_frame();
+	source.slots[0].ready = false;
+
+	for (size_t i = 1; i < GpuProfiler::FRAME_LATENCY; i++)
+	{
+		profiler.begin_frame();
+		profiler.end_frame();
+	}
+
+	// Slot 0 comes around again while its queries are still in flight.
+	profiler.begin_frame();
+	CHECK_EQUAL(profiler.skipped_frames(), 1u);
+	CHECK_EQUAL(profiler.frames(), 0u);
+
+	// Marks in a skipped frame issue nothing.
+	const auto issued = source.timestamps_issued;
+	profiler.mark(2);
+	profiler.end_frame();
+	CHECK_EQUAL(source.timestamps_issued, issued);
+
+	source.slots[0].ready = true;
+
+	for (size_t i = 1; i < GpuProfiler::FRAME_LATENCY; i++)
+	{
+		profiler.begin_frame();
+		profiler.end_frame();
+	}
+
+	profiler.begin_frame();
+	CHECK_EQUAL(profiler.frames(), 1u);
+	CHECK_NEAR(profiler.totals().at(1).us, 10.0, 1e-9);
+}
+
+TEST(disjoint_frames_are_discarded)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(1);
+	source.clock += 10;
+	profiler.end_frame();
+	source.slots[0].disjoint = true;
+
+	for (size_t i = 1; i < GpuProfiler::FRAME_LATENCY; i++)
+	{
+		profiler.begin_frame();
+		profiler.end_frame();
+	}
+
+	profiler.begin_frame();
+	CHECK(profiler.totals().empty());
+	CHECK_EQUAL(profiler.skipped_frames(), 0u);
+}
+
+TEST(timestamps_are_capped_per_frame)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+
+	for (uint32_t i = 0; i < GpuProfiler::MAX_TIMESTAMPS * 2; i++)
+	{
+		profiler.mark(i & 1);
+		source.clock += 1;
+	}
+
+	profiler.end_frame();
+	CHECK_EQUAL(source.timestamps_issued, GpuProfiler::MAX_TIMESTAMPS);
+
+	flush(profiler);
+	CHECK_EQUAL(profiler.totals().at(0).runs + profiler.totals().at(1).runs, GpuProfiler::MAX_TIMESTAMPS - 1);
+}
+
+TEST(source_refusing_a_frame_disables_marks)
+{
+	MockTimestampSource source;
+	source.can_begin = false;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(1);
+	profiler.end_frame();
+
+	CHECK_EQUAL(source.timestamps_issued, 0u);
+}
+
+TEST(reset_discards_frames_in_flight)
+{
+	MockTimestampSource source;
+	GpuProfiler profiler(&source);
+
+	profiler.begin_frame();
+	profiler.mark(1);
+	source.clock += 10;
+	profiler.end_frame();
+	profiler.reset();
+	flush(profiler);
+
+	CHECK(profiler.totals().empty());
+	CHECK_EQUAL(profiler.frames(), 0u);
+
+	profiler.clear();
+	CHECK_EQUAL(profiler.total_us(), 0.0);
+}
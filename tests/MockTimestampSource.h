@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "GpuProfiler.h"
+
+// Deterministic stand-in for TimestampQueries. Timestamps read the simulated
+// GPU clock at the time they're issued; tests advance the clock to model the
+// work between them and decide when each slot's results become available.
+class MockTimestampSource : public ITimestampSource
+{
+public:
+	struct Slot
+	{
+		bool begun = false;
+		bool ended = false;
+		bool ready = true;     // Results can be read.
+		bool disjoint = false;
+		std::vector<uint64_t> ticks;
+	};
+
+	uint64_t frequency = 1000000; // One tick per microsecond.
+	uint64_t clock = 1;
+	bool can_begin = true;
+	size_t timestamps_issued = 0;
+	Slot slots[GpuProfiler::FRAME_LATENCY];
+
+	bool begin_frame(size_t slot) override
+	{
+		if (!can_begin)
+		{
+			return false;
+		}
+
+		slots[slot] = {};
+		slots[slot].begun = true;
+		return true;
+	}
+
+	void end_frame(size_t slot) override
+	{
+		slots[slot].ended = true;
+	}
+
+	void timestamp(size_t slot, size_t index) override
+	{
+		auto& ticks = slots[slot].ticks;
+
+		if (ticks.size() <= index)
+		{
+			ticks.resize(index + 1);
+		}
+
+		ticks[index] = clock;
+		++timestamps_issued;
+	}
+
+	bool frame_data(size_t slot, uint64_t& out_frequency, bool& disjoint) override
+	{
+		if (!slots[slot].ready)
+		{
+			return false;
+		}
+
+		out_frequency = frequency;
+		disjoint = slots[slot].disjoint;
+		return true;
+	}
+
+	bool timestamp_data(size_t slot, size_t index, uint64_t& ticks) override
+	{
+		if (!slots[slot].ready || index >= slots[slot].ticks.size())
+		{
+			return false;
+		}
+
+		ticks = slots[slot].ticks[index];
+		return true;
+	}
+};
@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "CaptureReplay.h"
+
+// Replays a capture written by StartCapture outside of the game and prints
+// the cost per frame, like the mod's ReplayCapture export.
+int main(int argc, char** argv)
+{
+	CaptureReplay::Options options;
+	const char* path = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--uber"))
+		{
+			options.uber_shader = true;
+		}
+		else if (!strcmp(argv[i], "--state-blocks"))
+		{
+			options.state_blocks = true;
+		}
+		else if (!strcmp(argv[i], "--passes") && i + 1 < argc)
+		{
+			options.passes = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (path == nullptr)
+	{
+		fprintf(stderr, "usage: capture_replay [--uber] [--state-blocks] [--passes N] capture.bin\n");
+		return 2;
+	}
+
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	CaptureReplay::Results results;
+
+	if (!file.is_open() || !CaptureReplay::run(file, options, results))
+	{
+		fprintf(stderr, "failed to read capture: %s\n", path);
+		return 1;
+	}
+
+	const double frames = results.frames > 0 ? results.frames : 1.0;
+	const auto& device = results.device;
+
+	printf("frames:                %u\n", results.frames);
+	printf("draws:                 %llu\n", static_cast<unsigned long long>(results.draws));
+	printf("ns per draw:           %.1f\n", results.ns_per_draw);
+	printf("per frame:\n");
+	printf("  device calls:        %.1f\n", device.calls / frames);
+	printf("  permutation changes: %.1f\n", results.permutation_changes / frames);
+	printf("  vertex shader binds: %.1f\n", device.vertex_shaders / frames);
+	printf("  pixel shader binds:  %.1f\n", device.pixel_shaders / frames);
+	printf("  float constants:     %.1f (%.0f bytes)\n", device.float_constants / frames, device.constant_bytes / frames);
+	printf("  bool constants:      %.1f\n", device.bool_constants / frames);
+	printf("  textures:            %.1f\n", device.textures / frames);
+	printf("  sampler states:      %.1f\n", device.sampler_states / frames);
+	printf("  state reads:         %.1f\n", device.state_reads / frames);
+	printf("  state block applies: %.1f\n", device.state_block_applies / frames);
+	return 0;
+}
@@ -0,0 +1,398 @@
+#include "test.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "FogTable.h"
+#include "ShaderReference.h"
+#include "ShaderSelection.h"
+
+using namespace shader_reference;
+
+static void set_identity(Constants& constants, Register m)
+{
+	const float identity[16] = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f,
+	};
+
+	constants.set(m, identity, sizeof(identity));
+}
+
+static void set(Constants& constants, Register index, float x, float y, float z, float w = 0.0f)
+{
+	const float value[] = { x, y, z, w };
+	constants.set(index, value, sizeof(value));
+}
+
+// A lit scene with linear fog from 10 to 110 in front of the camera.
+static Constants make_constants()
+{
+	Constants constants;
+
+	set_identity(constants, Register_WorldMatrix);
+	set_identity(constants, Register_wvMatrix);
+	set_identity(constants, Register_ProjectionMatrix);
+	set_identity(constants, Register_wvMatrixInvT);
+
+	const float length = std::sqrt(3.0f);
+	set(constants, Register_LightDirection, 1.0f / length, 1.0f / length, 1.0f / length);
+	set(constants, Register_LightDiffuse, 0.8f, 0.7f, 0.6f, 1.0f);
+	set(constants, Register_LightSpecular, 1.0f, 1.0f, 1.0f, 1.0f);
+	set(constants, Register_LightAmbient, 0.2f, 0.25f, 0.3f, 1.0f);
+	set(constants, Register_MaterialSpecular, 0.5f, 0.5f, 0.5f, 1.0f);
+	set(constants, Register_MaterialPower, 8.0f, 0.0f, 0.0f);
+	set(constants, Register_CameraPosition, 0.0f, 5.0f, -20.0f);
+	set(constants, Register_FogConfig, -1.0f / 100.0f, 110.0f / 100.0f, -0.02f, -0.0004f);
+	set(constants, Register_FogColor, 0.25f, 0.5f, 0.75f, 1.0f);
+
+	for (int i = 1; i < 4; i++)
+	{
+		const auto light = static_cast<Register>(Register_StageLights + i * 4);
+		set(constants, light, 0.0f, static_cast<float>(i) / 4.0f, -1.0f);
+		set(constants, static_cast<Register>(light + 1), 0.0f, 0.5f, 0.4f, 0.3f);
+	}
+
+	set(constants, Register_LightWeights, 0.5f, 0.25f, 0.125f);
+	return constants;
+}
+
+static std::vector<Vertex> make_vertices(size_t count)
+{
+	std::vector<Vertex> vertices(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const float t = static_cast<float>(i);
+		const float nx = std::sin(t);
+		const float nz = std::cos(t);
+		const float ny = 0.5f;
+		const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+
+		vertices[i] = {
+			{ t * 3.0f - 10.0f, t, t * 7.0f + 5.0f },
+			{ nx / length, ny / length, nz / length },
+			{ t / 8.0f, 1.0f - t / 8.0f },
+			{ 0.5f + t / 32.0f, 0.25f, 1.0f - t / 16.0f, t / 8.0f },
+		};
+	}
+
+	return vertices;
+}
+
+static std::vector<PixelResult> shade(uint32_t flags, const Constants& constants, const std::vector<Vertex>& vertices)
+{
+	std::vector<Interpolants> interpolants(vertices.size());
+	vs_main(flags, constants, vertices.data(), interpolants.data(), vertices.size());
+
+	std::vector<Pixel> pixels(vertices.size());
+
+	for (size_t i = 0; i < pixels.size(); i++)
+	{
+		pixels[i].input = interpolants[i];
+
+		// A texture that varies with the coordinates.
+		for (int c = 0; c < 4; c++)
+		{
+			pixels[i].texel[c] = 0.25f + 0.5f * std::fabs(interpolants[i].tex[c & 1]) / static_cast<float>(c + 1);
+		}
+	}
+
+	std::vector<PixelResult> results(pixels.size());
+	ps_main(flags, constants, pixels.data(), results.data(), pixels.size());
+	return results;
+}
+
+// Pixels on the vertices see exactly the vertex shader's inputs, so both
+// lighting tiers have to agree there. This is what ShaderFlags_VertexLit
+// relies on to stand in for the per-pixel shaders at a distance.
+TEST(vertex_lit_matches_per_pixel_lighting_at_vertices)
+{
+	const auto constants = make_constants();
+	const auto vertices = make_vertices(11);
+
+	const uint32_t fog_modes[] = { 0, ShaderFlags_FogExp, ShaderFlags_FogExp2 };
+
+	for (uint32_t base = 0; base < 0b1000000; base++)
+	{
+		for (auto fog_mode : fog_modes)
+		{
+			uint32_t flags = fog_mode;
+			flags |= base & 1 ? ShaderFlags_Texture : 0;
+			flags |= base & 2 ? ShaderFlags_Alpha : 0;
+			flags |= base & 4 ? ShaderFlags_Light : 0;
+			flags |= base & 8 ? ShaderFlags_Specular : 0;
+			flags |= base & 16 ? ShaderFlags_Fog : 0;
+			flags |= base & 32 ? ShaderFlags_MultiLight | ShaderFlags_VertexColor : 0;
+
+			const auto per_pixel = shade(flags, constants, vertices);
+			const auto vertex_lit = shade(flags | ShaderFlags_VertexLit, constants, vertices);
+
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					CHECK_NEAR(per_pixel[i].color[c], vertex_lit[i].color[c], 1e-5);
+				}
+
+				CHECK_EQUAL(per_pixel[i].clipped, vertex_lit[i].clipped);
+			}
+		}
+	}
+}
+
+// Every lane is independent of the others, including in a partial batch.
+TEST(batches_match_single_vertices)
+{
+	const auto constants = make_constants();
+	const auto vertices = make_vertices(7);
+	const uint32_t flags = ShaderFlags_Texture | ShaderFlags_Light | ShaderFlags_Specular | ShaderFlags_Fog
+		| ShaderFlags_MultiLight | ShaderFlags_EnvMap;
+
+	const auto batched = shade(flags, constants, vertices);
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const auto single = shade(flags, constants, { vertices[i] });
+		CHECK(memcmp(single[0].color, batched[i].color, sizeof(single[0].color)) == 0);
+	}
+}
+
+TEST(transform_uses_world_view_and_projection)
+{
+	auto constants = make_constants();
+	set(constants, static_cast<Register>(Register_wvMatrix + 3), 1.0f, 2.0f, 3.0f, 1.0f);
+	set(constants, static_cast<Register>(Register_ProjectionMatrix), 2.0f, 0.0f, 0.0f, 0.0f);
+
+	const Vertex vertex = { { 1.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, {}, {} };
+	Interpolants output;
+	vs_main(ShaderFlags_None, constants, &vertex, &output, 1);
+
+	CHECK_NEAR(output.position[0], 4.0f, 1e-6);
+	CHECK_NEAR(output.position[1], 3.0f, 1e-6);
+	CHECK_NEAR(output.position[2], 4.0f, 1e-6);
+	CHECK_NEAR(output.position[3], 1.0f, 1e-6);
+	CHECK_NEAR(output.fog_dist, 4.0f, 1e-6);
+}
+
+TEST(linear_fog_blends_towards_the_fog_color)
+{
+	const auto constants = make_constants();
+	const float expected[][2] = { { 0.0f, 1.0f }, { 10.0f, 1.0f }, { 60.0f, 0.5f }, { 110.0f, 0.0f }, { 500.0f, 0.0f } };
+
+	for (auto& it : expected)
+	{
+		Pixel pixel {};
+		pixel.input.diffuse[0] = pixel.input.diffuse[1] = pixel.input.diffuse[2] = pixel.input.diffuse[3] = 1.0f;
+		pixel.input.fog_dist = it[0];
+
+		PixelResult result;
+		ps_main(ShaderFlags_Fog, constants, &pixel, &result, 1);
+
+		const float fog = it[1];
+		CHECK_NEAR(result.color[0], fog + (1.0f - fog) * 0.25f, 1e-5);
+		CHECK_NEAR(result.color[1], fog + (1.0f - fog) * 0.5f, 1e-5);
+		CHECK_NEAR(result.color[2], fog + (1.0f - fog) * 0.75f, 1e-5);
+		CHECK_NEAR(result.color[3], 1.0f, 1e-6);
+	}
+}
+
+TEST(fog_table_is_filtered_and_clamped)
+{
+	auto constants = make_constants();
+	const float table[] = { 1.0f, 0.0f };
+	constants.fog_table = table;
+	constants.fog_table_size = 2;
+
+	// Distance 0 to 100 maps to the centers of the first and last entries.
+	set(constants, Register_FogTableScale, 0.5f / 100.0f, 0.25f, 0.0f);
+
+	const float expected[][2] = { { -50.0f, 1.0f }, { 0.0f, 1.0f }, { 50.0f, 0.5f }, { 100.0f, 0.0f }, { 200.0f, 0.0f } };
+
+	for (auto& it : expected)
+	{
+		Pixel pixel {};
+		pixel.input.fog_dist = it[0];
+
+		PixelResult result;
+		ps_main(ShaderFlags_Fog | ShaderFlags_FogTable, constants, &pixel, &result, 1);
+
+		CHECK_NEAR(result.color[0], (1.0f - it[1]) * 0.25f, 1e-5);
+	}
+}
+
+// Fog factors of the formula and of the fog table built for it, at view
+// distances across and beyond the table. Pixels are white against black fog.
+static void check_fog_table(const fog_table::Fog& fog, const float* game_table)
+{
+	auto constants = make_constants();
+
+	float config[4];
+	fog_table::config(fog, config);
+	constants.set(Register_FogConfig, config, sizeof(config));
+	set(constants, Register_FogColor, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	const float distance = fog_table::distance(fog);
+	CHECK(distance > 0.0f);
+
+	float scale[2];
+	fog_table::scale(distance, scale);
+	set(constants, Register_FogTableScale, scale[0], scale[1], 0.0f);
+
+	uint8_t texels[fog_table::SIZE];
+	fog_table::build(fog, game_table, texels);
+
+	float table[fog_table::SIZE];
+	for (uint32_t i = 0; i < fog_table::SIZE; i++)
+	{
+		table[i] = texels[i] / 255.0f;
+	}
+
+	constants.fog_table = table;
+	constants.fog_table_size = fog_table::SIZE;
+
+	uint32_t mode_flags = 0;
+
+	if (fog.mode == fog_table::Mode_Exp)
+	{
+		mode_flags = ShaderFlags_FogExp;
+	}
+	else if (fog.mode == fog_table::Mode_Exp2)
+	{
+		mode_flags = ShaderFlags_FogExp2;
+	}
+
+	for (int i = 0; i <= 60; i++)
+	{
+		Pixel pixel {};
+		pixel.input.diffuse[0] = pixel.input.diffuse[1] = pixel.input.diffuse[2] = pixel.input.diffuse[3] = 1.0f;
+		pixel.input.fog_dist = distance * 1.2f * static_cast<float>(i) / 60.0f;
+
+		PixelResult formula, sampled;
+		ps_main(ShaderFlags_Fog | mode_flags, constants, &pixel, &formula, 1);
+		ps_main(ShaderFlags_Fog | ShaderFlags_FogTable, constants, &pixel, &sampled, 1);
+
+		CHECK_NEAR(formula.color[0], fog_table::visibility(fog, pixel.input.fog_dist), 1e-5);
+		// Rounding to 8 bits and filtering across the start of linear fog.
+		CHECK_NEAR(sampled.color[0], formula.color[0], 2.0f / 255.0f);
+	}
+}
+
+TEST(fog_table_matches_the_fog_formula)
+{
+	check_fog_table({ fog_table::Mode_Linear, 10.0f, 110.0f, 0.0f }, nullptr);
+	check_fog_table({ fog_table::Mode_Linear, 400.0f, 1200.0f, 0.0f }, nullptr);
+	check_fog_table({ fog_table::Mode_Exp, 0.0f, 0.0f, 0.02f }, nullptr);
+	check_fog_table({ fog_table::Mode_Exp2, 0.0f, 0.0f, 0.02f }, nullptr);
+}
+
+// A game table spans the fog range, from the fog start rather than from 0.
+TEST(game_fog_tables_span_the_fog_range)
+{
+	float density[fog_table::SIZE];
+	float visibility[fog_table::SIZE];
+
+	for (uint32_t i = 0; i < fog_table::SIZE; i++)
+	{
+		const float t = static_cast<float>(i) / (fog_table::SIZE - 1);
+		density[i] = t * 255.0f;
+		visibility[i] = 1.0f - t;
+	}
+
+	check_fog_table({ fog_table::Mode_Linear, 400.0f, 1200.0f, 0.0f }, density);
+	check_fog_table({ fog_table::Mode_Linear, 10.0f, 110.0f, 0.0f }, visibility);
+}
+
+// The pp_ pixel shaders against the full precision ones for every
+// combination of the flags ps_main's color math depends on, in both tiers.
+TEST(partial_precision_stays_within_its_error_budget)
+{
+	const auto constants = make_constants();
+	const auto vertices = make_vertices(64);
+	const uint32_t varying[] = { ShaderFlags_Texture, ShaderFlags_Light, ShaderFlags_Specular, ShaderFlags_Fog,
+		ShaderFlags_VertexLit };
+
+	float max_error = 0.0f;
+
+	for (uint32_t combination = 0; combination < 1u << 5; combination++)
+	{
+		uint32_t flags = 0;
+
+		for (uint32_t i = 0; i < 5; i++)
+		{
+			if (combination >> i & 1)
+			{
+				flags |= varying[i];
+			}
+		}
+
+		std::vector<Interpolants> interpolants(vertices.size());
+		vs_main(flags, constants, vertices.data(), interpolants.data(), vertices.size());
+
+		std::vector<Pixel> pixels(vertices.size());
+
+		for (size_t i = 0; i < pixels.size(); i++)
+		{
+			pixels[i].input = interpolants[i];
+
+			for (int c = 0; c < 4; c++)
+			{
+				pixels[i].texel[c] = static_cast<float>((i * 37 + c * 101) % 256) / 255.0f;
+			}
+		}
+
+		std::vector<PixelResult> full(pixels.size()), partial(pixels.size());
+		ps_main(flags, constants, pixels.data(), full.data(), pixels.size());
+		ps_main(flags, constants, pixels.data(), partial.data(), pixels.size(), true);
+
+		for (size_t i = 0; i < pixels.size(); i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				max_error = std::fmax(max_error, std::fabs(partial[i].color[c] - full[i].color[c]));
+			}
+		}
+	}
+
+	CHECK(max_error > 0.0f);
+	CHECK(max_error <= PARTIAL_PRECISION_ERROR);
+}
+
+TEST(alpha_test_discards_below_the_reference)
+{
+	const auto constants = make_constants();
+	const float alphas[] = { 0.0f, ALPHA_REF - 0.001f, ALPHA_REF, 1.0f };
+
+	Pixel pixels[4] {};
+
+	for (int i = 0; i < 4; i++)
+	{
+		pixels[i].input.diffuse[3] = alphas[i];
+	}
+
+	PixelResult results[4];
+
+	ps_main(ShaderFlags_Alpha, constants, pixels, results, 4);
+	CHECK(results[0].clipped);
+	CHECK(results[1].clipped);
+	CHECK(!results[2].clipped);
+	CHECK(!results[3].clipped);
+
+	ps_main(ShaderFlags_None, constants, pixels, results, 4);
+	CHECK(!results[0].clipped);
+}
+
+TEST(register_writes_stop_at_the_last_register)
+{
+	Constants constants;
+	const float values[8] = { 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f };
+
+	constants.set(Register_Count - 1, values, sizeof(values));
+	CHECK_EQUAL(constants.registers[Register_Count - 1][3], 4.0f);
+
+	constants.set(Register_Count, values, sizeof(values));
+	CHECK_EQUAL(constants.registers[Register_Count - 1][0], 1.0f);
+}
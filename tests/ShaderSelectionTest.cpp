@@ -0,0 +1,40 @@
+#include "test.h"
+
+#include "ShaderSelection.h"
+
+using namespace selection;
+
+static uint32_t select(uint32_t flags, LodLevel level)
+{
+	return sanitize(apply_lod(flags, level));
+}
+
+TEST(fog_table_replaces_the_fog_mode)
+{
+	const uint32_t flags = ShaderFlags_Fog | ShaderFlags_FogTable | ShaderFlags_FogExp2;
+	CHECK_EQUAL(sanitize(flags), ShaderFlags_Fog | ShaderFlags_FogTable);
+}
+
+TEST(vertex_lit_fog_falls_back_to_the_fog_mode)
+{
+	const uint32_t flags = ShaderFlags_Light | ShaderFlags_Fog | ShaderFlags_FogTable | ShaderFlags_FogExp2;
+
+	CHECK_EQUAL(select(flags, LodLevel_VertexLit),
+		ShaderFlags_Light | ShaderFlags_Fog | ShaderFlags_FogExp2 | ShaderFlags_VertexLit);
+	CHECK_EQUAL(select(ShaderFlags_Fog | ShaderFlags_FogTable | ShaderFlags_FogExp, LodLevel_VertexLit),
+		ShaderFlags_Fog | ShaderFlags_FogExp | ShaderFlags_VertexLit);
+}
+
+TEST(nearer_levels_keep_the_fog_table)
+{
+	const uint32_t flags = ShaderFlags_Light | ShaderFlags_Specular | ShaderFlags_Fog | ShaderFlags_FogTable
+		| ShaderFlags_FogExp2;
+
+	CHECK_EQUAL(select(flags, LodLevel_Full), flags & ~ShaderFlags_FogExp2);
+	CHECK_EQUAL(select(flags, LodLevel_NoSpecular), ShaderFlags_Light | ShaderFlags_Fog | ShaderFlags_FogTable);
+}
+
+TEST(unlit_draws_without_fog_stay_per_pixel)
+{
+	CHECK_EQUAL(select(ShaderFlags_Texture, LodLevel_VertexLit), ShaderFlags_Texture);
+}
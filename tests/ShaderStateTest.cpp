@@ -0,0 +1,294 @@
+#include "test.h"
+
+#include <unordered_map>
+
+#include "CountingDevice.h"
+#include "metrics.h"
+#include "ShaderSelection.h"
+#include "ShaderState.h"
+
+constexpr Uint32 LIT = ShaderFlags_Texture | ShaderFlags_Light | ShaderFlags_Fog;
+constexpr Uint32 FOG_TABLE = LIT | ShaderFlags_FogTable;
+
+// Placeholder shaders, one per flags.
+class Shaders : public ShaderState::IShaderSource
+{
+public:
+	explicit Shaders(IDirect3DDevice9* device) : device(device)
+	{
+	}
+
+	VertexShader vertex_shader(Uint32 flags) override
+	{
+		auto& shader = vertex_shaders[flags & ~ShaderFlags_FogTable];
+
+		if (shader == nullptr)
+		{
+			device->CreateVertexShader(nullptr, &shader);
+		}
+
+		return shader;
+	}
+
+	PixelShader pixel_shader(Uint32 flags) override
+	{
+		auto& shader = pixel_shaders[flags];
+
+		if (shader == nullptr)
+		{
+			device->CreatePixelShader(nullptr, &shader);
+		}
+
+		return shader;
+	}
+
+	void flush() override
+	{
+		++flushes;
+	}
+
+	unsigned int flushes = 0;
+
+private:
+	IDirect3DDevice9* device;
+	std::unordered_map<Uint32, VertexShader> vertex_shaders;
+	std::unordered_map<Uint32, PixelShader> pixel_shaders;
+};
+
+struct Fixture
+{
+	CountingDevice device;
+	Shaders shaders { &device };
+	FrameCounters counters {};
+	ShaderState state { shaders, counters };
+
+	Fixture(bool uber_shader, bool state_blocks)
+	{
+		state.device = &device;
+		state.uber_shader = uber_shader;
+		state.state_blocks = state_blocks;
+
+		device.state.sampler_states[1][D3DSAMP_MINFILTER] = D3DTEXF_POINT;
+		device.state.sampler_states[1][D3DSAMP_MAGFILTER] = D3DTEXF_POINT;
+		device.state.sampler_states[1][D3DSAMP_ADDRESSU] = D3DTADDRESS_WRAP;
+	}
+
+	~Fixture()
+	{
+		state.release();
+	}
+
+	void draw(Uint32 flags)
+	{
+		state.start(flags);
+		device.DrawPrimitive(D3DPT_TRIANGLELIST, 0, 1);
+		state.end();
+	}
+
+	bool bools_match(Uint32 flags) const
+	{
+		for (Uint32 i = 0; i < ShaderState::BOOL_REGISTER_COUNT; i++)
+		{
+			const BOOL expected = (flags >> i) & 1;
+
+			if (device.state.vertex_bools[i] != expected || device.state.pixel_bools[i] != expected)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool fog_sampler_set() const
+	{
+		return device.state.sampler_states[1][D3DSAMP_MINFILTER] == D3DTEXF_LINEAR
+			&& device.state.sampler_states[1][D3DSAMP_MAGFILTER] == D3DTEXF_LINEAR
+			&& device.state.sampler_states[1][D3DSAMP_ADDRESSU] == D3DTADDRESS_CLAMP;
+	}
+
+	bool game_sampler_restored() const
+	{
+		return device.state.sampler_states[1][D3DSAMP_MINFILTER] == D3DTEXF_POINT
+			&& device.state.sampler_states[1][D3DSAMP_MAGFILTER] == D3DTEXF_POINT
+			&& device.state.sampler_states[1][D3DSAMP_ADDRESSU] == D3DTADDRESS_WRAP;
+	}
+};
+
+TEST(start_binds_the_permutation_and_end_unbinds_it)
+{
+	for (int blocks = 0; blocks < 2; blocks++)
+	{
+		Fixture f(false, blocks != 0);
+
+		f.state.start(FOG_TABLE);
+		CHECK(f.device.state.vertex_shader == f.shaders.vertex_shader(FOG_TABLE));
+		CHECK(f.device.state.pixel_shader == f.shaders.pixel_shader(FOG_TABLE));
+		CHECK(f.fog_sampler_set());
+		CHECK(f.state.active());
+
+		f.state.end();
+		CHECK(f.device.state.vertex_shader == nullptr);
+		CHECK(f.device.state.pixel_shader == nullptr);
+		CHECK(f.game_sampler_restored());
+		CHECK(!f.state.active());
+	}
+}
+
+TEST(state_blocks_leave_the_shaders_alone)
+{
+	Fixture f(false, true);
+
+	f.draw(FOG_TABLE);
+	f.draw(FOG_TABLE);
+
+	CHECK_EQUAL(f.counters.state_block_builds, 1u);
+	CHECK_EQUAL(f.device.counts.state_block_applies, 2u);
+	CHECK_EQUAL(f.device.counts.applied_states, 6u);
+	// One bind and one unbind of each per draw.
+	CHECK_EQUAL(f.device.counts.vertex_shaders, 4u);
+	CHECK_EQUAL(f.device.counts.pixel_shaders, 4u);
+}
+
+TEST(state_blocks_are_shared_by_permutations_with_the_same_states)
+{
+	Fixture f(false, true);
+
+	f.draw(FOG_TABLE);
+	f.draw(FOG_TABLE | ShaderFlags_Specular);
+	f.draw(LIT);
+
+	CHECK_EQUAL(f.counters.state_block_builds, 1u);
+	CHECK(f.game_sampler_restored());
+}
+
+TEST(uber_state_blocks_apply_only_when_the_constants_change)
+{
+	Fixture f(true, true);
+
+	f.draw(LIT);
+	CHECK(f.bools_match(LIT));
+
+	f.draw(LIT);
+	f.draw(LIT | ShaderFlags_Specular);
+	CHECK(f.bools_match(LIT | ShaderFlags_Specular));
+
+	f.draw(LIT | ShaderFlags_Specular);
+	f.draw(LIT);
+	CHECK(f.bools_match(LIT));
+
+	CHECK_EQUAL(f.counters.state_block_builds, 2u);
+	CHECK_EQUAL(f.device.counts.state_block_applies, 3u);
+	CHECK_EQUAL(f.shaders.flushes, 2u + 3u);
+}
+
+// Device calls for a scene that switches between permutations every draw,
+// as a fraction of the calls made without state blocks.
+static double calls_with_state_blocks(bool uber_shader, const Uint32* flags, size_t count)
+{
+	uint64_t calls[2] {};
+
+	for (int blocks = 0; blocks < 2; blocks++)
+	{
+		Fixture f(uber_shader, blocks != 0);
+
+		for (int frame = 0; frame < 10; frame++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				f.draw(flags[i]);
+			}
+		}
+
+		calls[blocks] = f.device.counts.calls;
+	}
+
+	return static_cast<double>(calls[1]) / static_cast<double>(calls[0]);
+}
+
+TEST(state_blocks_save_calls_only_where_they_hold_states)
+{
+	const Uint32 uber[] = { LIT, LIT | ShaderFlags_Specular, FOG_TABLE, LIT | ShaderFlags_Alpha };
+	const Uint32 separate[] = { LIT, LIT | ShaderFlags_Specular, LIT | ShaderFlags_Alpha };
+	const Uint32 fog_table[] = { FOG_TABLE, FOG_TABLE | ShaderFlags_Specular, LIT };
+
+	CHECK(calls_with_state_blocks(true, uber, 4) < 0.95);
+	CHECK(calls_with_state_blocks(false, fog_table, 3) < 0.95);
+	// Separate shaders without the fog table have no states to put in a block.
+	CHECK_EQUAL(calls_with_state_blocks(false, separate, 3), 1.0);
+}
+
+TEST(uber_constants_are_set_once_without_state_blocks)
+{
+	Fixture f(true, false);
+
+	f.draw(LIT);
+	f.draw(LIT);
+	f.draw(LIT);
+
+	CHECK(f.bools_match(LIT));
+	CHECK_EQUAL(f.device.counts.bool_constants, 2u);
+}
+
+TEST(fog_table_states_are_reapplied_after_end)
+{
+	Fixture f(true, true);
+
+	f.draw(FOG_TABLE);
+	CHECK(f.game_sampler_restored());
+
+	f.state.start(FOG_TABLE);
+	CHECK(f.fog_sampler_set());
+	CHECK(f.bools_match(FOG_TABLE));
+	f.state.end();
+
+	CHECK_EQUAL(f.device.counts.state_block_applies, 2u);
+}
+
+TEST(unchanged_shaders_are_not_rebound_while_active)
+{
+	Fixture f(false, false);
+
+	// Same vertex shader, different pixel shaders.
+	f.state.start(LIT);
+	f.state.start(FOG_TABLE);
+
+	CHECK_EQUAL(f.device.counts.vertex_shaders, 1u);
+	CHECK_EQUAL(f.device.counts.pixel_shaders, 2u);
+	f.state.end();
+}
+
+TEST(depth_shaders_are_replaced_by_the_permutation)
+{
+	Fixture f(false, false);
+	IDirect3DVertexShader9* depth = nullptr;
+	f.device.CreateVertexShader(nullptr, &depth);
+
+	f.draw(LIT);
+	f.state.start(depth, nullptr);
+	CHECK(f.device.state.vertex_shader == depth);
+	f.state.start(LIT);
+	CHECK(f.device.state.vertex_shader == f.shaders.vertex_shader(LIT));
+	CHECK(f.device.state.pixel_shader == f.shaders.pixel_shader(LIT));
+	f.state.end();
+
+	depth->Release();
+}
+
+TEST(release_forgets_the_blocks_but_rebuilds_them)
+{
+	Fixture f(true, true);
+
+	f.draw(LIT);
+	f.draw(FOG_TABLE);
+	CHECK_EQUAL(f.counters.state_block_builds, 2u);
+
+	f.state.release();
+	f.state.reset(LIT);
+	f.state.rebuild_state_blocks();
+	CHECK_EQUAL(f.counters.state_block_builds, 4u);
+
+	f.draw(LIT);
+	CHECK(f.bools_match(LIT));
+	CHECK_EQUAL(f.counters.state_block_builds, 4u);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Stand-in for ATL's CComPtr; see d3d9.h.
+
+template <typename T>
+class CComPtr
+{
+public:
+	T* p = nullptr;
+
+	CComPtr() = default;
+
+	CComPtr(decltype(nullptr))
+	{
+	}
+
+	CComPtr(T* value) : p(value)
+	{
+		if (p)
+		{
+			p->AddRef();
+		}
+	}
+
+	CComPtr(const CComPtr& other) : CComPtr(other.p)
+	{
+	}
+
+	~CComPtr()
+	{
+		Release();
+	}
+
+	CComPtr& operator=(T* value)
+	{
+		if (value != p)
+		{
+			if (value)
+			{
+				value->AddRef();
+			}
+
+			Release();
+			p = value;
+		}
+
+		return *this;
+	}
+
+	CComPtr& operator=(const CComPtr& other)
+	{
+		return *this = other.p;
+	}
+
+	void Release()
+	{
+		T* temp = p;
+
+		if (temp)
+		{
+			p = nullptr;
+			temp->Release();
+		}
+	}
+
+	void Attach(T* value)
+	{
+		Release();
+		p = value;
+	}
+
+	T* Detach()
+	{
+		T* temp = p;
+		p = nullptr;
+		return temp;
+	}
+
+	operator T*() const { return p; }
+	T* operator->() const { return p; }
+	T** operator&() { return &p; }
+
+	bool operator==(T* value) const { return p == value; }
+	bool operator!=(T* value) const { return p != value; }
+	bool operator!() const { return p == nullptr; }
+};
@@ -0,0 +1,513 @@
+#pragma once
+
+// Stand-in for the parts of the Windows and Direct3D 9 headers the mod's
+// game-independent sources use, so they build and can be tested on any
+// platform. Interfaces have the same methods in the same order as the SDK's;
+// enums only have the values something here uses, with the SDK's values.
+// Only used when the real headers aren't available.
+
+#include <cstdint>
+#include <cstring>
+
+typedef uint8_t  BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t UINT;
+typedef int32_t  INT;
+typedef int32_t  BOOL;
+typedef int32_t  LONG;
+typedef uint32_t ULONG;
+typedef int32_t  HRESULT;
+typedef float    FLOAT;
+typedef void*    HANDLE;
+typedef void*    HWND;
+typedef DWORD    D3DCOLOR;
+
+#define CONST const
+#define TRUE  1
+#define FALSE 0
+
+#define STDMETHODCALLTYPE
+#ifndef __stdcall
+#define __stdcall
+#endif
+
+#define SUCCEEDED(hr) (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr)    (static_cast<HRESULT>(hr) < 0)
+
+#define S_OK          static_cast<HRESULT>(0)
+#define S_FALSE       static_cast<HRESULT>(1)
+#define E_NOTIMPL     static_cast<HRESULT>(0x80004001)
+#define E_NOINTERFACE static_cast<HRESULT>(0x80004002)
+#define E_POINTER     static_cast<HRESULT>(0x80004003)
+#define E_FAIL        static_cast<HRESULT>(0x80004005)
+#define E_OUTOFMEMORY static_cast<HRESULT>(0x8007000E)
+
+#define D3D_OK              S_OK
+#define D3DERR_INVALIDCALL  static_cast<HRESULT>(0x8876086C)
+#define D3DERR_NOTAVAILABLE static_cast<HRESULT>(0x8876086A)
+
+struct GUID
+{
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t  Data4[8];
+};
+
+typedef GUID IID;
+typedef const IID& REFIID;
+typedef const GUID& REFGUID;
+
+inline bool operator==(const GUID& a, const GUID& b)
+{
+	return !memcmp(&a, &b, sizeof(GUID));
+}
+
+inline bool operator!=(const GUID& a, const GUID& b)
+{
+	return !(a == b);
+}
+
+#define __uuidof(T) IID_##T
+
+constexpr IID IID_IUnknown             = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+constexpr IID IID_IDirect3DDevice9     = { 0xD0223B96, 0xBF7A, 0x43FD, { 0x92, 0xBD, 0xA4, 0x3B, 0x0D, 0x82, 0xB9, 0xEB } };
+constexpr IID IID_IDirect3DTexture9    = { 0x85C31227, 0x3DE5, 0x4F00, { 0x9B, 0x3A, 0xF1, 0x1A, 0xC3, 0x8C, 0x18, 0xB5 } };
+constexpr IID IID_IDirect3DStateBlock9 = { 0xB07C4FE5, 0x310D, 0x4BA8, { 0xA2, 0x3C, 0x4F, 0x0F, 0x20, 0x6F, 0x21, 0x8B } };
+
+struct RECT
+{
+	LONG left, top, right, bottom;
+};
+
+struct POINT
+{
+	LONG x, y;
+};
+
+struct RGNDATA;
+struct PALETTEENTRY;
+
+enum D3DRENDERSTATETYPE
+{
+	D3DRS_ZENABLE          = 7,
+	D3DRS_FILLMODE         = 8,
+	D3DRS_ZWRITEENABLE     = 14,
+	D3DRS_ALPHATESTENABLE  = 15,
+	D3DRS_SRCBLEND         = 19,
+	D3DRS_DESTBLEND        = 20,
+	D3DRS_CULLMODE         = 22,
+	D3DRS_ZFUNC            = 23,
+	D3DRS_ALPHAREF         = 24,
+	D3DRS_ALPHAFUNC        = 25,
+	D3DRS_ALPHABLENDENABLE = 27,
+	D3DRS_FOGENABLE        = 28,
+	D3DRS_SPECULARENABLE   = 29,
+	D3DRS_FOGCOLOR         = 34,
+	D3DRS_FOGTABLEMODE     = 35,
+	D3DRS_LIGHTING         = 137,
+	D3DRS_AMBIENT          = 139,
+	D3DRS_FOGVERTEXMODE    = 140,
+	D3DRS_COLORWRITEENABLE = 168,
+	D3DRS_BLENDOPALPHA     = 209,
+};
+
+enum D3DSAMPLERSTATETYPE
+{
+	D3DSAMP_ADDRESSU      = 1,
+	D3DSAMP_ADDRESSV      = 2,
+	D3DSAMP_ADDRESSW      = 3,
+	D3DSAMP_BORDERCOLOR   = 4,
+	D3DSAMP_MAGFILTER     = 5,
+	D3DSAMP_MINFILTER     = 6,
+	D3DSAMP_MIPFILTER     = 7,
+	D3DSAMP_MIPMAPLODBIAS = 8,
+	D3DSAMP_MAXMIPLEVEL   = 9,
+	D3DSAMP_MAXANISOTROPY = 10,
+	D3DSAMP_SRGBTEXTURE   = 11,
+	D3DSAMP_ELEMENTINDEX  = 12,
+	D3DSAMP_DMAPOFFSET    = 13,
+};
+
+enum D3DTEXTUREFILTERTYPE
+{
+	D3DTEXF_NONE   = 0,
+	D3DTEXF_POINT  = 1,
+	D3DTEXF_LINEAR = 2,
+};
+
+enum D3DTEXTUREADDRESS
+{
+	D3DTADDRESS_WRAP   = 1,
+	D3DTADDRESS_MIRROR = 2,
+	D3DTADDRESS_CLAMP  = 3,
+};
+
+enum D3DCMPFUNC
+{
+	D3DCMP_NEVER        = 1,
+	D3DCMP_LESS         = 2,
+	D3DCMP_EQUAL        = 3,
+	D3DCMP_LESSEQUAL    = 4,
+	D3DCMP_GREATER      = 5,
+	D3DCMP_NOTEQUAL     = 6,
+	D3DCMP_GREATEREQUAL = 7,
+	D3DCMP_ALWAYS       = 8,
+};
+
+enum D3DZBUFFERTYPE
+{
+	D3DZB_FALSE = 0,
+	D3DZB_TRUE  = 1,
+};
+
+enum D3DPRIMITIVETYPE
+{
+	D3DPT_POINTLIST     = 1,
+	D3DPT_LINELIST      = 2,
+	D3DPT_LINESTRIP     = 3,
+	D3DPT_TRIANGLELIST  = 4,
+	D3DPT_TRIANGLESTRIP = 5,
+	D3DPT_TRIANGLEFAN   = 6,
+};
+
+enum D3DFORMAT
+{
+	D3DFMT_UNKNOWN  = 0,
+	D3DFMT_A8R8G8B8 = 21,
+	D3DFMT_A8       = 28,
+	D3DFMT_L8       = 50,
+	D3DFMT_INDEX16  = 101,
+	D3DFMT_INDEX32  = 102,
+};
+
+enum D3DPOOL
+{
+	D3DPOOL_DEFAULT   = 0,
+	D3DPOOL_MANAGED   = 1,
+	D3DPOOL_SYSTEMMEM = 2,
+	D3DPOOL_SCRATCH   = 3,
+};
+
+enum D3DRESOURCETYPE
+{
+	D3DRTYPE_SURFACE = 1,
+	D3DRTYPE_TEXTURE = 3,
+};
+
+enum D3DSTATEBLOCKTYPE
+{
+	D3DSBT_ALL         = 1,
+	D3DSBT_PIXELSTATE  = 2,
+	D3DSBT_VERTEXSTATE = 3,
+};
+
+enum D3DTRANSFORMSTATETYPE
+{
+	D3DTS_VIEW       = 2,
+	D3DTS_PROJECTION = 3,
+	D3DTS_TEXTURE0   = 16,
+};
+
+#define D3DTS_WORLD static_cast<D3DTRANSFORMSTATETYPE>(256)
+
+enum D3DTEXTURESTAGESTATETYPE
+{
+	D3DTSS_COLOROP = 1,
+};
+
+enum D3DBACKBUFFER_TYPE
+{
+	D3DBACKBUFFER_TYPE_MONO = 0,
+};
+
+enum D3DMULTISAMPLE_TYPE
+{
+	D3DMULTISAMPLE_NONE = 0,
+};
+
+enum D3DQUERYTYPE
+{
+	D3DQUERYTYPE_OCCLUSION         = 9,
+	D3DQUERYTYPE_TIMESTAMP         = 10,
+	D3DQUERYTYPE_TIMESTAMPDISJOINT = 11,
+	D3DQUERYTYPE_TIMESTAMPFREQ     = 12,
+};
+
+#define D3DFVF_XYZ     0x002
+#define D3DFVF_NORMAL  0x010
+#define D3DFVF_DIFFUSE 0x040
+#define D3DFVF_TEX1    0x100
+
+#define D3DLOCK_READONLY    0x00000010L
+#define D3DLOCK_DISCARD     0x00002000L
+#define D3DLOCK_NOOVERWRITE 0x00001000L
+
+#define D3DUSAGE_WRITEONLY 0x00000008L
+#define D3DUSAGE_DYNAMIC   0x00000200L
+
+#define D3DDMAPSAMPLER            256
+#define D3DVERTEXTEXTURESAMPLER0 (D3DDMAPSAMPLER + 1)
+#define D3DVERTEXTEXTURESAMPLER1 (D3DDMAPSAMPLER + 2)
+#define D3DVERTEXTEXTURESAMPLER2 (D3DDMAPSAMPLER + 3)
+#define D3DVERTEXTEXTURESAMPLER3 (D3DDMAPSAMPLER + 4)
+
+struct D3DVECTOR
+{
+	float x, y, z;
+};
+
+struct D3DCOLORVALUE
+{
+	float r, g, b, a;
+};
+
+struct D3DMATRIX
+{
+	union
+	{
+		struct
+		{
+			float _11, _12, _13, _14;
+			float _21, _22, _23, _24;
+			float _31, _32, _33, _34;
+			float _41, _42, _43, _44;
+		};
+
+		float m[4][4];
+	};
+};
+
+struct D3DMATERIAL9
+{
+	D3DCOLORVALUE Diffuse;
+	D3DCOLORVALUE Ambient;
+	D3DCOLORVALUE Specular;
+	D3DCOLORVALUE Emissive;
+	float         Power;
+};
+
+struct D3DLOCKED_RECT
+{
+	INT   Pitch;
+	void* pBits;
+};
+
+struct D3DSURFACE_DESC;
+struct D3DCAPS9;
+struct D3DDISPLAYMODE;
+struct D3DDEVICE_CREATION_PARAMETERS;
+struct D3DPRESENT_PARAMETERS;
+struct D3DRASTER_STATUS;
+struct D3DGAMMARAMP;
+struct D3DRECT;
+struct D3DVIEWPORT9;
+struct D3DLIGHT9;
+struct D3DCLIPSTATUS9;
+struct D3DVERTEXELEMENT9;
+struct D3DRECTPATCH_INFO;
+struct D3DTRIPATCH_INFO;
+
+struct IDirect3D9;
+struct IDirect3DDevice9;
+struct IDirect3DSurface9;
+struct IDirect3DSwapChain9;
+struct IDirect3DVolumeTexture9;
+struct IDirect3DCubeTexture9;
+
+struct IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObj) = 0;
+	virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+	virtual ULONG STDMETHODCALLTYPE Release() = 0;
+};
+
+struct IDirect3DResource9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID refguid, CONST void* pData, DWORD SizeOfData, DWORD Flags) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID refguid, void* pData, DWORD* pSizeOfData) = 0;
+	virtual HRESULT STDMETHODCALLTYPE FreePrivateData(REFGUID refguid) = 0;
+	virtual DWORD STDMETHODCALLTYPE SetPriority(DWORD PriorityNew) = 0;
+	virtual DWORD STDMETHODCALLTYPE GetPriority() = 0;
+	virtual void STDMETHODCALLTYPE PreLoad() = 0;
+	virtual D3DRESOURCETYPE STDMETHODCALLTYPE GetType() = 0;
+};
+
+struct IDirect3DBaseTexture9 : IDirect3DResource9
+{
+	virtual DWORD STDMETHODCALLTYPE SetLOD(DWORD LODNew) = 0;
+	virtual DWORD STDMETHODCALLTYPE GetLOD() = 0;
+	virtual DWORD STDMETHODCALLTYPE GetLevelCount() = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetAutoGenFilterType(D3DTEXTUREFILTERTYPE FilterType) = 0;
+	virtual D3DTEXTUREFILTERTYPE STDMETHODCALLTYPE GetAutoGenFilterType() = 0;
+	virtual void STDMETHODCALLTYPE GenerateMipSubLevels() = 0;
+};
+
+struct IDirect3DTexture9 : IDirect3DBaseTexture9
+{
+	virtual HRESULT STDMETHODCALLTYPE GetLevelDesc(UINT Level, D3DSURFACE_DESC* pDesc) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetSurfaceLevel(UINT Level, IDirect3DSurface9** ppSurfaceLevel) = 0;
+	virtual HRESULT STDMETHODCALLTYPE LockRect(UINT Level, D3DLOCKED_RECT* pLockedRect, CONST RECT* pRect, DWORD Flags) = 0;
+	virtual HRESULT STDMETHODCALLTYPE UnlockRect(UINT Level) = 0;
+	virtual HRESULT STDMETHODCALLTYPE AddDirtyRect(CONST RECT* pDirtyRect) = 0;
+};
+
+// Buffers and queries are only passed around here, so their own methods are left out.
+struct IDirect3DVertexBuffer9 : IDirect3DResource9
+{
+};
+
+struct IDirect3DIndexBuffer9 : IDirect3DResource9
+{
+};
+
+struct IDirect3DQuery9 : IUnknown
+{
+};
+
+struct IDirect3DVertexDeclaration9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDeclaration(D3DVERTEXELEMENT9* pElement, UINT* pNumElements) = 0;
+};
+
+struct IDirect3DVertexShader9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetFunction(void* pData, UINT* pSizeOfData) = 0;
+};
+
+struct IDirect3DPixelShader9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetFunction(void* pData, UINT* pSizeOfData) = 0;
+};
+
+struct IDirect3DStateBlock9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetDevice(IDirect3DDevice9** ppDevice) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Capture() = 0;
+	virtual HRESULT STDMETHODCALLTYPE Apply() = 0;
+};
+
+struct IDirect3DDevice9 : IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE TestCooperativeLevel() = 0;
+	virtual UINT STDMETHODCALLTYPE GetAvailableTextureMem() = 0;
+	virtual HRESULT STDMETHODCALLTYPE EvictManagedResources() = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDirect3D(IDirect3D9** ppD3D9) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDeviceCaps(D3DCAPS9* pCaps) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDisplayMode(UINT iSwapChain, D3DDISPLAYMODE* pMode) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetCreationParameters(D3DDEVICE_CREATION_PARAMETERS* pParameters) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetCursorProperties(UINT XHotSpot, UINT YHotSpot, IDirect3DSurface9* pCursorBitmap) = 0;
+	virtual void STDMETHODCALLTYPE SetCursorPosition(int X, int Y, DWORD Flags) = 0;
+	virtual BOOL STDMETHODCALLTYPE ShowCursor(BOOL bShow) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateAdditionalSwapChain(D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DSwapChain9** pSwapChain) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetSwapChain(UINT iSwapChain, IDirect3DSwapChain9** pSwapChain) = 0;
+	virtual UINT STDMETHODCALLTYPE GetNumberOfSwapChains() = 0;
+	virtual HRESULT STDMETHODCALLTYPE Reset(D3DPRESENT_PARAMETERS* pPresentationParameters) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Present(CONST RECT* pSourceRect, CONST RECT* pDestRect, HWND hDestWindowOverride, CONST RGNDATA* pDirtyRegion) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetBackBuffer(UINT iSwapChain, UINT iBackBuffer, D3DBACKBUFFER_TYPE Type, IDirect3DSurface9** ppBackBuffer) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetRasterStatus(UINT iSwapChain, D3DRASTER_STATUS* pRasterStatus) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetDialogBoxMode(BOOL bEnableDialogs) = 0;
+	virtual void STDMETHODCALLTYPE SetGammaRamp(UINT iSwapChain, DWORD Flags, CONST D3DGAMMARAMP* pRamp) = 0;
+	virtual void STDMETHODCALLTYPE GetGammaRamp(UINT iSwapChain, D3DGAMMARAMP* pRamp) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateTexture(UINT Width, UINT Height, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DTexture9** ppTexture, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateVolumeTexture(UINT Width, UINT Height, UINT Depth, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DVolumeTexture9** ppVolumeTexture, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateCubeTexture(UINT EdgeLength, UINT Levels, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DCubeTexture9** ppCubeTexture, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateVertexBuffer(UINT Length, DWORD Usage, DWORD FVF, D3DPOOL Pool, IDirect3DVertexBuffer9** ppVertexBuffer, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateIndexBuffer(UINT Length, DWORD Usage, D3DFORMAT Format, D3DPOOL Pool, IDirect3DIndexBuffer9** ppIndexBuffer, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateRenderTarget(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample, DWORD MultisampleQuality, BOOL Lockable, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateDepthStencilSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DMULTISAMPLE_TYPE MultiSample, DWORD MultisampleQuality, BOOL Discard, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE UpdateSurface(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect, IDirect3DSurface9* pDestinationSurface, CONST POINT* pDestPoint) = 0;
+	virtual HRESULT STDMETHODCALLTYPE UpdateTexture(IDirect3DBaseTexture9* pSourceTexture, IDirect3DBaseTexture9* pDestinationTexture) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetRenderTargetData(IDirect3DSurface9* pRenderTarget, IDirect3DSurface9* pDestSurface) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetFrontBufferData(UINT iSwapChain, IDirect3DSurface9* pDestSurface) = 0;
+	virtual HRESULT STDMETHODCALLTYPE StretchRect(IDirect3DSurface9* pSourceSurface, CONST RECT* pSourceRect, IDirect3DSurface9* pDestSurface, CONST RECT* pDestRect, D3DTEXTUREFILTERTYPE Filter) = 0;
+	virtual HRESULT STDMETHODCALLTYPE ColorFill(IDirect3DSurface9* pSurface, CONST RECT* pRect, D3DCOLOR color) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateOffscreenPlainSurface(UINT Width, UINT Height, D3DFORMAT Format, D3DPOOL Pool, IDirect3DSurface9** ppSurface, HANDLE* pSharedHandle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9** ppRenderTarget) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetDepthStencilSurface(IDirect3DSurface9* pNewZStencil) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetDepthStencilSurface(IDirect3DSurface9** ppZStencilSurface) = 0;
+	virtual HRESULT STDMETHODCALLTYPE BeginScene() = 0;
+	virtual HRESULT STDMETHODCALLTYPE EndScene() = 0;
+	virtual HRESULT STDMETHODCALLTYPE Clear(DWORD Count, CONST D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetTransform(D3DTRANSFORMSTATETYPE State, D3DMATRIX* pMatrix) = 0;
+	virtual HRESULT STDMETHODCALLTYPE MultiplyTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetViewport(CONST D3DVIEWPORT9* pViewport) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetViewport(D3DVIEWPORT9* pViewport) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetMaterial(CONST D3DMATERIAL9* pMaterial) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetMaterial(D3DMATERIAL9* pMaterial) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetLight(DWORD Index, CONST D3DLIGHT9* pLight) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetLight(DWORD Index, D3DLIGHT9* pLight) = 0;
+	virtual HRESULT STDMETHODCALLTYPE LightEnable(DWORD Index, BOOL Enable) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetLightEnable(DWORD Index, BOOL* pEnable) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetClipPlane(DWORD Index, CONST float* pPlane) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetClipPlane(DWORD Index, float* pPlane) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetRenderState(D3DRENDERSTATETYPE State, DWORD Value) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetRenderState(D3DRENDERSTATETYPE State, DWORD* pValue) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateStateBlock(D3DSTATEBLOCKTYPE Type, IDirect3DStateBlock9** ppSB) = 0;
+	virtual HRESULT STDMETHODCALLTYPE BeginStateBlock() = 0;
+	virtual HRESULT STDMETHODCALLTYPE EndStateBlock(IDirect3DStateBlock9** ppSB) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetClipStatus(CONST D3DCLIPSTATUS9* pClipStatus) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetClipStatus(D3DCLIPSTATUS9* pClipStatus) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetTexture(DWORD Stage, IDirect3DBaseTexture9** ppTexture) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD* pValue) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetTextureStageState(DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD* pValue) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetSamplerState(DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value) = 0;
+	virtual HRESULT STDMETHODCALLTYPE ValidateDevice(DWORD* pNumPasses) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY* pEntries) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY* pEntries) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetCurrentTexturePalette(UINT PaletteNumber) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetCurrentTexturePalette(UINT* PaletteNumber) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetScissorRect(CONST RECT* pRect) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetScissorRect(RECT* pRect) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetSoftwareVertexProcessing(BOOL bSoftware) = 0;
+	virtual BOOL STDMETHODCALLTYPE GetSoftwareVertexProcessing() = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetNPatchMode(float nSegments) = 0;
+	virtual float STDMETHODCALLTYPE GetNPatchMode() = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex, UINT NumVertices, UINT startIndex, UINT primCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices, UINT PrimitiveCount, CONST void* pIndexData, D3DFORMAT IndexDataFormat, CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride) = 0;
+	virtual HRESULT STDMETHODCALLTYPE ProcessVertices(UINT SrcStartIndex, UINT DestIndex, UINT VertexCount, IDirect3DVertexBuffer9* pDestBuffer, IDirect3DVertexDeclaration9* pVertexDecl, DWORD Flags) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateVertexDeclaration(CONST D3DVERTEXELEMENT9* pVertexElements, IDirect3DVertexDeclaration9** ppDecl) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetVertexDeclaration(IDirect3DVertexDeclaration9* pDecl) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetVertexDeclaration(IDirect3DVertexDeclaration9** ppDecl) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetFVF(DWORD FVF) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetFVF(DWORD* pFVF) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateVertexShader(CONST DWORD* pFunction, IDirect3DVertexShader9** ppShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetVertexShader(IDirect3DVertexShader9* pShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetVertexShader(IDirect3DVertexShader9** ppShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetVertexShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetVertexShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetVertexShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetVertexShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetVertexShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetVertexShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9** ppStreamData, UINT* pOffsetInBytes, UINT* pStride) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetStreamSourceFreq(UINT StreamNumber, UINT Setting) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetIndices(IDirect3DIndexBuffer9* pIndexData) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetIndices(IDirect3DIndexBuffer9** ppIndexData) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreatePixelShader(CONST DWORD* pFunction, IDirect3DPixelShader9** ppShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPixelShader(IDirect3DPixelShader9* pShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPixelShader(IDirect3DPixelShader9** ppShader) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPixelShaderConstantF(UINT StartRegister, CONST float* pConstantData, UINT Vector4fCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPixelShaderConstantF(UINT StartRegister, float* pConstantData, UINT Vector4fCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPixelShaderConstantI(UINT StartRegister, CONST int* pConstantData, UINT Vector4iCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPixelShaderConstantI(UINT StartRegister, int* pConstantData, UINT Vector4iCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE SetPixelShaderConstantB(UINT StartRegister, CONST BOOL* pConstantData, UINT BoolCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetPixelShaderConstantB(UINT StartRegister, BOOL* pConstantData, UINT BoolCount) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawRectPatch(UINT Handle, CONST float* pNumSegs, CONST D3DRECTPATCH_INFO* pRectPatchInfo) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DrawTriPatch(UINT Handle, CONST float* pNumSegs, CONST D3DTRIPATCH_INFO* pTriPatchInfo) = 0;
+	virtual HRESULT STDMETHODCALLTYPE DeletePatch(UINT Handle) = 0;
+	virtual HRESULT STDMETHODCALLTYPE CreateQuery(D3DQUERYTYPE Type, IDirect3DQuery9** ppQuery) = 0;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// Stand-in for the D3DX effect header; see d3d9.h.
+
+#include "d3d9.h"
+#include "d3dx9math.h"
+
+struct ID3DXBuffer : IUnknown
+{
+	virtual void* STDMETHODCALLTYPE GetBufferPointer() = 0;
+	virtual DWORD STDMETHODCALLTYPE GetBufferSize() = 0;
+};
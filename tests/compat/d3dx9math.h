@@ -0,0 +1,65 @@
+#pragma once
+
+// Stand-in for the D3DX math types; see d3d9.h.
+
+#include "d3d9.h"
+
+struct D3DXVECTOR2
+{
+	float x, y;
+
+	D3DXVECTOR2() = default;
+	D3DXVECTOR2(float x, float y) : x(x), y(y) {}
+
+	bool operator==(const D3DXVECTOR2& v) const { return x == v.x && y == v.y; }
+	bool operator!=(const D3DXVECTOR2& v) const { return !(*this == v); }
+};
+
+struct D3DXVECTOR3 : D3DVECTOR
+{
+	D3DXVECTOR3() = default;
+	D3DXVECTOR3(float x, float y, float z) : D3DVECTOR { x, y, z } {}
+
+	bool operator==(const D3DXVECTOR3& v) const { return x == v.x && y == v.y && z == v.z; }
+	bool operator!=(const D3DXVECTOR3& v) const { return !(*this == v); }
+};
+
+struct D3DXVECTOR4
+{
+	float x, y, z, w;
+
+	D3DXVECTOR4() = default;
+	D3DXVECTOR4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+	operator float*() { return &x; }
+	operator const float*() const { return &x; }
+
+	bool operator==(const D3DXVECTOR4& v) const { return x == v.x && y == v.y && z == v.z && w == v.w; }
+	bool operator!=(const D3DXVECTOR4& v) const { return !(*this == v); }
+};
+
+struct D3DXCOLOR
+{
+	float r, g, b, a;
+
+	D3DXCOLOR() = default;
+	D3DXCOLOR(float r, float g, float b, float a) : r(r), g(g), b(b), a(a) {}
+	D3DXCOLOR(const D3DCOLORVALUE& c) : r(c.r), g(c.g), b(c.b), a(c.a) {}
+
+	operator float*() { return &r; }
+	operator const float*() const { return &r; }
+
+	bool operator==(const D3DXCOLOR& c) const { return r == c.r && g == c.g && b == c.b && a == c.a; }
+	bool operator!=(const D3DXCOLOR& c) const { return !(*this == c); }
+};
+
+struct D3DXMATRIX : D3DMATRIX
+{
+	D3DXMATRIX() = default;
+
+	operator float*() { return &_11; }
+	operator const float*() const { return &_11; }
+
+	bool operator==(const D3DXMATRIX& m) const { return !memcmp(this, &m, sizeof(D3DMATRIX)); }
+	bool operator!=(const D3DXMATRIX& m) const { return !(*this == m); }
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+// Stand-in for the Ninja types of the mod loader's headers.
+
+#include <cstdint>
+
+typedef int8_t   Sint8;
+typedef uint8_t  Uint8;
+typedef int16_t  Sint16;
+typedef uint16_t Uint16;
+typedef int32_t  Sint32;
+typedef uint32_t Uint32;
+typedef float    Float;
+typedef Float    Angle;
+
+struct NJS_VECTOR
+{
+	Float x, y, z;
+};
+
+typedef NJS_VECTOR NJS_POINT3;
@@ -0,0 +1,49 @@
+#include "test.h"
+
+namespace test
+{
+	Case*& registry()
+	{
+		static Case* head = nullptr;
+		return head;
+	}
+
+	int& failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	void fail(const char* file, int line, const char* expression)
+	{
+		++failures();
+		fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+	}
+
+	int run_all()
+	{
+		int tests = 0;
+		int failed = 0;
+
+		for (Case* c = registry(); c != nullptr; c = c->next)
+		{
+			const int before = failures();
+			c->function();
+			++tests;
+
+			if (failures() != before)
+			{
+				++failed;
+				fprintf(stderr, "FAILED: %s\n", c->name);
+			}
+		}
+
+		printf("%d of %d tests passed\n", tests - failed, tests);
+		return failed ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return test::run_all();
+}
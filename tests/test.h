@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+// Minimal test registry for the standalone test executables. Each TEST body
+// registers itself before main runs; CHECK failures are reported and counted
+// without aborting the test so one run shows every mismatch.
+
+namespace test
+{
+	using Function = void(*)();
+
+	struct Case
+	{
+		const char* name;
+		Function function;
+		Case* next;
+	};
+
+	Case*& registry();
+	int& failures();
+
+	struct Registrar
+	{
+		Case entry;
+
+		Registrar(const char* name, Function function)
+			: entry { name, function, nullptr }
+		{
+			Case** tail = &registry();
+
+			while (*tail)
+			{
+				tail = &(*tail)->next;
+			}
+
+			*tail = &entry;
+		}
+	};
+
+	void fail(const char* file, int line, const char* expression);
+
+	// Runs every registered test and returns the process exit code.
+	int run_all();
+}
+
+#define TEST(name) \
+	static void test_##name(); \
+	static test::Registrar registrar_##name(#name, &test_##name); \
+	static void test_##name()
+
+#define CHECK(expression) \
+	do { if (!(expression)) { test::fail(__FILE__, __LINE__, #expression); } } while (false)
+
+#define CHECK_EQUAL(a, b) CHECK((a) == (b))
+
+#define CHECK_NEAR(a, b, epsilon) CHECK(std::fabs(static_cast<double>(a) - static_cast<double>(b)) <= (epsilon))